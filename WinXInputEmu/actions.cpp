@@ -0,0 +1,232 @@
+#include "pch.h"
+
+#include "actions.h"
+
+#include <algorithm>
+#include <cmath>
+
+// ActionScheduler::Action::phase, per kind
+constexpr uint8_t kActionIdle = 0;
+// Turbo: while the key is held, alternates between these two every half period
+constexpr uint8_t kTurboDown = 1;
+constexpr uint8_t kTurboUp = 2;
+// Macro: the current step's buttons are held, then released while waiting for the next step
+constexpr uint8_t kMacroHolding = 1;
+constexpr uint8_t kMacroWaiting = 2;
+// TapHold: the key is down but it's not yet known which it is, the key is held past the threshold, or the key was tapped and `tap` is being pressed for a moment
+constexpr uint8_t kTapHoldDeciding = 1;
+constexpr uint8_t kTapHoldHolding = 2;
+constexpr uint8_t kTapHoldTapping = 3;
+
+static double MsToWheelTicks(float ms) noexcept {
+    return ms * (ActionScheduler::kWheelTicksPerSecond / 1000.0);
+}
+
+static double HalfPeriod(const UserProfile::Turbo& turbo) noexcept {
+    return ActionScheduler::kWheelTicksPerSecond / (2.0 * turbo.rate);
+}
+
+static void SetButton(XiGamepad& dev, XiButton btn, bool pressed) noexcept {
+    bool* field = dev.GetButton(btn);
+    if (field && *field != pressed) {
+        *field = pressed;
+        ++dev.epoch;
+    }
+}
+
+void ActionScheduler::SetClock(int64_t ticksPerSecond, int64_t origin) noexcept {
+    ticksPerWheelTick = std::max<int64_t>(ticksPerSecond / kWheelTicksPerSecond, 1);
+    clockOrigin = origin - origin % ticksPerWheelTick;
+}
+
+void ActionScheduler::ClearAll() {
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex)
+        slots[userIndex] = {};
+    wheel = {};
+}
+
+void ActionScheduler::Bind(int userIndex, const UserProfile& profile) {
+    Unbind(userIndex);
+
+    auto& slot = slots[userIndex];
+    slot.profile = &profile;
+
+    auto add = [&](Kind kind, size_t def, const UserProfile::Button& key) {
+        // Timer payloads and `keys` store the index in a byte
+        if (slot.actions.size() >= 0xFF) {
+            LOG(Config, Warning, L"Too many timed actions on gamepad {}, ignoring the rest", userIndex);
+            return;
+        }
+        slot.actions.push_back(Action{ .kind = kind, .def = static_cast<uint16_t>(def) });
+        for (KeyCode keyCode : key.keyCodes)
+            slot.keys[keyCode] = static_cast<uint8_t>(slot.actions.size());
+    };
+    for (size_t i = 0; i < profile.turbos.size(); ++i)
+        add(Kind::Turbo, i, profile.turbos[i].key);
+    for (size_t i = 0; i < profile.macros.size(); ++i)
+        add(Kind::Macro, i, profile.macros[i].key);
+    for (size_t i = 0; i < profile.tapHolds.size(); ++i)
+        add(Kind::TapHold, i, profile.tapHolds[i].key);
+}
+
+void ActionScheduler::Unbind(int userIndex) {
+    for (auto& action : slots[userIndex].actions)
+        Disarm(action);
+    slots[userIndex] = {};
+}
+
+bool ActionScheduler::OnKey(int userIndex, BYTE vkey, bool pressed, int64_t now, XiGamepad& dev) {
+    auto& slot = slots[userIndex];
+    int actionIndex = slot.keys[vkey] - 1;
+    if (actionIndex < 0) return false;
+
+    auto& action = slot.actions[actionIndex];
+    // Another of the trigger's keys is already down, or still down
+    if (pressed ? action.keysHeld++ > 0 : (action.keysHeld == 0 || --action.keysHeld > 0))
+        return true;
+
+    double t = ToWheelTicks(now);
+    switch (action.kind) {
+    case Kind::Turbo: {
+        const auto& def = slot.profile->turbos[action.def];
+        if (pressed) {
+            SetButton(dev, def.button, true);
+            action.phase = kTurboDown;
+            Arm(userIndex, actionIndex, t + HalfPeriod(def));
+        }
+        else {
+            Disarm(action);
+            SetButton(dev, def.button, false);
+            action.phase = kActionIdle;
+        }
+    } break;
+
+    case Kind::Macro: {
+        if (pressed && action.phase == kActionIdle) {
+            action.step = 0;
+            StartMacroStep(userIndex, actionIndex, t, dev);
+        }
+    } break;
+
+    case Kind::TapHold: {
+        const auto& def = slot.profile->tapHolds[action.def];
+        if (pressed) {
+            // Pressed again before the previous tap finished, let the game see it as two presses
+            if (action.phase == kTapHoldTapping) {
+                Disarm(action);
+                SetButton(dev, def.tap, false);
+            }
+            action.phase = kTapHoldDeciding;
+            Arm(userIndex, actionIndex, t + MsToWheelTicks(def.thresholdMs));
+        }
+        else if (action.phase == kTapHoldDeciding) {
+            Disarm(action);
+            SetButton(dev, def.tap, true);
+            action.phase = kTapHoldTapping;
+            Arm(userIndex, actionIndex, t + MsToWheelTicks(def.tapMs));
+        }
+        else if (action.phase == kTapHoldHolding) {
+            SetButton(dev, def.hold, false);
+            action.phase = kActionIdle;
+        }
+    } break;
+    }
+
+    return true;
+}
+
+bool ActionScheduler::Advance(int64_t now, XiGamepad* gamepads) {
+    auto wheelNow = static_cast<uint64_t>(std::max(ToWheelTicks(now), 0.0));
+
+    bool changed = false;
+    uint64_t payload;
+    while (wheel.PopExpired(wheelNow, payload)) {
+        int userIndex = static_cast<int>(payload >> 8);
+        int actionIndex = static_cast<int>(payload & 0xFF);
+        slots[userIndex].actions[actionIndex].timer = 0;
+
+        auto& dev = gamepads[userIndex];
+        int epoch = dev.epoch;
+        OnTimer(userIndex, actionIndex, dev);
+        changed |= dev.epoch != epoch;
+    }
+    return changed;
+}
+
+int64_t ActionScheduler::NextDeadline() const noexcept {
+    uint64_t next = wheel.NextDeadline();
+    if (next == UINT64_MAX) return INT64_MAX;
+    return clockOrigin + static_cast<int64_t>(next) * ticksPerWheelTick;
+}
+
+double ActionScheduler::ToWheelTicks(int64_t now) const noexcept {
+    return static_cast<double>(now - clockOrigin) / static_cast<double>(ticksPerWheelTick);
+}
+
+void ActionScheduler::Arm(int userIndex, int actionIndex, double due) {
+    auto& action = slots[userIndex].actions[actionIndex];
+    action.due = due;
+    // Never early: a step due at 10.5 runs once the wheel reaches 11
+    auto deadline = static_cast<uint64_t>(std::ceil(std::max(due, 0.0)));
+    action.timer = wheel.Schedule(deadline, (static_cast<uint64_t>(userIndex) << 8) | static_cast<uint64_t>(actionIndex));
+}
+
+void ActionScheduler::Disarm(Action& action) noexcept {
+    if (action.timer) {
+        wheel.Cancel(action.timer);
+        action.timer = 0;
+    }
+}
+
+void ActionScheduler::OnTimer(int userIndex, int actionIndex, XiGamepad& dev) {
+    auto& slot = slots[userIndex];
+    auto& action = slot.actions[actionIndex];
+
+    switch (action.kind) {
+    case Kind::Turbo: {
+        const auto& def = slot.profile->turbos[action.def];
+        bool down = action.phase != kTurboDown;
+        SetButton(dev, def.button, down);
+        action.phase = down ? kTurboDown : kTurboUp;
+        Arm(userIndex, actionIndex, action.due + HalfPeriod(def));
+    } break;
+
+    case Kind::Macro: {
+        const auto& def = slot.profile->macros[action.def];
+        const auto& step = def.steps[action.step];
+        if (action.phase == kMacroHolding) {
+            for (auto btn : step.buttons)
+                SetButton(dev, btn, false);
+            action.phase = kMacroWaiting;
+            Arm(userIndex, actionIndex, action.due + MsToWheelTicks(step.waitMs));
+        }
+        else if (++action.step < def.steps.size()) {
+            StartMacroStep(userIndex, actionIndex, action.due, dev);
+        }
+        else {
+            action.phase = kActionIdle;
+        }
+    } break;
+
+    case Kind::TapHold: {
+        const auto& def = slot.profile->tapHolds[action.def];
+        if (action.phase == kTapHoldDeciding) {
+            SetButton(dev, def.hold, true);
+            action.phase = kTapHoldHolding;
+        }
+        else if (action.phase == kTapHoldTapping) {
+            SetButton(dev, def.tap, false);
+            action.phase = kActionIdle;
+        }
+    } break;
+    }
+}
+
+void ActionScheduler::StartMacroStep(int userIndex, int actionIndex, double now, XiGamepad& dev) {
+    auto& action = slots[userIndex].actions[actionIndex];
+    const auto& step = slots[userIndex].profile->macros[action.def].steps[action.step];
+    for (auto btn : step.buttons)
+        SetButton(dev, btn, true);
+    action.phase = kMacroHolding;
+    Arm(userIndex, actionIndex, now + MsToWheelTicks(step.holdMs));
+}
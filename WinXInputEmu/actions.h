@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "config.h"
+#include "platform.h"
+#include "shadowed.h"
+#include "timerwheel.h"
+#include "userdevice.h"
+
+// Runs the timed actions of bound profiles (UserProfile::Turbo, Macro and TapHold) on a TimerWheel
+//
+// Time is whatever clock the caller feeds in, in the units given to SetClock(): gClock on the input thread, recorded timestamps in a replay.
+// Nothing here reads a clock or waits; the owner asks NextDeadline() when Advance() should be called next.
+// Threading: same as the InputTranslationStruct that owns it
+struct ActionScheduler {
+    // Resolution of the wheel
+    // Periodic actions are scheduled from their previous exact due time, not from when they actually ran, so rates stay exact on average regardless
+    static constexpr int64_t kWheelTicksPerSecond = 4000;
+
+    enum class Kind : uint8_t {
+        Turbo,
+        Macro,
+        TapHold,
+    };
+
+    struct Action {
+        Kind kind;
+        // Kind specific, see actions.cpp
+        uint8_t phase = 0;
+        // How many of the trigger's keys are held; the action sees the first press and the last release
+        uint8_t keysHeld = 0;
+        // Index into the profile's turbos/macros/tapHolds
+        uint16_t def = 0;
+        // Macro only: the step being played
+        uint16_t step = 0;
+        TimerWheel::TimerId timer = 0;
+        // When `timer` is due, in fractional wheel ticks
+        double due = 0.0;
+    };
+
+    struct Slot {
+        const UserProfile* profile = nullptr;
+        std::vector<Action> actions;
+        // VK_xxx -> 1 + index into `actions`, 0 if the key triggers nothing
+        // A key triggers at most one action, the last one bound
+        uint8_t keys[0xFF] = {};
+    };
+
+    TimerWheel wheel;
+    Slot slots[XUSER_MAX_COUNT];
+    int64_t ticksPerWheelTick = 1;
+    int64_t clockOrigin = 0;
+
+    // `origin` is any clock reading at or before the first one ever passed in, it keeps wheel ticks small
+    // It's rounded down to a whole wheel tick, so that any two origins on the same clock quantize time the same way, e.g. a live session and a replay of it
+    // Call before anything is bound
+    void SetClock(int64_t ticksPerSecond, int64_t origin) noexcept;
+
+    void ClearAll();
+    // `profile` must outlive this object, or until the next Bind(), Unbind() or ClearAll() of this gamepad
+    // Normally it's kept alive by the ProfileStore reference of the gamepad's XiGamepadBinding
+    void Bind(int userIndex, const UserProfile& profile);
+    // Drops pending steps without touching the gamepad: the caller is expected to reset it
+    void Unbind(int userIndex);
+
+    // Returns true if `vkey` triggers an action of this gamepad, whether or not that changed `dev` right away
+    // Call once per press and release, without key repeats
+    bool OnKey(int userIndex, BYTE vkey, bool pressed, int64_t now, XiGamepad& dev);
+    // Runs every step due at or before `now`, in order, bumping the epoch of each gamepad it touches
+    // Returns true if any gamepad changed
+    bool Advance(int64_t now, XiGamepad* gamepads);
+    // The time at or before which Advance() should be called next, or INT64_MAX if nothing is pending
+    int64_t NextDeadline() const noexcept;
+
+private:
+    double ToWheelTicks(int64_t now) const noexcept;
+    void Arm(int userIndex, int actionIndex, double due);
+    void Disarm(Action& action) noexcept;
+    void OnTimer(int userIndex, int actionIndex, XiGamepad& dev);
+    void StartMacroStep(int userIndex, int actionIndex, double now, XiGamepad& dev);
+};
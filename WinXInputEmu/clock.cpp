@@ -0,0 +1,19 @@
+#include "pch.h"
+
+#include "clock.h"
+
+#include "platform.h"
+
+int64_t QpcClock::Now() const noexcept {
+    return PlatformPerformanceCounter();
+}
+
+int64_t QpcClock::TicksPerSecond() const noexcept {
+    // Function-local so it's ready whenever the first caller shows up, even during static initialization of another file
+    static const int64_t freq = PlatformPerformanceFrequency();
+    return freq;
+}
+
+// Constant initialized: no virtual call needs a constructor to have run
+static constinit QpcClock gQpcClock;
+const Clock* gClock = &gQpcClock;
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Monotonic time for the input pipeline
+//
+// Every timestamp that flows through translation, publishing, recording and keystroke repeats is an int64 count of ticks of one Clock,
+// taken once where the event enters the pipeline and passed along from there. Nothing in the translation core reads a clock on its own,
+// so feeding it from a ManualClock (or from recorded timestamps) runs it faster than real time with identical results.
+// The only other reader is XInputGetState(), which evaluates published ramps at the time the game polls.
+struct Clock {
+    virtual ~Clock() = default;
+
+    // Never goes backwards
+    virtual int64_t Now() const noexcept = 0;
+    // Constant for the lifetime of the clock
+    virtual int64_t TicksPerSecond() const noexcept = 0;
+
+    int64_t FromMilliseconds(double ms) const noexcept {
+        return static_cast<int64_t>(ms * static_cast<double>(TicksPerSecond()) / 1000.0);
+    }
+    double ToSeconds(int64_t ticks) const noexcept {
+        return static_cast<double>(ticks) / static_cast<double>(TicksPerSecond());
+    }
+};
+
+// QueryPerformanceCounter()
+struct QpcClock final : Clock {
+    int64_t Now() const noexcept override;
+    int64_t TicksPerSecond() const noexcept override;
+};
+
+// Only moves when told to
+// Now() may be called from any thread, e.g. game threads evaluating ramps while a test drives the input side
+struct ManualClock final : Clock {
+    std::atomic<int64_t> now;
+    int64_t ticksPerSecond;
+
+    explicit ManualClock(int64_t ticksPerSecond = 10'000'000, int64_t start = 0) noexcept
+        : now{ start }
+        , ticksPerSecond{ ticksPerSecond } {}
+
+    int64_t Now() const noexcept override { return now.load(std::memory_order_acquire); }
+    int64_t TicksPerSecond() const noexcept override { return ticksPerSecond; }
+
+    void Set(int64_t ticks) noexcept { now.store(ticks, std::memory_order_release); }
+    void Advance(int64_t ticks) noexcept { now.fetch_add(ticks, std::memory_order_acq_rel); }
+};
+
+// The clock the live pipeline runs on, a QpcClock unless replaced
+// Replace only before the input thread starts: published ramps and pending timers are in the ticks of whoever was here before
+extern const Clock* gClock;
@@ -4,140 +4,757 @@
 
 #include <algorithm>
 #include <fstream>
+#include <sstream>
 
-#include "dll.h"
+#include "clock.h"
+#include "configschema.h"
+#include "platform.h"
+#include "slotrouting.h"
 #include "userdevice.h"
 
 using namespace std::literals;
 
 Config gConfig;
 ConfigEvents gConfigEvents;
+// gConfig as of the last load or save, what SaveConfigToDesignatedPath() compares against
+static Config gConfigOnDisk;
+
+static std::filesystem::path DesignatedConfigPath() {
+    return PlatformModuleDirectory() / L"WinXInputEmu.toml";
+}
 
 void ReloadConfigFromDesignatedPath() {
     // Load config from the designated config file
-    WCHAR buf[MAX_PATH];
-    DWORD numChars = GetModuleFileNameW(gHModule, buf, MAX_PATH);
-    auto configPath = std::filesystem::path(buf, buf + numChars).remove_filename() / L"WinXInputEmu.toml";
+    auto configPath = DesignatedConfigPath();
 
-    LOG_DEBUG(L"Designated config path: {}", configPath.native());
+    LOG(Config, Debug, L"Designated config path: {}", configPath.wstring());
 
     ReloadConfig(configPath);
 }
 
 void ReloadConfig(const std::filesystem::path& path) {
     gConfig = LoadConfig(toml::parse_file(path));
+    gConfigOnDisk = gConfig;
+
+    for (size_t i = 0; i < kLogCategoryCount; ++i)
+        SetLogLevel(static_cast<LogCategory>(i), gConfig.logLevels[i]);
     
     gConfigEvents.onMouseCheckFrequencyChanged(gConfig.mouseCheckFrequency);
-
-    SrwExclusiveLock lock(gXiGamepadsLock);
+    gConfigEvents.onFixedPointMouseSticksChanged(gConfig.fixedPointMouseSticks);
+    gConfigEvents.onMouseDpiChanged();
 
     for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
         const auto& profileName = gConfig.xiGamepadBindings[userIndex];
         if (profileName.empty()) continue;
 
-        auto iter = gConfig.profiles.find(profileName);
-        if (iter != gConfig.profiles.end()) {
-            const auto& profile = iter->second;
-            LOG_DEBUG(L"Binding profile '{}' to gamepad {}", Utf8ToWide(profileName), userIndex);
-            gXiGamepadsEnabled[userIndex] = true;
-            gXiGamepads[userIndex] = {};
-            gXiGamepads[userIndex].profile = &profile;
+        auto profileId = gConfig.profiles->Find(profileName);
+        if (profileId != kInvalidProfileId) {
+            const auto& profile = gConfig.profiles->profiles[profileId];
+            LOG(Config, Info, L"Binding profile '{}' to gamepad {}", Utf8ToWide(profileName), userIndex);
+            BindProfileToGamepad(userIndex, gConfig.profiles, profileId);
             gConfigEvents.onGamepadBindingChanged(userIndex, profileName, profile);
         }
         else {
-            LOG_DEBUG(L"Cannout find profile '{}' for binding gamepads, skipping", Utf8ToWide(profileName));
+            LOG(Config, Warning, L"Cannout find profile '{}' for binding gamepads, skipping", Utf8ToWide(profileName));
         }
     }
+
+    UpdateSlotRoutes(gConfig);
+    gConfigEvents.onSlotRoutingChanged();
 }
 
-toml::table StringifyConfig(const Config& config)  noexcept {
-    return {}; // TODO
+ProfileId ProfileStore::Find(std::string_view name) const noexcept {
+    auto iter = ids.find(name);
+    return iter != ids.end() ? iter->second : kInvalidProfileId;
 }
 
-static void ReadButton(toml::node_view<const toml::node> t, UserProfile::Button& btn) {
-    btn.keyCode = KeyCodeFromString(t.value_or<std::string_view>(""sv)).value_or(0xFF);
+ProfileId ProfileStore::Add(std::string name, UserProfile profile) {
+    if (profiles.size() >= kInvalidProfileId)
+        return kInvalidProfileId;
+    auto id = static_cast<ProfileId>(profiles.size());
+    auto [DISCARD, success] = ids.try_emplace(name, id);
+    if (!success)
+        return kInvalidProfileId;
+    profiles.push_back(std::move(profile));
+    names.push_back(std::move(name));
+    return id;
 }
 
-static void ReadJoystick(toml::node_view<const toml::node> t, UserProfile::Joystick& js, UserProfile::Button& jsBtn) {
-    ReadButton(t["Button"], jsBtn);
+////////// Schema //////////
+// Each Visit function lists the keys of one table, LoadConfig() reads through them and StringifyConfig() writes through them, see configschema.h
 
-    if (const auto& v = t["Type"];
-        v == "keyboard")
-    {
-        js.useMouse = false;
-        ReadButton(t["Up"], js.kbd.up);
-        ReadButton(t["Down"], js.kbd.down);
-        ReadButton(t["Left"], js.kbd.left);
-        ReadButton(t["Right"], js.kbd.right);
-        js.kbd.speed = std::clamp(t["Speed"].value_or<float>(1.0f), 0.0f, 1.0f);
+// A key name, see InitKeyCodeConv(); "" binds nothing
+struct KeyCodeCodec {
+    bool Read(const toml::node& node, KeyCode& out, ConfigReader& r, std::string_view key) const {
+        auto name = node.value<std::string_view>();
+        if (!name) {
+            r.Warn(key, "should be a key name, ignored");
+            return false;
+        }
+        if (name->empty())
+            return false;
+        auto keyCode = KeyCodeFromString(*name);
+        if (!keyCode) {
+            r.Warn(key, std::format("unknown key '{}', ignored", *name));
+            return false;
+        }
+        out = *keyCode;
+        return true;
+    }
+
+    auto Write(KeyCode value) const { return toml::value<std::string>(std::string(KeyCodeToString(value))); }
+};
+
+struct HotkeyCodec {
+    bool Read(const toml::node& node, KeyCode& out, ConfigReader& r, std::string_view key) const {
+        out = kNoHotkey;
+        KeyCodeCodec{}.Read(node, out, r, key);
+        return true;
     }
-    else if (v == "mouse") {
-        js.useMouse = true;
-        js.mouse.sensitivity = t["Sensitivity"].value_or<float>(50.0f);
-        js.mouse.nonLinear = t["NonLinearSensitivity"].value_or<float>(0.8f);
-        js.mouse.deadzone = t["Deadzone"].value_or<float>(0.02f);
-        js.mouse.invertXAxis = t["InvertXAxis"].value_or<bool>(false);
-        js.mouse.invertYAxis = t["InvertYAxis"].value_or<bool>(false);
+
+    auto Write(KeyCode value) const { return value == kNoHotkey ? toml::value<std::string>(""s) : KeyCodeCodec{}.Write(value); }
+};
+
+struct LogLevelCodec {
+    bool Read(const toml::node& node, LogLevel& out, ConfigReader& r, std::string_view key) const {
+        auto name = node.value<std::string_view>();
+        auto level = name ? LogLevelFromString(*name) : std::nullopt;
+        if (!level) {
+            r.Warn(key, "should be one of \"trace\", \"debug\", \"info\", \"warning\", \"error\", \"off\", ignored");
+            return false;
+        }
+        out = *level;
+        return true;
+    }
+
+    auto Write(LogLevel value) const { return toml::value<std::string>(WideToUtf8(LogLevelToString(value))); }
+};
+
+struct MouseDpiCodec {
+    bool Read(const toml::node& node, float& out, ConfigReader& r, std::string_view key) const {
+        auto dpi = node.value<double>();
+        if (!dpi || *dpi <= 0.0) {
+            r.Warn(key, "DPI should be a positive number, ignored");
+            return false;
+        }
+        out = static_cast<float>(*dpi);
+        return true;
     }
-    else {
-        // Resets to inactive mode
-        js = {};
+
+    auto Write(float value) const { return toml::value<double>(FloatForToml(value)); }
+};
+
+// "auto", "none", "physical N" or "merge N"
+struct SlotRoutingCodec {
+    bool Read(const toml::node& node, SlotRouting& out, ConfigReader& r, std::string_view key) const {
+        auto value = node.value_or<std::string_view>(""sv);
+
+        auto space = value.find(' ');
+        auto mode = value.substr(0, space);
+        int physical = -1;
+        if (space != std::string_view::npos) {
+            auto arg = value.substr(space + 1);
+            if (arg.size() == 1 && arg[0] >= '0' && arg[0] < '0' + XUSER_MAX_COUNT)
+                physical = arg[0] - '0';
+        }
+
+        if (value == "auto")
+            out = { SlotRouting::Mode::Auto };
+        else if (value == "none")
+            out = { SlotRouting::Mode::None };
+        else if (mode == "physical" && physical != -1)
+            out = { SlotRouting::Mode::Physical, physical };
+        else if (mode == "merge" && physical != -1)
+            out = { SlotRouting::Mode::Merge, physical };
+        else {
+            r.Warn(key, std::format("invalid routing '{}', using 'auto'", value));
+            return false;
+        }
+        return true;
+    }
+
+    auto Write(const SlotRouting& value) const {
+        switch (value.mode) {
+        case SlotRouting::Mode::Physical: return toml::value<std::string>(std::format("physical {}", value.physical));
+        case SlotRouting::Mode::Merge: return toml::value<std::string>(std::format("merge {}", value.physical));
+        case SlotRouting::Mode::None: return toml::value<std::string>("none"s);
+        case SlotRouting::Mode::Auto: break;
+        }
+        return toml::value<std::string>("auto"s);
+    }
+};
+
+// [[input, output], ...], sorted by input
+struct CurvePointsCodec {
+    bool Read(const toml::node& node, std::vector<std::array<float, 2>>& out, ConfigReader& r, std::string_view key) const {
+        auto arr = node.as_array();
+        if (!arr) {
+            r.Warn(key, "should be an array of [input, output] points, ignored");
+            return false;
+        }
+        out.clear();
+        for (auto&& elm : *arr) {
+            auto pt = elm.as_array();
+            if (!pt || pt->size() != 2) {
+                r.Warn(key, "a point isn't [input, output], ignored");
+                continue;
+            }
+            float x = std::clamp(pt->get(0)->value_or<float>(0.0f), 0.0f, 1.0f);
+            float y = std::clamp(pt->get(1)->value_or<float>(0.0f), 0.0f, 1.0f);
+            out.push_back({ x, y });
+        }
+        std::sort(out.begin(), out.end());
+        return true;
+    }
+
+    auto Write(const std::vector<std::array<float, 2>>& value) const {
+        toml::array arr;
+        for (const auto& [x, y] : value)
+            arr.push_back(toml::array{ FloatForToml(x), FloatForToml(y) });
+        return arr;
+    }
+};
+
+// [x1, y1, x2, y2]
+struct BezierCodec {
+    bool Read(const toml::node& node, std::array<float, 4>& out, ConfigReader& r, std::string_view key) const {
+        auto arr = node.as_array();
+        if (!arr || arr->size() != 4) {
+            r.Warn(key, "should be [x1, y1, x2, y2], ignored");
+            return false;
+        }
+        for (size_t i = 0; i < 4; ++i)
+            out[i] = arr->get(i)->value_or<float>(out[i]);
+        // The X coordinates must stay within [0,1] for the curve to be a function of the input
+        out[0] = std::clamp(out[0], 0.0f, 1.0f);
+        out[2] = std::clamp(out[2], 0.0f, 1.0f);
+        return true;
+    }
+
+    auto Write(const std::array<float, 4>& value) const {
+        return toml::array{ FloatForToml(value[0]), FloatForToml(value[1]), FloatForToml(value[2]), FloatForToml(value[3]) };
+    }
+};
+
+constexpr std::pair<std::string_view, InputBackendType> kInputBackendNames[] = {
+    { "rawinput"sv, InputBackendType::RawInput },
+    { "hooks"sv, InputBackendType::Hooks },
+    { "replay"sv, InputBackendType::Replay },
+    { "synthetic"sv, InputBackendType::Synthetic },
+};
+constexpr std::pair<std::string_view, bool> kStickTypeNames[] = {
+    { "keyboard"sv, false },
+    { "mouse"sv, true },
+};
+constexpr std::pair<std::string_view, UserProfile::SocdPolicy> kSocdNames[] = {
+    { "neutral"sv, UserProfile::SocdPolicy::Neutral },
+    { "last-wins"sv, UserProfile::SocdPolicy::LastWins },
+    { "first-wins"sv, UserProfile::SocdPolicy::FirstWins },
+};
+constexpr std::pair<std::string_view, UserProfile::StickCurve::Shape> kCurveShapeNames[] = {
+    { "power"sv, UserProfile::StickCurve::Shape::Power },
+    { "piecewise"sv, UserProfile::StickCurve::Shape::Piecewise },
+    { "bezier"sv, UserProfile::StickCurve::Shape::Bezier },
+};
+constexpr std::pair<std::string_view, UserProfile::StickCurve::Gate> kGateNames[] = {
+    { "square"sv, UserProfile::StickCurve::Gate::Square },
+    { "circle"sv, UserProfile::StickCurve::Gate::Circle },
+};
+// Only the digital buttons: profile actions press and release things, they don't deflect sticks
+constexpr std::pair<std::string_view, XiButton> kGamepadButtonNames[] = {
+    { "A"sv, XiButton::A }, { "B"sv, XiButton::B }, { "X"sv, XiButton::X }, { "Y"sv, XiButton::Y },
+    { "LB"sv, XiButton::LB }, { "RB"sv, XiButton::RB },
+    { "LT"sv, XiButton::LT }, { "RT"sv, XiButton::RT },
+    { "Start"sv, XiButton::Start }, { "Back"sv, XiButton::Back },
+    { "DpadUp"sv, XiButton::DpadUp }, { "DpadDown"sv, XiButton::DpadDown }, { "DpadLeft"sv, XiButton::DpadLeft }, { "DpadRight"sv, XiButton::DpadRight },
+    { "LStickButton"sv, XiButton::LStickBtn }, { "RStickButton"sv, XiButton::RStickBtn },
+};
+
+// Either a single key name or an array of them
+constexpr OneOrManyCodec<KeyCodeCodec> kKeys{};
+constexpr OneOrManyCodec<EnumCodec<XiButton>> kGamepadButtons{ { kGamepadButtonNames } };
+constexpr EnumCodec<XiButton> kGamepadButton{ kGamepadButtonNames };
+// [0,1]
+constexpr NumberCodec<float> kFraction{ 0.0f, 1.0f };
+// Milliseconds
+constexpr NumberCodec<float> kDuration{ 0.0f };
+
+UserProfile::StickCurve UserProfile::Joystick::DefaultMouseCurve() noexcept {
+    StickCurve curve;
+    curve.exponent = 0.8f;
+    curve.deadzone = 0.02f;
+    return curve;
+}
+
+// Mouse sticks' curves are written relative to DefaultMouseCurve()
+// Not static, WriteConfigTable() finds it by argument-dependent lookup
+UserProfile ConfigDefaults(const UserProfile& profile) {
+    UserProfile defaults;
+    if (profile.lstick.useMouse)
+        defaults.lstick.curve = UserProfile::Joystick::DefaultMouseCurve();
+    if (profile.rstick.useMouse)
+        defaults.rstick.curve = UserProfile::Joystick::DefaultMouseCurve();
+    return defaults;
+}
+
+template <typename TVisitor, typename TCurve>
+static void VisitStickCurve(TVisitor& v, TCurve& curve) {
+    v("Curve", curve.shape, EnumCodec<UserProfile::StickCurve::Shape>{ kCurveShapeNames });
+    v("NonLinearSensitivity", curve.exponent, NumberCodec<float>{ 0.01f, 100.0f });
+    v("CurvePoints", curve.points, CurvePointsCodec{});
+    v("CurveBezier", curve.bezier, BezierCodec{});
+    v("Deadzone", curve.deadzone, kFraction);
+    v("AxialDeadzone", curve.axialDeadzone, kFraction);
+    v("Saturation", curve.saturation, kFraction);
+    v("AntiDeadzone", curve.antiDeadzone, kFraction);
+    v("Gate", curve.gate, EnumCodec<UserProfile::StickCurve::Gate>{ kGateNames });
+}
+
+// The stick's Button lives in the profile, next to the other buttons
+template <typename TVisitor, typename TJoystick, typename TButton>
+static void VisitJoystick(TVisitor& v, TJoystick& js, TButton& button) {
+    v("Type", js.useMouse, EnumCodec<bool>{ kStickTypeNames });
+    if constexpr (TVisitor::kReads) {
+        if (js.useMouse)
+            js.curve = UserProfile::Joystick::DefaultMouseCurve();
+    }
+    v("Button", button.keyCodes, kKeys);
+
+    // Both types' settings are kept, so that switching Type back and forth doesn't lose any
+    v("Up", js.kbd.up.keyCodes, kKeys);
+    v("Down", js.kbd.down.keyCodes, kKeys);
+    v("Left", js.kbd.left.keyCodes, kKeys);
+    v("Right", js.kbd.right.keyCodes, kKeys);
+    v("Speed", js.kbd.speed, kFraction);
+    v("Attack", js.kbd.attackMs, kDuration);
+    v("Release", js.kbd.releaseMs, kDuration);
+    v("SOCD", js.kbd.socd, EnumCodec<UserProfile::SocdPolicy>{ kSocdNames });
+
+    v("Sensitivity", js.mouse.sensitivity, NumberCodec<float>{ 0.0f });
+    v("InvertXAxis", js.mouse.invertXAxis, BoolCodec{});
+    v("InvertYAxis", js.mouse.invertYAxis, BoolCodec{});
+
+    VisitStickCurve(v, js.curve);
+}
+
+template <typename TVisitor, typename TTurbo>
+static void VisitTurbo(TVisitor& v, TTurbo& turbo) {
+    v("Key", turbo.key.keyCodes, kKeys);
+    v("Button", turbo.button, kGamepadButton);
+    v("Rate", turbo.rate, NumberCodec<float>{ 0.1f, 1000.0f });
+}
+
+template <typename TVisitor, typename TMacroStep>
+static void VisitMacroStep(TVisitor& v, TMacroStep& step) {
+    v("Press", step.buttons, kGamepadButtons);
+    v("Hold", step.holdMs, kDuration);
+    v("Wait", step.waitMs, kDuration);
+}
+
+template <typename TVisitor, typename TMacro>
+static void VisitMacro(TVisitor& v, TMacro& macro) {
+    v("Key", macro.key.keyCodes, kKeys);
+    v.Tables("Steps", macro.steps, [](auto& v, auto& step) { VisitMacroStep(v, step); }, [](const ConfigReader&, const UserProfile::MacroStep&) { return true; });
+}
+
+template <typename TVisitor, typename TTapHold>
+static void VisitTapHold(TVisitor& v, TTapHold& th) {
+    v("Key", th.key.keyCodes, kKeys);
+    v("Tap", th.tap, kGamepadButton);
+    v("Hold", th.hold, kGamepadButton);
+    v("Threshold", th.thresholdMs, kDuration);
+    v("TapDuration", th.tapMs, kDuration);
+}
+
+template <typename TVisitor, typename TProfile>
+static void VisitProfile(TVisitor& v, TProfile& profile) {
+    v("A", profile.a.keyCodes, kKeys);
+    v("B", profile.b.keyCodes, kKeys);
+    v("X", profile.x.keyCodes, kKeys);
+    v("Y", profile.y.keyCodes, kKeys);
+    v("LB", profile.lb.keyCodes, kKeys);
+    v("RB", profile.rb.keyCodes, kKeys);
+    v("LT", profile.lt.keyCodes, kKeys);
+    v("RT", profile.rt.keyCodes, kKeys);
+    v("Start", profile.start.keyCodes, kKeys);
+    v("Back", profile.back.keyCodes, kKeys);
+    v("DpadUp", profile.dpadUp.keyCodes, kKeys);
+    v("DpadDown", profile.dpadDown.keyCodes, kKeys);
+    v("DpadLeft", profile.dpadLeft.keyCodes, kKeys);
+    v("DpadRight", profile.dpadRight.keyCodes, kKeys);
+    v.Table("LStick", [&](auto& v) { VisitJoystick(v, profile.lstick, profile.lstickBtn); });
+    v.Table("RStick", [&](auto& v) { VisitJoystick(v, profile.rstick, profile.rstickBtn); });
+    v("TriggerAttack", profile.triggerAttackMs, kDuration);
+    v("TriggerRelease", profile.triggerReleaseMs, kDuration);
+    v("AnalogModifier", profile.analogModifier.keyCodes, kKeys);
+    v("AnalogModifierScale", profile.analogModifierScale, kFraction);
+
+    // Timed actions that can't do anything are dropped
+    v.Tables("Turbo", profile.turbos, [](auto& v, auto& turbo) { VisitTurbo(v, turbo); }, [](const ConfigReader& r, const UserProfile::Turbo& turbo) {
+        if (!turbo.key.keyCodes.empty() && turbo.button != XiButton::None)
+            return true;
+        LOG(Config, Warning, L"{}: Turbo needs both a Key and a Button, ignored", Utf8ToWide(r.Path()));
+        return false;
+    });
+    v.Tables("Macro", profile.macros, [](auto& v, auto& macro) { VisitMacro(v, macro); }, [](const ConfigReader& r, const UserProfile::Macro& macro) {
+        if (!macro.key.keyCodes.empty() && !macro.steps.empty())
+            return true;
+        LOG(Config, Warning, L"{}: Macro needs both a Key and some Steps, ignored", Utf8ToWide(r.Path()));
+        return false;
+    });
+    v.Tables("TapHold", profile.tapHolds, [](auto& v, auto& th) { VisitTapHold(v, th); }, [](const ConfigReader& r, const UserProfile::TapHold& th) {
+        if (!th.key.keyCodes.empty())
+            return true;
+        LOG(Config, Warning, L"{}: TapHold needs a Key, ignored", Utf8ToWide(r.Path()));
+        return false;
+    });
+}
+
+static std::string GamepadKey(int userIndex) {
+    return std::format("Gamepad{}", userIndex);
+}
+
+// Everything but [UserProfiles], which LoadConfig() and StringifyConfig() go through one profile at a time
+template <typename TVisitor, typename TConfig>
+static void VisitConfig(TVisitor& v, TConfig& config) {
+    v.Table("General", [&](auto& v) {
+        v("MouseCheckFrequency", config.mouseCheckFrequency, NumberCodec<int>{ 1, 1000 });
+        v("FixedPointMouseSticks", config.fixedPointMouseSticks, BoolCodec{});
+        v("InputBackend", config.inputBackend, EnumCodec<InputBackendType>{ kInputBackendNames });
+        v("SyntheticEventRate", config.syntheticEventRate, NumberCodec<int>{ 1 });
+        v("SyntheticSeed", config.syntheticSeed, NumberCodec<uint32_t>{});
+        v("SuppressBoundKeys", config.suppressBoundKeys, BoolCodec{});
+        v("SuppressMouseStickMotion", config.suppressMouseStickMotion, BoolCodec{});
+        v("RecenterCursor", config.recenterCursor, BoolCodec{});
+    });
+    v.Map("MouseDpi", config.mouseDpi, MouseDpiCodec{});
+    v.Table("Logging", [&](auto& v) {
+        for (size_t i = 0; i < kLogCategoryCount; ++i)
+            v(WideToUtf8(LogCategoryToString(static_cast<LogCategory>(i))), config.logLevels[i], LogLevelCodec{});
+    });
+    v.Table("HotKeys", [&](auto& v) {
+        v("ShowUI", config.hotkeyShowUI, HotkeyCodec{});
+        v("CaptureCursor", config.hotkeyCaptureCursor, HotkeyCodec{});
+    });
+    v.Table("Binding", [&](auto& v) {
+        for (int i = 0; i < XUSER_MAX_COUNT; ++i)
+            v(GamepadKey(i), config.xiGamepadBindings[i], StringCodec{});
+    });
+    v.Table("ForegroundOnly", [&](auto& v) {
+        for (int i = 0; i < XUSER_MAX_COUNT; ++i)
+            v(GamepadKey(i), config.foregroundOnly[i], BoolCodec{});
+    });
+    v.Table("Routing", [&](auto& v) {
+        for (int i = 0; i < XUSER_MAX_COUNT; ++i)
+            v(GamepadKey(i), config.slotRouting[i], SlotRoutingCodec{});
+        v("Compact", config.compactSlots, BoolCodec{});
+        v("PollInterval", config.physicalPollMs, NumberCodec<float>{ 1.0f });
+    });
+}
+
+toml::table StringifyConfig(const Config& config) noexcept {
+    auto toml = WriteConfigTable(config, [](auto& v, auto& config) { VisitConfig(v, config); });
+
+    toml::table tomlProfiles;
+    const auto& store = *config.profiles;
+    // Starting after the built-in "NULL" profile
+    for (size_t id = 1; id < store.profiles.size(); ++id) {
+        // Kept even if empty: the profile still exists
+        tomlProfiles.insert_or_assign(store.names[id], WriteConfigTable(store.profiles[id], [](auto& v, auto& profile) { VisitProfile(v, profile); }));
     }
+    if (!tomlProfiles.empty())
+        toml.insert_or_assign("UserProfiles", std::move(tomlProfiles));
+
+    return toml;
 }
 
 Config LoadConfig(const toml::table& toml) noexcept {
     Config config;
+    ConfigReader r(toml, ""s);
+    VisitConfig(r, config);
+
+    auto profiles = std::make_shared<ProfileStore>();
 
     // This should map nothing, effectively hiding this gamepad slot
-    config.profiles.emplace("NULL"sv, UserProfile{});
-
-    config.mouseCheckFrequency = toml["General"]["MouseCheckFrequency"].value_or<int>(75);
-    config.hotkeyShowUI = KeyCodeFromString(toml["HotKeys"]["ShowUI"].value_or<std::string_view>(""sv)).value_or(0xFF);
-    config.hotkeyCaptureCursor = KeyCodeFromString(toml["HotKeys"]["CaptureCursor"].value_or<std::string_view>(""sv)).value_or(0xFF);
-
-    if (auto tomlProfiles = toml["UserProfiles"].as_table()) {
-        for (auto&& [key, val] : *tomlProfiles) {
-            auto e1 = val.as_table();
-            if (!e1) continue;
-            auto& tomlProfile = *e1;
-            auto name = key.str();
-
-            UserProfile profile;
-            ReadButton(tomlProfile["A"], profile.a);
-            ReadButton(tomlProfile["B"], profile.b);
-            ReadButton(tomlProfile["X"], profile.x);
-            ReadButton(tomlProfile["Y"], profile.y);
-            ReadButton(tomlProfile["LB"], profile.lb);
-            ReadButton(tomlProfile["RB"], profile.rb);
-            ReadButton(tomlProfile["LT"], profile.lt);
-            ReadButton(tomlProfile["RT"], profile.rt);
-            ReadButton(tomlProfile["Start"], profile.start);
-            ReadButton(tomlProfile["Back"], profile.back);
-            ReadButton(tomlProfile["DpadUp"], profile.dpadUp);
-            ReadButton(tomlProfile["DpadDown"], profile.dpadDown);
-            ReadButton(tomlProfile["DpadLeft"], profile.dpadLeft);
-            ReadButton(tomlProfile["DpadRight"], profile.dpadRight);
-            ReadJoystick(tomlProfile["LStick"], profile.lstick, profile.rstickBtn);
-            ReadJoystick(tomlProfile["RStick"], profile.rstick, profile.lstickBtn);
-
-            auto [DISCARD, success] = config.profiles.try_emplace(std::string(name), std::move(profile));
-            if (!success) {
-                LOG_DEBUG(L"User profile '{}' already exists, cannot add", Utf8ToWide(name));
+    profiles->Add("NULL"s, UserProfile{});
+
+    if (auto node = r.Take("UserProfiles")) {
+        if (auto tomlProfiles = node->as_table()) {
+            for (auto&& [key, val] : *tomlProfiles) {
+                auto name = key.str();
+                auto path = std::format("UserProfiles.{}", name);
+                auto tomlProfile = val.as_table();
+                if (!tomlProfile) {
+                    LOG(Config, Warning, L"{}: should be a table, ignored", Utf8ToWide(path));
+                    continue;
+                }
+
+                UserProfile profile;
+                ConfigReader pr(*tomlProfile, std::move(path));
+                VisitProfile(pr, profile);
+                pr.Finish();
+
+                if (profiles->Add(std::string(name), std::move(profile)) == kInvalidProfileId) {
+                    LOG(Config, Warning, L"User profile '{}' already exists, cannot add", Utf8ToWide(name));
+                }
             }
         }
+        else {
+            r.Warn("UserProfiles", "should be a table, ignored");
+        }
     }
+    config.profiles = std::move(profiles);
+
+    r.Finish();
+    return config;
+}
+
+////////// Saving //////////
 
-    for (int i = 0; i < XUSER_MAX_COUNT; ++i) {
-        auto key = std::format("Gamepad{}", i);
-        config.xiGamepadBindings[i] = toml["Binding"][key].value_or<std::string>(""s);
+// A key of a top level table to set, or to remove if `value` is null
+struct ConfigKeyEdit {
+    std::string table;
+    std::string key;
+    const toml::node* value;
+};
+
+static std::optional<toml::table> TryParseToml(std::string_view text) {
+    try {
+        return toml::parse(text);
+    }
+    catch (const toml::parse_error&) {
+        return {};
     }
+}
 
-    return config;
+// The one key `line` assigns, if it's a `key = value` line complete on its own (not e.g. the first line of a multiline array)
+static std::optional<std::string> ParseKeyLine(std::string_view line) {
+    auto doc = TryParseToml(line);
+    if (!doc || doc->size() != 1 || doc->begin()->second.is_table())
+        return {};
+    return std::string(doc->begin()->first.str());
+}
+
+// The top level table `line` opens, if it's a header of one like "[Binding]"; empty for any other header, nullopt if it's not a header
+static std::optional<std::string> ParseTableHeader(std::string_view line) {
+    if (!line.starts_with('['))
+        return {};
+    auto doc = TryParseToml(line);
+    if (!doc)
+        return {};
+    if (doc->size() == 1) {
+        auto t = doc->begin()->second.as_table();
+        if (t && t->empty() && !line.starts_with("[["))
+            return std::string(doc->begin()->first.str());
+    }
+    return ""s;
+}
+
+static std::string FormatKeyLine(std::string_view key, const toml::node& value) {
+    toml::table t;
+    value.visit([&](const auto& v) { t.insert_or_assign(key, v); });
+    std::ostringstream ss;
+    ss << toml::toml_formatter{ t };
+    auto line = ss.str();
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+        line.pop_back();
+    return line;
+}
+
+static std::string_view TrimLeft(std::string_view s) {
+    auto begin = s.find_first_not_of(" \t");
+    return begin == std::string_view::npos ? ""sv : s.substr(begin);
+}
+
+// Replaces, inserts or removes the line of `edit.key`; lines keep their indentation and trailing comment
+static void PatchConfigLines(std::vector<std::string>& lines, const ConfigKeyEdit& edit) {
+    // [sectionBegin, sectionEnd) are the lines after the table's header
+    std::optional<size_t> sectionBegin;
+    size_t sectionEnd = lines.size();
+    for (size_t i = 0; i < lines.size(); ++i) {
+        auto header = ParseTableHeader(TrimLeft(lines[i]));
+        if (!header)
+            continue;
+        if (sectionBegin) {
+            sectionEnd = i;
+            break;
+        }
+        if (*header == edit.table)
+            sectionBegin = i + 1;
+    }
+
+    if (!sectionBegin) {
+        if (!edit.value)
+            return;
+        // No such table yet
+        if (!lines.empty() && !TrimLeft(lines.back()).empty())
+            lines.push_back(""s);
+        lines.push_back(std::format("[{}]", edit.table));
+        lines.push_back(FormatKeyLine(edit.key, *edit.value));
+        return;
+    }
+
+    for (size_t i = *sectionBegin; i < sectionEnd; ++i) {
+        auto& line = lines[i];
+        auto content = TrimLeft(line);
+        if (content.empty() || content.starts_with('#'))
+            continue;
+        if (ParseKeyLine(content) != edit.key)
+            continue;
+
+        if (!edit.value) {
+            lines.erase(lines.begin() + i);
+            return;
+        }
+
+        // The comment starts at the first '#' that isn't inside the key or the value
+        auto indent = line.substr(0, line.size() - content.size());
+        std::string_view comment;
+        for (size_t pos = content.find('#'); pos != std::string_view::npos; pos = content.find('#', pos + 1)) {
+            if (ParseKeyLine(content.substr(0, pos)) == edit.key) {
+                auto valueEnd = content.find_last_not_of(" \t", pos - 1) + 1;
+                comment = content.substr(valueEnd);
+                break;
+            }
+        }
+        line = std::format("{}{}{}", indent, FormatKeyLine(edit.key, *edit.value), comment);
+        return;
+    }
+
+    if (!edit.value)
+        return;
+    // After the last line of the table that isn't blank
+    size_t insertAt = sectionEnd;
+    while (insertAt > *sectionBegin && TrimLeft(lines[insertAt - 1]).empty())
+        --insertAt;
+    lines.insert(lines.begin() + insertAt, FormatKeyLine(edit.key, *edit.value));
+}
+
+// The keys to change for `base` to become `edited`, pointing into both
+static std::vector<ConfigKeyEdit> DiffConfigTables(const toml::table& base, const toml::table& edited) {
+    std::vector<ConfigKeyEdit> edits;
+    auto diffTable = [&](std::string_view tableName, const toml::table* b, const toml::table* e) {
+        static const toml::table kEmpty;
+        if (!b) b = &kEmpty;
+        if (!e) e = &kEmpty;
+        auto diffKey = [&](std::string_view key, const toml::node* bv, const toml::node* ev) {
+            if (bv && ev && TomlNodesEqual(*bv, *ev))
+                return;
+            if ((bv && bv->is_table()) || (ev && ev->is_table())) {
+                LOG(Config, Warning, L"Saving changes to [{}.{}] isn't supported, skipped", Utf8ToWide(tableName), Utf8ToWide(key));
+                return;
+            }
+            edits.push_back({ std::string(tableName), std::string(key), ev });
+        };
+        for (auto&& [key, val] : *b)
+            diffKey(key.str(), &val, e->get(key.str()));
+        for (auto&& [key, val] : *e) {
+            if (!b->contains(key.str()))
+                diffKey(key.str(), nullptr, &val);
+        }
+    };
+
+    for (auto&& [key, val] : base)
+        diffTable(key.str(), val.as_table(), edited[key.str()].as_table());
+    for (auto&& [key, val] : edited) {
+        if (!base.contains(key.str()))
+            diffTable(key.str(), nullptr, val.as_table());
+    }
+    return edits;
+}
+
+bool SaveConfigChanges(const std::filesystem::path& path, const Config& base, const Config& edited) {
+    auto baseToml = StringifyConfig(base);
+    auto editedToml = StringifyConfig(edited);
+    auto edits = DiffConfigTables(baseToml, editedToml);
+    if (edits.empty()) {
+        LOG(Config, Info, L"No config changes to save");
+        return true;
+    }
+
+    std::string text;
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        if (!ifs) {
+            LOG(Config, Error, L"Cannot open config file '{}' for saving", path.wstring());
+            return false;
+        }
+        text.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+
+    // Kept as they are in the file
+    auto eol = text.find("\r\n") != std::string::npos ? "\r\n"sv : "\n"sv;
+    bool finalEol = text.ends_with('\n');
+
+    std::vector<std::string> lines;
+    for (size_t begin = 0; begin < text.size();) {
+        auto end = text.find('\n', begin);
+        if (end == std::string::npos)
+            end = text.size();
+        auto line = std::string_view(text).substr(begin, end - begin);
+        if (line.ends_with('\r'))
+            line.remove_suffix(1);
+        lines.emplace_back(line);
+        begin = end + 1;
+    }
+
+    for (const auto& edit : edits)
+        PatchConfigLines(lines, edit);
+
+    std::string patched;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        patched += lines[i];
+        if (i + 1 < lines.size() || finalEol)
+            patched += eol;
+    }
+
+    // Something in the file the patching didn't account for (e.g. a table written inline) shows up here, before anything is overwritten
+    auto check = TryParseToml(patched);
+    bool ok = check.has_value();
+    for (size_t i = 0; ok && i < edits.size(); ++i) {
+        const auto& edit = edits[i];
+        auto node = (*check)[edit.table][edit.key].node();
+        ok = edit.value ? node && TomlNodesEqual(*node, *edit.value) : !node;
+    }
+    if (!ok) {
+        LOG(Config, Error, L"Cannot save config changes into '{}' without rewriting it, left alone", path.wstring());
+        return false;
+    }
+
+    // Replaced in one step, so that a failed write doesn't leave half a config behind
+    auto tmpPath = path;
+    tmpPath += L".tmp";
+    {
+        std::ofstream ofs(tmpPath, std::ios::binary | std::ios::trunc);
+        ofs.write(patched.data(), patched.size());
+        if (!ofs) {
+            LOG(Config, Error, L"Cannot write '{}'", tmpPath.wstring());
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec) {
+        LOG(Config, Error, L"Cannot replace config file '{}': {}", path.wstring(), Utf8ToWide(ec.message()));
+        std::filesystem::remove(tmpPath, ec);
+        return false;
+    }
+
+    LOG(Config, Info, L"Saved {} config change(s) into '{}'", edits.size(), path.wstring());
+    return true;
+}
+
+bool SaveConfigToDesignatedPath() {
+    if (!SaveConfigChanges(DesignatedConfigPath(), gConfigOnDisk, gConfig))
+        return false;
+    gConfigOnDisk = gConfig;
+    return true;
 }
 
-void BindProfileToGamepad(int userIndex, const UserProfile& profile) {
-    SrwExclusiveLock lock(gXiGamepadsLock);
-    gXiGamepadsEnabled[userIndex] = true;
+void BindProfileToGamepad(int userIndex, std::shared_ptr<const ProfileStore> store, ProfileId profileId) {
+    gXiGamepadBindings[userIndex].Bind(std::move(store), profileId);
     gXiGamepads[userIndex] = {};
-    gXiGamepads[userIndex].profile = &profile;
+    // Publish the reset state before flipping the slot over, so a game never sees the previous binding's leftovers
+    PublishGamepad(userIndex, gClock->Now());
+    SetGamepadEnabled(userIndex, true);
 }
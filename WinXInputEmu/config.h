@@ -1,20 +1,91 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
 #include <functional>
 #include <map>
 #include <memory>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include <toml++/toml.h>
 
 #include "shadowed.h"
+#include "inputbackend.h"
 #include "inputdevice.h"
+#include "log.h"
+
+// Everything a key can be bound to on a gamepad
+// Profile actions (turbo, macros, tap/hold) only drive the digital buttons, A through RStickBtn
+enum class XiButton : unsigned char {
+    None = 0,
+    A, B, X, Y,
+    LB, RB,
+    LT, RT,
+    Start, Back,
+    DpadUp, DpadDown, DpadLeft, DpadRight,
+    LStickBtn, RStickBtn,
+    LStickUp, LStickDown, LStickLeft, LStickRight,
+    RStickUp, RStickDown, RStickLeft, RStickRight,
+    AnalogModifier,
+};
+constexpr int kXiButtonCount = static_cast<int>(XiButton::AnalogModifier) + 1;
 
 struct UserProfile {
     struct Button {
-        KeyCode keyCode = 0xFF;
+        // Any of these keys holds the button, empty if nothing is bound
+        // A key may also appear in several Buttons, pressing it holds all of them
+        std::vector<KeyCode> keyCodes;
+    };
+
+    // Maps how far a stick is deflected (before shaping, [0,1]) to how far it is reported deflected (also [0,1])
+    // Compiled into a lookup table when the profile is bound, see StickCurveLut
+    struct StickCurve {
+        enum class Shape {
+            // input ^ exponent
+            Power,
+            // Straight lines through `points`, plus (0,0) and (1,1)
+            Piecewise,
+            // Cubic Bézier from (0,0) to (1,1) with control points (bezier[0],bezier[1]) and (bezier[2],bezier[3]), like CSS' cubic-bezier()
+            Bezier,
+        };
+
+        enum class Gate {
+            // Diagonals reach at most (0.71,0.71), like a real stick
+            Circle,
+            // Diagonals reach (1,1)
+            Square,
+        };
+
+        Shape shape = Shape::Power;
+        // 1.0 is linear
+        // < 1 makes center more sensitive
+        float exponent = 1.0f;
+        std::vector<std::array<float, 2>> points;
+        std::array<float, 4> bezier = { 0.0f, 0.0f, 1.0f, 1.0f };
+
+        // Range: [0,1]
+        // Radial: deflection up to this is reported as centered
+        float deadzone = 0.0f;
+        // Per axis: a component up to this is dropped, e.g. so that a mostly-vertical motion doesn't also drift sideways
+        float axialDeadzone = 0.0f;
+        // Deflection from this on is reported as full
+        float saturation = 1.0f;
+        // The smallest deflection past the deadzone is reported as this, to skip over a game's own deadzone
+        float antiDeadzone = 0.0f;
+
+        Gate gate = Gate::Square;
+    };
+
+    // What a keyboard stick axis reports while both of its opposing keys are held
+    enum class SocdPolicy {
+        // Centered
+        Neutral,
+        // The most recently pressed key
+        LastWins,
+        // The key that was already held
+        FirstWins,
     };
 
     struct Joystick {
@@ -26,23 +97,28 @@ struct UserProfile {
             Button up, down, left, right;
             // Range: [0,1] i.e. works as a percentage
             float speed = 1.0f;
+            // Milliseconds to go from centered to full deflection, and back; 0 jumps instantly
+            float attackMs = 0.0f;
+            float releaseMs = 0.0f;
+            SocdPolicy socd = SocdPolicy::Neutral;
         } kbd;
 
         struct {
             // 
             // Lower value corresponds to higher sensitivity
             float sensitivity = 15.0f;
-            // 1.0 is linear
-            // < 1 makes center more sensitive
-            float nonLinear = 1.0f;
-            // Range: [0,1]
-            float deadzone = 0.0f;
             bool invertXAxis = false;
             bool invertYAxis = false;
         } mouse;
 
-        // If true, both axis will be generated from mouse movements (specifically the mouse specified by XiGamepad.srcMouse)
+        // Applies to both keyboard and mouse mode
+        StickCurve curve;
+
+        // If true, both axis will be generated from mouse movements (specifically the mouse specified by XiGamepadBinding.srcMouse)
         bool useMouse = false;
+
+        // Mouse sticks start out from this instead of a default StickCurve: slightly nonlinear, with a small deadzone
+        static StickCurve DefaultMouseCurve() noexcept;
     };
 
     Button a, b, x, y;
@@ -52,21 +128,139 @@ struct UserProfile {
     Button dpadUp, dpadDown, dpadLeft, dpadRight;
     Button lstickBtn, rstickBtn;
     Joystick lstick, rstick;
+
+    // Milliseconds to go from released to fully pulled, and back; 0 jumps instantly
+    float triggerAttackMs = 0.0f;
+    float triggerReleaseMs = 0.0f;
+
+    // While held, keyboard sticks and triggers only go as far as `analogModifierScale`, e.g. for walking or half throttle
+    Button analogModifier;
+    float analogModifierScale = 0.5f;
+
+    // Timed actions, run by ActionScheduler (see actions.h)
+    // Their keys shouldn't also be bound to a button above, or both will fight over the same gamepad button
+
+    // While `key` is held, presses and releases `button` `rate` times per second
+    struct Turbo {
+        Button key;
+        XiButton button = XiButton::None;
+        float rate = 10.0f;
+    };
+
+    // Holds `buttons` for `holdMs`, then releases them and waits `waitMs` before the next step
+    struct MacroStep {
+        std::vector<XiButton> buttons;
+        float holdMs = 50.0f;
+        float waitMs = 50.0f;
+    };
+
+    // Each press of `key` plays `steps` once, to the end even if the key is released early
+    // Pressing the key again while the macro is playing does nothing
+    struct Macro {
+        Button key;
+        std::vector<MacroStep> steps;
+    };
+
+    // Releasing `key` within `thresholdMs` taps `tap` for `tapMs`; holding it longer holds `hold` until the key is released
+    struct TapHold {
+        Button key;
+        XiButton tap = XiButton::None;
+        XiButton hold = XiButton::None;
+        float thresholdMs = 200.0f;
+        float tapMs = 50.0f;
+    };
+
+    std::vector<Turbo> turbos;
+    std::vector<Macro> macros;
+    std::vector<TapHold> tapHolds;
+};
+
+// What one of the slots a game polls shows
+struct SlotRouting {
+    enum class Mode {
+        // The emulated gamepad bound to the slot, if there is one, otherwise a physical controller (see Config::compactSlots)
+        Auto,
+        // Physical controller `physical`, even if an emulated gamepad is bound to the slot
+        Physical,
+        // The emulated gamepad bound to the slot and physical controller `physical` together
+        Merge,
+        // Nothing, the slot always reads as disconnected
+        None,
+    };
+
+    Mode mode = Mode::Auto;
+    // System XInput user index
+    int physical = 0;
+};
+
+// Config::hotkeyXxx when nothing is bound
+constexpr KeyCode kNoHotkey = 0xFF;
+
+// Index into ProfileStore::profiles
+using ProfileId = uint16_t;
+constexpr ProfileId kInvalidProfileId = 0xFFFF;
+
+// Every profile of a Config, interned into one contiguous array and addressed by ProfileId
+// Immutable once loaded and shared by pointer: each copy of the Config, and each gamepad bound to one of its profiles, keeps it alive,
+// so a bound profile stays valid across config reloads until the gamepad is rebound.
+struct ProfileStore {
+    std::vector<UserProfile> profiles;
+    // Parallel to `profiles`
+    std::vector<std::string> names;
+    // Name -> ProfileId, for config and UI code; translation only ever goes by ProfileId
+    std::map<std::string, ProfileId, std::less<>> ids;
+
+    // Returns kInvalidProfileId if there is no such profile
+    ProfileId Find(std::string_view name) const noexcept;
+    // Returns kInvalidProfileId if the name is already taken, or the store is full
+    ProfileId Add(std::string name, UserProfile profile);
 };
 
 struct Config {
-    std::map<std::string, UserProfile, std::less<>> profiles;
+    std::shared_ptr<const ProfileStore> profiles = std::make_shared<const ProfileStore>();
     std::array<std::string, XUSER_MAX_COUNT> xiGamepadBindings;
+    std::array<SlotRouting, XUSER_MAX_COUNT> slotRouting;
+    // Per gamepad: ignore input while no window of the game is in the foreground
+    std::array<bool, XUSER_MAX_COUNT> foregroundOnly = {};
+    // Auto slots without an emulated gamepad take the connected physical controllers in order, instead of the one at their own index
+    bool compactSlots = false;
+    // How often physical controllers are polled for merged slots, in milliseconds
+    float physicalPollMs = 4.0f;
     // Recommends 50-100
     int mouseCheckFrequency = 75;
-    KeyCode hotkeyShowUI;
-    KeyCode hotkeyCaptureCursor;
+    // See InputTranslationStruct::fixedPointMouseSticks
+    bool fixedPointMouseSticks = false;
+    // Only read when the input thread starts
+    InputBackendType inputBackend = InputBackendType::RawInput;
+    // For InputBackendType::Synthetic
+    int syntheticEventRate = 1000;
+    uint32_t syntheticSeed = 1;
+    // Keep keys and mouse buttons bound on an enabled gamepad from also reaching the game
+    // Needs the hook backend, which is used instead of raw input when this is set
+    bool suppressBoundKeys = false;
+    // Same for mouse motion, while it drives a mouse stick and the cursor is captured
+    bool suppressMouseStickMotion = false;
+    // Move the cursor back to the middle of the game window every mouse tick while it's captured, so that it never runs into an edge
+    bool recenterCursor = false;
+    // Device name (as listed in the UI) -> counts per inch, see devicestats.h
+    std::map<std::string, float, std::less<>> mouseDpi;
+    KeyCode hotkeyShowUI = kNoHotkey;
+    KeyCode hotkeyCaptureCursor = kNoHotkey;
+    // Indexed by LogCategory
+    std::array<LogLevel, kLogCategoryCount> logLevels = [] {
+        std::array<LogLevel, kLogCategoryCount> levels;
+        levels.fill(LogLevel::Debug);
+        return levels;
+    }();
 };
 
 // Container for all EventBus objects used for a given Config object
 // Since Config is just a plain old object, these need to be called by code that modifies the given Config object.
 struct ConfigEvents {
     EventBus<void(int)> onMouseCheckFrequencyChanged;
+    EventBus<void(bool)> onFixedPointMouseSticksChanged;
+    EventBus<void()> onMouseDpiChanged;
+    EventBus<void()> onSlotRoutingChanged;
     EventBus<void(int userIndex, const std::string& profileName, const UserProfile& profile)> onGamepadBindingChanged;
 };
 
@@ -75,8 +269,17 @@ extern ConfigEvents gConfigEvents;
 void ReloadConfigFromDesignatedPath();
 void ReloadConfig(const std::filesystem::path& path);
 
+// Both follow the same schema, see config.cpp; keys left at their defaults aren't written
+// LoadConfig() warns about unknown keys and values that are out of range or of the wrong type, and uses the defaults instead
 toml::table StringifyConfig(const Config&) noexcept;
 Config LoadConfig(const toml::table&) noexcept;
 
-// Lock: built-in
-void BindProfileToGamepad(int userIndex, const UserProfile& profile);
+// Writes the keys that differ between `base` and `edited` into the config file at `path`; the rest of the file, comments included, stays as it is
+// Only keys of the top level tables (e.g. [Binding], [MouseDpi]) are edited in place, changes to profiles are logged and skipped
+// Returns false, leaving the file alone, if it couldn't be read, edited or written
+bool SaveConfigChanges(const std::filesystem::path& path, const Config& base, const Config& edited);
+// Saves what changed in gConfig since the designated config file was last loaded or saved
+bool SaveConfigToDesignatedPath();
+
+// Threading: input thread only
+void BindProfileToGamepad(int userIndex, std::shared_ptr<const ProfileStore> store, ProfileId profileId);
@@ -0,0 +1,65 @@
+#include "pch.h"
+
+#include "configschema.h"
+
+const toml::node* ConfigReader::Take(std::string_view key) {
+    auto node = table.get(key);
+    if (!node)
+        return nullptr;
+    // Point at the table's copy of the key, `key` may be a temporary
+    seen.push_back(table.find(key)->first.str());
+    return node;
+}
+
+void ConfigReader::Warn(std::string_view key, std::string_view message) const {
+    LOG(Config, Warning, L"{}: {}", Utf8ToWide(Join(key)), Utf8ToWide(message));
+}
+
+void ConfigReader::Finish() const {
+    for (auto&& [key, val] : table) {
+        if (std::find(seen.begin(), seen.end(), key.str()) == seen.end())
+            Warn(key.str(), "unknown key, ignored");
+    }
+}
+
+std::string ConfigReader::Join(std::string_view key) const {
+    if (path.empty())
+        return std::string(key);
+    return std::format("{}.{}", path, key);
+}
+
+bool TomlNodesEqual(const toml::node& a, const toml::node& b) {
+    if (a.type() != b.type())
+        return false;
+    return a.visit([&](const auto& x) {
+        auto y = b.as<std::remove_cvref_t<decltype(x)>>();
+        return y && x == *y;
+    });
+}
+
+static bool IsEmptyContainer(const toml::node& node) {
+    if (auto t = node.as_table())
+        return t->empty();
+    if (auto arr = node.as_array())
+        return arr->empty();
+    return false;
+}
+
+void PruneTomlDefaults(toml::table& t, const toml::table& defaults) {
+    for (auto iter = t.begin(); iter != t.end();) {
+        auto& [key, val] = *iter;
+        auto def = defaults.get(key.str());
+        if (def && val.is_table() && def->is_table()) {
+            PruneTomlDefaults(*val.as_table(), *def->as_table());
+        }
+        else if (def && TomlNodesEqual(val, *def)) {
+            iter = t.erase(iter);
+            continue;
+        }
+
+        if (IsEmptyContainer(val))
+            iter = t.erase(iter);
+        else
+            ++iter;
+    }
+}
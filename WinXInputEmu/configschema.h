@@ -0,0 +1,334 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <format>
+#include <limits>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <toml++/toml.h>
+
+#include "log.h"
+#include "utils.h"
+
+// Config structs are described once, by a Visit function listing their keys; the same function reads them (ConfigReader) and writes them (ConfigWriter):
+//
+//     template <typename TVisitor, typename TFoo>
+//     void VisitFoo(TVisitor& v, TFoo& foo) {
+//         v("Speed", foo.speed, NumberCodec<float>{ 0.0f, 1.0f });
+//         v.Table("Keys", [&](auto& v) { ... });
+//     }
+//
+// TFoo is `Foo` when reading and `const Foo` when writing, so a Visit function must only touch the object it's given.
+// A codec converts one value between TOML and C++, and checks it:
+//     bool Read(const toml::node& node, T& out, ConfigReader& r, std::string_view key) const;  // false leaves `out` alone
+//     auto Write(const T& value) const;                                                         // something toml::table::insert() takes
+// or, to pick the shape of the value by its contents, WriteInto(const T& value, toml::table& out, std::string_view key) instead of Write()
+
+class ConfigReader {
+public:
+    static constexpr bool kReads = true;
+
+    // `path` prefixes warnings, e.g. "UserProfiles.myprofile.LStick"
+    ConfigReader(const toml::table& table, std::string path)
+        : table{ table }
+        , path{ std::move(path) }
+    {
+    }
+
+    template <typename T, typename TCodec>
+    void operator()(std::string_view key, T& out, const TCodec& codec) {
+        if (auto node = Take(key))
+            codec.Read(*node, out, *this, key);
+    }
+
+    // Subtable, `visit` is called with a visitor for it
+    template <typename TVisit>
+    void Table(std::string_view key, TVisit&& visit) {
+        auto node = Take(key);
+        if (!node) return;
+        auto t = node->as_table();
+        if (!t) {
+            Warn(key, "should be a table, ignored");
+            return;
+        }
+        ConfigReader sub(*t, Join(key));
+        visit(sub);
+        sub.Finish();
+    }
+
+    // Array of tables, each visited by `visit(visitor, element)`; elements that `valid` rejects are dropped (it should say why)
+    template <typename T, typename TVisit, typename TValid>
+    void Tables(std::string_view key, std::vector<T>& out, TVisit&& visit, TValid&& valid) {
+        auto node = Take(key);
+        if (!node) return;
+        auto arr = node->as_array();
+        if (!arr) {
+            Warn(key, "should be an array of tables, ignored");
+            return;
+        }
+        for (size_t i = 0; i < arr->size(); ++i) {
+            auto t = arr->get(i)->as_table();
+            auto elmPath = std::format("{}[{}]", Join(key), i);
+            if (!t) {
+                LOG(Config, Warning, L"{}: should be a table, ignored", Utf8ToWide(elmPath));
+                continue;
+            }
+            ConfigReader sub(*t, std::move(elmPath));
+            T elm{};
+            visit(sub, elm);
+            sub.Finish();
+            if (valid(sub, elm))
+                out.push_back(std::move(elm));
+        }
+    }
+
+    // Table whose keys are picked by the user, e.g. mouse names
+    template <typename T, typename TCodec>
+    void Map(std::string_view key, std::map<std::string, T, std::less<>>& out, const TCodec& codec) {
+        Table(key, [&](ConfigReader& sub) {
+            for (auto&& [k, v] : sub.table) {
+                sub.seen.push_back(k.str());
+                T value{};
+                if (codec.Read(v, value, sub, k.str()))
+                    out.insert_or_assign(std::string(k.str()), std::move(value));
+            }
+        });
+    }
+
+    // Marks `key` as known and returns its value, for keys handled by hand; nullptr if it's absent
+    const toml::node* Take(std::string_view key);
+
+    void Warn(std::string_view key, std::string_view message) const;
+    const std::string& Path() const noexcept { return path; }
+
+    // Warns about each key that no Visit function asked for, e.g. typos; call once everything was read
+    void Finish() const;
+
+private:
+    std::string Join(std::string_view key) const;
+
+    const toml::table& table;
+    std::string path;
+    // Views into `table`'s own keys
+    std::vector<std::string_view> seen;
+};
+
+class ConfigWriter {
+public:
+    static constexpr bool kReads = false;
+
+    explicit ConfigWriter(toml::table& out) noexcept
+        : out{ out }
+    {
+    }
+
+    template <typename T, typename TCodec>
+    void operator()(std::string_view key, const T& value, const TCodec& codec) {
+        if constexpr (requires { codec.WriteInto(value, out, key); })
+            codec.WriteInto(value, out, key);
+        else
+            out.insert_or_assign(key, codec.Write(value));
+    }
+
+    template <typename TVisit>
+    void Table(std::string_view key, TVisit&& visit) {
+        toml::table t;
+        ConfigWriter sub(t);
+        visit(sub);
+        out.insert_or_assign(key, std::move(t));
+    }
+
+    template <typename T, typename TVisit, typename TValid>
+    void Tables(std::string_view key, const std::vector<T>& values, TVisit&& visit, TValid&&);
+
+    template <typename T, typename TCodec>
+    void Map(std::string_view key, const std::map<std::string, T, std::less<>>& values, const TCodec& codec) {
+        toml::table t;
+        for (const auto& [k, v] : values)
+            t.insert_or_assign(k, codec.Write(v));
+        out.insert_or_assign(key, std::move(t));
+    }
+
+private:
+    toml::table& out;
+};
+
+// Deep comparison; integers and floats are different things here, like they are to TOML
+bool TomlNodesEqual(const toml::node& a, const toml::node& b);
+
+// Removes everything from `t` that `defaults` has too, then the subtables and arrays left empty
+void PruneTomlDefaults(toml::table& t, const toml::table& defaults);
+
+// What `value` is compared with to leave out the keys it doesn't change; overloaded by structs whose defaults depend on their contents
+template <typename T>
+T ConfigDefaults(const T&) {
+    return T{};
+}
+
+// Everything `visit` writes of `value`, minus what it has in common with ConfigDefaults(value)
+template <typename T, typename TVisit>
+toml::table WriteConfigTable(const T& value, TVisit&& visit) {
+    toml::table t;
+    ConfigWriter w(t);
+    visit(w, value);
+
+    toml::table d;
+    ConfigWriter dw(d);
+    const T defaults = ConfigDefaults(value);
+    visit(dw, defaults);
+
+    PruneTomlDefaults(t, d);
+    return t;
+}
+
+template <typename T, typename TVisit, typename TValid>
+void ConfigWriter::Tables(std::string_view key, const std::vector<T>& values, TVisit&& visit, TValid&&) {
+    toml::array arr;
+    for (const auto& elm : values)
+        arr.push_back(WriteConfigTable(elm, visit));
+    out.insert_or_assign(key, std::move(arr));
+}
+
+////////// Codecs //////////
+
+// Shortest decimal that reads back as `f`, so that 0.8f is written as 0.8 and not 0.800000011920929
+inline double FloatForToml(float f) noexcept {
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof(buf), f);
+    double d = f;
+    std::from_chars(buf, res.ptr, d);
+    return d;
+}
+
+// Integers or floats, clamped to [min,max]
+template <typename T>
+struct NumberCodec {
+    T min = std::numeric_limits<T>::lowest();
+    T max = std::numeric_limits<T>::max();
+
+    bool Read(const toml::node& node, T& out, ConfigReader& r, std::string_view key) const {
+        using TRead = std::conditional_t<std::is_floating_point_v<T>, double, int64_t>;
+        auto v = node.value<TRead>();
+        if (!v) {
+            r.Warn(key, std::is_floating_point_v<T> ? "should be a number, ignored" : "should be an integer, ignored");
+            return false;
+        }
+        TRead clamped = std::clamp<TRead>(*v, static_cast<TRead>(min), static_cast<TRead>(max));
+        if (clamped != *v)
+            r.Warn(key, std::format("{} is out of range [{}, {}], using {}", *v, min, max, clamped));
+        out = static_cast<T>(clamped);
+        return true;
+    }
+
+    auto Write(T value) const {
+        if constexpr (std::is_floating_point_v<T>)
+            return toml::value<double>(FloatForToml(value));
+        else
+            return toml::value<int64_t>(static_cast<int64_t>(value));
+    }
+};
+
+struct BoolCodec {
+    bool Read(const toml::node& node, bool& out, ConfigReader& r, std::string_view key) const {
+        auto v = node.value_exact<bool>();
+        if (!v) {
+            r.Warn(key, "should be true or false, ignored");
+            return false;
+        }
+        out = *v;
+        return true;
+    }
+
+    auto Write(bool value) const { return toml::value<bool>(value); }
+};
+
+struct StringCodec {
+    bool Read(const toml::node& node, std::string& out, ConfigReader& r, std::string_view key) const {
+        auto v = node.value<std::string_view>();
+        if (!v) {
+            r.Warn(key, "should be a string, ignored");
+            return false;
+        }
+        out = *v;
+        return true;
+    }
+
+    auto Write(const std::string& value) const { return toml::value<std::string>(value); }
+};
+
+// One of a fixed set of strings
+template <typename T>
+struct EnumCodec {
+    std::span<const std::pair<std::string_view, T>> names;
+
+    bool Read(const toml::node& node, T& out, ConfigReader& r, std::string_view key) const {
+        auto v = node.value<std::string_view>();
+        if (v) {
+            for (const auto& [name, value] : names) {
+                if (*v == name) {
+                    out = value;
+                    return true;
+                }
+            }
+        }
+        if (auto current = NameOf(out); !current.empty())
+            r.Warn(key, std::format("unknown value '{}', using '{}'", v.value_or(""), current));
+        else
+            r.Warn(key, std::format("unknown value '{}', ignored", v.value_or("")));
+        return false;
+    }
+
+    auto Write(const T& value) const { return toml::value<std::string>(std::string(NameOf(value))); }
+
+    std::string_view NameOf(const T& value) const {
+        for (const auto& [name, v] : names) {
+            if (v == value)
+                return name;
+        }
+        return {};
+    }
+};
+
+// A single value or an array of them, read into a vector; elements that don't read are skipped
+template <typename TElmCodec>
+struct OneOrManyCodec {
+    TElmCodec elm;
+
+    template <typename T>
+    bool Read(const toml::node& node, std::vector<T>& out, ConfigReader& r, std::string_view key) const {
+        out.clear();
+        auto add = [&](const toml::node& n) {
+            T value{};
+            if (elm.Read(n, value, r, key))
+                out.push_back(std::move(value));
+        };
+        if (auto arr = node.as_array()) {
+            for (auto&& n : *arr)
+                add(n);
+        }
+        else {
+            add(node);
+        }
+        return true;
+    }
+
+    // A single value on its own, like it would usually be written by hand
+    template <typename T>
+    void WriteInto(const std::vector<T>& values, toml::table& out, std::string_view key) const {
+        if (values.size() == 1) {
+            out.insert_or_assign(key, elm.Write(values[0]));
+            return;
+        }
+        toml::array arr;
+        for (const auto& value : values)
+            arr.push_back(elm.Write(value));
+        out.insert_or_assign(key, std::move(arr));
+    }
+};
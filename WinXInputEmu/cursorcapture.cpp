@@ -0,0 +1,138 @@
+#include "pch.h"
+
+#include "cursorcapture.h"
+
+CursorCapture* CursorCapture::sActive = nullptr;
+
+bool CursorCapture::Start(HWND window, bool inForeground) {
+    if (sActive) {
+        LOG(Input, Error, L"Only one cursor capture can run at a time");
+        return false;
+    }
+    if (!window || !IsWindow(window)) {
+        LOG(Input, Warning, L"No window to capture the cursor in");
+        return false;
+    }
+
+    // Moves and resizes of that window only; being out of context, nothing gets injected into anything
+    DWORD processId = 0;
+    DWORD windowThreadId = GetWindowThreadProcessId(window, &processId);
+    locationHook = SetWinEventHook(EVENT_OBJECT_LOCATIONCHANGE, EVENT_OBJECT_LOCATIONCHANGE, nullptr, &WinEventProc, processId, windowThreadId, WINEVENT_OUTOFCONTEXT);
+    if (!locationHook) {
+        LOG(Input, Error, L"Error setting WinEvent hook: {}", GetLastErrorStr());
+        return false;
+    }
+    sActive = this;
+
+    this->window = window;
+    this->inForeground = inForeground;
+    reassertsMoved = 0;
+    reassertsDropped = 0;
+    recenters = 0;
+    clipped = false;
+    everClipped = false;
+    Update();
+
+    ShowCursor(false);
+    cursorHidden = true;
+    return true;
+}
+
+void CursorCapture::Stop() {
+    if (locationHook) {
+        UnhookWinEvent(locationHook);
+        locationHook = nullptr;
+    }
+    if (sActive == this)
+        sActive = nullptr;
+
+    if (clipped) {
+        ClipCursor(nullptr);
+        clipped = false;
+    }
+    if (cursorHidden) {
+        ShowCursor(true);
+        cursorHidden = false;
+    }
+    window = nullptr;
+}
+
+void CursorCapture::OnForegroundChanged(bool inForeground) {
+    if (!Active() || this->inForeground == inForeground) return;
+    this->inForeground = inForeground;
+    Update();
+}
+
+bool CursorCapture::Recenter(POINT& center) {
+    if (!Active()) return false;
+
+    // Cheap enough to do every time, and catches clips dropped without any event we'd hear about
+    Update();
+    if (!clipped) return false;
+
+    center = {
+        clip.left + (clip.right - clip.left) / 2,
+        clip.top + (clip.bottom - clip.top) / 2,
+    };
+    POINT current;
+    if (GetCursorPos(&current) && current.x == center.x && current.y == center.y)
+        return false;
+    if (!SetCursorPos(center.x, center.y))
+        return false;
+    ++recenters;
+    return true;
+}
+
+bool CursorCapture::ComputeClip(RECT& out) const noexcept {
+    RECT rect;
+    if (IsIconic(window) || !GetClientRect(window, &rect) || IsRectEmpty(&rect))
+        return false;
+    // Client rect is relative to the window itself, ClipCursor() wants screen coordinates
+    MapWindowPoints(window, nullptr, reinterpret_cast<POINT*>(&rect), 2);
+    out = rect;
+    return true;
+}
+
+void CursorCapture::Update() {
+    RECT rect;
+    if (!inForeground || !ComputeClip(rect)) {
+        // In the background or minimized, let the cursor go where it wants to
+        if (clipped) {
+            ClipCursor(nullptr);
+            clipped = false;
+        }
+        return;
+    }
+
+    if (clipped) {
+        RECT current;
+        if (EqualRect(&rect, &clip) && GetClipCursor(&current) && EqualRect(&current, &clip))
+            return;
+        if (EqualRect(&rect, &clip))
+            ++reassertsDropped;
+        else
+            ++reassertsMoved;
+    }
+    else if (everClipped) {
+        // Back from the background or from being minimized; the first clip after Start() isn't a reassertion
+        ++reassertsDropped;
+    }
+
+    if (!ClipCursor(&rect)) {
+        LOG(Input, Warning, L"Error clipping cursor: {}", GetLastErrorStr());
+        clipped = false;
+        return;
+    }
+    clip = rect;
+    clipped = true;
+    everClipped = true;
+}
+
+void CALLBACK CursorCapture::WinEventProc(HWINEVENTHOOK hook, DWORD event, HWND hwnd, LONG idObject, LONG idChild, DWORD idEventThread, DWORD dwmsEventTime) noexcept {
+    auto self = sActive;
+    if (!self) return;
+
+    // The cursor itself reports location changes too, along with carets and child controls
+    if (hwnd != self->window || idObject != OBJID_WINDOW || idChild != CHILDID_SELF) return;
+    self->Update();
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+// Keeps the cursor confined to the client area of a window, for as long as capture is on
+// The clip is applied again whenever the window moves or resizes (reported by a WinEvent hook, nothing is polled) and whenever it comes back to the foreground.
+// Windows drops a clip on its own in several cases, e.g. on foreground changes; while the window is in the background the cursor is left free on purpose.
+// Callbacks arrive on the thread that called Start(), whenever it pumps messages.
+class CursorCapture {
+public:
+    // Times the clip was applied again since Start(), because the window moved or resized
+    uint64_t reassertsMoved = 0;
+    // ... because Windows had dropped it
+    uint64_t reassertsDropped = 0;
+    uint64_t recenters = 0;
+
+    ~CursorCapture() { Stop(); }
+
+    bool Active() const noexcept { return window != nullptr; }
+    HWND Window() const noexcept { return window; }
+
+    // `inForeground`: whether `window` is in the foreground right now, the clip is only applied while it is
+    bool Start(HWND window, bool inForeground);
+    void Stop();
+    void OnForegroundChanged(bool inForeground);
+    // Moves the cursor to the center of the clip, e.g. so that it never reaches an edge; returns true and where it went if it did
+    // Also checks that the clip is still in effect
+    bool Recenter(POINT& center);
+
+private:
+    static void CALLBACK WinEventProc(HWINEVENTHOOK hook, DWORD event, HWND hwnd, LONG idObject, LONG idChild, DWORD idEventThread, DWORD dwmsEventTime) noexcept;
+
+    // Returns false if the window has no client area to clip to, e.g. while minimized
+    bool ComputeClip(RECT& out) const noexcept;
+    // Applies the clip if it isn't in effect, or releases it if it shouldn't be
+    void Update();
+
+    // Hook procedures have no context pointer, there can only be one running instance
+    static CursorCapture* sActive;
+
+    HWND window = nullptr;
+    HWINEVENTHOOK locationHook = nullptr;
+    bool inForeground = false;
+    bool cursorHidden = false;
+    // What we last clipped to; only meaningful while `clipped`
+    RECT clip = {};
+    bool clipped = false;
+    bool everClipped = false;
+};
@@ -0,0 +1,94 @@
+#include "pch.h"
+
+#include "devicestats.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+// Index of the log2 bucket `value` falls into: 0 for 0, 1 for 1, 2 for 2-3, ... clamped to `buckets` - 1
+static int Log2Bucket(uint64_t value, int buckets) noexcept {
+    return std::min(static_cast<int>(std::bit_width(value)), buckets - 1);
+}
+
+double MouseCalibration::Counts() const noexcept {
+    return std::hypot(static_cast<double>(countsX), static_cast<double>(countsY));
+}
+
+void DeviceStatsTable::OnEvent(const InputEvent& e, int64_t time) {
+    auto& st = devices[e.device];
+
+    if (st.lastEventTime != 0) {
+        int64_t gap = time - st.lastEventTime;
+        st.longestGap = std::max(st.longestGap, gap);
+        uint64_t gapMs = static_cast<uint64_t>(std::max<int64_t>(gap, 0) * 1000 / ticksPerSecond);
+        st.gapHistogram[Log2Bucket(gapMs, DeviceStats::kGapBuckets)] += 1;
+    }
+    st.lastEventTime = time;
+
+    if (time - st.windowStart >= ticksPerSecond) {
+        // A window only closes at the next event, so one spanning a pause reads as a lower rate
+        double seconds = static_cast<double>(time - st.windowStart) / static_cast<double>(ticksPerSecond);
+        st.reportRate = st.windowStart != 0 ? static_cast<float>(st.windowEvents / seconds) : 0.0f;
+        st.peakReportRate = std::max(st.peakReportRate, st.reportRate);
+        st.windowStart = time;
+        st.windowEvents = 0;
+    }
+    st.windowEvents += 1;
+
+    switch (e.type) {
+    case InputEvent::Type::Key: {
+        st.keyEvents += 1;
+    } break;
+
+    case InputEvent::Type::MouseMove: {
+        st.moveEvents += 1;
+        uint64_t magnitude = static_cast<uint64_t>(std::abs(static_cast<int64_t>(e.dx))) + static_cast<uint64_t>(std::abs(static_cast<int64_t>(e.dy)));
+        st.deltaHistogram[Log2Bucket(magnitude, DeviceStats::kDeltaBuckets)] += 1;
+
+        if (calibration.device == e.device) {
+            calibration.countsX += e.dx;
+            calibration.countsY += e.dy;
+        }
+    } break;
+    }
+}
+
+void DeviceStatsTable::NormalizeMotion(HANDLE device, LONG& dx, LONG& dy) {
+    auto iter = devices.find(device);
+    if (iter == devices.end() || iter->second.dpi <= 0.0f)
+        return;
+    auto& st = iter->second;
+
+    float scale = kReferenceDpi / st.dpi;
+    float x = static_cast<float>(dx) * scale + st.residualX;
+    float y = static_cast<float>(dy) * scale + st.residualY;
+    dx = static_cast<LONG>(std::trunc(x));
+    dy = static_cast<LONG>(std::trunc(y));
+    st.residualX = x - static_cast<float>(dx);
+    st.residualY = y - static_cast<float>(dy);
+}
+
+void DeviceStatsTable::SetDpi(HANDLE device, float dpi) {
+    auto& st = devices[device];
+    st.dpi = std::max(dpi, 0.0f);
+    st.residualX = 0.0f;
+    st.residualY = 0.0f;
+}
+
+void DeviceStatsTable::StartCalibration(HANDLE device) {
+    calibration = {};
+    calibration.device = device;
+}
+
+float DeviceStatsTable::FinishCalibration(float distanceInches) {
+    double counts = calibration.Counts();
+    calibration = {};
+    if (counts <= 0.0 || distanceInches <= 0.0f)
+        return 0.0f;
+    return static_cast<float>(counts / distanceInches);
+}
+
+void DeviceStatsTable::CancelCalibration() {
+    calibration = {};
+}
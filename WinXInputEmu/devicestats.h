@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+#include "inputbackend.h"
+#include "platform.h"
+
+// Mouse sensitivity is stated in counts of a mouse with this resolution; motion of mice with a known DPI is scaled to it
+// Profiles written before calibration existed were tuned on whatever mouse their author had, 800 is the most common default
+constexpr float kReferenceDpi = 800.0f;
+
+// Live statistics of one input device, as seen by the input thread
+struct DeviceStats {
+    // Log2 buckets of |dx| + |dy| per report: 0, 1, 2-3, 4-7, ..., >= 64
+    static constexpr int kDeltaBuckets = 8;
+    // Log2 buckets of the time between two reports, in milliseconds: < 1, 1-2, 2-4, ..., >= 64
+    static constexpr int kGapBuckets = 8;
+
+    uint64_t keyEvents = 0;
+    uint64_t moveEvents = 0;
+    // gClock reading of the latest event, 0 if there was none yet
+    int64_t lastEventTime = 0;
+
+    // Events per second over the latest complete one second window
+    float reportRate = 0.0f;
+    float peakReportRate = 0.0f;
+    int64_t windowStart = 0;
+    uint32_t windowEvents = 0;
+
+    uint64_t deltaHistogram[kDeltaBuckets] = {};
+    uint64_t gapHistogram[kGapBuckets] = {};
+    // In gClock ticks
+    int64_t longestGap = 0;
+
+    // Counts per inch, 0 if unknown, in which case motion is passed on as is
+    float dpi = 0.0f;
+    // What scaling to kReferenceDpi rounded off, carried into the next move so that slow motion isn't lost
+    float residualX = 0.0f;
+    float residualY = 0.0f;
+};
+
+// Counts a mouse reports while it's moved a known distance
+struct MouseCalibration {
+    // nullptr if not calibrating
+    HANDLE device = nullptr;
+    int64_t countsX = 0;
+    int64_t countsY = 0;
+
+    bool Running() const noexcept { return device != nullptr; }
+    // Straight line distance covered, in counts
+    double Counts() const noexcept;
+};
+
+// Threading: input thread only (which includes the UI)
+struct DeviceStatsTable {
+    std::unordered_map<HANDLE, DeviceStats> devices;
+    MouseCalibration calibration;
+    int64_t ticksPerSecond = 0;
+
+    // Call for every event from the input backend, before any coalescing
+    void OnEvent(const InputEvent& e, int64_t time);
+    // Scales relative motion of `device` to kReferenceDpi, if its DPI is known
+    void NormalizeMotion(HANDLE device, LONG& dx, LONG& dy);
+    // 0 clears it
+    void SetDpi(HANDLE device, float dpi);
+
+    void StartCalibration(HANDLE device);
+    // Returns the measured DPI, or 0 if the mouse didn't move; doesn't apply it
+    float FinishCalibration(float distanceInches);
+    void CancelCalibration();
+};
@@ -1,7 +1,5 @@
 #pragma once
 
-#define NOMINMAX
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
+#include "platform.h"
 
 extern HMODULE gHModule;
@@ -1,21 +1,22 @@
 #include "pch.h"
 
 #include <format>
-
-#define NOMINMAX
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
+#include <mutex>
+#include <thread>
 
 #include "dll.h"
 #include "export.h"
 #include "inputdevice.h"
 #include "inputsrc.h"
+#include "keystroke.h"
+#include "platform.h"
 #include "shadowed.h"
+#include "slotrouting.h"
 #include "userdevice.h"
 #include "utils.h"
 
 // Declared in dll.h
-// Assigned in DllMain() -> DLL_PROCESS_ATTACH
+// Assigned in DllMain() -> DLL_PROCESS_ATTACH, stays null on the stand-in platform
 HMODULE gHModule;
 
 // Definitions for stuff in shadowed.h
@@ -29,56 +30,61 @@ Pfn_XInputGetKeystroke pfn_XInputGetKeystroke = nullptr;
 Pfn_XInputGetState pfn_XInputGetState = nullptr;
 Pfn_XInputSetState pfn_XInputSetState = nullptr;
 
+// Stand-ins for when the system XInput is missing, so that physical and merged slots read as unplugged instead of crashing
+static DWORD WINAPI NoSystemXInputGetAudioDeviceIds(DWORD, LPWSTR, UINT*, LPWSTR, UINT*) WIN_NOEXCEPT { return ERROR_DEVICE_NOT_CONNECTED; }
+static DWORD WINAPI NoSystemXInputGetBatteryInformation(DWORD, BYTE, XINPUT_BATTERY_INFORMATION*) WIN_NOEXCEPT { return ERROR_DEVICE_NOT_CONNECTED; }
+static DWORD WINAPI NoSystemXInputGetCapabilities(DWORD, DWORD, XINPUT_CAPABILITIES*) WIN_NOEXCEPT { return ERROR_DEVICE_NOT_CONNECTED; }
+static DWORD WINAPI NoSystemXInputGetKeystroke(DWORD, DWORD, XINPUT_KEYSTROKE*) WIN_NOEXCEPT { return ERROR_DEVICE_NOT_CONNECTED; }
+static DWORD WINAPI NoSystemXInputGetState(DWORD, XINPUT_STATE*) WIN_NOEXCEPT { return ERROR_DEVICE_NOT_CONNECTED; }
+static DWORD WINAPI NoSystemXInputSetState(DWORD, XINPUT_VIBRATION*) WIN_NOEXCEPT { return ERROR_DEVICE_NOT_CONNECTED; }
+
+template <typename TPfn>
+static void LoadShadowedPfn(TPfn& pfn, const char* name, TPfn fallback) {
+    pfn = xinput_dll ? reinterpret_cast<TPfn>(PlatformGetProcAddress(xinput_dll, name)) : nullptr;
+    if (!pfn)
+        pfn = fallback;
+}
+
 static void InitializeShadowedPfns() {
-    // Using LoadLibraryExW() with LOAD_LIBRARY_SEARCH_SYSTEM32 only doesn't seem to work -- it still found our XInput1_4.dll (if our name is indeed this)
-    // On 32-bit process, "System32" is automatically redirected to SysWOW64
-    // On 64-bit process, "System32" will work in place
-    xinput_dll = LoadLibraryW(L"C:/Windows/System32/XInput1_4.dll");
+    xinput_dll = PlatformLoadSystemXInput();
     if (!xinput_dll) {
-        LOG_DEBUG(L"Error opening XInput1_4.dll: {}", GetLastErrorStr());
-        return;
+#ifdef _WIN32
+        LOG(General, Error, L"Error opening XInput1_4.dll: {}", GetLastErrorStr());
+#else
+        LOG(General, Info, L"No system XInput on this platform, physical gamepads read as unplugged");
+#endif
     }
 
     //pfn_XInputEnable = (Pfn_XInputEnable)GetProcAddress(xinput_dll, "XInputEnable");
-    pfn_XInputGetAudioDeviceIds = (Pfn_XInputGetAudioDeviceIds)GetProcAddress(xinput_dll, "XInputGetAudioDeviceIds");
-    pfn_XInputGetBatteryInformation = (Pfn_XInputGetBatteryInformation)GetProcAddress(xinput_dll, "XInputGetBatteryInformation");
-    pfn_XInputGetCapabilities = (Pfn_XInputGetCapabilities)GetProcAddress(xinput_dll, "XInputGetCapabilities");
+    LoadShadowedPfn(pfn_XInputGetAudioDeviceIds, "XInputGetAudioDeviceIds", &NoSystemXInputGetAudioDeviceIds);
+    LoadShadowedPfn(pfn_XInputGetBatteryInformation, "XInputGetBatteryInformation", &NoSystemXInputGetBatteryInformation);
+    LoadShadowedPfn(pfn_XInputGetCapabilities, "XInputGetCapabilities", &NoSystemXInputGetCapabilities);
     //pfn_XInputGetDSoundAudioDeviceGuids = (Pfn_XInputGetDSoundAudioDeviceGuids)GetProcAddress(xinput_dll, "XInputGetDSoundAudioDeviceGuids");
-    pfn_XInputGetKeystroke = (Pfn_XInputGetKeystroke)GetProcAddress(xinput_dll, "XInputGetKeystroke");
-    pfn_XInputGetState = (Pfn_XInputGetState)GetProcAddress(xinput_dll, "XInputGetState");
-    pfn_XInputSetState = (Pfn_XInputSetState)GetProcAddress(xinput_dll, "XInputSetState");
-}
-
-static HANDLE gWorkingThread;
-static DWORD gWorkingThreadId;
-static DWORD WINAPI WorkingThreadFunction(LPVOID lpParam) {
-    RunInputSource();
-    return 0;
+    LoadShadowedPfn(pfn_XInputGetKeystroke, "XInputGetKeystroke", &NoSystemXInputGetKeystroke);
+    LoadShadowedPfn(pfn_XInputGetState, "XInputGetState", &NoSystemXInputGetState);
+    LoadShadowedPfn(pfn_XInputSetState, "XInputSetState", &NoSystemXInputSetState);
 }
 
 static void StartWorkingThread() {
-    gWorkingThread = CreateThread(nullptr, 0, WorkingThreadFunction, nullptr, 0, &gWorkingThreadId);
-    if (gWorkingThread == nullptr) {
-        LOG_DEBUG(L"Failed to launch working thread");
-    }
-
+#ifdef _WIN32
     // TODO gracefully exit the thread when dll unloads
-    //WaitForSingleObject(gWorkingThread, INFINITE);
-    //CloseHandle(gWorkingThread);
+    try {
+        std::thread(RunInputSource).detach();
+    }
+    catch (const std::system_error& e) {
+        LOG(General, Error, L"Failed to launch working thread: {}", Utf8ToWide(e.what()));
+    }
+#else
+    // The input thread is a window message loop; on the stand-in, tests feed packets to the backends directly
+#endif
 }
 
-static INIT_ONCE gDllInitGuard = INIT_ONCE_STATIC_INIT;
-static BOOL CALLBACK DllInitHandler(PINIT_ONCE initOnce, PVOID parameter, PVOID* lpContext) {
-    InitializeShadowedPfns();
-    StartWorkingThread();
-    return TRUE;
-}
+static std::once_flag gDllInitGuard;
 static void EnsureDllInit() {
-    PVOID ctx = nullptr;
-    BOOL status = InitOnceExecuteOnce(&gDllInitGuard, DllInitHandler, nullptr, &ctx);
-    if (!status) {
-        LOG_DEBUG(L"Failed to execute INIT_ONCE");
-    }
+    std::call_once(gDllInitGuard, [] {
+        InitializeShadowedPfns();
+        StartWorkingThread();
+    });
 }
 
 // This function is deprecated, but we still provide it in case the game uses it
@@ -97,11 +103,13 @@ XI_API_FUNC DWORD WINAPI XInputGetAudioDeviceIds(
 ) WIN_NOEXCEPT {
     EnsureDllInit();
 
-    SrwSharedLock lock(gXiGamepadsLock);
-
     //LOG_DEBUG(L"audio device ids {}", dwUserIndex);
-    if (!gXiGamepadsEnabled[dwUserIndex])
-        return pfn_XInputGetAudioDeviceIds(dwUserIndex, pRenderDeviceId, pRenderCount, pCaptureDeviceId, pCaptureCount);
+    auto route = GetSlotRoute(dwUserIndex);
+    if (route.kind == XiSlotRoute::Kind::Disconnected)
+        return ERROR_DEVICE_NOT_CONNECTED;
+    // A merged slot's headset is the physical controller's
+    if (route.kind != XiSlotRoute::Kind::Emulated)
+        return pfn_XInputGetAudioDeviceIds(route.physical, pRenderDeviceId, pRenderCount, pCaptureDeviceId, pCaptureCount);
 
     // We pretend that a headset is not connected to this emulated gamepad
 
@@ -120,11 +128,12 @@ XI_API_FUNC DWORD WINAPI XInputGetBatteryInformation(
 ) WIN_NOEXCEPT {
     EnsureDllInit();
 
-    SrwSharedLock lock(gXiGamepadsLock);
-
     //LOG_DEBUG(L"battery info {}", dwUserIndex);
-    if (!gXiGamepadsEnabled[dwUserIndex])
-        return pfn_XInputGetBatteryInformation(dwUserIndex, devType, pBatteryInformation);
+    auto route = GetSlotRoute(dwUserIndex);
+    if (route.kind == XiSlotRoute::Kind::Disconnected)
+        return ERROR_DEVICE_NOT_CONNECTED;
+    if (route.kind != XiSlotRoute::Kind::Emulated)
+        return pfn_XInputGetBatteryInformation(route.physical, devType, pBatteryInformation);
 
     *pBatteryInformation = {};
 
@@ -150,11 +159,12 @@ XI_API_FUNC DWORD WINAPI XInputGetCapabilities(
 ) WIN_NOEXCEPT {
     EnsureDllInit();
 
-    SrwSharedLock lock(gXiGamepadsLock);
-
     //LOG_DEBUG(L"caps {}", dwUserIndex);
-    if (!gXiGamepadsEnabled[dwUserIndex])
-        return pfn_XInputGetCapabilities(dwUserIndex, dwFlags, pCapabilities);
+    auto route = GetSlotRoute(dwUserIndex);
+    if (route.kind == XiSlotRoute::Kind::Disconnected)
+        return ERROR_DEVICE_NOT_CONNECTED;
+    if (route.kind == XiSlotRoute::Kind::Physical)
+        return pfn_XInputGetCapabilities(route.physical, dwFlags, pCapabilities);
 
     *pCapabilities = {};
 
@@ -176,6 +186,7 @@ XI_API_FUNC DWORD WINAPI XInputGetCapabilities(
     return ERROR_SUCCESS;
 }
 
+// Safe to call from several game threads at once: concurrent calls for the same slot take turns reading its queue, see XiKeystrokeQueue::TryPop()
 XI_API_FUNC DWORD WINAPI XInputGetKeystroke(
     _In_ DWORD dwUserIndex,
     _Reserved_ DWORD dwReserved,
@@ -183,16 +194,55 @@ XI_API_FUNC DWORD WINAPI XInputGetKeystroke(
 ) WIN_NOEXCEPT {
     EnsureDllInit();
 
-    SrwSharedLock lock(gXiGamepadsLock);
-
     //LOG_DEBUG(L"keystroke {}", dwUserIndex);
-    if (!gXiGamepadsEnabled[dwUserIndex])
-        return pfn_XInputGetKeystroke(dwUserIndex, dwReserved, pKeystroke);
+    if (dwUserIndex == XUSER_INDEX_ANY) {
+        // Start from a different slot each call, so that a busy gamepad can't starve the others
+        static std::atomic<DWORD> nextStart = 0;
+        DWORD start = nextStart.fetch_add(1, std::memory_order_relaxed);
+
+        DWORD res = ERROR_DEVICE_NOT_CONNECTED;
+        for (DWORD i = 0; i < XUSER_MAX_COUNT; ++i) {
+            DWORD userIndex = (start + i) % XUSER_MAX_COUNT;
+            auto route = GetSlotRoute(userIndex);
+            if (route.kind == XiSlotRoute::Kind::Emulated || route.kind == XiSlotRoute::Kind::Merged) {
+                if (gXiKeystrokeQueues[userIndex].TryPop(*pKeystroke))
+                    return ERROR_SUCCESS;
+                res = ERROR_EMPTY;
+            }
+            if (route.kind == XiSlotRoute::Kind::Physical || route.kind == XiSlotRoute::Kind::Merged) {
+                // Asking the system for each routed controller individually, instead of XUSER_INDEX_ANY, so that hidden controllers stay hidden
+                // and keystrokes report the slot the game knows the controller by
+                DWORD sysRes = pfn_XInputGetKeystroke(route.physical, dwReserved, pKeystroke);
+                if (sysRes == ERROR_SUCCESS) {
+                    pKeystroke->UserIndex = static_cast<BYTE>(userIndex);
+                    return ERROR_SUCCESS;
+                }
+                if (sysRes == ERROR_EMPTY)
+                    res = ERROR_EMPTY;
+            }
+        }
+
+        *pKeystroke = {};
+        return res;
+    }
 
-    // TODO this would require us to maintain a list of input events
-    //      I don't think many games actually use this?
-    *pKeystroke = {};
+    if (dwUserIndex >= XUSER_MAX_COUNT)
+        return ERROR_BAD_ARGUMENTS;
+
+    auto route = GetSlotRoute(dwUserIndex);
+    if (route.kind == XiSlotRoute::Kind::Disconnected)
+        return ERROR_DEVICE_NOT_CONNECTED;
+    if (route.kind != XiSlotRoute::Kind::Physical && gXiKeystrokeQueues[dwUserIndex].TryPop(*pKeystroke))
+        return ERROR_SUCCESS;
+    if (route.kind != XiSlotRoute::Kind::Emulated) {
+        DWORD sysRes = pfn_XInputGetKeystroke(route.physical, dwReserved, pKeystroke);
+        if (sysRes == ERROR_SUCCESS)
+            pKeystroke->UserIndex = static_cast<BYTE>(dwUserIndex);
+        if (sysRes != ERROR_DEVICE_NOT_CONNECTED || route.kind == XiSlotRoute::Kind::Physical)
+            return sysRes;
+    }
 
+    *pKeystroke = {};
     return ERROR_EMPTY;
 }
 
@@ -202,17 +252,22 @@ XI_API_FUNC DWORD WINAPI XInputGetState(
 ) WIN_NOEXCEPT {
     EnsureDllInit();
 
-    SrwSharedLock lock(gXiGamepadsLock);
-
     //LOG_DEBUG(L"get state {}", dwUserIndex);
-    if (!gXiGamepadsEnabled[dwUserIndex])
-        return pfn_XInputGetState(dwUserIndex, pState);
-
-    *pState = {};
-
-    const auto& dev = gXiGamepads[dwUserIndex];
-    pState->dwPacketNumber = dev.epoch;
-    pState->Gamepad = dev.ComputeXInputGamepad();
+    auto route = GetSlotRoute(dwUserIndex);
+    switch (route.kind) {
+    case XiSlotRoute::Kind::Physical:
+        return pfn_XInputGetState(route.physical, pState);
+    case XiSlotRoute::Kind::Disconnected:
+        return ERROR_DEVICE_NOT_CONNECTED;
+    case XiSlotRoute::Kind::Emulated:
+        // Lock-free: this is polled every frame, possibly from several game threads at once
+        *pState = gXiGamepadsPublished[dwUserIndex].Read();
+        break;
+    case XiSlotRoute::Kind::Merged:
+        // The physical state is the one the input thread polled last, so this is no slower than an emulated slot
+        *pState = MergeStates(gXiGamepadsPublished[dwUserIndex].Read(), gXiPhysicalGamepads[route.physical].cell.Load());
+        break;
+    }
 
     return ERROR_SUCCESS;
 }
@@ -223,11 +278,13 @@ XI_API_FUNC DWORD WINAPI XInputSetState(
 ) WIN_NOEXCEPT {
     EnsureDllInit();
 
-    SrwSharedLock lock(gXiGamepadsLock);
-
     //LOG_DEBUG(L"set state {}", dwUserIndex);
-    if (!gXiGamepadsEnabled[dwUserIndex])
-        return pfn_XInputSetState(dwUserIndex, pVibration);
+    auto route = GetSlotRoute(dwUserIndex);
+    if (route.kind == XiSlotRoute::Kind::Disconnected)
+        return ERROR_DEVICE_NOT_CONNECTED;
+    // A merged slot rumbles its physical controller
+    if (route.kind != XiSlotRoute::Kind::Emulated)
+        return pfn_XInputSetState(route.physical, pVibration);
 
     // Ignore all vibration states, as we don't really have a way to make keyboards and mouse vibrate :P
     // NOTE: the application shouldn't be calling this function anyways, because we specified in XINPUT_CAPABILITIES.Flags that we don't support vibration
@@ -236,6 +293,7 @@ XI_API_FUNC DWORD WINAPI XInputSetState(
     return ERROR_SUCCESS;
 }
 
+#ifdef _WIN32
 BOOL APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID lpReserved) noexcept {
     switch (fdwReason) {
     case DLL_PROCESS_ATTACH:
@@ -253,3 +311,9 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID lpReserved) noexc
     }
     return TRUE;
 }
+#else
+// No DllMain() outside of Windows, run the same setup when the shared library is loaded
+__attribute__((constructor)) static void SharedLibraryInit() {
+    InitKeyCodeConv();
+}
+#endif
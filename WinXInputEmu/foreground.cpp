@@ -0,0 +1,104 @@
+#include "pch.h"
+
+#include "foreground.h"
+
+#include <algorithm>
+
+ForegroundTracker* ForegroundTracker::sActive = nullptr;
+
+bool ForegroundTracker::Start() {
+    if (sActive) {
+        LOG(Input, Error, L"Only one foreground tracker can run at a time");
+        return false;
+    }
+
+    threadId = GetCurrentThreadId();
+    // Of every process: losing the foreground to another process is what this is about
+    foregroundHook = SetWinEventHook(EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND, nullptr, &WinEventProc, 0, 0, WINEVENT_OUTOFCONTEXT);
+    // EVENT_OBJECT_DESTROY, _SHOW and _HIDE, of this process only and skipping the config window's own thread
+    windowHook = SetWinEventHook(EVENT_OBJECT_DESTROY, EVENT_OBJECT_HIDE, nullptr, &WinEventProc, GetCurrentProcessId(), 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNTHREAD);
+    if (!foregroundHook || !windowHook) {
+        LOG(Input, Error, L"Error setting WinEvent hooks: {}", GetLastErrorStr());
+        Stop();
+        return false;
+    }
+    sActive = this;
+
+    // Hooks only report changes, pick up whatever is there already
+    EnumWindows(&EnumWindowsProc, reinterpret_cast<LPARAM>(this));
+    UpdateForeground(GetForegroundWindow());
+    return true;
+}
+
+void ForegroundTracker::Stop() {
+    if (foregroundHook) {
+        UnhookWinEvent(foregroundHook);
+        foregroundHook = nullptr;
+    }
+    if (windowHook) {
+        UnhookWinEvent(windowHook);
+        windowHook = nullptr;
+    }
+    if (sActive == this)
+        sActive = nullptr;
+    hostWindows.clear();
+    foregroundHostWindow = nullptr;
+}
+
+bool ForegroundTracker::IsHostWindow(HWND hwnd) const noexcept {
+    if (!hwnd || GetAncestor(hwnd, GA_ROOT) != hwnd)
+        return false;
+    DWORD processId = 0;
+    DWORD windowThreadId = GetWindowThreadProcessId(hwnd, &processId);
+    return processId == GetCurrentProcessId() && windowThreadId != threadId;
+}
+
+void ForegroundTracker::UpdateForeground(HWND foreground) {
+    // Dialogs and popups count as their owner, e.g. a game's own settings dialog
+    HWND root = foreground ? GetAncestor(foreground, GA_ROOTOWNER) : nullptr;
+    HWND host = IsHostWindow(root) ? root : nullptr;
+    if (host == foregroundHostWindow) return;
+
+    foregroundHostWindow = host;
+    if (onForegroundChanged)
+        onForegroundChanged();
+}
+
+BOOL CALLBACK ForegroundTracker::EnumWindowsProc(HWND hwnd, LPARAM lParam) noexcept {
+    auto self = reinterpret_cast<ForegroundTracker*>(lParam);
+    if (IsWindowVisible(hwnd) && self->IsHostWindow(hwnd))
+        self->hostWindows.push_back(hwnd);
+    return true;
+}
+
+void CALLBACK ForegroundTracker::WinEventProc(HWINEVENTHOOK hook, DWORD event, HWND hwnd, LONG idObject, LONG idChild, DWORD idEventThread, DWORD dwmsEventTime) noexcept {
+    auto self = sActive;
+    if (!self) return;
+
+    if (event == EVENT_SYSTEM_FOREGROUND) {
+        self->UpdateForeground(hwnd);
+        return;
+    }
+
+    // Only whole windows, not the objects (carets, scroll bars, etc.) inside them
+    if (!hwnd || idObject != OBJID_WINDOW || idChild != CHILDID_SELF) return;
+
+    auto& list = self->hostWindows;
+    auto iter = std::find(list.begin(), list.end(), hwnd);
+    switch (event) {
+    case EVENT_OBJECT_SHOW: {
+        if (iter == list.end() && self->IsHostWindow(hwnd))
+            list.push_back(hwnd);
+    } break;
+
+    case EVENT_OBJECT_HIDE:
+    case EVENT_OBJECT_DESTROY: {
+        if (iter == list.end()) break;
+        list.erase(iter);
+        if (event == EVENT_OBJECT_DESTROY && self->onWindowDestroyed)
+            self->onWindowDestroyed(hwnd);
+        if (self->foregroundHostWindow == hwnd)
+            self->UpdateForeground(GetForegroundWindow());
+    } break;
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+// Follows the top-level windows of the host process, and whether one of them is in the foreground, through WinEvent hooks
+// Nothing is polled: the hooks are out of context, so their callbacks run on the thread that called Start(), whenever it pumps messages.
+// Windows of that thread itself (i.e. the config window) don't count as host windows.
+class ForegroundTracker {
+public:
+    // Called whenever HostInForeground() or ForegroundHostWindow() changes
+    std::function<void()> onForegroundChanged;
+    // Called after a host window went away, e.g. to stop using it as the game window
+    std::function<void(HWND)> onWindowDestroyed;
+
+    ~ForegroundTracker() { Stop(); }
+
+    bool Start();
+    void Stop();
+
+    bool HostInForeground() const noexcept { return foregroundHostWindow != nullptr; }
+    // The top-level host window that is, or owns, the foreground window; nullptr if some other process (or the config window) is in the foreground
+    HWND ForegroundHostWindow() const noexcept { return foregroundHostWindow; }
+    // Visible top-level windows of the host process, in the order they appeared
+    const std::vector<HWND>& HostWindows() const noexcept { return hostWindows; }
+
+private:
+    static void CALLBACK WinEventProc(HWINEVENTHOOK hook, DWORD event, HWND hwnd, LONG idObject, LONG idChild, DWORD idEventThread, DWORD dwmsEventTime) noexcept;
+    static BOOL CALLBACK EnumWindowsProc(HWND hwnd, LPARAM lParam) noexcept;
+
+    bool IsHostWindow(HWND hwnd) const noexcept;
+    void UpdateForeground(HWND foreground);
+
+    // Hook procedures have no context pointer, there can only be one running instance
+    static ForegroundTracker* sActive;
+
+    HWINEVENTHOOK foregroundHook = nullptr;
+    HWINEVENTHOOK windowHook = nullptr;
+    DWORD threadId = 0;
+    HWND foregroundHostWindow = nullptr;
+    std::vector<HWND> hostWindows;
+};
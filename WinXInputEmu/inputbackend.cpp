@@ -0,0 +1,478 @@
+#include "pch.h"
+
+#include "inputbackend.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+#ifdef _WIN32
+#include <hidusage.h>
+#endif
+
+#include "clock.h"
+#include "dll.h"
+#include "inputdevice.h"
+#include "inputrecord.h"
+#include "platform.h"
+
+using namespace std::literals;
+
+void InputEventSink::Push(const InputEvent& e) noexcept {
+    if (pending.count == InputEventBatch::kCapacity)
+        Flush();
+    pending.events[pending.count++] = e;
+}
+
+void InputEventSink::Flush() noexcept {
+    if (pending.count == 0) return;
+    // Like the recorder, never block the producer: if the input thread fell this far behind, the events would be stale anyways
+    if (!queue.TryPush(pending))
+        eventsDropped.fetch_add(pending.count, std::memory_order_relaxed);
+    pending.count = 0;
+    if (notify)
+        notify();
+}
+
+bool RawInputBackend::Start(InputEventSink& sink) {
+    RAWINPUTDEVICE rid[2];
+
+    // We don't use RIDEV_NOLEGACY because all the window manipulation (e.g. dragging the title bar) relies on the "legacy messages"
+    // RIDEV_INPUTSINK so that we get input even if the game window is current in focus instead
+    rid[0].usUsagePage = HID_USAGE_PAGE_GENERIC;
+    rid[0].dwFlags = RIDEV_DEVNOTIFY | RIDEV_INPUTSINK;
+    rid[0].usUsage = HID_USAGE_GENERIC_KEYBOARD;
+    rid[0].hwndTarget = hwnd;
+
+    rid[1].usUsagePage = HID_USAGE_PAGE_GENERIC;
+    rid[1].dwFlags = RIDEV_DEVNOTIFY | RIDEV_INPUTSINK;
+    rid[1].usUsage = HID_USAGE_GENERIC_MOUSE;
+    rid[1].hwndTarget = hwnd;
+
+    if (!PlatformRegisterRawInputDevices(rid, std::size(rid))) {
+        LOG(Input, Error, L"Error registering raw input devices: {}", GetLastErrorStr());
+        return false;
+    }
+
+    this->sink = &sink;
+    absolute.Reset();
+    return true;
+}
+
+void RawInputBackend::Stop() {
+    if (!sink) return;
+
+    RAWINPUTDEVICE rid[2];
+    rid[0] = { HID_USAGE_PAGE_GENERIC, HID_USAGE_GENERIC_KEYBOARD, RIDEV_REMOVE, nullptr };
+    rid[1] = { HID_USAGE_PAGE_GENERIC, HID_USAGE_GENERIC_MOUSE, RIDEV_REMOVE, nullptr };
+    PlatformRegisterRawInputDevices(rid, std::size(rid));
+    sink = nullptr;
+}
+
+void RawInputBackend::OnWmInput(HRAWINPUT hri, int64_t time) {
+    if (!sink) return;
+
+    UINT size = 0;
+    PlatformGetRawInputData(hri, nullptr, &size);
+    if (size > rawinputSize || rawinput == nullptr) {
+        rawinput = std::make_unique<std::byte[]>(size);
+        rawinputSize = size;
+    }
+
+    if (PlatformGetRawInputData(hri, rawinput.get(), &size) == (UINT)-1) {
+        LOG(Input, Error, L"GetRawInputData() failed");
+        return;
+    }
+    RAWINPUT* ri = (RAWINPUT*)rawinput.get();
+    HANDLE hDevice = ri->header.hDevice;
+
+    auto key = [&](BYTE vkey, bool pressed) {
+        sink->Push(InputEvent{ .type = InputEvent::Type::Key, .pressed = pressed, .vkey = vkey, .device = hDevice, .time = time });
+    };
+
+    switch (ri->header.dwType) {
+    case RIM_TYPEMOUSE: {
+        const auto& mouse = ri->data.mouse;
+
+        if (mouse.usButtonFlags & RI_MOUSE_LEFT_BUTTON_DOWN) key(VK_LBUTTON, true);
+        if (mouse.usButtonFlags & RI_MOUSE_LEFT_BUTTON_UP) key(VK_LBUTTON, false);
+        if (mouse.usButtonFlags & RI_MOUSE_RIGHT_BUTTON_DOWN) key(VK_RBUTTON, true);
+        if (mouse.usButtonFlags & RI_MOUSE_RIGHT_BUTTON_UP) key(VK_RBUTTON, false);
+        if (mouse.usButtonFlags & RI_MOUSE_MIDDLE_BUTTON_DOWN) key(VK_MBUTTON, true);
+        if (mouse.usButtonFlags & RI_MOUSE_MIDDLE_BUTTON_UP) key(VK_MBUTTON, false);
+        if (mouse.usButtonFlags & RI_MOUSE_BUTTON_4_DOWN) key(VK_XBUTTON1, true);
+        if (mouse.usButtonFlags & RI_MOUSE_BUTTON_4_UP) key(VK_XBUTTON1, false);
+        if (mouse.usButtonFlags & RI_MOUSE_BUTTON_5_DOWN) key(VK_XBUTTON2, true);
+        if (mouse.usButtonFlags & RI_MOUSE_BUTTON_5_UP) key(VK_XBUTTON2, false);
+
+        LONG dx = mouse.lLastX;
+        LONG dy = mouse.lLastY;
+        if (mouse.usFlags & MOUSE_MOVE_ABSOLUTE) {
+            bool isNew = false;
+            bool moved = absolute.Convert(hDevice, mouse.usFlags, mouse.lLastX, mouse.lLastY, time, dx, dy, isNew);
+            if (isNew && time - lastAbsoluteLogTime >= gClock->TicksPerSecond()) {
+                lastAbsoluteLogTime = time;
+                LOG(Input, Info, L"Mouse {} reports absolute coordinates{}, converting them to relative motion", hDevice, mouse.usFlags & MOUSE_VIRTUAL_DESKTOP ? L" over the virtual desktop" : L"");
+            }
+            if (!moved)
+                break;
+        } // else: MOUSE_MOVE_RELATIVE, as is
+
+        sink->Push(InputEvent{ .type = InputEvent::Type::MouseMove, .device = hDevice, .dx = dx, .dy = dy, .time = time });
+    } break;
+
+    case RIM_TYPEKEYBOARD: {
+        const auto& kbd = ri->data.keyboard;
+
+        // This message is a part of a longer makecode sequence -- the actual Vkey is in another one
+        if (kbd.VKey == 0xFF)
+            break;
+        // All of the relevant keys that we support fit in a BYTE
+        if (kbd.VKey > 0xFF)
+            break;
+
+        key((BYTE)kbd.VKey, !(kbd.Flags & RI_KEY_BREAK));
+    } break;
+    }
+
+    // Everything in one WM_INPUT happened at one instant
+    sink->Flush();
+}
+
+void AbsoluteMouseConverter::Reset() noexcept {
+    pointers.clear();
+    pointers.reserve(kMaxPointers);
+    restartTicks = gClock->FromMilliseconds(kRestartAfterMs);
+    UpdateMetrics();
+}
+
+void AbsoluteMouseConverter::UpdateMetrics() noexcept {
+    PlatformGetScreenSizes(primaryWidth, primaryHeight, virtualWidth, virtualHeight);
+}
+
+bool AbsoluteMouseConverter::Convert(HANDLE device, USHORT flags, LONG x, LONG y, int64_t time, LONG& dx, LONG& dy, bool& isNew) noexcept {
+    auto iter = std::find_if(pointers.begin(), pointers.end(), [&](const Pointer& p) { return p.device == device; });
+    isNew = iter == pointers.end();
+    if (isNew) {
+        if (pointers.size() == kMaxPointers) {
+            auto oldest = std::min_element(pointers.begin(), pointers.end(), [](const Pointer& a, const Pointer& b) { return a.lastTime < b.lastTime; });
+            pointers.erase(oldest);
+        }
+        pointers.push_back({ .device = device, .lastX = x, .lastY = y, .residualX = 0, .residualY = 0, .lastTime = time, .wrapsX = false, .wrapsY = false });
+        return false;
+    }
+
+    auto& p = *iter;
+    // Normalized units moved along one axis; false for a jump
+    auto axisDelta = [](int32_t last, int32_t curr, bool& wraps, int32_t& d) {
+        d = curr - last;
+        if (d <= kWrapThreshold && d >= -kWrapThreshold)
+            return true;
+        if (std::min(last, curr) < kWrapEdgeMargin && std::max(last, curr) > 0xFFFF - kWrapEdgeMargin)
+            wraps = true;
+        if (!wraps)
+            return false;
+        d += d > 0 ? -0x10000 : 0x10000;
+        return true;
+    };
+
+    bool moved = false;
+    int32_t unitsX, unitsY;
+    // Both checked, so that either axis can learn that the device wraps
+    bool isMotionX = axisDelta(p.lastX, x, p.wrapsX, unitsX);
+    bool isMotionY = axisDelta(p.lastY, y, p.wrapsY, unitsY);
+    if (time - p.lastTime >= restartTicks || !isMotionX || !isMotionY) {
+        p.residualX = 0;
+        p.residualY = 0;
+    }
+    else {
+        bool virtualDesktop = flags & MOUSE_VIRTUAL_DESKTOP;
+        // Normalized units to 1/65536 pixels is a multiplication by the pixel size of the area
+        p.residualX += static_cast<int64_t>(unitsX) * (virtualDesktop ? virtualWidth : primaryWidth);
+        p.residualY += static_cast<int64_t>(unitsY) * (virtualDesktop ? virtualHeight : primaryHeight);
+        dx = static_cast<LONG>(p.residualX / 0x10000);
+        dy = static_cast<LONG>(p.residualY / 0x10000);
+        p.residualX -= static_cast<int64_t>(dx) * 0x10000;
+        p.residualY -= static_cast<int64_t>(dy) * 0x10000;
+        moved = dx != 0 || dy != 0;
+    }
+    p.lastX = x;
+    p.lastY = y;
+    p.lastTime = time;
+    return moved;
+}
+
+#ifdef _WIN32
+
+HookInputBackend* HookInputBackend::sActive = nullptr;
+
+bool HookInputBackend::Start(InputEventSink& sink) {
+    if (sActive) {
+        LOG(Input, Error, L"Low level hooks are already in use");
+        return false;
+    }
+    sActive = this;
+    this->sink = &sink;
+    hasCursorPos = false;
+    warped.store(false, std::memory_order_relaxed);
+    std::fill(std::begin(blockedDown), std::end(blockedDown), 0);
+
+    // 0 while starting, then 1 if the hooks are in, -1 if not
+    std::atomic<int> startResult = 0;
+    thread = std::thread(&HookInputBackend::ThreadMain, this, std::ref(startResult));
+    startResult.wait(0);
+    if (startResult.load() < 0) {
+        thread.join();
+        sActive = nullptr;
+        this->sink = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void HookInputBackend::Stop() {
+    if (!thread.joinable()) return;
+
+    PostThreadMessageW(threadId, WM_QUIT, 0, 0);
+    thread.join();
+    sActive = nullptr;
+    sink = nullptr;
+}
+
+void HookInputBackend::ThreadMain(std::atomic<int>& startResult) {
+    threadId = GetCurrentThreadId();
+    // Make sure the thread has a message queue before anyone can post WM_QUIT to it
+    MSG msg;
+    PeekMessageW(&msg, nullptr, WM_USER, WM_USER, PM_NOREMOVE);
+
+    HHOOK kbdHook = SetWindowsHookExW(WH_KEYBOARD_LL, KeyboardProc, gHModule, 0);
+    HHOOK mouseHook = SetWindowsHookExW(WH_MOUSE_LL, MouseProc, gHModule, 0);
+    if (!kbdHook || !mouseHook) {
+        LOG(Input, Error, L"Error installing low level hooks: {}", GetLastErrorStr());
+        if (kbdHook) UnhookWindowsHookEx(kbdHook);
+        if (mouseHook) UnhookWindowsHookEx(mouseHook);
+        startResult = -1;
+        startResult.notify_one();
+        return;
+    }
+    startResult = 1;
+    startResult.notify_one();
+
+    // Hooks are called from inside GetMessageW()
+    while (GetMessageW(&msg, nullptr, 0, 0) > 0) {
+        TranslateMessage(&msg);
+        DispatchMessageW(&msg);
+    }
+
+    UnhookWindowsHookEx(kbdHook);
+    UnhookWindowsHookEx(mouseHook);
+}
+
+// Each hook call is delivered on its own, with nothing to tell whether another one follows right away; they're flushed one by one so nothing waits for the next event
+// Windows unhooks procedures that take too long (LowLevelHooksTimeout), so these must do nothing but hand the event over and look up `suppression`
+
+bool HookInputBackend::OnKey(BYTE vkey, bool pressed, int64_t time) noexcept {
+    sink->Push(InputEvent{ .type = InputEvent::Type::Key, .pressed = pressed, .vkey = vkey, .device = nullptr, .time = time });
+
+    // A release is swallowed if and only if its press was, whatever the map says now, so the game never sees a key stuck down or a stray release
+    uint64_t bit = 1ull << (vkey % 64);
+    auto& blocked = blockedDown[vkey / 64];
+    if (pressed) {
+        if (!suppression.BlocksKey(vkey)) return false;
+        blocked |= bit;
+        return true;
+    }
+    bool block = blocked & bit;
+    blocked &= ~bit;
+    return block;
+}
+
+LRESULT CALLBACK HookInputBackend::KeyboardProc(int nCode, WPARAM wParam, LPARAM lParam) noexcept {
+    if (nCode == HC_ACTION && sActive) {
+        const auto& kbd = *reinterpret_cast<const KBDLLHOOKSTRUCT*>(lParam);
+        if (kbd.vkCode <= 0xFF) {
+            bool pressed = wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN;
+            bool block = sActive->OnKey(static_cast<BYTE>(kbd.vkCode), pressed, gClock->Now());
+            sActive->sink->Flush();
+            if (block)
+                return 1;
+        }
+    }
+    return CallNextHookEx(nullptr, nCode, wParam, lParam);
+}
+
+void HookInputBackend::OnCursorWarped(POINT pos) noexcept {
+    warpedTo.store(static_cast<uint64_t>(static_cast<uint32_t>(pos.x)) << 32 | static_cast<uint32_t>(pos.y), std::memory_order_relaxed);
+    warped.store(true, std::memory_order_release);
+}
+
+LRESULT CALLBACK HookInputBackend::MouseProc(int nCode, WPARAM wParam, LPARAM lParam) noexcept {
+    if (nCode != HC_ACTION || !sActive)
+        return CallNextHookEx(nullptr, nCode, wParam, lParam);
+
+    auto& self = *sActive;
+    const auto& mouse = *reinterpret_cast<const MSLLHOOKSTRUCT*>(lParam);
+    int64_t time = gClock->Now();
+    bool block = false;
+
+    switch (wParam) {
+    case WM_MOUSEMOVE: {
+        // Moves queued before the warp get rebased too, that's a one-off error of a few counts at worst
+        if (self.warped.exchange(false, std::memory_order_acquire)) {
+            uint64_t packed = self.warpedTo.load(std::memory_order_relaxed);
+            self.lastCursorPos = { static_cast<LONG>(static_cast<int32_t>(packed >> 32)), static_cast<LONG>(static_cast<int32_t>(packed)) };
+            self.hasCursorPos = true;
+        }
+        if (self.hasCursorPos) {
+            LONG dx = mouse.pt.x - self.lastCursorPos.x;
+            LONG dy = mouse.pt.y - self.lastCursorPos.y;
+            if (dx != 0 || dy != 0)
+                self.sink->Push(InputEvent{ .type = InputEvent::Type::MouseMove, .device = nullptr, .dx = dx, .dy = dy, .time = time });
+        }
+        // A swallowed move leaves the cursor where it was, which is what the next position is relative to
+        block = self.suppression.BlocksMouseMotion();
+        if (!block || !self.hasCursorPos) {
+            self.lastCursorPos = mouse.pt;
+            self.hasCursorPos = true;
+        }
+    } break;
+
+    case WM_LBUTTONDOWN: block = self.OnKey(VK_LBUTTON, true, time); break;
+    case WM_LBUTTONUP: block = self.OnKey(VK_LBUTTON, false, time); break;
+    case WM_RBUTTONDOWN: block = self.OnKey(VK_RBUTTON, true, time); break;
+    case WM_RBUTTONUP: block = self.OnKey(VK_RBUTTON, false, time); break;
+    case WM_MBUTTONDOWN: block = self.OnKey(VK_MBUTTON, true, time); break;
+    case WM_MBUTTONUP: block = self.OnKey(VK_MBUTTON, false, time); break;
+    case WM_XBUTTONDOWN:
+    case WM_XBUTTONUP:
+        block = self.OnKey(HIWORD(mouse.mouseData) == XBUTTON1 ? VK_XBUTTON1 : VK_XBUTTON2, wParam == WM_XBUTTONDOWN, time);
+        break;
+    }
+
+    self.sink->Flush();
+    if (block)
+        return 1;
+    return CallNextHookEx(nullptr, nCode, wParam, lParam);
+}
+
+#endif
+
+bool ReplayInputBackend::Start(InputEventSink& sink) {
+    auto error = LoadRecordedInput(path, events, ticksPerSecond);
+    if (!error.empty()) {
+        LOG(Input, Error, L"Cannot load {} for the replay input backend: {}", path.wstring(), Utf8ToWide(error));
+        return false;
+    }
+    if (events.empty()) {
+        LOG(Input, Warning, L"{} has no key or mouse events to replay", path.wstring());
+        return false;
+    }
+
+    stopRequested = false;
+    thread = std::thread(&ReplayInputBackend::ThreadMain, this, std::ref(sink));
+    return true;
+}
+
+void ReplayInputBackend::Stop() {
+    if (!thread.joinable()) return;
+    stopRequested = true;
+    thread.join();
+}
+
+void ReplayInputBackend::ThreadMain(InputEventSink& sink) {
+    // The first event happens right away, the rest keep their recorded spacing, both in real time and on gClock
+    using Clock = std::chrono::steady_clock;
+    auto wallStart = Clock::now();
+    int64_t clockStart = gClock->Now();
+    int64_t recordedStart = events.front().time;
+    double clockTicksPerRecordedTick = static_cast<double>(gClock->TicksPerSecond()) / static_cast<double>(ticksPerSecond);
+
+    size_t i = 0;
+    while (i < events.size() && !stopRequested.load(std::memory_order_relaxed)) {
+        auto e = events[i];
+        double seconds = static_cast<double>(e.time - recordedStart) / static_cast<double>(ticksPerSecond);
+        auto due = wallStart + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+        auto now = Clock::now();
+        if (now < due) {
+            // Everything up to now is one burst
+            sink.Flush();
+            // Bounded, to notice Stop() during long pauses
+            std::this_thread::sleep_until(std::min(due, now + 100ms));
+            continue;
+        }
+
+        e.time = clockStart + std::llround(static_cast<double>(e.time - recordedStart) * clockTicksPerRecordedTick);
+        sink.Push(e);
+        ++i;
+    }
+    sink.Flush();
+
+    LOG(Input, Info, L"Replay input backend finished, {} events", i);
+}
+
+bool SyntheticInputBackend::Start(InputEventSink& sink) {
+    stopRequested = false;
+    thread = std::thread(&SyntheticInputBackend::ThreadMain, this, std::ref(sink));
+    return true;
+}
+
+void SyntheticInputBackend::Stop() {
+    if (!thread.joinable()) return;
+    stopRequested = true;
+    thread.join();
+}
+
+void SyntheticInputBackend::ThreadMain(InputEventSink& sink) {
+    // Keys that are commonly bound, so that the events actually reach the translation logic's interesting paths
+    constexpr BYTE kKeys[] = {
+        'W', 'A', 'S', 'D', 'Q', 'E', 'R', 'F', 'C', 'X', 'Z',
+        '1', '2', '3', '4',
+        VK_SPACE, VK_LSHIFT, VK_LCONTROL, VK_TAB, VK_ESCAPE,
+        VK_UP, VK_DOWN, VK_LEFT, VK_RIGHT,
+        VK_LBUTTON, VK_RBUTTON, VK_MBUTTON, VK_XBUTTON1, VK_XBUTTON2,
+    };
+    constexpr int kMaxMouseDelta = 20;
+    // Generate in bursts of about this long, like a real device would deliver
+    constexpr auto kBurstInterval = 1ms;
+
+    // std::mt19937 output is specified exactly, distributions aren't: keep to the raw numbers so that a seed gives the same sequence with any standard library
+    std::mt19937 rng(seed);
+    auto pickKey = [&]() { return kKeys[rng() % std::size(kKeys)]; };
+    auto pickDelta = [&]() { return static_cast<LONG>(rng() % (2 * kMaxMouseDelta + 1)) - kMaxMouseDelta; };
+    auto pickMouseMove = [&]() { return (rng() & 1) != 0; };
+    bool held[0x100] = {};
+
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    uint64_t emitted = 0;
+    while (!stopRequested.load(std::memory_order_relaxed)) {
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        auto target = static_cast<uint64_t>(seconds * eventsPerSecond);
+        // Don't try to catch up on a backlog, e.g. after the thread didn't get scheduled for a while
+        target = std::min<uint64_t>(target, emitted + std::max(eventsPerSecond / 10, 1));
+
+        int64_t now = gClock->Now();
+        for (; emitted < target; ++emitted) {
+            if (pickMouseMove()) {
+                sink.Push(InputEvent{ .type = InputEvent::Type::MouseMove, .device = MouseHandle(), .dx = pickDelta(), .dy = pickDelta(), .time = now });
+            }
+            else {
+                BYTE vkey = pickKey();
+                held[vkey] = !held[vkey];
+                sink.Push(InputEvent{ .type = InputEvent::Type::Key, .pressed = held[vkey], .vkey = vkey, .device = IsKeyCodeMouseButton(vkey) ? MouseHandle() : KeyboardHandle(), .time = now });
+            }
+        }
+        sink.Flush();
+
+        std::this_thread::sleep_for(kBurstInterval);
+    }
+
+    // Don't leave anything held down
+    int64_t now = gClock->Now();
+    for (int vkey = 0; vkey < 0x100; ++vkey) {
+        if (held[vkey])
+            sink.Push(InputEvent{ .type = InputEvent::Type::Key, .pressed = false, .vkey = static_cast<BYTE>(vkey), .device = IsKeyCodeMouseButton(static_cast<BYTE>(vkey)) ? MouseHandle() : KeyboardHandle(), .time = now });
+    }
+    sink.Flush();
+}
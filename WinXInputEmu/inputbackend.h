@@ -0,0 +1,255 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "platform.h"
+#include "spscring.h"
+
+// One keyboard/mouse event, as handed to the translation core
+struct InputEvent {
+    enum class Type : uint8_t {
+        // Keyboard keys and mouse buttons
+        Key,
+        // Relative mouse motion
+        MouseMove,
+    };
+
+    Type type;
+    bool pressed;
+    BYTE vkey;
+    // What device filters compare against; nullptr if the backend can't tell devices apart
+    HANDLE device;
+    LONG dx, dy;
+    // gClock reading of when the event happened
+    int64_t time;
+};
+
+struct InputEventBatch {
+    static constexpr uint32_t kCapacity = 32;
+
+    uint32_t count;
+    InputEvent events[kCapacity];
+};
+
+// Where a backend puts its events, drained by the input thread
+// Events are grouped into batches on the producer side and only published as a whole, so that the queue is touched once per burst instead of once per event.
+// Each sink has exactly one producer (the backend) and one consumer (the input thread), which may be the same thread.
+struct InputEventSink {
+    SpscRing<InputEventBatch, 256> queue;
+    // Called by the producer after each published batch, e.g. to wake up the consumer
+    // Set up before the backend starts
+    std::function<void()> notify;
+    std::atomic<uint64_t> eventsDropped = 0;
+
+    // Producer side
+    // Publishes the pending batch first if it's full
+    void Push(const InputEvent& e) noexcept;
+    // Publishes the pending batch, call at the end of each burst of events
+    void Flush() noexcept;
+
+private:
+    InputEventBatch pending = {};
+};
+
+// Something that produces keyboard/mouse events
+// Start() and Stop() are called from the input thread; what thread the events are produced on is up to the backend.
+class InputBackend {
+public:
+    virtual ~InputBackend() = default;
+
+    virtual std::wstring_view Name() const noexcept = 0;
+    // Returns false if the backend can't run, in which case nothing is pushed into `sink`
+    // `sink` must outlive the backend, or until Stop()
+    virtual bool Start(InputEventSink& sink) = 0;
+    virtual void Stop() = 0;
+};
+
+// Which input the hook backend swallows, so that the game doesn't also see what drives a gamepad
+// Written by the input thread whenever bindings change, read by the hook thread: each decision is one relaxed load and a bit test
+struct SuppressionMap {
+    // Bit per VK_xxx, keyboard keys and mouse buttons alike
+    std::atomic<uint64_t> keys[0x100 / 64] = {};
+    std::atomic<bool> mouseMotion = false;
+
+    bool BlocksKey(BYTE vkey) const noexcept { return keys[vkey / 64].load(std::memory_order_relaxed) & (1ull << (vkey % 64)); }
+    bool BlocksMouseMotion() const noexcept { return mouseMotion.load(std::memory_order_relaxed); }
+};
+
+enum class InputBackendType {
+    // WM_INPUT, on the input thread
+    RawInput,
+    // WH_KEYBOARD_LL and WH_MOUSE_LL hooks, on their own thread
+    Hooks,
+    // Plays back the keyboard/mouse events of a recording (see inputrecord.h)
+    Replay,
+    // Random key presses and mouse motion
+    Synthetic,
+};
+
+// Turns absolute mouse positions into relative motion, per device
+// Remote desktop, streaming and VM software and pen tablets send positions instead of motion: normalized to 0..65535 over the primary monitor,
+// or over the whole virtual desktop with MOUSE_VIRTUAL_DESKTOP. Motion comes out in pixels of that area, as if from a relative mouse with no acceleration.
+struct AbsoluteMouseConverter {
+    // Positions further apart than half the range are a jump, not motion: the device starts over from the new position (e.g. a pen put down elsewhere, a remote desktop teleporting the pointer)
+    // Except on an axis where the device has wrapped around before, as software that keeps the pointer moving endlessly does; there it's motion across the edge
+    static constexpr int32_t kWrapThreshold = 0x8000;
+    // A device has wrapped around once two consecutive positions are this close to opposite edges
+    static constexpr int32_t kWrapEdgeMargin = 0x800;
+    // A device quiet for this long starts over from its next position, e.g. a pen lifted and put down elsewhere
+    static constexpr int kRestartAfterMs = 250;
+    // Beyond this many devices, the one heard from least recently is forgotten
+    static constexpr size_t kMaxPointers = 16;
+
+    struct Pointer {
+        HANDLE device;
+        int32_t lastX;
+        int32_t lastY;
+        // Sub-pixel motion not reported yet, in 1/65536 pixels
+        int64_t residualX;
+        int64_t residualY;
+        int64_t lastTime;
+        // Per axis, whether the device was seen wrapping around, see kWrapThreshold
+        bool wrapsX;
+        bool wrapsY;
+    };
+    // Few enough that a linear search beats anything fancier
+    std::vector<Pointer> pointers;
+    // Pixel sizes of the areas positions are normalized over
+    int32_t primaryWidth = 0;
+    int32_t primaryHeight = 0;
+    int32_t virtualWidth = 0;
+    int32_t virtualHeight = 0;
+    int64_t restartTicks = 0;
+
+    void Reset() noexcept;
+    // Call whenever display settings change
+    void UpdateMetrics() noexcept;
+    // `flags` is RAWMOUSE::usFlags; returns false if there is no motion to report, e.g. for the first position of a device
+    // `isNew` is set if the device wasn't being tracked
+    bool Convert(HANDLE device, USHORT flags, LONG x, LONG y, int64_t time, LONG& dx, LONG& dy, bool& isNew) noexcept;
+};
+
+// Registers for WM_INPUT on `hwnd`, whose window procedure must call OnWmInput()
+// Events are produced on the window's thread, i.e. the input thread.
+class RawInputBackend : public InputBackend {
+public:
+    explicit RawInputBackend(HWND hwnd) noexcept : hwnd{ hwnd } {}
+
+    std::wstring_view Name() const noexcept override { return L"Raw input"; }
+    bool Start(InputEventSink& sink) override;
+    void Stop() override;
+
+    // `time` is the gClock reading the message is handled at
+    void OnWmInput(HRAWINPUT hri, int64_t time);
+    // For WM_DISPLAYCHANGE, absolute positions are relative to the screen size
+    void OnDisplayChange() noexcept { absolute.UpdateMetrics(); }
+
+private:
+    HWND hwnd;
+    InputEventSink* sink = nullptr;
+    AbsoluteMouseConverter absolute;
+    // Of the last "absolute coordinates" diagnostic, to keep devices coming and going from flooding the log
+    int64_t lastAbsoluteLogTime = INT64_MIN;
+    // For a RAWINPUT*
+    std::unique_ptr<std::byte[]> rawinput;
+    size_t rawinputSize = 0;
+};
+
+#ifdef _WIN32
+
+// Low level hooks see input before any application does, including input that raw input misses, e.g. some remote desktop and injected input.
+// They can't tell devices apart, so events have no device and gamepads with a keyboard/mouse filter won't see them.
+// Mouse motion is derived from cursor positions, so it's subject to pointer acceleration and stops at the edges of the screen (or of ClipCursor()).
+// It's also the only backend that can keep input from reaching the game, see `suppression`: input swallowed by a low level hook doesn't reach raw input either.
+class HookInputBackend : public InputBackend {
+public:
+    // Every event is still handed to the sink, swallowed or not
+    SuppressionMap suppression;
+
+    ~HookInputBackend() override { Stop(); }
+
+    std::wstring_view Name() const noexcept override { return L"Low level hooks"; }
+    bool Start(InputEventSink& sink) override;
+    void Stop() override;
+
+    // Call after SetCursorPos(), which doesn't go through the hook: the next move is taken relative to `pos` instead of where the cursor was before
+    // Any thread
+    void OnCursorWarped(POINT pos) noexcept;
+
+private:
+    static LRESULT CALLBACK KeyboardProc(int nCode, WPARAM wParam, LPARAM lParam) noexcept;
+    static LRESULT CALLBACK MouseProc(int nCode, WPARAM wParam, LPARAM lParam) noexcept;
+    void ThreadMain(std::atomic<int>& startResult);
+    // Pushes the event, returns true if it should be swallowed
+    bool OnKey(BYTE vkey, bool pressed, int64_t time) noexcept;
+
+    // Hook procedures have no context pointer, there can only be one running instance
+    static HookInputBackend* sActive;
+
+    InputEventSink* sink = nullptr;
+    std::thread thread;
+    DWORD threadId = 0;
+    POINT lastCursorPos = {};
+    bool hasCursorPos = false;
+    // Set by OnCursorWarped(), taken by the hook thread; x in the high half, y in the low half
+    std::atomic<uint64_t> warpedTo = 0;
+    std::atomic<bool> warped = false;
+    // Bit per VK_xxx: the press was swallowed
+    uint64_t blockedDown[0x100 / 64] = {};
+};
+
+#endif
+
+// Plays back the key and mouse motion events of a recording, in real time from when it's started
+// Everything else in the recording (mouse ticks, bindings, filters, states) is ignored: the live configuration applies.
+// Devices are the same fake handles a replay uses, so device filters set up in the UI won't match; recorded filters aren't applied either.
+// Uses no Windows APIs, beyond the handle type.
+class ReplayInputBackend : public InputBackend {
+public:
+    explicit ReplayInputBackend(std::filesystem::path path) : path{ std::move(path) } {}
+    ~ReplayInputBackend() override { Stop(); }
+
+    std::wstring_view Name() const noexcept override { return L"Replay"; }
+    bool Start(InputEventSink& sink) override;
+    void Stop() override;
+
+private:
+    void ThreadMain(InputEventSink& sink);
+
+    std::filesystem::path path;
+    std::vector<InputEvent> events;
+    int64_t ticksPerSecond = 0;
+    std::thread thread;
+    std::atomic<bool> stopRequested = false;
+};
+
+// Presses and releases random keys and moves a mouse randomly, `eventsPerSecond` events in total
+// The sequence only depends on `seed`. Keys come from one fake keyboard and motion from one fake mouse.
+// Uses no Windows APIs, beyond the handle type.
+class SyntheticInputBackend : public InputBackend {
+public:
+    SyntheticInputBackend(int eventsPerSecond, uint32_t seed) noexcept : eventsPerSecond{ eventsPerSecond }, seed{ seed } {}
+    ~SyntheticInputBackend() override { Stop(); }
+
+    std::wstring_view Name() const noexcept override { return L"Synthetic"; }
+    bool Start(InputEventSink& sink) override;
+    void Stop() override;
+
+    static HANDLE KeyboardHandle() noexcept { return reinterpret_cast<HANDLE>(static_cast<uintptr_t>(0x5EED0001)); }
+    static HANDLE MouseHandle() noexcept { return reinterpret_cast<HANDLE>(static_cast<uintptr_t>(0x5EED0002)); }
+
+private:
+    void ThreadMain(InputEventSink& sink);
+
+    int eventsPerSecond;
+    uint32_t seed;
+    std::thread thread;
+    std::atomic<bool> stopRequested = false;
+};
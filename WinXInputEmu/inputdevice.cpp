@@ -6,18 +6,22 @@
 #include <initializer_list>
 #include <unordered_map>
 
-#include <Rpc.h>
+#include "platform.h"
 
 using namespace std::literals;
 
-static std::unordered_map<std::string_view, KeyCode> gStr2Keycode;
+// Function-local so it's constructed before InitKeyCodeConv() fills it, which on Linux runs from a shared library constructor that may come before this file's static initializers
+static std::unordered_map<std::string_view, KeyCode>& Str2Keycode() {
+    static std::unordered_map<std::string_view, KeyCode> map;
+    return map;
+}
 static std::string_view gKeycode2Str[0xFF];
 
 void InitKeyCodeConv() {
     auto add = [](KeyCode keycode, std::initializer_list<std::string_view> names) -> void {
         assert(names.size() >= 1);
         for (const auto& name : names)
-            gStr2Keycode.emplace(name, keycode);
+            Str2Keycode().emplace(name, keycode);
         gKeycode2Str[keycode] = *names.begin();
     };
 
@@ -236,8 +240,9 @@ std::string_view KeyCodeToString(KeyCode key) {
 }
 
 std::optional<KeyCode> KeyCodeFromString(std::string_view str) {
-    auto iter = gStr2Keycode.find(str);
-    if (iter != gStr2Keycode.end())
+    auto& str2Keycode = Str2Keycode();
+    auto iter = str2Keycode.find(str);
+    if (iter != str2Keycode.end())
         return iter->second;
     else
         return {};
@@ -261,24 +266,17 @@ GUID ParseRawInputDeviceGUID(std::wstring_view name) {
     size_t uuidBegin = name.rfind(L'{') + 1;
     size_t uuidEnd = name.rfind(L'}');
     if (uuidBegin == std::wstring_view::npos) {
-        LOG_DEBUG(L"Error parsing RAWINPUT device GUID: cannot find delimitors {{ or }}");
+        LOG(Input, Warning, L"Error parsing RAWINPUT device GUID: cannot find delimitors {{ or }}");
         return {};
     }
     if (uuidEnd - uuidBegin != kUuidLen) {
-        LOG_DEBUG(L"Malformed GUID in RAWINPUT device (incorrect length), name: {}", name);
+        LOG(Input, Warning, L"Malformed GUID in RAWINPUT device (incorrect length), name: {}", name);
         return {};
     }
 
-    // RPC_WSTR uses unsigned short instead of wchar_t/WCHAR for some reason
-    unsigned short buffer[kUuidLen + 1];
-
-    for (size_t it = uuidBegin, i = 0; it != uuidEnd; ++it)
-        buffer[i++] = name[it];
-    buffer[kUuidLen] = L'\0';
-
     GUID result;
-    if (UuidFromStringW(buffer, &result) != RPC_S_OK) {
-        LOG_DEBUG(L"Malformed GUID in RAWINPUT device (UuidFromStringW error), name: {}", name);
+    if (!PlatformParseGuid(name.substr(uuidBegin, kUuidLen), result)) {
+        LOG(Input, Warning, L"Malformed GUID in RAWINPUT device (not a UUID), name: {}", name);
         return {};
     }
 
@@ -300,14 +298,9 @@ IdevDevice IdevDevice::FromHANDLE(HANDLE hDevice) {
 
     res.info = {};
     res.info.cbSize = sizeof(res.info);
-    UINT deviceInfoBytes = sizeof(res.info);
-    GetRawInputDeviceInfoW(hDevice, RIDI_DEVICEINFO, &res.info, &deviceInfoBytes);
+    PlatformGetRawInputDeviceInfo(hDevice, res.info);
 
-    UINT deviceNameLen = 0;
-    GetRawInputDeviceInfoW(hDevice, RIDI_DEVICENAME, NULL, &deviceNameLen);
-    res.nameWide.resize_and_overwrite(
-        deviceNameLen,
-        [&](wchar_t* buf, size_t) { GetRawInputDeviceInfoW(hDevice, RIDI_DEVICENAME, buf, &deviceNameLen); return deviceNameLen; });
+    res.nameWide = PlatformGetRawInputDeviceName(hDevice);
     res.nameUtf8 = WideToUtf8(res.nameWide);
 
     res.guid = ParseRawInputDeviceGUID(res.nameWide);
@@ -316,31 +309,8 @@ IdevDevice IdevDevice::FromHANDLE(HANDLE hDevice) {
 }
 
 void PollInputDevices(std::vector<IdevDevice>& out) {
-    UINT numDevices = 0;
-    RAWINPUTDEVICELIST* devices = nullptr;
-    DEFER{ free(devices); };
-    if (GetRawInputDeviceList(nullptr, &numDevices, sizeof(RAWINPUTDEVICELIST)) != 0)
-        return;
-
-    if (numDevices == 0)
-        return;
-
-    UINT numDevicesSuccessfullyFetched;
-    do {
-        auto newPtr = (RAWINPUTDEVICELIST*)realloc(devices, sizeof(RAWINPUTDEVICELIST) * numDevices);
-        if (newPtr == nullptr)
-            return;
-        else
-            devices = newPtr;
-
-        numDevicesSuccessfullyFetched = GetRawInputDeviceList(devices, &numDevices, sizeof(RAWINPUTDEVICELIST));
-    } while (numDevicesSuccessfullyFetched == (UINT)-1 && GetLastError() == ERROR_INSUFFICIENT_BUFFER);
-
-    if (numDevicesSuccessfullyFetched == (UINT)-1)
-        return;
-
-    for (UINT i = 0; i < numDevicesSuccessfullyFetched; i++) {
-        out.push_back(IdevDevice::FromHANDLE(devices[i].hDevice));
-        LOG_DEBUG("[PollInputDevices()] {} {}", devices[i].dwType, out.back().nameWide);
+    for (const auto& device : PlatformListRawInputDevices()) {
+        out.push_back(IdevDevice::FromHANDLE(device.hDevice));
+        LOG(Input, Debug, "[PollInputDevices()] {} {}", device.dwType, out.back().nameWide);
     }
 }
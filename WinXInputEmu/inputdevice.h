@@ -5,9 +5,7 @@
 #include <string>
 #include <string_view>
 
-#define NOMINMAX
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
+#include "platform.h"
 
 // Win32 Vkey keycode
 using KeyCode = BYTE;
@@ -0,0 +1,688 @@
+#include "pch.h"
+
+#include "inputrecord.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+#include "clock.h"
+#include "platform.h"
+
+using namespace std::literals;
+
+InputRecorder gInputRecorder;
+
+std::filesystem::path GetDesignatedRecordingPath() {
+    return PlatformModuleDirectory() / L"WinXInputEmu.wxirec";
+}
+
+// Varint/zigzag helpers shared by the encoder and decoder
+
+static void PutVarint(std::vector<uint8_t>& buf, uint64_t v) {
+    while (v >= 0x80) {
+        buf.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    buf.push_back(static_cast<uint8_t>(v));
+}
+
+static uint64_t ZigZag(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+static int64_t UnZigZag(uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+static bool GamepadEquals(const XINPUT_GAMEPAD& a, const XINPUT_GAMEPAD& b) {
+    return a.wButtons == b.wButtons
+        && a.bLeftTrigger == b.bLeftTrigger
+        && a.bRightTrigger == b.bRightTrigger
+        && a.sThumbLX == b.sThumbLX
+        && a.sThumbLY == b.sThumbLY
+        && a.sThumbRX == b.sThumbRX
+        && a.sThumbRY == b.sThumbRY;
+}
+
+bool InputRecorder::Start(const std::filesystem::path& path) {
+    if (recording.load(std::memory_order_relaxed))
+        return false;
+
+    // Drop anything left over from a previous session that failed to start
+    RecordEntry discard;
+    while (queue.TryPop(discard)) {
+        if (discard.tag == RecordTag::Binding)
+            delete discard.profileName;
+    }
+
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        LOG(General, Error, L"Failed to open recording file {}", path.wstring());
+        return false;
+    }
+
+    entriesWritten = 0;
+    entriesDropped = 0;
+    bytesWritten = 0;
+    writeFailed = false;
+    stopRequested = false;
+    writer = std::thread(&InputRecorder::WriterMain, this, std::move(file), gClock->Now());
+    recording.store(true, std::memory_order_relaxed);
+
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        const auto& dev = gXiGamepads[userIndex];
+        lastEpoch[userIndex] = dev.epoch;
+        lastGamepad[userIndex] = {};
+
+        const auto& binding = gXiGamepadBindings[userIndex];
+        if (!binding.enabled) continue;
+        RecordBinding(userIndex, binding.ProfileName());
+        RecordFilter(userIndex, false, binding.srcKbd);
+        RecordFilter(userIndex, true, binding.srcMouse);
+        if (binding.suspended)
+            RecordSuspended(userIndex, true, gClock->Now());
+    }
+
+    LOG_DEBUG(L"Started recording input to {}", path.wstring());
+    return true;
+}
+
+void InputRecorder::Stop() {
+    if (!recording.load(std::memory_order_relaxed))
+        return;
+
+    recording.store(false, std::memory_order_relaxed);
+    stopRequested.store(true, std::memory_order_release);
+    if (writer.joinable())
+        writer.join();
+
+    LOG_DEBUG(L"Stopped recording input: {} entries written, {} dropped, {} bytes", entriesWritten.load(), entriesDropped.load(), bytesWritten.load());
+}
+
+void InputRecorder::Push(const RecordEntry& entry) noexcept {
+    if (!queue.TryPush(entry)) {
+        entriesDropped.fetch_add(1, std::memory_order_relaxed);
+        if (entry.tag == RecordTag::Binding)
+            delete entry.profileName;
+    }
+}
+
+void InputRecorder::RecordKey(HANDLE hDevice, BYTE vkey, bool pressed, int64_t time) noexcept {
+    if (!recording.load(std::memory_order_relaxed)) return;
+    RecordEntry e;
+    e.tag = pressed ? RecordTag::KeyDown : RecordTag::KeyUp;
+    e.timestamp = time;
+    e.device = hDevice;
+    e.vkey = vkey;
+    Push(e);
+}
+
+void InputRecorder::RecordMouseMove(HANDLE hDevice, LONG dx, LONG dy, int64_t time) noexcept {
+    if (!recording.load(std::memory_order_relaxed)) return;
+    RecordEntry e;
+    e.tag = RecordTag::MouseMove;
+    e.timestamp = time;
+    e.device = hDevice;
+    e.mouse.dx = dx;
+    e.mouse.dy = dy;
+    Push(e);
+}
+
+void InputRecorder::RecordMouseTick(int64_t elapsed, int64_t period, int64_t time) noexcept {
+    if (!recording.load(std::memory_order_relaxed)) return;
+    RecordEntry e;
+    e.tag = RecordTag::MouseTick;
+    e.timestamp = time;
+    e.tick.elapsed = elapsed;
+    e.tick.period = period;
+    Push(e);
+}
+
+void InputRecorder::RecordBinding(int userIndex, std::string_view profileName) {
+    if (!recording.load(std::memory_order_relaxed)) return;
+    RecordEntry e;
+    e.tag = RecordTag::Binding;
+    e.timestamp = gClock->Now();
+    e.userIndex = static_cast<uint8_t>(userIndex);
+    e.profileName = new std::string(profileName);
+    Push(e);
+}
+
+void InputRecorder::RecordFilter(int userIndex, bool mouse, HANDLE hDevice) noexcept {
+    if (!recording.load(std::memory_order_relaxed)) return;
+    RecordEntry e;
+    e.tag = mouse ? RecordTag::MouseFilter : RecordTag::KbdFilter;
+    e.timestamp = gClock->Now();
+    e.userIndex = static_cast<uint8_t>(userIndex);
+    e.device = hDevice;
+    Push(e);
+}
+
+void InputRecorder::RecordSuspended(int userIndex, bool suspended, int64_t time) noexcept {
+    if (!recording.load(std::memory_order_relaxed)) return;
+    RecordEntry e;
+    e.tag = RecordTag::Suspend;
+    e.timestamp = time;
+    e.userIndex = static_cast<uint8_t>(userIndex);
+    e.suspended = suspended;
+    Push(e);
+}
+
+void InputRecorder::RecordPublishedStates(const InputTranslationStruct& its, int64_t time) noexcept {
+    if (!recording.load(std::memory_order_relaxed)) return;
+
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        if (!its.bindings[userIndex].enabled) continue;
+
+        const auto& dev = its.gamepads[userIndex];
+        auto gamepad = dev.ComputeXInputGamepad();
+        if (dev.epoch == lastEpoch[userIndex] && GamepadEquals(gamepad, lastGamepad[userIndex]))
+            continue;
+        lastEpoch[userIndex] = dev.epoch;
+        lastGamepad[userIndex] = gamepad;
+
+        RecordEntry e;
+        e.tag = RecordTag::State;
+        e.timestamp = time;
+        e.userIndex = static_cast<uint8_t>(userIndex);
+        e.state.gamepad = gamepad;
+        e.state.epoch = dev.epoch;
+        Push(e);
+    }
+}
+
+namespace {
+struct RecordEncoder {
+    std::vector<uint8_t> buf;
+    std::unordered_map<HANDLE, uint64_t> deviceIndices;
+    int64_t lastTimestamp = 0;
+    int lastEpoch[XUSER_MAX_COUNT] = {};
+    XINPUT_GAMEPAD lastGamepad[XUSER_MAX_COUNT] = {};
+
+    RecordEncoder(int64_t startTimestamp)
+        : lastTimestamp{ startTimestamp }
+    {
+        deviceIndices.emplace(INVALID_HANDLE_VALUE, 0);
+    }
+
+    void PutHeader(RecordTag tag, int64_t timestamp) {
+        buf.push_back(static_cast<uint8_t>(tag));
+        // Entries are pushed by a single thread in order, but an event timestamped right before Start() may still be slightly behind
+        PutVarint(buf, static_cast<uint64_t>(std::max<int64_t>(timestamp - lastTimestamp, 0)));
+        lastTimestamp = std::max(timestamp, lastTimestamp);
+    }
+
+    uint64_t DeviceIndex(HANDLE hDevice, int64_t timestamp) {
+        auto [iter, inserted] = deviceIndices.try_emplace(hDevice, deviceIndices.size());
+        if (inserted) {
+            PutHeader(RecordTag::DeviceDef, timestamp);
+            PutVarint(buf, iter->second);
+            PutVarint(buf, reinterpret_cast<uintptr_t>(hDevice));
+        }
+        return iter->second;
+    }
+
+    void Encode(const RecordEntry& e) {
+        switch (e.tag) {
+        case RecordTag::KeyDown:
+        case RecordTag::KeyUp: {
+            auto dev = DeviceIndex(e.device, e.timestamp);
+            PutHeader(e.tag, e.timestamp);
+            PutVarint(buf, dev);
+            buf.push_back(e.vkey);
+        } break;
+
+        case RecordTag::MouseMove: {
+            auto dev = DeviceIndex(e.device, e.timestamp);
+            PutHeader(e.tag, e.timestamp);
+            PutVarint(buf, dev);
+            PutVarint(buf, ZigZag(e.mouse.dx));
+            PutVarint(buf, ZigZag(e.mouse.dy));
+        } break;
+
+        case RecordTag::MouseTick: {
+            PutHeader(e.tag, e.timestamp);
+            PutVarint(buf, static_cast<uint64_t>(std::max<int64_t>(e.tick.elapsed, 0)));
+            PutVarint(buf, static_cast<uint64_t>(std::max<int64_t>(e.tick.period, 0)));
+        } break;
+
+        case RecordTag::Binding: {
+            PutHeader(e.tag, e.timestamp);
+            buf.push_back(e.userIndex);
+            PutVarint(buf, e.profileName->size());
+            buf.insert(buf.end(), e.profileName->begin(), e.profileName->end());
+            delete e.profileName;
+        } break;
+
+        case RecordTag::KbdFilter:
+        case RecordTag::MouseFilter: {
+            auto dev = DeviceIndex(e.device, e.timestamp);
+            PutHeader(e.tag, e.timestamp);
+            buf.push_back(e.userIndex);
+            PutVarint(buf, dev);
+        } break;
+
+        case RecordTag::Suspend: {
+            PutHeader(e.tag, e.timestamp);
+            buf.push_back(e.userIndex);
+            buf.push_back(e.suspended ? 1 : 0);
+        } break;
+
+        case RecordTag::State: {
+            auto& prev = lastGamepad[e.userIndex];
+            const auto& curr = e.state.gamepad;
+
+            uint8_t mask = 0;
+            if (curr.wButtons != prev.wButtons) mask |= SF_Buttons;
+            if (curr.bLeftTrigger != prev.bLeftTrigger) mask |= SF_LeftTrigger;
+            if (curr.bRightTrigger != prev.bRightTrigger) mask |= SF_RightTrigger;
+            if (curr.sThumbLX != prev.sThumbLX) mask |= SF_ThumbLX;
+            if (curr.sThumbLY != prev.sThumbLY) mask |= SF_ThumbLY;
+            if (curr.sThumbRX != prev.sThumbRX) mask |= SF_ThumbRX;
+            if (curr.sThumbRY != prev.sThumbRY) mask |= SF_ThumbRY;
+
+            PutHeader(e.tag, e.timestamp);
+            buf.push_back(e.userIndex);
+            PutVarint(buf, ZigZag(static_cast<int64_t>(e.state.epoch) - lastEpoch[e.userIndex]));
+            buf.push_back(mask);
+            if (mask & SF_Buttons) PutVarint(buf, curr.wButtons);
+            if (mask & SF_LeftTrigger) buf.push_back(curr.bLeftTrigger);
+            if (mask & SF_RightTrigger) buf.push_back(curr.bRightTrigger);
+            if (mask & SF_ThumbLX) PutVarint(buf, ZigZag(curr.sThumbLX - prev.sThumbLX));
+            if (mask & SF_ThumbLY) PutVarint(buf, ZigZag(curr.sThumbLY - prev.sThumbLY));
+            if (mask & SF_ThumbRX) PutVarint(buf, ZigZag(curr.sThumbRX - prev.sThumbRX));
+            if (mask & SF_ThumbRY) PutVarint(buf, ZigZag(curr.sThumbRY - prev.sThumbRY));
+
+            prev = curr;
+            lastEpoch[e.userIndex] = e.state.epoch;
+        } break;
+
+        case RecordTag::DeviceDef: break;
+        }
+    }
+};
+}
+
+void InputRecorder::WriterMain(std::ofstream file, int64_t startTicks) {
+    // Once a write fails the recording is cut short, but the queue is still drained so that producers don't see it fill up
+    auto checkFile = [&]() {
+        if (file || writeFailed.load(std::memory_order_relaxed))
+            return;
+        writeFailed.store(true, std::memory_order_relaxed);
+        LOG(General, Error, L"Failed to write recording file, the rest of the recording is lost");
+    };
+
+    RecordFileHeader header;
+    std::memcpy(header.magic, kRecordFileMagic, sizeof(header.magic));
+    header.version = kRecordFileVersion;
+    header.ticksPerSecond = gClock->TicksPerSecond();
+    header.startTicks = startTicks;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    checkFile();
+    if (!writeFailed.load(std::memory_order_relaxed))
+        bytesWritten.fetch_add(sizeof(header), std::memory_order_relaxed);
+
+    RecordEncoder enc(startTicks);
+    constexpr size_t kFlushThreshold = 64 * 1024;
+
+    while (true) {
+        // Read the flag before draining, so that everything pushed before Stop() is guaranteed to be written out
+        bool stopping = stopRequested.load(std::memory_order_acquire);
+
+        RecordEntry e;
+        uint64_t numEntries = 0;
+        while (queue.TryPop(e)) {
+            enc.Encode(e);
+            ++numEntries;
+            if (enc.buf.size() >= kFlushThreshold)
+                break;
+        }
+        if (!writeFailed.load(std::memory_order_relaxed))
+            entriesWritten.fetch_add(numEntries, std::memory_order_relaxed);
+
+        if (!enc.buf.empty()) {
+            if (!writeFailed.load(std::memory_order_relaxed)) {
+                file.write(reinterpret_cast<const char*>(enc.buf.data()), enc.buf.size());
+                file.flush();
+                checkFile();
+                if (!writeFailed.load(std::memory_order_relaxed))
+                    bytesWritten.fetch_add(enc.buf.size(), std::memory_order_relaxed);
+            }
+            enc.buf.clear();
+        }
+
+        if (numEntries == 0) {
+            if (stopping)
+                break;
+            std::this_thread::sleep_for(2ms);
+        }
+    }
+
+    file.flush();
+    checkFile();
+}
+
+namespace {
+struct RecordDecoder {
+    const uint8_t* curr;
+    const uint8_t* end;
+
+    bool ReadByte(uint8_t& out) {
+        if (curr == end) return false;
+        out = *curr++;
+        return true;
+    }
+
+    bool ReadVarint(uint64_t& out) {
+        out = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b;
+            if (!ReadByte(b)) return false;
+            out |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    bool ReadZigZag(int64_t& out) {
+        uint64_t v;
+        if (!ReadVarint(v)) return false;
+        out = UnZigZag(v);
+        return true;
+    }
+};
+
+// Replayed devices get fake handles derived from their index, so that gamepad filters compare the same way as they did when recording
+HANDLE ReplayDeviceHandle(uint64_t index) {
+    return index == 0 ? INVALID_HANDLE_VALUE : reinterpret_cast<HANDLE>(static_cast<uintptr_t>(index));
+}
+
+// Returns an error message, or an empty string on success
+std::string LoadRecordFile(const std::filesystem::path& path, std::vector<uint8_t>& data, RecordFileHeader& header) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        return "Cannot open recording file";
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    if (data.size() < sizeof(header))
+        return "File too short";
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, kRecordFileMagic, sizeof(header.magic)) != 0 || header.version != kRecordFileVersion || header.ticksPerSecond <= 0)
+        return "Not a recording file, or unsupported version";
+    return {};
+}
+
+// One record as stored, see RecordTag for which fields each tag sets
+struct DecodedRecord {
+    RecordTag tag;
+    uint64_t dt;
+    uint64_t device;
+    uint64_t handle;
+    uint8_t vkey;
+    int64_t dx, dy;
+    uint64_t elapsed, period;
+    uint8_t userIndex;
+    // Points into the file data
+    std::string_view profileName;
+    int64_t epochDelta;
+    uint8_t mask;
+    uint8_t suspended;
+};
+
+// State records are applied onto `states`, the previous State of each gamepad
+// Returns an error message, or nullptr on success
+const char* ReadRecord(RecordDecoder& dec, DecodedRecord& rec, XINPUT_GAMEPAD (&states)[XUSER_MAX_COUNT]) {
+    constexpr auto kTruncated = "Truncated record";
+
+    uint8_t tag;
+    if (!dec.ReadByte(tag) || !dec.ReadVarint(rec.dt)) return kTruncated;
+    rec.tag = static_cast<RecordTag>(tag);
+
+    switch (rec.tag) {
+    case RecordTag::DeviceDef:
+        return dec.ReadVarint(rec.device) && dec.ReadVarint(rec.handle) ? nullptr : kTruncated;
+
+    case RecordTag::KeyDown:
+    case RecordTag::KeyUp:
+        return dec.ReadVarint(rec.device) && dec.ReadByte(rec.vkey) ? nullptr : kTruncated;
+
+    case RecordTag::MouseMove:
+        return dec.ReadVarint(rec.device) && dec.ReadZigZag(rec.dx) && dec.ReadZigZag(rec.dy) ? nullptr : kTruncated;
+
+    case RecordTag::MouseTick:
+        return dec.ReadVarint(rec.elapsed) && dec.ReadVarint(rec.period) ? nullptr : kTruncated;
+
+    case RecordTag::Binding: {
+        uint64_t len;
+        if (!dec.ReadByte(rec.userIndex) || !dec.ReadVarint(len)) return kTruncated;
+        if (rec.userIndex >= XUSER_MAX_COUNT || len > static_cast<uint64_t>(dec.end - dec.curr)) return kTruncated;
+        rec.profileName = std::string_view(reinterpret_cast<const char*>(dec.curr), len);
+        dec.curr += len;
+        return nullptr;
+    }
+
+    case RecordTag::KbdFilter:
+    case RecordTag::MouseFilter:
+        return dec.ReadByte(rec.userIndex) && dec.ReadVarint(rec.device) && rec.userIndex < XUSER_MAX_COUNT ? nullptr : kTruncated;
+
+    case RecordTag::Suspend:
+        return dec.ReadByte(rec.userIndex) && dec.ReadByte(rec.suspended) && rec.userIndex < XUSER_MAX_COUNT ? nullptr : kTruncated;
+
+    case RecordTag::State: {
+        if (!dec.ReadByte(rec.userIndex) || !dec.ReadZigZag(rec.epochDelta) || !dec.ReadByte(rec.mask)) return kTruncated;
+        if (rec.userIndex >= XUSER_MAX_COUNT) return kTruncated;
+
+        auto& state = states[rec.userIndex];
+        uint64_t u;
+        int64_t d;
+        if (rec.mask & SF_Buttons) { if (!dec.ReadVarint(u)) return kTruncated; state.wButtons = static_cast<WORD>(u); }
+        if (rec.mask & SF_LeftTrigger) { if (!dec.ReadByte(state.bLeftTrigger)) return kTruncated; }
+        if (rec.mask & SF_RightTrigger) { if (!dec.ReadByte(state.bRightTrigger)) return kTruncated; }
+        if (rec.mask & SF_ThumbLX) { if (!dec.ReadZigZag(d)) return kTruncated; state.sThumbLX = static_cast<SHORT>(state.sThumbLX + d); }
+        if (rec.mask & SF_ThumbLY) { if (!dec.ReadZigZag(d)) return kTruncated; state.sThumbLY = static_cast<SHORT>(state.sThumbLY + d); }
+        if (rec.mask & SF_ThumbRX) { if (!dec.ReadZigZag(d)) return kTruncated; state.sThumbRX = static_cast<SHORT>(state.sThumbRX + d); }
+        if (rec.mask & SF_ThumbRY) { if (!dec.ReadZigZag(d)) return kTruncated; state.sThumbRY = static_cast<SHORT>(state.sThumbRY + d); }
+        return nullptr;
+    }
+    }
+
+    return "Unknown record tag";
+}
+}
+
+ReplayResult ReplayRecording(const std::filesystem::path& path, const Config& config, ReplaySpeed speed, ReplayKernels kernels) {
+    ReplayResult res;
+
+    std::vector<uint8_t> data;
+    RecordFileHeader header;
+    res.error = LoadRecordFile(path, data, header);
+    if (!res.error.empty())
+        return res;
+
+    // InputTranslationStruct is a few KB, keep it off the stack
+    struct ReplayState {
+        InputTranslationStruct its;
+        XiGamepad gamepads[XUSER_MAX_COUNT] = {};
+        XiGamepadBinding bindings[XUSER_MAX_COUNT] = {};
+        XINPUT_GAMEPAD recorded[XUSER_MAX_COUNT] = {};
+    };
+    auto rs = std::make_unique<ReplayState>();
+    rs->its.gamepads = rs->gamepads;
+    rs->its.bindings = rs->bindings;
+    rs->its.genericKernels = kernels == ReplayKernels::Generic;
+    rs->its.fixedPointMouseSticks = config.fixedPointMouseSticks;
+    rs->its.actions.SetClock(header.ticksPerSecond, header.startTicks);
+
+    RecordDecoder dec{ data.data() + sizeof(header), data.data() + data.size() };
+    // The gClock reading the current record was handled at
+    int64_t recordedTicks = header.startTicks;
+    uint64_t recordIndex = 0;
+    auto startTime = std::chrono::steady_clock::now();
+
+    while (dec.curr != dec.end) {
+        DecodedRecord rec;
+        if (auto error = ReadRecord(dec, rec, rs->recorded)) {
+            res.error = std::format("{} at record #{}", error, recordIndex);
+            break;
+        }
+        recordedTicks += static_cast<int64_t>(rec.dt);
+
+        if (speed == ReplaySpeed::RealTime && rec.dt > 0) {
+            auto target = startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(static_cast<double>(recordedTicks - header.startTicks) / header.ticksPerSecond));
+            std::this_thread::sleep_until(target);
+        }
+
+        // Timed actions that came due between the previous record and this one, same as the input thread's scheduler would have run them
+        AdvanceActions(recordedTicks, rs->its);
+
+        switch (rec.tag) {
+        case RecordTag::DeviceDef:
+            break;
+
+        case RecordTag::KeyDown:
+        case RecordTag::KeyUp:
+            HandleKeyPress(ReplayDeviceHandle(rec.device), rec.vkey, rec.tag == RecordTag::KeyDown, recordedTicks, rs->its);
+            ++res.eventsReplayed;
+            break;
+
+        case RecordTag::MouseMove:
+            HandleMouseMovement(ReplayDeviceHandle(rec.device), static_cast<LONG>(rec.dx), static_cast<LONG>(rec.dy), rs->its);
+            ++res.eventsReplayed;
+            break;
+
+        case RecordTag::MouseTick:
+            DoMouse2Joystick(static_cast<int64_t>(rec.elapsed), static_cast<int64_t>(rec.period), rs->its);
+            ++res.eventsReplayed;
+            break;
+
+        case RecordTag::Binding: {
+            // Mirrors ReloadConfig() and the onGamepadBindingChanged handler
+            auto profileId = config.profiles->Find(rec.profileName);
+            if (profileId != kInvalidProfileId) {
+                const auto& profile = config.profiles->profiles[profileId];
+                rs->bindings[rec.userIndex].Bind(config.profiles, profileId);
+                rs->bindings[rec.userIndex].enabled = true;
+                rs->gamepads[rec.userIndex] = {};
+                rs->its.PopulateBtnLut(rec.userIndex, profile);
+                rs->its.PopulateSticks(rec.userIndex, profile);
+                rs->its.PopulateActions(rec.userIndex, profile);
+                rs->its.PopulateKernel(rec.userIndex);
+            }
+            else {
+                LOG_DEBUG(L"Replay: cannot find profile '{}', gamepad {} left as-is", Utf8ToWide(rec.profileName), rec.userIndex);
+            }
+        } break;
+
+        case RecordTag::KbdFilter:
+        case RecordTag::MouseFilter:
+            rs->its.SetDeviceFilter(rec.userIndex, rec.tag == RecordTag::MouseFilter, ReplayDeviceHandle(rec.device));
+            break;
+
+        case RecordTag::Suspend:
+            SetGamepadSuspended(rec.userIndex, rec.suspended != 0, recordedTicks, rs->its);
+            break;
+
+        case RecordTag::State: {
+            const auto& expected = rs->recorded[rec.userIndex];
+            auto actual = rs->gamepads[rec.userIndex].ComputeXInputGamepad();
+            ++res.statesCompared;
+            if (!GamepadEquals(expected, actual)) {
+                if (res.stateMismatches == 0) {
+                    res.firstMismatchUserIndex = rec.userIndex;
+                    res.firstMismatchRecordIndex = recordIndex;
+                    res.firstMismatchExpected = expected;
+                    res.firstMismatchActual = actual;
+                }
+                ++res.stateMismatches;
+            }
+        } break;
+        }
+
+        ++recordIndex;
+    }
+
+    res.recordedSeconds = static_cast<double>(recordedTicks - header.startTicks) / header.ticksPerSecond;
+    res.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    return res;
+}
+
+int RunReplayConsole(const std::filesystem::path& path, const std::filesystem::path& configPath, ReplaySpeed speed, ReplayKernels kernels) {
+    Config config;
+    try {
+        config = LoadConfig(toml::parse_file(configPath));
+    }
+    catch (const toml::parse_error& e) {
+        std::printf("Cannot load %s: %s\n", configPath.string().c_str(), std::string(e.description()).c_str());
+        return 1;
+    }
+
+    auto res = ReplayRecording(path, config, speed, kernels);
+    std::printf("Events replayed: %llu\n", (unsigned long long)res.eventsReplayed);
+    std::printf("States compared: %llu, mismatched: %llu\n", (unsigned long long)res.statesCompared, (unsigned long long)res.stateMismatches);
+    std::printf("Recorded %.3f s, replayed in %.3f s\n", res.recordedSeconds, res.elapsedSeconds);
+    if (res.stateMismatches > 0) {
+        const auto& e = res.firstMismatchExpected;
+        const auto& a = res.firstMismatchActual;
+        std::printf("First mismatch: gamepad %d, record #%llu\n", res.firstMismatchUserIndex, (unsigned long long)res.firstMismatchRecordIndex);
+        std::printf("  expected: btns=%04X lt=%u rt=%u l=(%d,%d) r=(%d,%d)\n", e.wButtons, e.bLeftTrigger, e.bRightTrigger, e.sThumbLX, e.sThumbLY, e.sThumbRX, e.sThumbRY);
+        std::printf("  actual:   btns=%04X lt=%u rt=%u l=(%d,%d) r=(%d,%d)\n", a.wButtons, a.bLeftTrigger, a.bRightTrigger, a.sThumbLX, a.sThumbLY, a.sThumbRX, a.sThumbRY);
+    }
+
+    if (!res.Success()) {
+        std::printf("Replay failed: %s\n", res.error.c_str());
+        return 1;
+    }
+    // A recording without states checks nothing, most likely it wasn't made with this version
+    if (res.statesCompared == 0) {
+        std::printf("Replay failed: the recording has no gamepad states to compare\n");
+        return 1;
+    }
+    return res.stateMismatches == 0 ? 0 : 1;
+}
+
+std::string LoadRecordedInput(const std::filesystem::path& path, std::vector<InputEvent>& events, int64_t& ticksPerSecond) {
+    std::vector<uint8_t> data;
+    RecordFileHeader header;
+    auto fileError = LoadRecordFile(path, data, header);
+    if (!fileError.empty())
+        return fileError;
+    ticksPerSecond = header.ticksPerSecond;
+
+    RecordDecoder dec{ data.data() + sizeof(header), data.data() + data.size() };
+    XINPUT_GAMEPAD states[XUSER_MAX_COUNT] = {};
+    int64_t recordedTicks = header.startTicks;
+    uint64_t recordIndex = 0;
+    events.clear();
+    while (dec.curr != dec.end) {
+        DecodedRecord rec;
+        if (auto error = ReadRecord(dec, rec, states))
+            return std::format("{} at record #{}", error, recordIndex);
+        recordedTicks += static_cast<int64_t>(rec.dt);
+
+        if (rec.tag == RecordTag::KeyDown || rec.tag == RecordTag::KeyUp) {
+            events.push_back(InputEvent{
+                .type = InputEvent::Type::Key,
+                .pressed = rec.tag == RecordTag::KeyDown,
+                .vkey = rec.vkey,
+                .device = ReplayDeviceHandle(rec.device),
+                .time = recordedTicks,
+            });
+        }
+        else if (rec.tag == RecordTag::MouseMove) {
+            events.push_back(InputEvent{
+                .type = InputEvent::Type::MouseMove,
+                .device = ReplayDeviceHandle(rec.device),
+                .dx = static_cast<LONG>(rec.dx),
+                .dy = static_cast<LONG>(rec.dy),
+                .time = recordedTicks,
+            });
+        }
+        ++recordIndex;
+    }
+    return {};
+}
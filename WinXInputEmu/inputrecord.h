@@ -0,0 +1,181 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "inputbackend.h"
+#include "platform.h"
+#include "shadowed.h"
+#include "spscring.h"
+#include "translation.h"
+#include "userdevice.h"
+
+// Input recording file format (*.wxirec)
+//
+// The file starts with a RecordFileHeader, followed by a stream of records until EOF. Each record is
+//     u8      tag, one of RecordTag
+//     varint  time since the previous record, in ticks (see RecordFileHeader::ticksPerSecond); the first record is relative to RecordFileHeader::startTicks
+//     ...     payload, depending on the tag
+// All integers in payloads are unsigned LEB128 varints, unless noted otherwise. Signed values are zigzag encoded first.
+//
+// Device handles are not stored directly. Each distinct handle is assigned a small index, in order of first appearance, announced by a DeviceDef record.
+// Index 0 is reserved for INVALID_HANDLE_VALUE, i.e. "any device" in gamepad filters.
+//
+// State records only store the fields that changed since the previous State record of the same gamepad.
+
+inline constexpr char kRecordFileMagic[4] = { 'W', 'X', 'I', 'R' };
+inline constexpr uint32_t kRecordFileVersion = 2;
+
+struct RecordFileHeader {
+    char magic[4];
+    uint32_t version;
+    // Of gClock at the time of recording
+    int64_t ticksPerSecond;
+    // gClock reading when recording started, so that a replay runs on the same absolute timeline, e.g. timed actions land on the same wheel ticks
+    int64_t startTicks;
+};
+
+enum class RecordTag : uint8_t {
+    // varint device index, varint original handle value
+    DeviceDef = 1,
+    // varint device index, u8 vkey
+    KeyDown = 2,
+    KeyUp = 3,
+    // varint device index, zigzag varint dx, zigzag varint dy
+    MouseMove = 4,
+    // varint ticks since the previous mouse tick, varint nominal tick period. One DoMouse2Joystick() invocation.
+    MouseTick = 5,
+    // u8 user index, varint length, UTF-8 profile name
+    Binding = 6,
+    // u8 user index, varint device index
+    KbdFilter = 7,
+    MouseFilter = 8,
+    // u8 user index, zigzag varint epoch delta, u8 StateField mask, then each present field in mask bit order:
+    //     varint wButtons, u8 bLeftTrigger, u8 bRightTrigger, zigzag varint delta for each thumb axis
+    State = 9,
+    // u8 user index, u8 1 if suspended or 0 if resumed. One SetGamepadSuspended() invocation.
+    Suspend = 10,
+};
+
+enum StateField : uint8_t {
+    SF_Buttons = 1 << 0,
+    SF_LeftTrigger = 1 << 1,
+    SF_RightTrigger = 1 << 2,
+    SF_ThumbLX = 1 << 3,
+    SF_ThumbLY = 1 << 4,
+    SF_ThumbRX = 1 << 5,
+    SF_ThumbRY = 1 << 6,
+};
+
+// One entry in the recorder's queue, produced by the input thread
+// Delta encoding happens on the writer thread, so that producing an entry is just a copy
+struct RecordEntry {
+    RecordTag tag;
+    uint8_t userIndex;
+    BYTE vkey;
+    int64_t timestamp;
+    HANDLE device;
+    union {
+        struct { LONG dx, dy; } mouse;
+        struct { int64_t elapsed, period; } tick;
+        struct { XINPUT_GAMEPAD gamepad; int epoch; } state;
+        bool suspended;
+        // Binding only: heap allocated by the producer, freed by the writer thread
+        std::string* profileName;
+    };
+};
+
+// Streams input events and published gamepad states to a file
+// The input thread only ever pushes into a lock-free queue; if the writer thread falls behind, entries are dropped (and counted) instead of blocking input.
+struct InputRecorder {
+    std::atomic<bool> recording = false;
+    std::atomic<uint64_t> entriesWritten = 0;
+    std::atomic<uint64_t> entriesDropped = 0;
+    std::atomic<uint64_t> bytesWritten = 0;
+    // Set by the writer thread once the file stops taking writes (e.g. the disk is full); nothing is written from then on
+    std::atomic<bool> writeFailed = false;
+
+    // Producer-side memory of what was recorded last, to only record states that actually changed
+    int lastEpoch[XUSER_MAX_COUNT] = {};
+    XINPUT_GAMEPAD lastGamepad[XUSER_MAX_COUNT] = {};
+
+    SpscRing<RecordEntry, 8192> queue;
+    std::thread writer;
+    std::atomic<bool> stopRequested = false;
+
+    // Start and Stop: input thread only
+    // Start() records the current bindings and device filters first, so a replay begins from the same configuration
+    // Returns false, without recording, if the file can't be created
+    bool Start(const std::filesystem::path& path);
+    void Stop();
+
+    // Input thread only; no-ops if not recording
+    // `time` is the gClock reading the event was handled at, i.e. the same one given to the translation core
+    void RecordKey(HANDLE hDevice, BYTE vkey, bool pressed, int64_t time) noexcept;
+    void RecordMouseMove(HANDLE hDevice, LONG dx, LONG dy, int64_t time) noexcept;
+    // Same arguments as DoMouse2Joystick()
+    void RecordMouseTick(int64_t elapsed, int64_t period, int64_t time) noexcept;
+    // Configuration changes aren't input, these take their own timestamp
+    void RecordBinding(int userIndex, std::string_view profileName);
+    void RecordFilter(int userIndex, bool mouse, HANDLE hDevice) noexcept;
+    // Same arguments as SetGamepadSuspended()
+    void RecordSuspended(int userIndex, bool suspended, int64_t time) noexcept;
+    // Records a State entry for each enabled gamepad that changed since the last call
+    void RecordPublishedStates(const InputTranslationStruct& its, int64_t time) noexcept;
+
+private:
+    void Push(const RecordEntry& entry) noexcept;
+    void WriterMain(std::ofstream file, int64_t startTicks);
+};
+
+extern InputRecorder gInputRecorder;
+
+std::filesystem::path GetDesignatedRecordingPath();
+
+enum class ReplaySpeed {
+    // Honor the recorded timestamps
+    RealTime,
+    // Feed events as fast as possible, e.g. for benchmarking
+    // Nothing in the translation core reads a clock, so this gives the exact same results as RealTime
+    Max,
+};
+
+// Which key kernels the replay translates with, see InputTranslationStruct::keyKernels
+enum class ReplayKernels {
+    Specialized,
+    Generic,
+};
+
+struct ReplayResult {
+    std::string error;
+    uint64_t eventsReplayed = 0;
+    uint64_t statesCompared = 0;
+    uint64_t stateMismatches = 0;
+    // Only meaningful if stateMismatches > 0
+    int firstMismatchUserIndex = -1;
+    uint64_t firstMismatchRecordIndex = 0;
+    XINPUT_GAMEPAD firstMismatchExpected = {};
+    XINPUT_GAMEPAD firstMismatchActual = {};
+    double recordedSeconds = 0.0;
+    double elapsedSeconds = 0.0;
+
+    bool Success() const { return error.empty(); }
+};
+
+// Drives a private InputTranslationStruct (not the global gamepads) with the events from a recording, and diffs every recorded state against the replayed one
+// Profiles are looked up by name in `config`
+ReplayResult ReplayRecording(const std::filesystem::path& path, const Config& config, ReplaySpeed speed, ReplayKernels kernels = ReplayKernels::Specialized);
+// The same from a console, without the UI: loads the config at `configPath`, replays and prints the results to stdout
+// Returns 0 only if the replay read the whole recording, compared at least one state and every state matched, so that it can gate a build
+int RunReplayConsole(const std::filesystem::path& path, const std::filesystem::path& configPath, ReplaySpeed speed, ReplayKernels kernels = ReplayKernels::Specialized);
+
+// Extracts the key and mouse motion events of a recording, for ReplayInputBackend
+// Times are as recorded, in `ticksPerSecond`; devices are the same fake handles ReplayRecording() uses
+// Returns an error message, or an empty string on success
+std::string LoadRecordedInput(const std::filesystem::path& path, std::vector<InputEvent>& events, int64_t& ticksPerSecond);
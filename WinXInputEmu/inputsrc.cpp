@@ -3,6 +3,7 @@
 #include "inputsrc.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
 #include <d3d11.h>
@@ -14,100 +15,72 @@
 #include <utility>
 #include <vector>
 
-#include <hidusage.h>
-
+#include "clock.h"
+#include "cursorcapture.h"
+#include "devicestats.h"
 #include "dll.h"
+#include "foreground.h"
+#include "inputbackend.h"
 #include "inputdevice.h"
+#include "inputrecord.h"
+#include "keystroke.h"
+#include "slotrouting.h"
+#include "translation.h"
 #include "ui.h"
 
-constexpr UINT_PTR kMouseCheckTimerID = 0;
-
-enum class XiButton : unsigned char {
-    None = 0,
-    A, B, X, Y,
-    LB, RB,
-    LT, RT,
-    Start, Back,
-    DpadUp, DpadDown, DpadLeft, DpadRight,
-    LStickBtn, RStickBtn,
-    LStickUp, LStickDown, LStickLeft, LStickRight,
-    RStickUp, RStickDown, RStickLeft, RStickRight,
-};
-
-// Information and lookup tables computable from a Config object
-// used for translating input key presses/mouse movements into gamepad state
-struct InputTranslationStruct {
-    struct {
-        struct {
-            // Keyboard mode stuff
-            bool up, down, left, right;
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
 
-            // Mouse mode stuff
-        } lstick, rstick;
+using namespace std::literals;
 
-        float accuMouseX;
-        float accuMouseY;
-    } xiGamepadExtraInfo[XUSER_MAX_COUNT];
-
-    // VK_xxx is BYTE, max 255 values
-    // NOTE: XiButton::COUNT is used to indicate "this mapping is not bound"
-    XiButton btns[XUSER_MAX_COUNT][0xFF];
-
-    InputTranslationStruct() {
-        ClearAll();
-    }
-
-    void ClearAll();
-    void PopulateBtnLut(int userIndex, const UserProfile& profile);
-};
-
-void InputTranslationStruct::ClearAll() {
-    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
-        xiGamepadExtraInfo[userIndex] = {};
-        for (int i = 0; i < 0xFF; ++i) {
-            btns[userIndex][i] = XiButton::None;
-        }
-    }
-}
-
-void InputTranslationStruct::PopulateBtnLut(int userIndex, const UserProfile& profile) {
-    // Clear
-    for (auto& btn : btns[userIndex])
-        btn = XiButton::None;
-
-    using enum XiButton;
-#define BTN(KEY_ENUM, THE_BTN) if (THE_BTN.keyCode != 0xFF) btns[userIndex][THE_BTN.keyCode] = KEY_ENUM;
-    BTN(A, profile.a);
-    BTN(B, profile.b);
-    BTN(X, profile.x);
-    BTN(Y, profile.y);
-    BTN(LB, profile.lb);
-    BTN(RB, profile.rb);
-    BTN(LT, profile.lt);
-    BTN(RT, profile.rt);
-    BTN(Start, profile.start);
-    BTN(Back, profile.back);
-    BTN(DpadUp, profile.dpadUp);
-    BTN(DpadDown, profile.dpadDown);
-    BTN(DpadLeft, profile.dpadLeft);
-    BTN(DpadRight, profile.dpadRight);
-    BTN(LStickBtn, profile.lstickBtn);
-    BTN(RStickBtn, profile.rstickBtn);
-#define STICK(PREFIX, THE_STICK) \
-    if (THE_STICK.useMouse) {} \
-    else { BTN(PREFIX##StickUp, THE_STICK.kbd.up); BTN(PREFIX##StickDown, THE_STICK.kbd.down); BTN(PREFIX##StickLeft, THE_STICK.kbd.left); BTN(PREFIX##StickRight, THE_STICK.kbd.right); }
-    STICK(L, profile.lstick);
-    STICK(R, profile.rstick);
-#undef STICK
-#undef BTN
-}
+// UI redraw pacing
+// ImGui needs a few frames after an input event to settle (hover highlights, layout changes, etc.)
+constexpr int kUISettleFrames = 3;
+// Caret blinking, tooltips delays, etc. need periodic frames even if nothing else happens
+constexpr auto kUIAnimationInterval = 100ms;
+// Upper bound on how long the UI may go without a frame, to pick up anything not covered by other triggers
+constexpr auto kUIFocusedHeartbeat = 500ms;
+constexpr auto kUIUnfocusedHeartbeat = 1000ms;
+// Minimum time between frames, when redrawing due to input state changes or when the window isn't focused
+constexpr auto kUIStateChangeFrameInterval = 50ms;
+constexpr auto kUIUnfocusedFrameInterval = 100ms;
 
 struct ThreadState {
     UIState* uiState = nullptr;
 
     std::vector<IdevDevice> devices;
+    // Keyed by device handle, including devices not in `devices`, e.g. the fake ones of the replay and synthetic backends
+    DeviceStatsTable deviceStats;
 
     InputTranslationStruct its;
+    KeystrokeGenerator keystrokes;
+
+    std::unique_ptr<InputBackend> backend;
+    // Same object as `backend` if it's the raw input one, which is fed by this thread's WM_INPUT
+    RawInputBackend* rawInput = nullptr;
+    // Same object as `backend` if it's the hook one, whose suppression map this thread keeps up to date
+    HookInputBackend* hooks = nullptr;
+    // Heap allocated, it's too big for the stack
+    std::unique_ptr<InputEventSink> inputSink;
+    // Signaled by backends running on other threads whenever they publish a batch into inputSink
+    HANDLE inputEvent = nullptr;
+    // Relative mouse motion not yet handed to the translation core, see CoalesceMouseMotion()
+    MouseMotionCoalescer mouseMotion;
+    // The latest gClock reading anything was handled at
+    // Events from other threads may be stamped slightly before it; they're moved up to it so the translation core only ever sees time go forward
+    int64_t latestTime = 0;
+
+    // Wakes the thread for anything due on the gClock timeline: timed actions, the mouse tick and key repeats
+    HANDLE scheduleTimer = nullptr;
+    // When scheduleTimer is currently set to go off, INT64_MAX if it's not set
+    // It's one-shot: whoever sees it signaled must reset this
+    int64_t scheduleTimerDue = INT64_MAX;
+    // 0 if mouse sticks are never ticked
+    int64_t mouseTickPeriod = 0;
+    int64_t lastMouseTick = 0;
+    int64_t nextMouseTick = INT64_MAX;
+    PhysicalGamepadPoller physicalPoller;
 
     // https://github.com/ocornut/imgui/blob/master/examples/example_win32_directx11/main.cpp
     // For ImGui main viewport
@@ -118,191 +91,167 @@ struct ThreadState {
 
     HWND mainWindow = NULL;
 
-    // For a RAWINPUT*
-    std::unique_ptr<std::byte[]> rawinput;
-    size_t rawinputSize = 0;
-
     bool blockingMessagePump = false;
-    bool capturingCursor = false;
+    CursorCapture cursorCapture;
+
+    // Only consulted once started, until then every gamepad takes input
+    ForegroundTracker foreground;
+    bool foregroundTracking = false;
+    // Every enabled gamepad is suspended by foreground gating, so input skips the translation core entirely
+    bool inputGatedOut = false;
+
+    // Set when the UI window received something that might change what it displays
+    bool uiDirty = true;
+    bool uiFocused = true;
 };
 
-static float Scale(float x, float lowerbound, float upperbound) {
-    return (x - lowerbound) / (upperbound - lowerbound);
+// Feed one key event into the translation core, recording it on the way if requested
+static void DispatchKeyPress(HANDLE hDevice, BYTE vkey, bool pressed, int64_t time, ThreadState& s) {
+    gInputRecorder.RecordKey(hDevice, vkey, pressed, time);
+    HandleKeyPress(hDevice, vkey, pressed, time, s.its);
 }
 
-/// \param phi phi ∈ [0,2π], defines in which direction the stick is tilted.
-/// \param tilt tilt ∈ (0,1], defines the amount of tilt. 0 is no tilt, 1 is full tilt.
-static void SetJoystickPosition(float phi, float tilt, bool invertX, bool invertY, short& outX, short& outY) {
-    constexpr float pi = 3.14159265358979323846f;
-    constexpr float kSnapToFullFilt = 0.005f;
-
-    tilt = std::clamp(tilt, 0.0f, 1.0f);
-    tilt = (1 - tilt) < kSnapToFullFilt ? 1 : tilt;
-
-    // [0,1]
-    float x, y;
-
-#define RANGE_FOR_X(LOWERBOUND, UPPERBOUND, FACTOR) if (phi >= LOWERBOUND && phi <= UPPERBOUND) { x = FACTOR * tilt * Scale(phi, LOWERBOUND, UPPERBOUND); y = FACTOR * tilt; }
-#define RANGE_FOR_Y(LOWERBOUND, UPPERBOUND, FACTOR) if (phi >= LOWERBOUND && phi <= UPPERBOUND) { x = FACTOR * tilt; y = FACTOR * tilt * Scale(phi, LOWERBOUND, UPPERBOUND); }
-    // Two cases with forward+right
-    // Tilt is forward and slightly right
-    RANGE_FOR_X(3 * pi / 2, 7 * pi / 4, 1);
-    // Tilt is slightly forwardand right.
-    RANGE_FOR_Y(7 * pi / 4, 2 * pi, 1);
-    // Two cases with right+downward
-    // Tilt is right and slightly downward.
-    RANGE_FOR_Y(0, pi / 4, 1);
-    // Tilt is downward and slightly right.
-    RANGE_FOR_X(pi / 4, pi / 2, 1);
-    // Two cases with downward+left
-    // Tilt is downward and slightly left.
-    RANGE_FOR_X(pi / 2, 3 * pi / 4, -1);
-    // Tilt is left and slightly downward.
-    RANGE_FOR_X(3 * pi / 4, pi, -1);
-    // Two cases with forward+left
-    // Tilt is left and slightly forward.
-    RANGE_FOR_Y(pi, 5 * pi / 4, -1);
-    // Tilt is forward and slightly left.
-    RANGE_FOR_X(5 * pi / 4, 3 * pi / 2, -1);
-#undef RANGE_FOR_X
-#undef RANGE_FOR_Y
-
-
-    // Scale [0,1] to [INT16_MIN,INT16_MAX]
-    outX = static_cast<short>(x * 32768);
-    outY = static_cast<short>(y * 32768);
-
-    if (invertX) outX = -outX;
-    if (invertY) outY = -outY;
+// Points scheduleTimer at whatever is due next
+static void ArmScheduleTimer(ThreadState& s) {
+    int64_t due = std::min({ s.its.actions.NextDeadline(), s.nextMouseTick, s.keystrokes.NextDeadline(), s.physicalPoller.NextDeadline() });
+    if (due == s.scheduleTimerDue) return;
+    s.scheduleTimerDue = due;
+
+    if (due == INT64_MAX) {
+        CancelWaitableTimer(s.scheduleTimer);
+        return;
+    }
+
+    // Relative, in 100ns units rounded up so it never goes off early; absolute due times are in system time, which isn't what gClock measures
+    int64_t ticksPerSecond = gClock->TicksPerSecond();
+    int64_t wait = std::max<int64_t>(due - gClock->Now(), 0);
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = -std::max<int64_t>((wait * 10'000'000 + ticksPerSecond - 1) / ticksPerSecond, 1);
+    SetWaitableTimer(s.scheduleTimer, &dueTime, 0, nullptr, nullptr, false);
 }
 
-static void DoMouse2Joystick(InputTranslationStruct& its) {
+// Call after the translation core may have changed any gamepad, this is where new states become visible to XInputGetState()
+// `time` is the gClock reading the changes were made at
+static void OnGamepadsChanged(int64_t time, ThreadState& s) {
+    gInputRecorder.RecordPublishedStates(s.its, time);
+
     for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
-        auto& profile = gXiGamepads[userIndex].profile;
-        auto& dev = gXiGamepads[userIndex];
-        auto& extra = its.xiGamepadExtraInfo[userIndex];
-
-        constexpr float kOuterRadius = 10.0f;
-        constexpr float kBounceBack = 0.0f;
-
-        float accuX = extra.accuMouseX;
-        float accuY = extra.accuMouseY;
-        // Distance of mouse from center
-        float r = sqrt(accuX * accuX + accuY * accuY);
-
-        // Clamp to a point on controller circle, if we are outside it
-        if (r > kOuterRadius) {
-            accuX = round(accuX * (kOuterRadius - kBounceBack) / r);
-            accuX = round(accuY * (kOuterRadius - kBounceBack) / r);
-            r = sqrt(accuX * accuX + accuY * accuY);
+        if (!gXiGamepadBindings[userIndex].enabled) {
+            // A slot disabled while buttons were held must not keep repeating them; nothing happens if it was already released
+            s.keystrokes.Reset(userIndex, time);
+            continue;
         }
+        PublishGamepad(userIndex, time);
+        s.keystrokes.Update(userIndex, gXiGamepadsPublished[userIndex].lastPublished, time);
+    }
 
-        float phi = atan2(accuY, accuX);
-
-        auto forStick = [&](auto& conf, auto& ex, short& outX, short& outY) {
-            if (r > conf.sensitivity * kOuterRadius) {
-                float num = r - conf.sensitivity * kOuterRadius;
-                float denom = kOuterRadius - conf.sensitivity * kOuterRadius;
-                SetJoystickPosition(phi, pow(num / denom, conf.nonLinear), conf.invertXAxis, conf.invertYAxis, outX, outY);
-            }
-            else {
-                dev.lstickX = 0;
-                dev.lstickY = 0;
-            }
-        };
-        forStick(profile->lstick.mouse, extra.lstick, dev.lstickX, dev.lstickY);
-        forStick(profile->rstick.mouse, extra.rstick, dev.rstickX, dev.rstickY);
+    // Key events may have started or stopped timed actions or key repeats
+    ArmScheduleTimer(s);
+}
 
-        extra.accuMouseX = 0;
-        extra.accuMouseY = 0;
+// Where coalesced mouse motion ends up
+static void HandOverMouseMotion(HANDLE hDevice, LONG dx, LONG dy, int64_t time, ThreadState& s) {
+    // Before recording, so that replays see the same motion regardless of the DPI configured at the time
+    s.deviceStats.NormalizeMotion(hDevice, dx, dy);
+    if (dx != 0 || dy != 0) {
+        gInputRecorder.RecordMouseMove(hDevice, dx, dy, time);
+        HandleMouseMovement(hDevice, dx, dy, s.its);
     }
 }
 
-static void HandleMouseMovement(HANDLE hDevice, LONG dx, LONG dy, InputTranslationStruct& its) {
-    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
-        if (!gXiGamepadsEnabled[userIndex]) continue;
-        HANDLE src = gXiGamepads[userIndex].srcMouse;
-        if (src != INVALID_HANDLE_VALUE && src != hDevice) continue;
+// Hands the coalesced mouse motion to the translation core
+// Call before anything that has to come after it: key events and the mouse tick
+static void FlushMouseMotion(ThreadState& s) {
+    s.mouseMotion.Flush([&](HANDLE hDevice, LONG dx, LONG dy, int64_t time) { HandOverMouseMotion(hDevice, dx, dy, time, s); });
+}
 
-        auto& extra = its.xiGamepadExtraInfo[userIndex];
+// Looks up the DPI of a mouse in the config, by its name
+static void ApplyConfiguredDpi(const IdevDevice& idev, ThreadState& s) {
+    if (idev.info.dwType != RIM_TYPEMOUSE) return;
+    auto iter = gConfig.mouseDpi.find(idev.nameUtf8);
+    s.deviceStats.SetDpi(idev.hDevice, iter != gConfig.mouseDpi.end() ? iter->second : 0.0f);
+}
+
+// See MouseMotionCoalescer
+static void CoalesceMouseMotion(HANDLE hDevice, LONG dx, LONG dy, int64_t time, ThreadState& s) {
+    s.mouseMotion.Add(hDevice, dx, dy, time, [&](HANDLE device, LONG sumX, LONG sumY, int64_t sumTime) { HandOverMouseMotion(device, sumX, sumY, sumTime, s); });
+}
+
+// Runs everything due by now on the gClock timeline, call whenever the thread wakes up
+static void RunScheduled(ThreadState& s) {
+    int64_t now = std::max(gClock->Now(), s.latestTime);
+    s.latestTime = now;
+    bool changed = AdvanceActions(now, s.its);
+
+    if (now >= s.nextMouseTick) {
+        FlushMouseMotion(s);
+        int64_t elapsed = now - s.lastMouseTick;
+        gInputRecorder.RecordMouseTick(elapsed, s.mouseTickPeriod, now);
+        DoMouse2Joystick(elapsed, s.mouseTickPeriod, s.its);
+        s.lastMouseTick = now;
+        changed = true;
+
+        POINT center;
+        if (gConfig.recenterCursor && s.cursorCapture.Recenter(center) && s.hooks)
+            s.hooks->OnCursorWarped(center);
+
+        s.nextMouseTick += s.mouseTickPeriod;
+        // Fell behind (e.g. the thread didn't get scheduled for a while), skip the missed ticks instead of bursting through them
+        if (s.nextMouseTick <= now)
+            s.nextMouseTick = now + s.mouseTickPeriod;
+    }
 
-        extra.accuMouseX += dx;
-        extra.accuMouseY += dy;
+    if (now >= s.keystrokes.NextDeadline())
+        s.keystrokes.Tick(now);
+
+    // Merged slots read the polled states directly, there is nothing to publish
+    if (now >= s.physicalPoller.NextDeadline() && s.physicalPoller.Poll(now)) {
+        UpdateSlotRoutes(gConfig);
+        s.physicalPoller.Configure(gConfig, now);
     }
+
+    if (changed)
+        OnGamepadsChanged(now, s);
+    else
+        ArmScheduleTimer(s);
 }
 
-static void HandleKeyPress(HANDLE hDevice, BYTE vkey, bool pressed, InputTranslationStruct& its) {
+// Recompiles what the hook backend swallows, call whenever a binding changes or the cursor is captured/released
+static void UpdateSuppression(ThreadState& s) {
+    if (!s.hooks) return;
+
+    uint64_t keys[0x100 / 64] = {};
+    bool mouseStick = false;
     for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
-        if (!gXiGamepadsEnabled[userIndex]) continue;
-        if (IsKeyCodeMouseButton(vkey)) {
-            HANDLE src = gXiGamepads[userIndex].srcMouse;
-            if (src != INVALID_HANDLE_VALUE && src != hDevice) continue;
-        }
-        else {
-            HANDLE src = gXiGamepads[userIndex].srcKbd;
-            if (src != INVALID_HANDLE_VALUE && src != hDevice) continue;
+        const auto& binding = s.its.bindings[userIndex];
+        if (!binding.enabled) continue;
+
+        if (gConfig.suppressBoundKeys) {
+            const auto& btns = s.its.btns[userIndex];
+            const auto& actionKeys = s.its.actions.slots[userIndex].keys;
+            for (size_t vkey = 0; vkey < 0x100; ++vkey) {
+                if (btns.keys[vkey].count > 0 || (vkey < std::size(actionKeys) && actionKeys[vkey] != 0))
+                    keys[vkey / 64] |= 1ull << (vkey % 64);
+            }
         }
+        mouseStick |= binding.sticks[0].useMouse || binding.sticks[1].useMouse;
+    }
 
-        auto& dev = gXiGamepads[userIndex];
-        auto& extra = its.xiGamepadExtraInfo[userIndex];
-
-        bool recompute_lstick = false;
-        bool recompute_rstick = false;
-
-        switch (its.btns[userIndex][vkey]) {
-            using enum XiButton;
-        case A: dev.a = pressed; break;
-        case B: dev.b = pressed; break;
-        case X: dev.x = pressed; break;
-        case Y: dev.y = pressed; break;
-
-        case LB: dev.lb = pressed; break;
-        case RB: dev.rb = pressed; break;
-        case LT: dev.lt = pressed; break;
-        case RT: dev.rt = pressed; break;
-
-        case Start: dev.start = pressed; break;
-        case Back: dev.back = pressed; break;
-
-        case DpadUp: dev.dpadUp = pressed; break;
-        case DpadDown: dev.dpadDown = pressed; break;
-        case DpadLeft: dev.dpadLeft = pressed; break;
-        case DpadRight: dev.dpadRight = pressed; break;
-
-        case LStickBtn: dev.lstickBtn = pressed; break;
-        case RStickBtn: dev.rstickBtn = pressed; break;
-
-            // NOTE: we assume that if any key is setup for the joystick directions, it's on keyboard mode
-            //       that is, we rely on the translation struct being populated from the current user config correctly
-#define STICKBUTTON(THEENUM, STICK, DIR) case THEENUM: recompute_##STICK = true; extra.STICK.DIR = pressed; break;
-            STICKBUTTON(LStickUp, lstick, up);
-            STICKBUTTON(LStickDown, lstick, down);
-            STICKBUTTON(LStickLeft, lstick, left);
-            STICKBUTTON(LStickRight, lstick, right);
-            STICKBUTTON(RStickUp, rstick, up);
-            STICKBUTTON(RStickDown, rstick, down);
-            STICKBUTTON(RStickLeft, rstick, left);
-            STICKBUTTON(RStickRight, rstick, right);
-#undef STICKBUTTON
-
-        case None: break;
-        }
+    // Never swallow hotkeys, even if a profile also binds them
+    for (KeyCode hotkey : { gConfig.hotkeyShowUI, gConfig.hotkeyCaptureCursor })
+        keys[hotkey / 64] &= ~(1ull << (hotkey % 64));
 
-        constexpr int kStickMaxVal = 32767;
-        if (recompute_lstick) {
-            // Stick's actual value per user's speed setting
-            int val = (int)(kStickMaxVal * dev.profile->lstick.kbd.speed);
-            dev.lstickX = (extra.lstick.right ? val : 0) + (extra.lstick.left ? -val : 0);
-            dev.lstickY = (extra.lstick.up ? val : 0) + (extra.lstick.down ? -val : 0);
-        }
-        if (recompute_rstick) {
-            int val = (int)(kStickMaxVal * dev.profile->rstick.kbd.speed);
-            dev.rstickX = (extra.rstick.right ? val : 0) + (extra.rstick.left ? -val : 0);
-            dev.rstickY = (extra.rstick.up ? val : 0) + (extra.rstick.down ? -val : 0);
-        }
+    for (size_t i = 0; i < std::size(keys); ++i)
+        s.hooks->suppression.keys[i].store(keys[i], std::memory_order_relaxed);
+    s.hooks->suppression.mouseMotion.store(gConfig.suppressMouseStickMotion && mouseStick && s.cursorCapture.Active(), std::memory_order_relaxed);
+}
 
-        ++dev.epoch;
-    }
+static void ReleaseCursor(ThreadState& s) {
+    if (!s.cursorCapture.Active()) return;
+    auto& c = s.cursorCapture;
+    LOG(Input, Debug, L"Released cursor, clip was reasserted {} times after moves/resizes and {} times after being dropped", c.reassertsMoved, c.reassertsDropped);
+    c.Stop();
+    UpdateSuppression(s);
 }
 
 static bool HandleHotkeys(BYTE vkey, ThreadState& s) {
@@ -310,48 +259,26 @@ static bool HandleHotkeys(BYTE vkey, ThreadState& s) {
         ShowWindow(s.mainWindow, SW_SHOWNORMAL);
         SetFocus(s.mainWindow);
         s.blockingMessagePump = false;
+        s.uiDirty = true;
 
         return true;
     }
     else if (vkey == gConfig.hotkeyCaptureCursor) {
         if (auto hostHwnd = s.uiState->mainHostHwnd) {
-            if (s.capturingCursor) {
-                ClipCursor(nullptr);
-                ShowCursor(true);
-
-                s.capturingCursor = false;
-                LOG_DEBUG(L"Released cursor");
+            if (s.cursorCapture.Active()) {
+                ReleaseCursor(s);
             }
             else {
-                // Get window-space rect of client area
-                RECT clientRect;
-                GetClientRect(hostHwnd, &clientRect);
-
-                POINT tl;
-                tl.x = clientRect.left;
-                tl.y = clientRect.top;
-                POINT br;
-                br.x = clientRect.right;
-                br.y = clientRect.bottom;
-
-                // Map window-space rect to screen-space
-                MapWindowPoints(hostHwnd, nullptr, &tl, 1);
-                MapWindowPoints(hostHwnd, nullptr, &br, 1);
-
-                RECT rect;
-                rect.left = tl.x;
-                rect.top = tl.y;
-                rect.right = br.x;
-                rect.bottom = br.y;
-                ClipCursor(&rect);
-                ShowCursor(false);
-
-                s.capturingCursor = true;
-                LOG_DEBUG(L"Captured cursor");
+                // Without foreground tracking, assume the hotkey was pressed in the game
+                bool inForeground = !s.foregroundTracking || s.foreground.ForegroundHostWindow() == hostHwnd;
+                if (s.cursorCapture.Start(hostHwnd, inForeground)) {
+                    UpdateSuppression(s);
+                    LOG(Input, Debug, L"Captured cursor");
+                }
             }
         }
         else {
-            LOG_DEBUG(L"Main game window not selected, cannot capture cursor");
+            LOG(Input, Warning, L"Main game window not selected, cannot capture cursor");
         }
 
         return true;
@@ -359,6 +286,146 @@ static bool HandleHotkeys(BYTE vkey, ThreadState& s) {
     return false;
 }
 
+// Suspends the gamepads set to ForegroundOnly while the game is in the background, and resumes them once it's back
+// Call whenever the foreground or a binding changes
+static void UpdateForegroundGating(ThreadState& s) {
+    bool background = s.foregroundTracking && !s.foreground.HostInForeground();
+    int64_t now = std::max(gClock->Now(), s.latestTime);
+    s.latestTime = now;
+    // Motion from before the switch still belongs to the gamepads
+    FlushMouseMotion(s);
+
+    bool changed = false;
+    bool anyActive = false;
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        const auto& binding = s.its.bindings[userIndex];
+        if (!binding.enabled) continue;
+
+        bool suspend = background && gConfig.foregroundOnly[userIndex];
+        anyActive |= !suspend;
+        if (binding.suspended == suspend) continue;
+
+        SetGamepadSuspended(userIndex, suspend, now, s.its);
+        gInputRecorder.RecordSuspended(userIndex, suspend, now);
+        LOG(Input, Debug, L"{} gamepad {}", suspend ? L"Suspended" : L"Resumed", userIndex);
+        changed = true;
+    }
+    s.inputGatedOut = background && !anyActive;
+
+    if (changed)
+        OnGamepadsChanged(now, s);
+}
+
+// Feeds one event from the input backend into the translation core, unless the input thread has a use for it itself
+static void ProcessInputEvent(const InputEvent& e, ThreadState& s) {
+    // Nobody would take it: skip everything but what the input thread itself needs, i.e. hotkeys and UI device capture
+    if (s.inputGatedOut && e.type == InputEvent::Type::MouseMove)
+        return;
+
+    int64_t time = std::max(e.time, s.latestTime);
+    s.latestTime = time;
+
+    s.deviceStats.OnEvent(e, time);
+
+    switch (e.type) {
+    case InputEvent::Type::Key: {
+        // Button edges keep their place relative to motion, e.g. a filter set by this very click mustn't apply to motion before it
+        FlushMouseMotion(s);
+
+        if (e.pressed) {
+            if (IsKeyCodeMouseButton(e.vkey)) {
+                if (s.uiState->bindIdevFromNextMouse != -1) {
+                    s.its.SetDeviceFilter(s.uiState->bindIdevFromNextMouse, true, e.device);
+                    gInputRecorder.RecordFilter(s.uiState->bindIdevFromNextMouse, true, e.device);
+                    s.uiState->bindIdevFromNextMouse = -1;
+                    return;
+                }
+            }
+            else {
+                if (HandleHotkeys(e.vkey, s))
+                    return;
+
+                if (s.uiState->bindIdevFromNextKey != -1) {
+                    s.its.SetDeviceFilter(s.uiState->bindIdevFromNextKey, false, e.device);
+                    gInputRecorder.RecordFilter(s.uiState->bindIdevFromNextKey, false, e.device);
+                    s.uiState->bindIdevFromNextKey = -1;
+                    return;
+                }
+            }
+        }
+
+        if (s.inputGatedOut)
+            return;
+        DispatchKeyPress(e.device, e.vkey, e.pressed, time, s);
+    } break;
+
+    case InputEvent::Type::MouseMove: {
+        CoalesceMouseMotion(e.device, e.dx, e.dy, time, s);
+    } break;
+    }
+}
+
+// Handles everything the input backend published so far
+static void DrainInputEvents(ThreadState& s) {
+    InputEventBatch batch;
+    while (s.inputSink->queue.TryPop(batch)) {
+        bool anyKey = false;
+        for (uint32_t i = 0; i < batch.count; ++i) {
+            ProcessInputEvent(batch.events[i], s);
+            anyKey |= batch.events[i].type == InputEvent::Type::Key;
+        }
+        // A batch is one burst of input, publish once for all of it
+        // Motion alone changes nothing until the mouse tick, which publishes by itself
+        if (anyKey)
+            OnGamepadsChanged(s.latestTime, s);
+    }
+}
+
+// Starts the backend selected in the config, falling back to raw input if it can't run
+static bool StartInputBackend(ThreadState& s) {
+    s.inputSink = std::make_unique<InputEventSink>();
+
+    auto type = gConfig.inputBackend;
+    if (type == InputBackendType::RawInput && (gConfig.suppressBoundKeys || gConfig.suppressMouseStickMotion)) {
+        LOG(Input, Info, L"Suppressing bound input needs low level hooks, using them instead of raw input");
+        type = InputBackendType::Hooks;
+    }
+
+    switch (type) {
+    case InputBackendType::RawInput: break;
+    case InputBackendType::Hooks: {
+        auto hooks = std::make_unique<HookInputBackend>();
+        s.hooks = hooks.get();
+        s.backend = std::move(hooks);
+    } break;
+    case InputBackendType::Replay: s.backend = std::make_unique<ReplayInputBackend>(GetDesignatedRecordingPath()); break;
+    case InputBackendType::Synthetic: s.backend = std::make_unique<SyntheticInputBackend>(gConfig.syntheticEventRate, gConfig.syntheticSeed); break;
+    }
+
+    if (s.backend) {
+        HANDLE inputEvent = s.inputEvent;
+        s.inputSink->notify = [inputEvent]() { SetEvent(inputEvent); };
+        if (!s.backend->Start(*s.inputSink)) {
+            LOG(Input, Warning, L"Cannot start the {} input backend, using raw input instead", s.backend->Name());
+            s.hooks = nullptr;
+            s.backend = nullptr;
+            s.inputSink->notify = nullptr;
+        }
+    }
+
+    if (!s.backend) {
+        auto rawInput = std::make_unique<RawInputBackend>(s.mainWindow);
+        if (!rawInput->Start(*s.inputSink))
+            return false;
+        s.rawInput = rawInput.get();
+        s.backend = std::move(rawInput);
+    }
+
+    LOG(Input, Info, L"Input backend: {}", s.backend->Name());
+    UpdateSuppression(s);
+    return true;
+}
+
 static void CleanupRenderTarget(ThreadState& s) {
     if (s.mainRenderTargetView) {
         s.mainRenderTargetView->Release();
@@ -423,21 +490,14 @@ static LRESULT CALLBACK InputSrc_WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LP
     auto& s = *(ThreadState*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
 
     switch (uMsg) {
-    case WM_TIMER: {
-        auto timerID = (UINT_PTR)wParam;
-
-        switch (timerID) {
-        case kMouseCheckTimerID: {
-            DoMouse2Joystick(s.its);
-            return 0;
-        }
-
-        default: break;
-        }
+    case WM_ACTIVATE: {
+        s.uiFocused = LOWORD(wParam) != WA_INACTIVE;
+        s.uiDirty = true;
         break;
     }
 
     case WM_SIZE: {
+        s.uiDirty = true;
         if (wParam == SIZE_MINIMIZED)
             return 0;
         auto resizeWidth = (UINT)LOWORD(lParam);
@@ -462,87 +522,19 @@ static LRESULT CALLBACK InputSrc_WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LP
     }
 
     case WM_INPUT: {
-        HRAWINPUT hri = (HRAWINPUT)lParam;
-
-        UINT size = 0;
-        GetRawInputData(hri, RID_INPUT, nullptr, &size, sizeof(RAWINPUTHEADER));
-        if (size > s.rawinputSize || s.rawinput == nullptr) {
-            s.rawinput = std::make_unique<std::byte[]>(size);
-            s.rawinputSize = size;
+        if (s.rawInput) {
+            s.rawInput->OnWmInput((HRAWINPUT)lParam, gClock->Now());
+            DrainInputEvents(s);
         }
-
-        if (GetRawInputData(hri, RID_INPUT, s.rawinput.get(), &size, sizeof(RAWINPUTHEADER)) == (UINT)-1) {
-            LOG_DEBUG(L"GetRawInputData() failed");
-            break;
-        }
-        RAWINPUT* ri = (RAWINPUT*)s.rawinput.get();
-
-        // We are going to modify/push data onto XiGamepad's below, from this input event
-        SrwExclusiveLock lock(gXiGamepadsLock);
-
-        switch (ri->header.dwType) {
-        case RIM_TYPEMOUSE: {
-            const auto& mouse = ri->data.mouse;
-
-            // If any button is pressed...
-            if (mouse.usButtonFlags != 0) {
-                if (s.uiState->bindIdevFromNextMouse != -1) {
-                    gXiGamepads[s.uiState->bindIdevFromNextMouse].srcMouse = ri->header.hDevice;
-                    s.uiState->bindIdevFromNextMouse = -1;
-                    break;
-                }
-            }
-
-            if (mouse.usButtonFlags & RI_MOUSE_LEFT_BUTTON_DOWN) HandleKeyPress(ri->header.hDevice, VK_LBUTTON, true, s.its);
-            if (mouse.usButtonFlags & RI_MOUSE_LEFT_BUTTON_UP) HandleKeyPress(ri->header.hDevice, VK_LBUTTON, false, s.its);
-            if (mouse.usButtonFlags & RI_MOUSE_RIGHT_BUTTON_DOWN) HandleKeyPress(ri->header.hDevice, VK_RBUTTON, true, s.its);
-            if (mouse.usButtonFlags & RI_MOUSE_RIGHT_BUTTON_UP) HandleKeyPress(ri->header.hDevice, VK_RBUTTON, false, s.its);
-            if (mouse.usButtonFlags & RI_MOUSE_MIDDLE_BUTTON_DOWN) HandleKeyPress(ri->header.hDevice, VK_MBUTTON, true, s.its);
-            if (mouse.usButtonFlags & RI_MOUSE_MIDDLE_BUTTON_UP) HandleKeyPress(ri->header.hDevice, VK_MBUTTON, false, s.its);
-            if (mouse.usButtonFlags & RI_MOUSE_BUTTON_4_DOWN) HandleKeyPress(ri->header.hDevice, VK_XBUTTON1, true, s.its);
-            if (mouse.usButtonFlags & RI_MOUSE_BUTTON_4_UP) HandleKeyPress(ri->header.hDevice, VK_XBUTTON1, false, s.its);
-            if (mouse.usButtonFlags & RI_MOUSE_BUTTON_5_DOWN) HandleKeyPress(ri->header.hDevice, VK_XBUTTON2, true, s.its);
-            if (mouse.usButtonFlags & RI_MOUSE_BUTTON_5_UP) HandleKeyPress(ri->header.hDevice, VK_XBUTTON2, false, s.its);
-
-            if (mouse.usFlags & MOUSE_MOVE_ABSOLUTE) {
-                LOG_DEBUG("Warning: RAWINPUT reported absolute mouse corrdinates, not supported");
-                break;
-            } // else: MOUSE_MOVE_RELATIVE
-
-            HandleMouseMovement(ri->header.hDevice, mouse.lLastX, mouse.lLastY, s.its);
-        } break;
-
-        case RIM_TYPEKEYBOARD: {
-            const auto& kbd = ri->data.keyboard;
-
-            // This message is a part of a longer makecode sequence -- the actual Vkey is in another one
-            if (kbd.VKey == 0xFF)
-                break;
-            // All of the relevant keys that we support fit in a BYTE
-            if (kbd.VKey > 0xFF)
-                break;
-
-            bool press = !(kbd.Flags & RI_KEY_BREAK);
-
-            // If any key is pressed...
-            if (press) {
-                if (HandleHotkeys(kbd.VKey, s))
-                    break;
-
-                if (s.uiState->bindIdevFromNextKey != -1) {
-                    gXiGamepads[s.uiState->bindIdevFromNextKey].srcKbd = ri->header.hDevice;
-                    s.uiState->bindIdevFromNextKey = -1;
-                    break;
-                }
-            }
-
-            HandleKeyPress(ri->header.hDevice, (BYTE)kbd.VKey, press, s.its);
-        } break;
-        }
-
         return 0;
     }
 
+    case WM_DISPLAYCHANGE: {
+        if (s.rawInput)
+            s.rawInput->OnDisplayChange();
+        break;
+    }
+
     case WM_INPUT_DEVICE_CHANGE: {
         HANDLE hDevice = (HANDLE)lParam;
 
@@ -557,7 +549,8 @@ static LRESULT CALLBACK InputSrc_WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LP
             s.devices.push_back(IdevDevice::FromHANDLE(hDevice));
 
             const auto& idev = s.devices.back();
-            LOG_DEBUG("Connected {} {}", RawInputTypeToString(idev.info.dwType), idev.nameWide);
+            LOG(Input, Info, "Connected {} {}", RawInputTypeToString(idev.info.dwType), idev.nameWide);
+            ApplyConfiguredDpi(idev, s);
         }
         else if (wParam == GIDC_REMOVAL) {
             // HACK: this relies on std::erase_if only visiting each element once (which is almost necessarily the case) but still technically not standard-compliant
@@ -566,13 +559,17 @@ static LRESULT CALLBACK InputSrc_WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LP
                 s.devices,
                 [&](const IdevDevice& idev) {
                     if (idev.hDevice == hDevice) {
-                        LOG_DEBUG("Disconnected {} {}", RawInputTypeToString(idev.info.dwType), idev.nameWide);
+                        LOG(Input, Info, "Disconnected {} {}", RawInputTypeToString(idev.info.dwType), idev.nameWide);
                         return true;
                     }
                     else {
                         return false;
                     }
                 });
+            // Handles get reused for other devices
+            s.deviceStats.devices.erase(hDevice);
+            if (s.deviceStats.calibration.device == hDevice)
+                s.deviceStats.CancelCalibration();
         }
 
         return 0;
@@ -584,16 +581,74 @@ static LRESULT CALLBACK InputSrc_WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LP
 
 void RunInputSource() {
     LOG_DEBUG(L"Starting input source window");
+    // Everything acquired below is released by the guards following it, in reverse order, on any way out of here
+    DEFER {
+        LOG_DEBUG(L"Stopping working thread");
+        FlushLogs();
+    };
 
     ThreadState s;
     UIState us;
     s.uiState = &us;
+    us.its = &s.its;
+    us.devices = &s.devices;
+    us.deviceStats = &s.deviceStats;
+
+    s.scheduleTimer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!s.scheduleTimer) {
+        // High resolution timers need Windows 10 1803; a regular one is only as precise as the system timer resolution
+        LOG(Input, Info, L"High resolution waitable timer unavailable, timed actions will be less precise");
+        s.scheduleTimer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+    }
+    if (!s.scheduleTimer) {
+        LOG(Input, Error, L"Error creating waitable timer: {}", GetLastErrorStr());
+        return;
+    }
+    DEFER { CloseHandle(s.scheduleTimer); };
+    s.inputEvent = CreateEventW(nullptr, false, false, nullptr);
+    if (!s.inputEvent) {
+        LOG(Input, Error, L"Error creating event: {}", GetLastErrorStr());
+        return;
+    }
+    DEFER { CloseHandle(s.inputEvent); };
+
+    s.its.actions.SetClock(gClock->TicksPerSecond(), gClock->Now());
+    s.keystrokes.SetClock(gClock->TicksPerSecond());
+    s.deviceStats.ticksPerSecond = gClock->TicksPerSecond();
 
     gConfigEvents.onMouseCheckFrequencyChanged += [&](int newFrequency) {
-        SetTimer(nullptr, kMouseCheckTimerID, newFrequency, nullptr);
+        // MouseCheckFrequency is the tick period in milliseconds
+        int64_t now = gClock->Now();
+        s.mouseTickPeriod = gClock->FromMilliseconds(std::max(newFrequency, 0));
+        s.lastMouseTick = now;
+        s.nextMouseTick = s.mouseTickPeriod > 0 ? now + s.mouseTickPeriod : INT64_MAX;
+        ArmScheduleTimer(s);
+    };
+    gConfigEvents.onFixedPointMouseSticksChanged += [&](bool fixedPoint) {
+        s.its.fixedPointMouseSticks = fixedPoint;
+    };
+    gConfigEvents.onMouseDpiChanged += [&]() {
+        for (const auto& idev : s.devices)
+            ApplyConfiguredDpi(idev, s);
     };
     gConfigEvents.onGamepadBindingChanged += [&](int userIndex, const std::string& profileName, const UserProfile& profile) {
         s.its.PopulateBtnLut(userIndex, profile);
+        s.its.PopulateSticks(userIndex, profile);
+        s.its.PopulateActions(userIndex, profile);
+        s.its.PopulateKernel(userIndex);
+        // The new binding starts from a released gamepad, key repeats of the old one stop here
+        s.keystrokes.Reset(userIndex, gClock->Now());
+        UpdateSuppression(s);
+        // Binding resets the gamepad, including its suspension
+        UpdateForegroundGating(s);
+        // The gamepad was just enabled, which may have turned on merging
+        s.physicalPoller.Configure(gConfig, gClock->Now());
+        ArmScheduleTimer(s);
+        gInputRecorder.RecordBinding(userIndex, profileName);
+    };
+    gConfigEvents.onSlotRoutingChanged += [&]() {
+        s.physicalPoller.Configure(gConfig, gClock->Now());
+        ArmScheduleTimer(s);
     };
     ReloadConfigFromDesignatedPath();
 
@@ -604,9 +659,10 @@ void RunInputSource() {
     wc.lpszClassName = L"WinXInputEmu";
     ATOM atom = RegisterClassExW(&wc);
     if (!atom) {
-        LOG_DEBUG(L"Error creating Input Source window class: {}", GetLastErrorStr());
+        LOG(UI, Error, L"Error creating Input Source window class: {}", GetLastErrorStr());
         return;
     }
+    DEFER { UnregisterClassW(MAKEINTATOM(atom), gHModule); };
 
     s.mainWindow = CreateWindowExW(
         0,
@@ -625,13 +681,16 @@ void RunInputSource() {
         NULL   // Additional application data
     );
     if (s.mainWindow == nullptr) {
-        LOG_DEBUG(L"Error creating Input Source window: {}", GetLastErrorStr());
+        LOG(UI, Error, L"Error creating Input Source window: {}", GetLastErrorStr());
         return;
     }
+    // Or the class can't be unregistered
+    DEFER { DestroyWindow(s.mainWindow); };
 
+    // Also cleans up after a partially failed CreateDeviceD3D()
+    DEFER { CleanupDeviceD3D(s); };
     if (!CreateDeviceD3D(s, s.mainWindow)) {
-        CleanupDeviceD3D(s);
-        LOG_DEBUG(L"Error creating D3D context");
+        LOG(UI, Error, L"Error creating D3D context");
         return;
     }
 
@@ -639,23 +698,39 @@ void RunInputSource() {
     ShowWindow(s.mainWindow, SW_SHOWDEFAULT);
     UpdateWindow(s.mainWindow);
 
-    RAWINPUTDEVICE rid[2];
-
-    // We don't use RIDEV_NOLEGACY because all the window manipulation (e.g. dragging the title bar) relies on the "legacy messages"
-    // RIDEV_INPUTSINK so that we get input even if the game window is current in focus instead
-    rid[0].usUsagePage = HID_USAGE_PAGE_GENERIC;
-    rid[0].dwFlags = RIDEV_DEVNOTIFY | RIDEV_INPUTSINK;
-    rid[0].usUsage = HID_USAGE_GENERIC_KEYBOARD;
-    rid[0].hwndTarget = s.mainWindow;
-
-    rid[1].usUsagePage = HID_USAGE_PAGE_GENERIC;
-    rid[1].dwFlags = RIDEV_DEVNOTIFY | RIDEV_INPUTSINK;
-    rid[1].usUsage = HID_USAGE_GENERIC_MOUSE;
-    rid[1].hwndTarget = s.mainWindow;
-
-    if (RegisterRawInputDevices(rid, std::size(rid), sizeof(RAWINPUTDEVICE)) == false) {
+    s.foreground.onForegroundChanged = [&]() {
+        // Whichever host window the user was in last is the game window, unless picked in the UI since
+        if (HWND host = s.foreground.ForegroundHostWindow())
+            us.mainHostHwnd = host;
+        // Windows drops the clip on foreground changes anyway; it's put back once the game is in front again
+        s.cursorCapture.OnForegroundChanged(s.foreground.ForegroundHostWindow() == s.cursorCapture.Window());
+        UpdateForegroundGating(s);
+        s.uiDirty = true;
+    };
+    s.foreground.onWindowDestroyed = [&](HWND hwnd) {
+        if (s.cursorCapture.Window() == hwnd)
+            ReleaseCursor(s);
+        if (us.mainHostHwnd != hwnd) return;
+        us.mainHostHwnd = nullptr;
+        s.uiDirty = true;
+    };
+    s.foregroundTracking = s.foreground.Start();
+    // The hooks' callbacks point into `s`
+    DEFER { s.foreground.Stop(); };
+    if (s.foregroundTracking)
+        UpdateForegroundGating(s);
+    else
+        LOG(Input, Warning, L"Cannot track the foreground window, ForegroundOnly has no effect");
+    us.hostWindows = &s.foreground.HostWindows();
+    us.cursorCapture = &s.cursorCapture;
+
+    if (!StartInputBackend(s))
         return;
-    }
+    DEFER {
+        ReleaseCursor(s);
+        s.backend->Stop();
+        gInputRecorder.Stop();
+    };
 
     // NB: we still can't run multiple copies of this thread, because ImGui context is global
     IMGUI_CHECKVERSION();
@@ -666,6 +741,23 @@ void RunInputSource() {
 
     ImGui_ImplWin32_Init(s.mainWindow);
     ImGui_ImplDX11_Init(s.d3dDevice, s.d3dDeviceContext);
+    DEFER {
+        ImGui_ImplDX11_Shutdown();
+        ImGui_ImplWin32_Shutdown();
+        ImGui::DestroyContext();
+    };
+
+    using Clock = std::chrono::steady_clock;
+    auto lastFrameTime = Clock::now();
+    auto statsWindowStart = lastFrameTime;
+    int settleFrames = kUISettleFrames;
+    uint32_t framesRendered = 0;
+    uint32_t framesSkipped = 0;
+    // Whether the frame currently held back was already counted in framesSkipped
+    bool frameHeldBack = false;
+
+    // In MsgWaitForMultipleObjectsEx() result order
+    HANDLE waitHandles[] = { s.scheduleTimer, s.inputEvent };
 
     LOG_DEBUG(L"Starting working thread's main loop");
     while (true) {
@@ -673,23 +765,88 @@ void RunInputSource() {
 
         // The blocking message pump
         // We'll block here, until one of the messages changes changes blockingMessagePump to false (i.e. we should be rendering again) ...
-        while (s.blockingMessagePump && GetMessageW(&msg, nullptr, 0, 0)) {
-            TranslateMessage(&msg);
-            DispatchMessageW(&msg);
-            if (msg.message == WM_QUIT)
-                goto cleanup;
+        // Not GetMessageW(): that wouldn't wake up for scheduled work
+        while (s.blockingMessagePump) {
+            if (MsgWaitForMultipleObjectsEx((DWORD)std::size(waitHandles), waitHandles, INFINITE, QS_ALLINPUT, MWMO_INPUTAVAILABLE) == WAIT_OBJECT_0)
+                s.scheduleTimerDue = INT64_MAX;
+            DrainInputEvents(s);
+            RunScheduled(s);
+            while (s.blockingMessagePump && PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+                TranslateMessage(&msg);
+                DispatchMessageW(&msg);
+                if (msg.message == WM_QUIT)
+                    return;
+            }
         }
 
         // ... in which case the above loop breaks, and we come here (regular polling message pump) to process the rest, and then enter regular main loop doing rendering + polling
         while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+            // Anything but the input source's own traffic is directed at the UI: mouse, keyboard, paint, etc.
+            if (msg.hwnd == s.mainWindow && msg.message != WM_INPUT && msg.message != WM_INPUT_DEVICE_CHANGE && msg.message != WM_TIMER)
+                s.uiDirty = true;
+
             TranslateMessage(&msg);
             DispatchMessageW(&msg);
 
             // WM_QUIT is gaurenteed to only exist when there is nothing else in the message queue, we can safely exit immediately
             if (msg.message == WM_QUIT)
-                goto cleanup;
+                return;
+        }
+
+        DrainInputEvents(s);
+        RunScheduled(s);
+
+        if (s.blockingMessagePump)
+            continue;
+
+        auto now = Clock::now();
+        if (now - statsWindowStart >= 1s) {
+            float secs = std::chrono::duration<float>(now - statsWindowStart).count();
+            us.uiFramesRenderedPerSec = framesRendered / secs;
+            us.uiFramesSkippedPerSec = framesSkipped / secs;
+            framesRendered = 0;
+            framesSkipped = 0;
+            statsWindowStart = now;
+        }
+
+        if (s.uiDirty) {
+            s.uiDirty = false;
+            settleFrames = kUISettleFrames;
         }
 
+        // Figure out if we should render now, or otherwise until when we can sleep
+        auto sinceLastFrame = now - lastFrameTime;
+        Clock::duration minInterval = s.uiFocused ? 0ms : kUIUnfocusedFrameInterval;
+        Clock::duration heartbeat = s.uiFocused ? kUIFocusedHeartbeat : kUIUnfocusedHeartbeat;
+        if (ImGui::GetIO().WantTextInput)
+            heartbeat = kUIAnimationInterval;
+        bool wantFrame = settleFrames > 0 || sinceLastFrame >= heartbeat;
+        if (!wantFrame && UIWatchedStateChanged(us)) {
+            wantFrame = true;
+            minInterval = std::max<Clock::duration>(minInterval, kUIStateChangeFrameInterval);
+        }
+
+        if (!wantFrame || sinceLastFrame < minInterval) {
+            // Once per frame that was due but is held back by the frame rate cap, not on every wakeup (which happens on each WM_INPUT)
+            if (wantFrame && !frameHeldBack) {
+                ++framesSkipped;
+                frameHeldBack = true;
+            }
+
+            auto wakeAt = lastFrameTime + (wantFrame ? minInterval : heartbeat);
+            auto timeout = std::chrono::ceil<std::chrono::milliseconds>(std::max<Clock::duration>(wakeAt - now, 0ms));
+            // Wakes up on any new message, including WM_INPUT, on events from other backends and on scheduled work, so input latency isn't affected
+            if (MsgWaitForMultipleObjectsEx((DWORD)std::size(waitHandles), waitHandles, (DWORD)timeout.count(), QS_ALLINPUT, MWMO_INPUTAVAILABLE) == WAIT_OBJECT_0)
+                s.scheduleTimerDue = INT64_MAX;
+            continue;
+        }
+
+        ++framesRendered;
+        frameHeldBack = false;
+        lastFrameTime = now;
+        if (settleFrames > 0)
+            --settleFrames;
+
         ImGui_ImplDX11_NewFrame();
         ImGui_ImplWin32_NewFrame();
         ImGui::NewFrame();
@@ -706,16 +863,4 @@ void RunInputSource() {
 
         s.swapChain->Present(1, 0); // Present with vsync
     }
-
-cleanup:
-    ImGui_ImplDX11_Shutdown();
-    ImGui_ImplWin32_Shutdown();
-    ImGui::DestroyContext();
-
-    CleanupDeviceD3D(s);
-    // Do we actually need this?
-    //DestroyWindow(s.mainWindow);
-    UnregisterClassW(MAKEINTATOM(atom), gHModule);
-
-    LOG_DEBUG(L"Stopping working thread");
 }
@@ -0,0 +1,174 @@
+#include "pch.h"
+
+#include "keystroke.h"
+
+#include <bit>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define CPU_RELAX() _mm_pause()
+#else
+#define CPU_RELAX() ((void)0)
+#endif
+
+XiKeystrokeQueue gXiKeystrokeQueues[XUSER_MAX_COUNT];
+
+bool XiKeystrokeQueue::TryPop(XINPUT_KEYSTROKE& out) noexcept {
+    // Another reader only holds this for one pop, so reporting ERROR_EMPTY right away would be spurious
+    for (int attempt = 0; consumerBusy.exchange(true, std::memory_order_acquire); ++attempt) {
+        if (attempt >= kConsumerSpins + kConsumerYields)
+            return false;
+        // Yielding is for a reader that got preempted while holding it
+        if (attempt < kConsumerSpins)
+            CPU_RELAX();
+        else
+            std::this_thread::yield();
+    }
+    bool res = ring.TryPop(out);
+    consumerBusy.store(false, std::memory_order_release);
+    return res;
+}
+
+// Index i of this table is the bit i in KeystrokeGenerator::Slot::held
+static constexpr WORD kPadKeys[KeystrokeGenerator::kNumPadButtons] = {
+    VK_PAD_A, VK_PAD_B, VK_PAD_X, VK_PAD_Y,
+    VK_PAD_RSHOULDER, VK_PAD_LSHOULDER,
+    VK_PAD_LTRIGGER, VK_PAD_RTRIGGER,
+    VK_PAD_DPAD_UP, VK_PAD_DPAD_DOWN, VK_PAD_DPAD_LEFT, VK_PAD_DPAD_RIGHT,
+    VK_PAD_START, VK_PAD_BACK,
+    VK_PAD_LTHUMB_PRESS, VK_PAD_RTHUMB_PRESS,
+};
+
+// Maps a deflected stick to one of 8 directions, each covering 45°
+// `base` is VK_PAD_LTHUMB_UP or VK_PAD_RTHUMB_UP, the other 7 codes follow it in the same order for both sticks
+static WORD ThumbDirection(SHORT x, SHORT y, SHORT deadzone, WORD base) noexcept {
+    int ax = std::abs((int)x);
+    int ay = std::abs((int)y);
+    // Compare squared magnitude against the deadzone, i.e. a radial deadzone
+    if ((int64_t)x * x + (int64_t)y * y <= (int64_t)deadzone * deadzone)
+        return 0;
+
+    // tan(67.5°) ~= 2.414 ~= 70/29, the boundary between a straight and a diagonal direction
+    bool vertical = ay * 29 > ax * 70;
+    bool horizontal = ax * 29 > ay * 70;
+    int offset;
+    if (vertical) offset = y > 0 ? 0 /*UP*/ : 1 /*DOWN*/;
+    else if (horizontal) offset = x > 0 ? 2 /*RIGHT*/ : 3 /*LEFT*/;
+    else if (y > 0) offset = x < 0 ? 4 /*UPLEFT*/ : 5 /*UPRIGHT*/;
+    else offset = x > 0 ? 6 /*DOWNRIGHT*/ : 7 /*DOWNLEFT*/;
+    return (WORD)(base + offset);
+}
+
+static void Emit(int userIndex, WORD vkey, WORD flags) noexcept {
+    XINPUT_KEYSTROKE ks = {};
+    ks.VirtualKey = vkey;
+    ks.Flags = flags;
+    ks.UserIndex = (BYTE)userIndex;
+    auto& queue = gXiKeystrokeQueues[userIndex];
+    if (!queue.ring.TryPush(ks))
+        queue.dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+namespace {
+struct PadKeys {
+    uint16_t held = 0;
+    WORD lthumb = 0;
+    WORD rthumb = 0;
+};
+}
+
+static PadKeys ComputePadKeys(const XINPUT_GAMEPAD& g) noexcept {
+    PadKeys res;
+    auto set = [&](int bit, bool v) { if (v) res.held |= (uint16_t)(1u << bit); };
+    set(0, g.wButtons & XINPUT_GAMEPAD_A);
+    set(1, g.wButtons & XINPUT_GAMEPAD_B);
+    set(2, g.wButtons & XINPUT_GAMEPAD_X);
+    set(3, g.wButtons & XINPUT_GAMEPAD_Y);
+    set(4, g.wButtons & XINPUT_GAMEPAD_RIGHT_SHOULDER);
+    set(5, g.wButtons & XINPUT_GAMEPAD_LEFT_SHOULDER);
+    set(6, g.bLeftTrigger > XINPUT_GAMEPAD_TRIGGER_THRESHOLD);
+    set(7, g.bRightTrigger > XINPUT_GAMEPAD_TRIGGER_THRESHOLD);
+    set(8, g.wButtons & XINPUT_GAMEPAD_DPAD_UP);
+    set(9, g.wButtons & XINPUT_GAMEPAD_DPAD_DOWN);
+    set(10, g.wButtons & XINPUT_GAMEPAD_DPAD_LEFT);
+    set(11, g.wButtons & XINPUT_GAMEPAD_DPAD_RIGHT);
+    set(12, g.wButtons & XINPUT_GAMEPAD_START);
+    set(13, g.wButtons & XINPUT_GAMEPAD_BACK);
+    set(14, g.wButtons & XINPUT_GAMEPAD_LEFT_THUMB);
+    set(15, g.wButtons & XINPUT_GAMEPAD_RIGHT_THUMB);
+    res.lthumb = ThumbDirection(g.sThumbLX, g.sThumbLY, XINPUT_GAMEPAD_LEFT_THUMB_DEADZONE, VK_PAD_LTHUMB_UP);
+    res.rthumb = ThumbDirection(g.sThumbRX, g.sThumbRY, XINPUT_GAMEPAD_RIGHT_THUMB_DEADZONE, VK_PAD_RTHUMB_UP);
+    return res;
+}
+
+void KeystrokeGenerator::SetClock(int64_t ticksPerSecond) noexcept {
+    repeatDelay = ticksPerSecond * kRepeatDelayMs / 1000;
+    repeatInterval = ticksPerSecond * kRepeatIntervalMs / 1000;
+}
+
+void KeystrokeGenerator::Update(int userIndex, const XINPUT_GAMEPAD& gamepad, int64_t now) noexcept {
+    auto& slot = slots[userIndex];
+    auto curr = ComputePadKeys(gamepad);
+
+    auto press = [&](WORD vkey) {
+        Emit(userIndex, vkey, XINPUT_KEYSTROKE_KEYDOWN);
+        slot.repeatKey = vkey;
+        slot.nextRepeat = now + repeatDelay;
+    };
+    auto release = [&](WORD vkey) {
+        Emit(userIndex, vkey, XINPUT_KEYSTROKE_KEYUP);
+        if (slot.repeatKey == vkey)
+            slot.repeatKey = 0;
+    };
+
+    // Buttons and triggers
+    uint32_t changed = slot.held ^ curr.held;
+    while (changed) {
+        int bit = std::countr_zero(changed);
+        changed &= changed - 1;
+        if (curr.held & (1u << bit))
+            press(kPadKeys[bit]);
+        else
+            release(kPadKeys[bit]);
+    }
+
+    // Thumb directions: moving from one direction to another is a key up followed by a key down
+    auto thumb = [&](WORD& prevKey, WORD currKey) {
+        if (prevKey == currKey) return;
+        if (prevKey) release(prevKey);
+        if (currKey) press(currKey);
+        prevKey = currKey;
+    };
+    thumb(slot.lthumbKey, curr.lthumb);
+    thumb(slot.rthumbKey, curr.rthumb);
+
+    slot.held = curr.held;
+}
+
+void KeystrokeGenerator::Tick(int64_t now) noexcept {
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        auto& slot = slots[userIndex];
+        if (slot.repeatKey == 0) continue;
+        // Catch up without bursting, if the tick was late
+        if (now >= slot.nextRepeat) {
+            Emit(userIndex, slot.repeatKey, XINPUT_KEYSTROKE_KEYDOWN | XINPUT_KEYSTROKE_REPEAT);
+            slot.nextRepeat += repeatInterval;
+            if (slot.nextRepeat <= now)
+                slot.nextRepeat = now + repeatInterval;
+        }
+    }
+}
+
+void KeystrokeGenerator::Reset(int userIndex, int64_t now) noexcept {
+    Update(userIndex, XINPUT_GAMEPAD{}, now);
+}
+
+int64_t KeystrokeGenerator::NextDeadline() const noexcept {
+    int64_t res = INT64_MAX;
+    for (const auto& slot : slots) {
+        if (slot.repeatKey != 0)
+            res = std::min(res, slot.nextRepeat);
+    }
+    return res;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "platform.h"
+#include "shadowed.h"
+#include "spscring.h"
+
+// Keystroke events for XInputGetKeystroke(), per emulated gamepad
+// Produced by the input thread, consumed by whichever game thread calls XInputGetKeystroke()
+struct XiKeystrokeQueue {
+    SpscRing<XINPUT_KEYSTROKE, 64> ring;
+    // XInputGetKeystroke() may be called from several game threads, but the ring only supports one consumer at a time
+    // Held for a single pop; a thread that finds it taken waits for it, spinning and then yielding, but only so long
+    std::atomic<bool> consumerBusy = false;
+    std::atomic<uint32_t> dropped = 0;
+
+    // Spins, then yields, waiting for another reader before giving up
+    static constexpr int kConsumerSpins = 64;
+    static constexpr int kConsumerYields = 16;
+
+    // Game threads; returns false if there is nothing to read
+    // NOTE: also if another reader got preempted in the middle of its pop and stayed so for all of the wait, the keystroke is then left for the next call
+    bool TryPop(XINPUT_KEYSTROKE& out) noexcept;
+};
+
+extern XiKeystrokeQueue gXiKeystrokeQueues[XUSER_MAX_COUNT];
+
+// Turns gamepad state transitions into VK_PAD_* key down/up/repeat events
+// Times are in the ticks given to SetClock(), like the rest of the pipeline
+// Input thread only
+struct KeystrokeGenerator {
+    static constexpr int kRepeatDelayMs = 400;
+    static constexpr int kRepeatIntervalMs = 100;
+    // Number of buttons (incl. triggers) tracked in Slot::held, see kPadKeys in keystroke.cpp
+    static constexpr int kNumPadButtons = 16;
+
+    struct Slot {
+        // Bitset of indices into kPadKeys
+        uint16_t held = 0;
+        // Current VK_PAD_xTHUMB_* direction of each stick, or 0 if centered
+        WORD lthumbKey = 0;
+        WORD rthumbKey = 0;
+        // Like a keyboard, only the most recently pressed key auto-repeats
+        WORD repeatKey = 0;
+        int64_t nextRepeat = 0;
+    } slots[XUSER_MAX_COUNT];
+
+    int64_t repeatDelay = 0;
+    int64_t repeatInterval = 0;
+
+    // Call before anything else
+    void SetClock(int64_t ticksPerSecond) noexcept;
+
+    // Diff `gamepad` against the previous state of this slot and enqueue the resulting events
+    void Update(int userIndex, const XINPUT_GAMEPAD& gamepad, int64_t now) noexcept;
+    // Generate repeats that are due
+    void Tick(int64_t now) noexcept;
+    // Release everything held by this slot, e.g. when it's unbound
+    void Reset(int userIndex, int64_t now) noexcept;
+
+    // When Tick() has something to do next, or INT64_MAX if nothing is repeating
+    int64_t NextDeadline() const noexcept;
+};
@@ -0,0 +1,186 @@
+#include "pch.h"
+
+#include "log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "platform.h"
+#include "spscring.h"
+
+using namespace std::literals;
+
+namespace {
+struct ThreadLogRing {
+    SpscRing<LogRecord, 256> ring;
+    // Set when the owning thread exits; the consumer frees the ring once it's drained
+    std::atomic<bool> orphaned = false;
+};
+
+struct ThreadLogRingHandle {
+    ThreadLogRing* ring = nullptr;
+
+    ~ThreadLogRingHandle() {
+        if (ring)
+            ring->orphaned.store(true, std::memory_order_release);
+    }
+};
+}
+
+static_assert(kLogCategoryCount == 4, "Update the initializer of gLogLevels");
+static std::atomic<LogLevel> gLogLevels[kLogCategoryCount] = {
+    LogLevel::Debug,
+    LogLevel::Debug,
+    LogLevel::Debug,
+    LogLevel::Debug,
+};
+static std::atomic<uint64_t> gLogDropped = 0;
+
+// Protects gLogRings itself; ring contents are lock-free
+static std::mutex gLogRingsLock;
+static std::vector<std::unique_ptr<ThreadLogRing>> gLogRings;
+// Serializes consumers: the background thread and FlushLogs()
+static std::mutex gLogConsumerLock;
+static std::once_flag gLogThreadStarted;
+
+static thread_local ThreadLogRingHandle tThreadRing;
+
+std::wstring_view LogLevelToString(LogLevel level) {
+    switch (level) {
+    case LogLevel::Trace: return L"trace"sv;
+    case LogLevel::Debug: return L"debug"sv;
+    case LogLevel::Info: return L"info"sv;
+    case LogLevel::Warning: return L"warning"sv;
+    case LogLevel::Error: return L"error"sv;
+    case LogLevel::Off: return L"off"sv;
+    }
+    return L"<unknown>"sv;
+}
+
+std::optional<LogLevel> LogLevelFromString(std::string_view str) {
+    if (str == "trace"sv) return LogLevel::Trace;
+    if (str == "debug"sv) return LogLevel::Debug;
+    if (str == "info"sv) return LogLevel::Info;
+    if (str == "warning"sv) return LogLevel::Warning;
+    if (str == "error"sv) return LogLevel::Error;
+    if (str == "off"sv) return LogLevel::Off;
+    return {};
+}
+
+std::wstring_view LogCategoryToString(LogCategory category) {
+    switch (category) {
+    case LogCategory::General: return L"General"sv;
+    case LogCategory::Input: return L"Input"sv;
+    case LogCategory::Config: return L"Config"sv;
+    case LogCategory::UI: return L"UI"sv;
+    case LogCategory::COUNT: break;
+    }
+    return L"<unknown>"sv;
+}
+
+std::optional<LogCategory> LogCategoryFromString(std::string_view str) {
+    if (str == "General"sv) return LogCategory::General;
+    if (str == "Input"sv) return LogCategory::Input;
+    if (str == "Config"sv) return LogCategory::Config;
+    if (str == "UI"sv) return LogCategory::UI;
+    return {};
+}
+
+void SetLogLevel(LogCategory category, LogLevel level) noexcept {
+    gLogLevels[static_cast<size_t>(category)].store(level, std::memory_order_relaxed);
+}
+
+bool IsLogEnabled(LogCategory category, LogLevel level) noexcept {
+    return level >= gLogLevels[static_cast<size_t>(category)].load(std::memory_order_relaxed);
+}
+
+static void DrainLogs() {
+    std::lock_guard consumerLock(gLogConsumerLock);
+
+    // Per-thread rings give no global order, so gather everything first and sort
+    std::vector<LogRecord> records;
+    {
+        std::lock_guard lock(gLogRingsLock);
+        LogRecord rec;
+        for (auto& threadRing : gLogRings) {
+            while (threadRing->ring.TryPop(rec))
+                records.push_back(rec);
+        }
+        std::erase_if(gLogRings, [](const std::unique_ptr<ThreadLogRing>& r) {
+            return r->orphaned.load(std::memory_order_acquire) && r->ring.Empty();
+        });
+    }
+    std::stable_sort(records.begin(), records.end(), [](const LogRecord& a, const LogRecord& b) { return a.timestamp < b.timestamp; });
+
+    std::wstring line;
+    if (uint64_t dropped = gLogDropped.exchange(0, std::memory_order_relaxed)) {
+        line = std::format(L"[WinXInputEmu][General] {} log messages dropped", dropped);
+        PlatformDebugOutput(line.c_str());
+    }
+
+    for (const auto& rec : records) {
+        line.clear();
+        line += L"[WinXInputEmu]["sv;
+        line += LogCategoryToString(rec.category);
+        if (rec.level >= LogLevel::Warning) {
+            line += L"]["sv;
+            line += LogLevelToString(rec.level);
+        }
+        line += L"] "sv;
+        try {
+            rec.format(rec, line);
+        }
+        catch (const std::format_error&) {
+            line += L"<format error> "sv;
+            line.append(rec.fmt, rec.fmtLen);
+        }
+        if (rec.truncated)
+            line += L" <truncated>"sv;
+        PlatformDebugOutput(line.c_str());
+    }
+}
+
+static void LogThreadMain() {
+    while (true) {
+        DrainLogs();
+        std::this_thread::sleep_for(5ms);
+    }
+}
+
+static ThreadLogRing* RegisterThreadRing() {
+    // Never join: like the input thread, this lives until the process exits
+    std::call_once(gLogThreadStarted, []() { std::thread(LogThreadMain).detach(); });
+
+    auto ring = std::make_unique<ThreadLogRing>();
+    auto ptr = ring.get();
+    std::lock_guard lock(gLogRingsLock);
+    gLogRings.push_back(std::move(ring));
+    return ptr;
+}
+
+void LogSubmit(LogRecord& rec) noexcept {
+    rec.timestamp = PlatformPerformanceCounter();
+
+    auto& handle = tThreadRing;
+    if (!handle.ring) {
+        try {
+            handle.ring = RegisterThreadRing();
+        }
+        catch (...) {
+            gLogDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    if (!handle.ring->ring.TryPush(rec))
+        gLogDropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FlushLogs() {
+    DrainLogs();
+}
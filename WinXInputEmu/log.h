@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+// Asynchronous logger
+//
+// A LOG() call does no formatting and no syscall: it copies its arguments in binary form into a fixed size record, and pushes that into a lock-free ring owned by the calling thread.
+// A background thread drains all rings, formats the records in timestamp order, and hands them to OutputDebugStringW().
+// If a ring is full, the record is dropped and counted instead of blocking the caller.
+//
+// Arguments must be either trivially copyable (numbers, pointers, HANDLEs, ...) or wide strings. Strings are copied into the record, and truncated if they don't fit.
+
+enum class LogLevel : uint8_t {
+    Trace,
+    Debug,
+    Info,
+    Warning,
+    Error,
+    Off,
+};
+
+enum class LogCategory : uint8_t {
+    General,
+    Input,
+    Config,
+    UI,
+    COUNT,
+};
+
+inline constexpr size_t kLogCategoryCount = static_cast<size_t>(LogCategory::COUNT);
+
+// LOG() calls below this level generate no code at all
+#ifndef WXI_LOG_COMPILED_LEVEL
+#define WXI_LOG_COMPILED_LEVEL Debug
+#endif
+inline constexpr LogLevel kLogCompiledLevel = LogLevel::WXI_LOG_COMPILED_LEVEL;
+
+std::wstring_view LogLevelToString(LogLevel level);
+std::optional<LogLevel> LogLevelFromString(std::string_view str);
+std::wstring_view LogCategoryToString(LogCategory category);
+std::optional<LogCategory> LogCategoryFromString(std::string_view str);
+
+// Runtime per-category level, may be called from any thread
+void SetLogLevel(LogCategory category, LogLevel level) noexcept;
+bool IsLogEnabled(LogCategory category, LogLevel level) noexcept;
+
+// Synchronously drains and prints everything logged so far, e.g. before shutting down
+void FlushLogs();
+
+struct LogRecord {
+    using FormatFn = void(*)(const LogRecord& rec, std::wstring& out);
+
+    // Keeps the whole record at roughly 512 bytes
+    static constexpr size_t kArgsCapacity = 464;
+
+    FormatFn format;
+    const wchar_t* fmt;
+    int64_t timestamp;
+    uint32_t fmtLen;
+    uint16_t argsSize;
+    LogCategory category;
+    LogLevel level;
+    bool truncated;
+    alignas(8) std::byte args[kArgsCapacity];
+};
+
+// Pushes the record into the calling thread's ring
+void LogSubmit(LogRecord& rec) noexcept;
+
+// What each argument type is stored as inside a LogRecord
+template <typename T>
+struct LogStoredImpl { using type = T; };
+template <> struct LogStoredImpl<std::wstring> { using type = std::wstring_view; };
+template <> struct LogStoredImpl<const wchar_t*> { using type = std::wstring_view; };
+template <> struct LogStoredImpl<wchar_t*> { using type = std::wstring_view; };
+
+template <typename T>
+using LogStored = typename LogStoredImpl<std::decay_t<T>>::type;
+
+struct LogArgWriter {
+    std::byte* curr;
+    std::byte* end;
+    bool truncated = false;
+
+    template <typename T>
+    void Put(const T& v) noexcept {
+        static_assert(std::is_trivially_copyable_v<T>, "LOG() arguments must be trivially copyable or wide strings");
+        if (truncated || static_cast<size_t>(end - curr) < sizeof(T)) {
+            truncated = true;
+            return;
+        }
+        std::memcpy(curr, &v, sizeof(T));
+        curr += sizeof(T);
+    }
+
+    void Put(std::wstring_view str) noexcept {
+        if (truncated || static_cast<size_t>(end - curr) < sizeof(uint16_t)) {
+            truncated = true;
+            return;
+        }
+        size_t maxLen = (end - curr - sizeof(uint16_t)) / sizeof(wchar_t);
+        auto len = static_cast<uint16_t>(std::min<size_t>({ str.size(), maxLen, UINT16_MAX }));
+        if (len < str.size())
+            truncated = true;
+        std::memcpy(curr, &len, sizeof(len));
+        curr += sizeof(len);
+        std::memcpy(curr, str.data(), len * sizeof(wchar_t));
+        curr += len * sizeof(wchar_t);
+    }
+};
+
+struct LogArgReader {
+    const std::byte* curr;
+    const std::byte* end;
+
+    // Arguments that didn't fit into the record come out as default values
+    template <typename T>
+    T Get() noexcept {
+        if constexpr (std::is_same_v<T, std::wstring_view>) {
+            uint16_t len;
+            if (static_cast<size_t>(end - curr) < sizeof(len))
+                return {};
+            std::memcpy(&len, curr, sizeof(len));
+            curr += sizeof(len);
+            auto data = reinterpret_cast<const wchar_t*>(curr);
+            curr += len * sizeof(wchar_t);
+            return std::wstring_view(data, len);
+        }
+        else {
+            T v{};
+            if (static_cast<size_t>(end - curr) < sizeof(T))
+                return v;
+            std::memcpy(&v, curr, sizeof(T));
+            curr += sizeof(T);
+            return v;
+        }
+    }
+};
+
+template <typename... Ts>
+void LogFormatRecord(const LogRecord& rec, std::wstring& out) {
+    LogArgReader reader{ rec.args, rec.args + rec.argsSize };
+    // Braced init list guarantees left-to-right evaluation
+    std::tuple<Ts...> values{ reader.Get<Ts>()... };
+    std::apply(
+        [&](auto&... vs) { std::vformat_to(std::back_inserter(out), std::wstring_view(rec.fmt, rec.fmtLen), std::make_wformat_args(vs...)); },
+        values);
+}
+
+template <typename... Ts>
+void LogWrite(LogCategory category, LogLevel level, std::wformat_string<LogStored<Ts>...> fmt, const Ts&... args) noexcept {
+    LogRecord rec;
+    rec.format = &LogFormatRecord<LogStored<Ts>...>;
+    // The format string is always a literal, so it's fine to keep a pointer to it
+    rec.fmt = fmt.get().data();
+    rec.fmtLen = static_cast<uint32_t>(fmt.get().size());
+    rec.category = category;
+    rec.level = level;
+
+    LogArgWriter writer{ rec.args, rec.args + LogRecord::kArgsCapacity };
+    (writer.Put(static_cast<LogStored<Ts>>(args)), ...);
+    rec.argsSize = static_cast<uint16_t>(writer.curr - rec.args);
+    rec.truncated = writer.truncated;
+
+    LogSubmit(rec);
+}
+
+#define LOG(CATEGORY, LEVEL, msg, ...) \
+    do { \
+        if constexpr (LogLevel::LEVEL >= kLogCompiledLevel) { \
+            if (IsLogEnabled(LogCategory::CATEGORY, LogLevel::LEVEL)) \
+                LogWrite(LogCategory::CATEGORY, LogLevel::LEVEL, L"" msg __VA_OPT__(,) __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(msg, ...) LOG(General, Debug, msg __VA_OPT__(,) __VA_ARGS__)
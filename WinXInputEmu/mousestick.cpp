@@ -0,0 +1,297 @@
+#include "pch.h"
+
+#include "mousestick.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define WXI_MOUSESTICK_SSE2 1
+#include <emmintrin.h>
+#endif
+
+constexpr float kStickMaxVal = 32767.0f;
+constexpr int32_t kOuterRadiusQ8 = static_cast<int32_t>(kMouseStickOuterRadius * 256.0f);
+constexpr int32_t kBounceBackQ8 = static_cast<int32_t>(kMouseStickBounceBack * 256.0f);
+// Beyond any real mouse in one tick, keeps every product below in 64 bits
+constexpr int64_t kMaxTickCounts = 1 << 20;
+
+static const StickCurveLut gIdentityCurve;
+
+void MouseStickLanes::ClearAll() noexcept {
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        accuX[userIndex] = 0.0f;
+        accuY[userIndex] = 0.0f;
+        for (int stick = 0; stick < kNumSticks; ++stick) {
+            threshold[stick][userIndex] = 0.0f;
+            invRange[stick][userIndex] = 0.0f;
+            axialDeadzone[stick][userIndex] = 0.0f;
+            squareGate[stick][userIndex] = 0xFFFFFFFF;
+            signX[stick][userIndex] = 1.0f;
+            signY[stick][userIndex] = -1.0f;
+            active[stick][userIndex] = 0;
+            curve[stick][userIndex] = &gIdentityCurve;
+            thresholdQ8[stick][userIndex] = 0;
+            rangeQ8[stick][userIndex] = 0;
+        }
+    }
+}
+
+void MouseStickLanes::Set(int userIndex, int stick, const UserProfile::Joystick& conf, const StickCurveLut& lut) noexcept {
+    float thr = std::max(conf.mouse.sensitivity, 0.0f) * kMouseStickOuterRadius;
+    float range = kMouseStickOuterRadius - thr;
+
+    threshold[stick][userIndex] = thr;
+    invRange[stick][userIndex] = range > 0.0f ? 1.0f / range : 0.0f;
+    axialDeadzone[stick][userIndex] = lut.axialDeadzone;
+    squareGate[stick][userIndex] = lut.squareGate ? 0xFFFFFFFF : 0;
+    signX[stick][userIndex] = conf.mouse.invertXAxis ? -1.0f : 1.0f;
+    signY[stick][userIndex] = conf.mouse.invertYAxis ? 1.0f : -1.0f;
+    active[stick][userIndex] = conf.useMouse ? 0xFFFFFFFF : 0;
+    curve[stick][userIndex] = &lut;
+
+    int32_t thrQ8 = static_cast<int32_t>(std::lrint(std::min(thr, kMouseStickOuterRadius) * 256.0f));
+    thresholdQ8[stick][userIndex] = thrQ8;
+    rangeQ8[stick][userIndex] = std::max(kOuterRadiusQ8 - thrQ8, 0);
+}
+
+// How a lane is computed, in short:
+// 1. r = |accu|, clamped to the outer radius
+// 2. magnitude = (r - threshold) / (outer radius - threshold), clamped to [0,1]
+// 3. The rest is StickCurveLut::Shape(): axial deadzone, curve lookup, gate
+
+void ComputeMouseSticksReference(const MouseStickLanes& lanes, MouseStickOutput& out) noexcept {
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        float ax = lanes.accuX[userIndex];
+        float ay = lanes.accuY[userIndex];
+        float r = std::sqrt(ax * ax + ay * ay);
+        if (r > kMouseStickOuterRadius)
+            r = kMouseStickOuterRadius - kMouseStickBounceBack;
+
+        for (int stick = 0; stick < MouseStickLanes::kNumSticks; ++stick) {
+            float magnitude = std::clamp((r - lanes.threshold[stick][userIndex]) * lanes.invRange[stick][userIndex], 0.0f, 1.0f);
+
+            short x, y;
+            lanes.curve[stick][userIndex]->Shape(ax * lanes.signX[stick][userIndex], ay * lanes.signY[stick][userIndex], magnitude, x, y);
+            out.x[stick][userIndex] = x;
+            out.y[stick][userIndex] = y;
+        }
+    }
+}
+
+// floor(sqrt(v)), bit by bit
+static int64_t ISqrt(uint64_t v) noexcept {
+    uint64_t res = 0;
+    uint64_t bit = 1ull << 62;
+    while (bit > v)
+        bit >>= 2;
+    while (bit != 0) {
+        if (v >= res + bit) {
+            v -= res + bit;
+            res = (res >> 1) + bit;
+        }
+        else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return static_cast<int64_t>(res);
+}
+
+// Rounds half away from zero, `den` > 0
+static int64_t DivRound(int64_t num, int64_t den) noexcept {
+    return num >= 0 ? (num + den / 2) / den : -((-num + den / 2) / den);
+}
+
+// Same steps as ComputeMouseSticksReference(), with lengths in 24.8 fixed point mouse counts and everything in [0,1] in 16.16
+void ComputeMouseSticksFixed(const MouseStickLanes& lanes, int32_t tickScaleQ16, MouseStickOutput& out) noexcept {
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        // Whole counts, see MouseStickLanes::accuX
+        int64_t countsX = std::clamp(static_cast<int64_t>(lanes.accuX[userIndex]), -kMaxTickCounts, kMaxTickCounts);
+        int64_t countsY = std::clamp(static_cast<int64_t>(lanes.accuY[userIndex]), -kMaxTickCounts, kMaxTickCounts);
+        int64_t ax = DivRound(countsX * tickScaleQ16, 1 << 8);
+        int64_t ay = DivRound(countsY * tickScaleQ16, 1 << 8);
+        int64_t len = ISqrt(static_cast<uint64_t>(ax * ax + ay * ay));
+        int64_t r = len > kOuterRadiusQ8 ? kOuterRadiusQ8 - kBounceBackQ8 : len;
+
+        for (int stick = 0; stick < MouseStickLanes::kNumSticks; ++stick) {
+            out.x[stick][userIndex] = 0;
+            out.y[stick][userIndex] = 0;
+
+            int64_t range = lanes.rangeQ8[stick][userIndex];
+            if (len == 0 || range == 0) continue;
+            int64_t magnitude = std::clamp<int64_t>(DivRound((r - lanes.thresholdQ8[stick][userIndex]) << 16, range), 0, 0x10000);
+            if (magnitude == 0) continue;
+
+            const auto& curve = *lanes.curve[stick][userIndex];
+            int64_t cx = DivRound(ax * magnitude, len) * (lanes.signX[stick][userIndex] < 0.0f ? -1 : 1);
+            int64_t cy = DivRound(ay * magnitude, len) * (lanes.signY[stick][userIndex] < 0.0f ? -1 : 1);
+            if (std::abs(cx) <= curve.axialDeadzoneQ16) cx = 0;
+            if (std::abs(cy) <= curve.axialDeadzoneQ16) cy = 0;
+            int64_t m = ISqrt(static_cast<uint64_t>(cx * cx + cy * cy));
+            if (m == 0) continue;
+
+            int64_t denom = curve.squareGate ? std::max(std::abs(cx), std::abs(cy)) : m;
+            int64_t shaped = curve.LookupQ16(static_cast<int32_t>(std::min<int64_t>(m, 0x10000)));
+            out.x[stick][userIndex] = static_cast<int32_t>(DivRound(cx * shaped * 32767, denom << 16));
+            out.y[stick][userIndex] = static_cast<int32_t>(DivRound(cy * shaped * 32767, denom << 16));
+        }
+    }
+}
+
+MouseStickMathComparison CompareMouseStickMath(const MouseStickLanes& lanes, int iterations, uint32_t seed) {
+    using Clock = std::chrono::steady_clock;
+    MouseStickMathComparison res;
+
+    // std::mt19937 output is specified exactly, distributions aren't: keep to the raw numbers so the inputs are the same everywhere
+    std::mt19937 rng(seed);
+    struct Sample {
+        float accuX[XUSER_MAX_COUNT];
+        float accuY[XUSER_MAX_COUNT];
+        int32_t scaleQ16;
+    };
+    std::vector<Sample> samples(std::max(iterations, 1));
+    for (auto& sample : samples) {
+        for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+            // Mostly within the outer radius, where the curves are; now and then a fast flick
+            int32_t spread = rng() % 8 == 0 ? 200 : 24;
+            sample.accuX[userIndex] = static_cast<float>(static_cast<int32_t>(rng() % (2 * spread + 1)) - spread);
+            sample.accuY[userIndex] = static_cast<float>(static_cast<int32_t>(rng() % (2 * spread + 1)) - spread);
+        }
+        // Tick jitter, within DoMouse2Joystick()'s clamp; whole 1/65536 steps, so the float path gets the very same scale
+        sample.scaleQ16 = rng() % 4 == 0 ? static_cast<int32_t>(0x4000 + rng() % (0x40000 - 0x4000 + 1)) : 0x10000;
+    }
+
+    auto copy = std::make_unique<MouseStickLanes>(lanes);
+    MouseStickOutput floatOut, simdOut, fixedOut;
+
+    int64_t checksum = 0;
+    auto timeFloat = [&](void (*compute)(const MouseStickLanes&, MouseStickOutput&) noexcept) {
+        auto start = Clock::now();
+        for (const auto& sample : samples) {
+            float scale = static_cast<float>(sample.scaleQ16) / 65536.0f;
+            for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+                copy->accuX[userIndex] = sample.accuX[userIndex] * scale;
+                copy->accuY[userIndex] = sample.accuY[userIndex] * scale;
+            }
+            compute(*copy, floatOut);
+            checksum += floatOut.x[1][0];
+        }
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>(samples.size());
+    };
+    res.floatNs = timeFloat(ComputeMouseSticks);
+    res.referenceNs = timeFloat(ComputeMouseSticksReference);
+
+    auto fixedStart = Clock::now();
+    for (const auto& sample : samples) {
+        std::copy(std::begin(sample.accuX), std::end(sample.accuX), copy->accuX);
+        std::copy(std::begin(sample.accuY), std::end(sample.accuY), copy->accuY);
+        ComputeMouseSticksFixed(*copy, sample.scaleQ16, fixedOut);
+        checksum += fixedOut.x[1][0];
+    }
+    auto fixedEnd = Clock::now();
+    // Keeps the timed loops from being optimized away
+    volatile int64_t checksumSink = checksum;
+    (void)checksumSink;
+
+    res.fixedNs = std::chrono::duration<double, std::nano>(fixedEnd - fixedStart).count() / static_cast<double>(samples.size());
+
+    // Outside the timed loops, to compare every sample and not just the last
+    for (const auto& sample : samples) {
+        float scale = static_cast<float>(sample.scaleQ16) / 65536.0f;
+        for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+            copy->accuX[userIndex] = sample.accuX[userIndex] * scale;
+            copy->accuY[userIndex] = sample.accuY[userIndex] * scale;
+        }
+        ComputeMouseSticksReference(*copy, floatOut);
+        ComputeMouseSticks(*copy, simdOut);
+        std::copy(std::begin(sample.accuX), std::end(sample.accuX), copy->accuX);
+        std::copy(std::begin(sample.accuY), std::end(sample.accuY), copy->accuY);
+        ComputeMouseSticksFixed(*copy, sample.scaleQ16, fixedOut);
+
+        for (int stick = 0; stick < MouseStickLanes::kNumSticks; ++stick) {
+            for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+                for (int32_t error : { std::abs(fixedOut.x[stick][userIndex] - floatOut.x[stick][userIndex]), std::abs(fixedOut.y[stick][userIndex] - floatOut.y[stick][userIndex]) }) {
+                    res.maxError = std::max(res.maxError, error);
+                    if (error > kMouseStickFixedMaxError)
+                        ++res.axesOverBound;
+                    ++res.axesCompared;
+                }
+                for (int32_t error : { std::abs(simdOut.x[stick][userIndex] - floatOut.x[stick][userIndex]), std::abs(simdOut.y[stick][userIndex] - floatOut.y[stick][userIndex]) }) {
+                    res.simdMaxError = std::max(res.simdMaxError, error);
+                    if (error > kMouseStickSimdMaxError)
+                        ++res.simdAxesOverBound;
+                }
+            }
+        }
+    }
+
+    return res;
+}
+
+#if WXI_MOUSESTICK_SSE2
+
+static __m128 Select(__m128 mask, __m128 a, __m128 b) noexcept {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+void ComputeMouseSticks(const MouseStickLanes& lanes, MouseStickOutput& out) noexcept {
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    const __m128 tiny = _mm_set1_ps(FLT_MIN);
+
+    // Per gamepad, shared by both sticks
+    __m128 ax = _mm_load_ps(lanes.accuX);
+    __m128 ay = _mm_load_ps(lanes.accuY);
+    __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ax, ax), _mm_mul_ps(ay, ay)));
+    __m128 r = Select(_mm_cmpgt_ps(len, _mm_set1_ps(kMouseStickOuterRadius)), _mm_set1_ps(kMouseStickOuterRadius - kMouseStickBounceBack), len);
+    // Unit direction, or 0 where the mouse didn't move
+    __m128 invLen = _mm_div_ps(_mm_set1_ps(1.0f), _mm_max_ps(len, tiny));
+    __m128 ux = _mm_mul_ps(ax, invLen);
+    __m128 uy = _mm_mul_ps(ay, invLen);
+
+    for (int stick = 0; stick < MouseStickLanes::kNumSticks; ++stick) {
+        __m128 thr = _mm_load_ps(lanes.threshold[stick]);
+        __m128 magnitude = _mm_mul_ps(_mm_sub_ps(r, thr), _mm_load_ps(lanes.invRange[stick]));
+        magnitude = _mm_max_ps(_mm_min_ps(magnitude, _mm_set1_ps(1.0f)), _mm_setzero_ps());
+
+        // Deflection before shaping
+        __m128 cx = _mm_mul_ps(_mm_mul_ps(ux, magnitude), _mm_load_ps(lanes.signX[stick]));
+        __m128 cy = _mm_mul_ps(_mm_mul_ps(uy, magnitude), _mm_load_ps(lanes.signY[stick]));
+        __m128 axialDz = _mm_load_ps(lanes.axialDeadzone[stick]);
+        __m128 absX = _mm_andnot_ps(signBit, cx);
+        __m128 absY = _mm_andnot_ps(signBit, cy);
+        cx = _mm_andnot_ps(_mm_cmple_ps(absX, axialDz), cx);
+        cy = _mm_andnot_ps(_mm_cmple_ps(absY, axialDz), cy);
+        absX = _mm_andnot_ps(signBit, cx);
+        absY = _mm_andnot_ps(signBit, cy);
+        __m128 m = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy)));
+
+        // No gather in SSE2: each lane has its own table
+        alignas(16) float mIn[XUSER_MAX_COUNT];
+        alignas(16) float mOut[XUSER_MAX_COUNT];
+        _mm_store_ps(mIn, m);
+        for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex)
+            mOut[userIndex] = lanes.curve[stick][userIndex]->Lookup(mIn[userIndex]);
+
+        __m128 squareGate = _mm_castsi128_ps(_mm_load_si128(reinterpret_cast<const __m128i*>(lanes.squareGate[stick])));
+        __m128 denom = _mm_max_ps(Select(squareGate, _mm_max_ps(absX, absY), m), tiny);
+        __m128 scale = _mm_mul_ps(_mm_div_ps(_mm_load_ps(mOut), denom), _mm_set1_ps(kStickMaxVal));
+
+        // Round to nearest, same as std::lrint() in the reference
+        _mm_store_si128(reinterpret_cast<__m128i*>(out.x[stick]), _mm_cvtps_epi32(_mm_mul_ps(cx, scale)));
+        _mm_store_si128(reinterpret_cast<__m128i*>(out.y[stick]), _mm_cvtps_epi32(_mm_mul_ps(cy, scale)));
+    }
+}
+
+#else
+
+void ComputeMouseSticks(const MouseStickLanes& lanes, MouseStickOutput& out) noexcept {
+    ComputeMouseSticksReference(lanes, out);
+}
+
+#endif
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+
+#include "config.h"
+#include "platform.h"
+#include "shadowed.h"
+#include "stickcurve.h"
+
+// Mouse-to-joystick ("mouse2joystick") math, for all gamepads at once
+//
+// Everything is laid out as structure-of-arrays indexed [stick][userIndex], where stick 0 is the left stick and 1 is the right stick,
+// so that one SSE register holds the same field of the same stick of all 4 gamepads, and a tick is 2 passes of straight-line code.
+
+// The accumulated mouse movement is clamped to a circle of this radius (in mouse counts) before being turned into a stick position
+constexpr float kMouseStickOuterRadius = 10.0f;
+constexpr float kMouseStickBounceBack = 0.0f;
+
+struct MouseStickLanes {
+    static constexpr int kNumSticks = 2;
+
+    // Mouse movement accumulated since the last tick, shared by both sticks of a gamepad
+    // Always a whole number of counts (exactly, below 2^24) until DoMouse2Joystick() scales it, which the fixed point path relies on
+    alignas(16) float accuX[XUSER_MAX_COUNT];
+    alignas(16) float accuY[XUSER_MAX_COUNT];
+
+    // Compiled from UserProfile::Joystick by Set()
+    // sensitivity * outer radius: the stick stays centered until the mouse moved this far
+    alignas(16) float threshold[kNumSticks][XUSER_MAX_COUNT];
+    // 1 / (outer radius - threshold), or 0 if the threshold can't be reached
+    alignas(16) float invRange[kNumSticks][XUSER_MAX_COUNT];
+    // Copied from the stick's StickCurveLut
+    alignas(16) float axialDeadzone[kNumSticks][XUSER_MAX_COUNT];
+    // All bits set for a square gate, 0 for a circular one
+    alignas(16) uint32_t squareGate[kNumSticks][XUSER_MAX_COUNT];
+    // +1, or -1 if the axis is inverted
+    // NOTE: the Y sign also flips screen space (+Y is down) into stick space (+Y is up)
+    alignas(16) float signX[kNumSticks][XUSER_MAX_COUNT];
+    alignas(16) float signY[kNumSticks][XUSER_MAX_COUNT];
+    // All bits set if this stick is driven by the mouse, 0 otherwise
+    alignas(16) uint32_t active[kNumSticks][XUSER_MAX_COUNT];
+    // Never null, points to an identity curve when unset
+    const StickCurveLut* curve[kNumSticks][XUSER_MAX_COUNT];
+
+    // For ComputeMouseSticksFixed(): threshold and (outer radius - threshold) in 24.8 fixed point mouse counts, range is 0 if the threshold can't be reached
+    int32_t thresholdQ8[kNumSticks][XUSER_MAX_COUNT];
+    int32_t rangeQ8[kNumSticks][XUSER_MAX_COUNT];
+
+    MouseStickLanes() {
+        ClearAll();
+    }
+
+    void ClearAll() noexcept;
+    // `curve` must outlive this object, or until the next Set() or ClearAll()
+    void Set(int userIndex, int stick, const UserProfile::Joystick& conf, const StickCurveLut& curve) noexcept;
+};
+
+struct MouseStickOutput {
+    // Only meaningful where MouseStickLanes::active is set
+    alignas(16) int32_t x[MouseStickLanes::kNumSticks][XUSER_MAX_COUNT];
+    alignas(16) int32_t y[MouseStickLanes::kNumSticks][XUSER_MAX_COUNT];
+};
+
+// Vectorized, except for the per-lane curve lookup
+// Falls back to ComputeMouseSticksReference() where SSE2 is unavailable
+void ComputeMouseSticks(const MouseStickLanes& lanes, MouseStickOutput& out) noexcept;
+// Scalar, using the C library's math functions; defines the intended result of ComputeMouseSticks()
+void ComputeMouseSticksReference(const MouseStickLanes& lanes, MouseStickOutput& out) noexcept;
+
+// Integer only, so that the same input gives bit-identical output with any compiler, flags and CPU, e.g. to reproduce a recording exactly
+// Unlike the float versions, the accumulated movement is read unscaled: `tickScaleQ16` is the scale DoMouse2Joystick() would have applied, in 16.16 fixed point.
+// Follows ComputeMouseSticksReference() to within kMouseStickFixedMaxError, except right at the edge of a deadzone, where one may round to inside and the other to outside.
+void ComputeMouseSticksFixed(const MouseStickLanes& lanes, int32_t tickScaleQ16, MouseStickOutput& out) noexcept;
+constexpr int32_t kMouseStickFixedMaxError = 16;
+
+// ComputeMouseSticks() follows ComputeMouseSticksReference() to within this; they only differ in rounding, e.g. the vector code normalizes the direction before scaling it,
+// which right at the edge of an axial deadzone may put an axis on the other side of it
+constexpr int32_t kMouseStickSimdMaxError = 1;
+
+struct MouseStickMathComparison {
+    uint64_t axesCompared = 0;
+    // Largest |fixed - float| of any stick axis
+    int32_t maxError = 0;
+    // Axes off by more than kMouseStickFixedMaxError
+    uint64_t axesOverBound = 0;
+    // Largest |ComputeMouseSticks() - ComputeMouseSticksReference()| of any stick axis, and the axes off by more than kMouseStickSimdMaxError
+    int32_t simdMaxError = 0;
+    uint64_t simdAxesOverBound = 0;
+    // Per call, i.e. all 8 sticks
+    double floatNs = 0.0;
+    double referenceNs = 0.0;
+    double fixedNs = 0.0;
+};
+
+// Runs all three paths on the same random movement, `iterations` ticks of it, with the sticks set up as in `lanes`
+// Fixed point and the vector code are both checked against the reference
+// Sticks not driven by the mouse are compared too, as if they were
+MouseStickMathComparison CompareMouseStickMath(const MouseStickLanes& lanes, int iterations, uint32_t seed);
@@ -31,21 +31,25 @@
 
 ////////// System headers //////////
 
-#define NOMINMAX
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
+// Windows.h, or its stand-in
+#include "platform.h"
 
+#ifdef _WIN32
 #include <d3d11.h>
 #include <Rpc.h>
 #include <hidusage.h>
 #include <tlhelp32.h>
+#endif
 
 ////////// 3rd party headers //////////
 
+// The UI is Windows only
+#ifdef _WIN32
 #include <imgui.h>
 #include <imgui_impl_dx11.h>
 #include <imgui_impl_win32.h>
 #include <imgui_stdlib.h>
+#endif
 #include <toml++/toml.h>
 
 // We don't include Xinput.h because dllmain.cpp wants separate declarations -- adding __declspec(dllexport), which is incompatible from the ones in Xinput.h
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Everything the portable parts need from the OS: the XInput exports, config loading, the device registry, raw input handling and the translation core
+// platform_win32.cpp implements it with the Win32 API. platform_linux.cpp is a stand-in so that those parts also build as a Linux shared library,
+// to be driven by tests and benchmarks with fake devices and raw input packets. Windows, hooks, D3D and the UI stay Windows only.
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+// The Win32 types, structures and constants the portable parts use, under their Win32 names
+#include "win32compat.h"
+#endif
+
+// Directory of this DLL (or shared library), where its config and recordings live
+std::filesystem::path PlatformModuleDirectory();
+
+// The system's own XInput; nullptr if it can't be loaded, which the stand-in never can
+HMODULE PlatformLoadSystemXInput();
+void* PlatformGetProcAddress(HMODULE module, const char* name);
+
+// One finished log line: OutputDebugStringW() on Windows, stderr on the stand-in
+void PlatformDebugOutput(const wchar_t* line) noexcept;
+
+// QueryPerformanceCounter() and its frequency
+int64_t PlatformPerformanceCounter() noexcept;
+int64_t PlatformPerformanceFrequency() noexcept;
+// CPU time the calling thread has used so far, kernel and user, in seconds; 0 if unknown
+double PlatformThreadCpuSeconds() noexcept;
+
+// In pixels, of the primary monitor and of the virtual desktop spanning all monitors
+void PlatformGetScreenSizes(int32_t& primaryWidth, int32_t& primaryHeight, int32_t& virtualWidth, int32_t& virtualHeight) noexcept;
+
+// Raw input
+bool PlatformRegisterRawInputDevices(const RAWINPUTDEVICE* devices, UINT count) noexcept;
+std::vector<RAWINPUTDEVICELIST> PlatformListRawInputDevices();
+// Returns false and leaves `out` alone if the device is gone
+bool PlatformGetRawInputDeviceInfo(HANDLE hDevice, RID_DEVICE_INFO& out) noexcept;
+std::wstring PlatformGetRawInputDeviceName(HANDLE hDevice);
+// Same contract as GetRawInputData(hri, RID_INPUT, ...): with `data` null, only writes the size needed; returns (UINT)-1 on error
+UINT PlatformGetRawInputData(HRAWINPUT hri, void* data, UINT* size) noexcept;
+
+// "{xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx}" without the braces
+bool PlatformParseGuid(std::wstring_view text, GUID& out) noexcept;
+
+#ifndef _WIN32
+
+// Stand-in only: the devices the raw input functions above report, for tests to set up
+struct FakeRawInputDevice {
+    HANDLE hDevice;
+    RID_DEVICE_INFO info;
+    std::wstring name;
+};
+
+void FakeRawInputSetDevices(std::vector<FakeRawInputDevice> devices);
+void FakeSetScreenSizes(int32_t primaryWidth, int32_t primaryHeight, int32_t virtualWidth, int32_t virtualHeight) noexcept;
+
+// What WM_INPUT's lParam would be: on the stand-in, an HRAWINPUT is just the address of a packet built by the caller
+inline HRAWINPUT FakeRawInputHandle(const RAWINPUT& packet) noexcept {
+    return reinterpret_cast<HRAWINPUT>(const_cast<RAWINPUT*>(&packet));
+}
+
+#endif
@@ -0,0 +1,216 @@
+#include "pch.h"
+
+#ifndef _WIN32
+
+#include "platform.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+
+#include <dlfcn.h>
+
+// The fake device registry, filled by tests through FakeRawInputSetDevices()
+static std::mutex gFakeDevicesLock;
+static std::vector<FakeRawInputDevice> gFakeDevices;
+// Like a single 1080p monitor until told otherwise
+static int32_t gFakePrimaryWidth = 1920;
+static int32_t gFakePrimaryHeight = 1080;
+static int32_t gFakeVirtualWidth = 1920;
+static int32_t gFakeVirtualHeight = 1080;
+
+void FakeRawInputSetDevices(std::vector<FakeRawInputDevice> devices) {
+    std::lock_guard lock(gFakeDevicesLock);
+    gFakeDevices = std::move(devices);
+}
+
+void FakeSetScreenSizes(int32_t primaryWidth, int32_t primaryHeight, int32_t virtualWidth, int32_t virtualHeight) noexcept {
+    gFakePrimaryWidth = primaryWidth;
+    gFakePrimaryHeight = primaryHeight;
+    gFakeVirtualWidth = virtualWidth;
+    gFakeVirtualHeight = virtualHeight;
+}
+
+std::filesystem::path PlatformModuleDirectory() {
+    // Any address inside this shared library will do
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(&PlatformModuleDirectory), &info) && info.dli_fname)
+        return std::filesystem::absolute(info.dli_fname).remove_filename();
+    return std::filesystem::current_path();
+}
+
+HMODULE PlatformLoadSystemXInput() {
+    return nullptr;
+}
+
+void* PlatformGetProcAddress(HMODULE module, const char* name) {
+    return nullptr;
+}
+
+void PlatformDebugOutput(const wchar_t* line) noexcept {
+    std::fprintf(stderr, "%ls\n", line);
+}
+
+int64_t PlatformPerformanceCounter() noexcept {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return static_cast<int64_t>(t.tv_sec) * 1'000'000'000 + t.tv_nsec;
+}
+
+int64_t PlatformPerformanceFrequency() noexcept {
+    return 1'000'000'000;
+}
+
+double PlatformThreadCpuSeconds() noexcept {
+    timespec t;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t) != 0)
+        return 0.0;
+    return static_cast<double>(t.tv_sec) + static_cast<double>(t.tv_nsec) * 1e-9;
+}
+
+void PlatformGetScreenSizes(int32_t& primaryWidth, int32_t& primaryHeight, int32_t& virtualWidth, int32_t& virtualHeight) noexcept {
+    primaryWidth = gFakePrimaryWidth;
+    primaryHeight = gFakePrimaryHeight;
+    virtualWidth = gFakeVirtualWidth;
+    virtualHeight = gFakeVirtualHeight;
+}
+
+bool PlatformRegisterRawInputDevices(const RAWINPUTDEVICE* devices, UINT count) noexcept {
+    // Packets are handed over directly, see FakeRawInputHandle()
+    return true;
+}
+
+std::vector<RAWINPUTDEVICELIST> PlatformListRawInputDevices() {
+    std::lock_guard lock(gFakeDevicesLock);
+    std::vector<RAWINPUTDEVICELIST> res;
+    res.reserve(gFakeDevices.size());
+    for (const auto& dev : gFakeDevices)
+        res.push_back({ dev.hDevice, dev.info.dwType });
+    return res;
+}
+
+bool PlatformGetRawInputDeviceInfo(HANDLE hDevice, RID_DEVICE_INFO& out) noexcept {
+    std::lock_guard lock(gFakeDevicesLock);
+    auto iter = std::find_if(gFakeDevices.begin(), gFakeDevices.end(), [&](const FakeRawInputDevice& dev) { return dev.hDevice == hDevice; });
+    if (iter == gFakeDevices.end())
+        return false;
+    out = iter->info;
+    out.cbSize = sizeof(out);
+    return true;
+}
+
+std::wstring PlatformGetRawInputDeviceName(HANDLE hDevice) {
+    std::lock_guard lock(gFakeDevicesLock);
+    auto iter = std::find_if(gFakeDevices.begin(), gFakeDevices.end(), [&](const FakeRawInputDevice& dev) { return dev.hDevice == hDevice; });
+    return iter != gFakeDevices.end() ? iter->name : std::wstring();
+}
+
+UINT PlatformGetRawInputData(HRAWINPUT hri, void* data, UINT* size) noexcept {
+    if (!hri || !size)
+        return (UINT)-1;
+    if (!data) {
+        *size = sizeof(RAWINPUT);
+        return 0;
+    }
+    if (*size < sizeof(RAWINPUT)) {
+        errno = ENOBUFS;
+        return (UINT)-1;
+    }
+    std::memcpy(data, reinterpret_cast<const RAWINPUT*>(hri), sizeof(RAWINPUT));
+    return sizeof(RAWINPUT);
+}
+
+bool PlatformParseGuid(std::wstring_view text, GUID& out) noexcept {
+    // xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx
+    constexpr size_t kUuidLen = 36;
+    if (text.size() != kUuidLen)
+        return false;
+
+    uint8_t bytes[16];
+    size_t n = 0;
+    for (size_t i = 0; i < kUuidLen; ++i) {
+        bool dash = i == 8 || i == 13 || i == 18 || i == 23;
+        if (dash) {
+            if (text[i] != L'-') return false;
+            continue;
+        }
+        auto hex = [](wchar_t c) -> int {
+            if (c >= L'0' && c <= L'9') return c - L'0';
+            if (c >= L'a' && c <= L'f') return c - L'a' + 10;
+            if (c >= L'A' && c <= L'F') return c - L'A' + 10;
+            return -1;
+        };
+        int hi = hex(text[i]);
+        int lo = hex(text[++i]);
+        if (hi < 0 || lo < 0) return false;
+        bytes[n++] = static_cast<uint8_t>(hi << 4 | lo);
+    }
+
+    // The first three groups read as numbers, the rest as bytes, same as UuidFromStringW()
+    out.Data1 = static_cast<uint32_t>(bytes[0]) << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+    out.Data2 = static_cast<uint16_t>(bytes[4] << 8 | bytes[5]);
+    out.Data3 = static_cast<uint16_t>(bytes[6] << 8 | bytes[7]);
+    std::memcpy(out.Data4, bytes + 8, 8);
+    return true;
+}
+
+// wchar_t is UTF-32 here
+
+std::wstring Utf8ToWide(std::string_view utf8) {
+    std::wstring result;
+    result.reserve(utf8.size());
+    for (size_t i = 0; i < utf8.size();) {
+        auto c = static_cast<unsigned char>(utf8[i]);
+        int len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+        if (len == 0 || i + len > utf8.size()) {
+            // Malformed, same replacement MultiByteToWideChar() uses
+            result.push_back(L'\xFFFD');
+            ++i;
+            continue;
+        }
+        char32_t cp = len == 1 ? c : c & (0x7F >> len);
+        for (int k = 1; k < len; ++k)
+            cp = cp << 6 | (static_cast<unsigned char>(utf8[i + k]) & 0x3F);
+        result.push_back(static_cast<wchar_t>(cp));
+        i += len;
+    }
+    return result;
+}
+
+std::string WideToUtf8(std::wstring_view wide) {
+    std::string result;
+    result.reserve(wide.size());
+    for (wchar_t wc : wide) {
+        auto cp = static_cast<char32_t>(wc);
+        if (cp < 0x80) {
+            result.push_back(static_cast<char>(cp));
+        }
+        else if (cp < 0x800) {
+            result.push_back(static_cast<char>(0xC0 | cp >> 6));
+            result.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+        else if (cp < 0x10000) {
+            result.push_back(static_cast<char>(0xE0 | cp >> 12));
+            result.push_back(static_cast<char>(0x80 | (cp >> 6 & 0x3F)));
+            result.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+        else {
+            result.push_back(static_cast<char>(0xF0 | cp >> 18));
+            result.push_back(static_cast<char>(0x80 | (cp >> 12 & 0x3F)));
+            result.push_back(static_cast<char>(0x80 | (cp >> 6 & 0x3F)));
+            result.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+    return result;
+}
+
+std::wstring GetLastErrorStr() noexcept {
+    if (errno == 0)
+        return std::wstring();
+    return Utf8ToWide(std::strerror(errno));
+}
+
+#endif
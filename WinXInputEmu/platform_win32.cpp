@@ -0,0 +1,163 @@
+#include "pch.h"
+
+#ifdef _WIN32
+
+#include "platform.h"
+
+#include <hidusage.h>
+#include <Rpc.h>
+
+#include "dll.h"
+
+std::filesystem::path PlatformModuleDirectory() {
+    WCHAR buf[MAX_PATH];
+    DWORD numChars = GetModuleFileNameW(gHModule, buf, MAX_PATH);
+    return std::filesystem::path(buf, buf + numChars).remove_filename();
+}
+
+HMODULE PlatformLoadSystemXInput() {
+    // Using LoadLibraryExW() with LOAD_LIBRARY_SEARCH_SYSTEM32 only doesn't seem to work -- it still found our XInput1_4.dll (if our name is indeed this)
+    // On 32-bit process, "System32" is automatically redirected to SysWOW64
+    // On 64-bit process, "System32" will work in place
+    return LoadLibraryW(L"C:/Windows/System32/XInput1_4.dll");
+}
+
+void* PlatformGetProcAddress(HMODULE module, const char* name) {
+    return reinterpret_cast<void*>(GetProcAddress(module, name));
+}
+
+void PlatformDebugOutput(const wchar_t* line) noexcept {
+    OutputDebugStringW(line);
+}
+
+int64_t PlatformPerformanceCounter() noexcept {
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+int64_t PlatformPerformanceFrequency() noexcept {
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    return f.QuadPart;
+}
+
+double PlatformThreadCpuSeconds() noexcept {
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0.0;
+    auto ticks = [](FILETIME ft) { return (static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime; };
+    // FILETIME is in 100ns units
+    return static_cast<double>(ticks(kernel) + ticks(user)) * 1e-7;
+}
+
+void PlatformGetScreenSizes(int32_t& primaryWidth, int32_t& primaryHeight, int32_t& virtualWidth, int32_t& virtualHeight) noexcept {
+    primaryWidth = GetSystemMetrics(SM_CXSCREEN);
+    primaryHeight = GetSystemMetrics(SM_CYSCREEN);
+    virtualWidth = GetSystemMetrics(SM_CXVIRTUALSCREEN);
+    virtualHeight = GetSystemMetrics(SM_CYVIRTUALSCREEN);
+}
+
+bool PlatformRegisterRawInputDevices(const RAWINPUTDEVICE* devices, UINT count) noexcept {
+    return RegisterRawInputDevices(devices, count, sizeof(RAWINPUTDEVICE));
+}
+
+std::vector<RAWINPUTDEVICELIST> PlatformListRawInputDevices() {
+    std::vector<RAWINPUTDEVICELIST> devices;
+    UINT numDevices = 0;
+    if (GetRawInputDeviceList(nullptr, &numDevices, sizeof(RAWINPUTDEVICELIST)) != 0)
+        return devices;
+
+    // Devices may arrive between asking for the count and fetching them
+    while (numDevices > 0) {
+        devices.resize(numDevices);
+        UINT numFetched = GetRawInputDeviceList(devices.data(), &numDevices, sizeof(RAWINPUTDEVICELIST));
+        if (numFetched != (UINT)-1) {
+            devices.resize(numFetched);
+            return devices;
+        }
+        if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+            break;
+    }
+    devices.clear();
+    return devices;
+}
+
+bool PlatformGetRawInputDeviceInfo(HANDLE hDevice, RID_DEVICE_INFO& out) noexcept {
+    RID_DEVICE_INFO info = {};
+    info.cbSize = sizeof(info);
+    UINT size = sizeof(info);
+    if (GetRawInputDeviceInfoW(hDevice, RIDI_DEVICEINFO, &info, &size) == (UINT)-1)
+        return false;
+    out = info;
+    return true;
+}
+
+std::wstring PlatformGetRawInputDeviceName(HANDLE hDevice) {
+    UINT len = 0;
+    GetRawInputDeviceInfoW(hDevice, RIDI_DEVICENAME, nullptr, &len);
+    std::wstring name;
+    name.resize_and_overwrite(len, [&](wchar_t* buf, size_t bufSize) {
+        if (GetRawInputDeviceInfoW(hDevice, RIDI_DEVICENAME, buf, &len) == (UINT)-1)
+            return size_t(0);
+        // `len` counts the null terminator, which isn't part of the name
+        return wcsnlen(buf, bufSize);
+    });
+    return name;
+}
+
+UINT PlatformGetRawInputData(HRAWINPUT hri, void* data, UINT* size) noexcept {
+    return GetRawInputData(hri, RID_INPUT, data, size, sizeof(RAWINPUTHEADER));
+}
+
+bool PlatformParseGuid(std::wstring_view text, GUID& out) noexcept {
+    constexpr size_t kUuidLen = 36;
+    if (text.size() != kUuidLen)
+        return false;
+
+    // RPC_WSTR uses unsigned short instead of wchar_t/WCHAR for some reason
+    unsigned short buffer[kUuidLen + 1];
+    for (size_t i = 0; i < kUuidLen; ++i)
+        buffer[i] = text[i];
+    buffer[kUuidLen] = L'\0';
+
+    return UuidFromStringW(buffer, &out) == RPC_S_OK;
+}
+
+std::wstring Utf8ToWide(std::string_view utf8) {
+    int len = MultiByteToWideChar(CP_UTF8, 0, utf8.data(), utf8.size(), nullptr, 0);
+    std::wstring result;
+    result.resize_and_overwrite(
+        len,
+        [utf8](wchar_t* buf, size_t bufSize) { return MultiByteToWideChar(CP_UTF8, 0, utf8.data(), utf8.size(), buf, bufSize); });
+    return result;
+}
+
+std::string WideToUtf8(std::wstring_view wide) {
+    int len = WideCharToMultiByte(CP_UTF8, 0, wide.data(), wide.size(), nullptr, 0, nullptr, nullptr);
+    std::string result;
+    result.resize_and_overwrite(
+        len,
+        [wide](char* buf, size_t bufSize) { return WideCharToMultiByte(CP_UTF8, 0, wide.data(), wide.size(), buf, bufSize, nullptr, nullptr); });
+    return result;
+
+}
+
+std::wstring GetLastErrorStr() noexcept {
+    // https://stackoverflow.com/a/17387176
+    DWORD errId = ::GetLastError();
+    if (errId == 0) {
+        return std::wstring();
+    }
+
+    LPWSTR messageBuffer = nullptr;
+    size_t size = FormatMessageW(
+        FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+        nullptr, errId, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPWSTR)&messageBuffer, 0, NULL);
+
+    std::wstring errMsg(messageBuffer, size);
+    LocalFree(messageBuffer);
+    return errMsg;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// One writer, any number of readers: readers retry if they raced with a write, and never block the writer or each other
+template <typename T>
+struct Seqlock {
+    static_assert(std::is_trivially_copyable_v<T>, "Seqlock values are copied around with memcpy");
+
+    static constexpr size_t kPayloadWords = (sizeof(T) + 3) / 4;
+
+    std::atomic<uint32_t> seq = 0;
+    // The value, stored as atomic words so that a torn read is merely detected by `seq` instead of being UB
+    std::atomic<uint32_t> payload[kPayloadWords] = {};
+
+    // Writer thread only
+    void Store(const T& value) noexcept {
+        uint32_t words[kPayloadWords] = {};
+        std::memcpy(words, &value, sizeof(T));
+
+        uint32_t s = seq.load(std::memory_order_relaxed);
+        // Odd sequence number: write in progress
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < kPayloadWords; ++i)
+            payload[i].store(words[i], std::memory_order_relaxed);
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    // Any thread
+    T Load() const noexcept {
+        uint32_t words[kPayloadWords];
+        while (true) {
+            uint32_t s0 = seq.load(std::memory_order_acquire);
+            if (s0 & 1)
+                continue;
+            for (size_t i = 0; i < kPayloadWords; ++i)
+                words[i] = payload[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint32_t s1 = seq.load(std::memory_order_relaxed);
+            if (s0 == s1)
+                break;
+        }
+
+        T value;
+        std::memcpy(&value, words, sizeof(T));
+        return value;
+    }
+};
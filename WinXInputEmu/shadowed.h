@@ -1,8 +1,6 @@
 #pragma once
 
-#define NOMINMAX
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
+#include "platform.h"
 
 #define XINPUT_DEVTYPE_GAMEPAD          0x01
 
@@ -161,7 +159,11 @@ struct XINPUT_KEYSTROKE
 // Note that XInput has a variety of different versions: https://learn.microsoft.com/en-us/windows/win32/xinput/xinput-versions and the relevant functions differ. 
 // We are targetting xinput1_4.dll as you would see on a typical Win10 installation
 
+#ifdef _WIN32
 #define XI_API_FUNC extern "C" __declspec(dllexport)
+#else
+#define XI_API_FUNC extern "C" __attribute__((visibility("default")))
+#endif
 
 // Deprecated in Win10
 //
@@ -0,0 +1,162 @@
+#include "pch.h"
+
+#include "slotrouting.h"
+
+#include <algorithm>
+
+#include "clock.h"
+#include "userdevice.h"
+
+static constexpr uint16_t PackRoute(XiSlotRoute::Kind kind, DWORD physical) noexcept {
+    return static_cast<uint16_t>(static_cast<uint16_t>(kind) << 8 | (physical & 0xFF));
+}
+
+XiPhysicalGamepad gXiPhysicalGamepads[XUSER_MAX_COUNT];
+// Until the input thread resolves the config, each slot forwards to the physical controller at the same index, like before any routing existed
+std::atomic<uint16_t> gXiSlotRoutes[XUSER_MAX_COUNT] = {
+    PackRoute(XiSlotRoute::Kind::Physical, 0),
+    PackRoute(XiSlotRoute::Kind::Physical, 1),
+    PackRoute(XiSlotRoute::Kind::Physical, 2),
+    PackRoute(XiSlotRoute::Kind::Physical, 3),
+};
+
+XINPUT_STATE MergeStates(const XINPUT_STATE& emulated, const XINPUT_STATE& physical) noexcept {
+    const auto& e = emulated.Gamepad;
+    const auto& p = physical.Gamepad;
+
+    XINPUT_STATE res = {};
+    // Both only ever increase, so their sum does too
+    res.dwPacketNumber = emulated.dwPacketNumber + physical.dwPacketNumber;
+    auto& g = res.Gamepad;
+    g.wButtons = e.wButtons | p.wButtons;
+    g.bLeftTrigger = std::max(e.bLeftTrigger, p.bLeftTrigger);
+    g.bRightTrigger = std::max(e.bRightTrigger, p.bRightTrigger);
+
+    // Picking whole sticks instead of single axes, so that the direction of either is kept
+    auto pickStick = [](SHORT ex, SHORT ey, SHORT px, SHORT py, SHORT& x, SHORT& y) {
+        int64_t em = static_cast<int64_t>(ex) * ex + static_cast<int64_t>(ey) * ey;
+        int64_t pm = static_cast<int64_t>(px) * px + static_cast<int64_t>(py) * py;
+        x = pm > em ? px : ex;
+        y = pm > em ? py : ey;
+    };
+    pickStick(e.sThumbLX, e.sThumbLY, p.sThumbLX, p.sThumbLY, g.sThumbLX, g.sThumbLY);
+    pickStick(e.sThumbRX, e.sThumbRY, p.sThumbRX, p.sThumbRY, g.sThumbRX, g.sThumbRY);
+
+    return res;
+}
+
+std::string DescribeSlotRoute(XiSlotRoute route) {
+    switch (route.kind) {
+        using enum XiSlotRoute::Kind;
+    case Emulated: return "emulated";
+    case Physical: return std::format("physical {}", route.physical);
+    case Merged: return std::format("emulated + physical {}", route.physical);
+    case Disconnected: return "disconnected";
+    }
+    return "";
+}
+
+void UpdateSlotRoutes(const Config& config) noexcept {
+    using enum XiSlotRoute::Kind;
+
+    // Physical controllers explicitly routed somewhere aren't also shown by an auto slot
+    bool taken[XUSER_MAX_COUNT] = {};
+    for (const auto& routing : config.slotRouting) {
+        if (routing.mode == SlotRouting::Mode::Physical || routing.mode == SlotRouting::Mode::Merge)
+            taken[routing.physical] = true;
+    }
+
+    int nextCompact = 0;
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        const auto& routing = config.slotRouting[userIndex];
+        bool emulated = gXiGamepadBindings[userIndex].enabled;
+
+        XiSlotRoute route = { Disconnected, 0 };
+        switch (routing.mode) {
+        case SlotRouting::Mode::Auto: {
+            if (emulated) {
+                route = { Emulated, 0 };
+            }
+            else if (config.compactSlots) {
+                while (nextCompact < XUSER_MAX_COUNT && (taken[nextCompact] || !gXiPhysicalGamepads[nextCompact].connected))
+                    ++nextCompact;
+                if (nextCompact < XUSER_MAX_COUNT)
+                    route = { Physical, static_cast<DWORD>(nextCompact++) };
+            }
+            else if (!taken[userIndex]) {
+                route = { Physical, static_cast<DWORD>(userIndex) };
+            }
+        } break;
+
+        case SlotRouting::Mode::Physical: {
+            route = { Physical, static_cast<DWORD>(routing.physical) };
+        } break;
+
+        case SlotRouting::Mode::Merge: {
+            route = { emulated ? Merged : Physical, static_cast<DWORD>(routing.physical) };
+        } break;
+
+        case SlotRouting::Mode::None: break;
+        }
+
+        uint16_t packed = PackRoute(route.kind, route.physical);
+        if (gXiSlotRoutes[userIndex].exchange(packed, std::memory_order_acq_rel) != packed)
+            LOG(Input, Info, L"Gamepad {} now shows {}", userIndex, Utf8ToWide(DescribeSlotRoute(route)));
+    }
+}
+
+void PhysicalGamepadPoller::Configure(const Config& config, int64_t now) noexcept {
+    bool anyMerged = false;
+    std::fill(std::begin(merged), std::end(merged), false);
+    for (DWORD userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        auto route = GetSlotRoute(userIndex);
+        if (route.kind == XiSlotRoute::Kind::Merged) {
+            merged[route.physical] = true;
+            anyMerged = true;
+        }
+    }
+    probeAll = config.compactSlots;
+
+    probePeriod = gClock->FromMilliseconds(kProbeIntervalMs);
+    if (anyMerged)
+        pollPeriod = gClock->FromMilliseconds(config.physicalPollMs);
+    else if (probeAll)
+        pollPeriod = probePeriod;
+    else
+        pollPeriod = 0;
+    nextPoll = pollPeriod > 0 ? now : INT64_MAX;
+}
+
+bool PhysicalGamepadPoller::Poll(int64_t now) noexcept {
+    bool changed = false;
+
+    for (DWORD userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        auto& pad = gXiPhysicalGamepads[userIndex];
+        bool due = (merged[userIndex] && pad.connected) || ((merged[userIndex] || probeAll) && now >= nextProbe[userIndex]);
+        if (!due) continue;
+
+        XINPUT_STATE state = {};
+        bool connected = pfn_XInputGetState && pfn_XInputGetState(userIndex, &state) == ERROR_SUCCESS;
+        if (!connected || !merged[userIndex])
+            nextProbe[userIndex] = now + probePeriod;
+        if (!connected)
+            state = {};
+
+        if (connected != pad.connected) {
+            LOG(Input, Info, L"Physical gamepad {} {}", userIndex, connected ? L"connected" : L"disconnected");
+            pad.connected = connected;
+            changed = true;
+        }
+        else if (state.dwPacketNumber == pad.lastPacket) {
+            continue;
+        }
+        pad.lastPacket = state.dwPacketNumber;
+        pad.cell.Store(state);
+    }
+
+    nextPoll += pollPeriod;
+    // Fell behind, skip the missed polls instead of bursting through them
+    if (nextPoll <= now)
+        nextPoll = now + pollPeriod;
+    return changed;
+}
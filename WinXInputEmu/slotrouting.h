@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "config.h"
+#include "platform.h"
+#include "seqlock.h"
+#include "shadowed.h"
+#include "spscring.h"
+
+// What XInputGet*() serve for one of the slots a game polls, resolved from Config::slotRouting
+struct XiSlotRoute {
+    enum class Kind : uint8_t {
+        // The emulated gamepad of the slot
+        Emulated,
+        // The system XInput, at user index `physical`
+        Physical,
+        // Both of the above, see MergeStates()
+        Merged,
+        Disconnected,
+    };
+
+    Kind kind;
+    DWORD physical;
+};
+
+// Latest state of a physical controller, polled by the input thread so that merged slots don't call into the system XInput on every poll
+struct alignas(kCacheLineSize) XiPhysicalGamepad {
+    // All zeros while disconnected
+    Seqlock<XINPUT_STATE> cell;
+
+    // Writer side bookkeeping, input thread only
+    bool connected = false;
+    DWORD lastPacket = 0;
+};
+
+extern XiPhysicalGamepad gXiPhysicalGamepads[XUSER_MAX_COUNT];
+// XiSlotRoute::Kind << 8 | physical, so that a route is read in one go
+extern std::atomic<uint16_t> gXiSlotRoutes[XUSER_MAX_COUNT];
+
+// Any thread
+// Indices past the slots go to the system XInput as they are, which rejects them
+inline XiSlotRoute GetSlotRoute(DWORD userIndex) noexcept {
+    if (userIndex >= XUSER_MAX_COUNT)
+        return { XiSlotRoute::Kind::Physical, userIndex };
+    uint16_t packed = gXiSlotRoutes[userIndex].load(std::memory_order_acquire);
+    return { static_cast<XiSlotRoute::Kind>(packed >> 8), static_cast<DWORD>(packed & 0xFF) };
+}
+
+// E.g. "emulated + physical 1"
+std::string DescribeSlotRoute(XiSlotRoute route);
+
+// Buttons are OR'd, each stick and trigger is taken from whichever state deflects it more
+// The packet number changes whenever either state's does
+XINPUT_STATE MergeStates(const XINPUT_STATE& emulated, const XINPUT_STATE& physical) noexcept;
+
+// Resolves `config.slotRouting` against which gamepads are enabled and which physical controllers are connected
+// Input thread only
+void UpdateSlotRoutes(const Config& config) noexcept;
+
+// Keeps gXiPhysicalGamepads up to date
+// Input thread only
+struct PhysicalGamepadPoller {
+    // Disconnected controllers are only probed this often, XInputGetState() on an empty slot is slow
+    static constexpr int kProbeIntervalMs = 1000;
+
+    // 0 if not polling
+    int64_t pollPeriod = 0;
+    int64_t probePeriod = 0;
+    int64_t nextPoll = INT64_MAX;
+    int64_t nextProbe[XUSER_MAX_COUNT] = {};
+    // Physical controllers shown in a merged slot, polled every pollPeriod while connected
+    bool merged[XUSER_MAX_COUNT] = {};
+    // Probe every controller, for compacted slots
+    bool probeAll = false;
+
+    // Call after UpdateSlotRoutes()
+    // Polls the controllers of merged slots every `config.physicalPollMs`; with compacted slots, also looks for controllers being connected and disconnected
+    void Configure(const Config& config, int64_t now) noexcept;
+    int64_t NextDeadline() const noexcept { return nextPoll; }
+    // Returns true if a controller was connected or disconnected, i.e. the slot routes need updating
+    bool Poll(int64_t now) noexcept;
+};
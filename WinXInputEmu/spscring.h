@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+// Assumed size of a cache line on every platform we care about (x86 and x64)
+// std::hardware_destructive_interference_size would be nicer, but MSVC warns about it being ABI-unstable
+inline constexpr size_t kCacheLineSize = 64;
+
+// Bounded, lock-free single-producer single-consumer queue.
+// Neither side ever blocks or allocates: TryPush() fails if the ring is full, and TryPop() fails if it's empty.
+// The producer and the consumer indices live on separate cache lines, and each side keeps a cached copy of the other's index, so that in the common case a push or pop touches no line written by the other thread.
+template <typename T, size_t N>
+struct SpscRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing capacity must be a power of 2");
+    static_assert(std::is_trivially_copyable_v<T>, "SpscRing elements are copied around with plain assignment");
+
+    // Producer side
+    alignas(kCacheLineSize) std::atomic<size_t> head{ 0 };
+    size_t tailCache = 0;
+
+    // Consumer side
+    alignas(kCacheLineSize) std::atomic<size_t> tail{ 0 };
+    size_t headCache = 0;
+
+    alignas(kCacheLineSize) T slots[N];
+
+    // Producer thread only
+    bool TryPush(const T& value) noexcept {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tailCache == N) {
+            tailCache = tail.load(std::memory_order_acquire);
+            if (h - tailCache == N)
+                return false;
+        }
+        slots[h & (N - 1)] = value;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer thread only
+    bool TryPop(T& out) noexcept {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == headCache) {
+            headCache = head.load(std::memory_order_acquire);
+            if (t == headCache)
+                return false;
+        }
+        out = slots[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer thread only
+    bool Empty() noexcept {
+        return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+    }
+
+    // May be called from any thread, the result is only a snapshot
+    size_t SizeApprox() const noexcept {
+        size_t t = tail.load(std::memory_order_acquire);
+        size_t h = head.load(std::memory_order_acquire);
+        return h - t;
+    }
+
+    static constexpr size_t Capacity() noexcept { return N; }
+};
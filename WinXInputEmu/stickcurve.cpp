@@ -0,0 +1,100 @@
+#include "pch.h"
+
+#include "stickcurve.h"
+
+#include <algorithm>
+#include <cmath>
+
+constexpr float kStickMaxVal = 32767.0f;
+
+static float EvalBezier(const std::array<float, 4>& cp, float x) {
+    auto bezier = [](float p1, float p2, float u) {
+        float v = 1 - u;
+        return 3 * v * v * u * p1 + 3 * v * u * u * p2 + u * u * u;
+    };
+
+    // x(u) is monotonic for control point X coordinates in [0,1], so bisect for the u that gives x
+    float lo = 0.0f, hi = 1.0f;
+    for (int i = 0; i < 32; ++i) {
+        float mid = (lo + hi) / 2;
+        if (bezier(cp[0], cp[2], mid) < x)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return bezier(cp[1], cp[3], (lo + hi) / 2);
+}
+
+static float EvalPiecewise(const std::vector<std::array<float, 2>>& points, float x) {
+    std::array<float, 2> prev = { 0.0f, 0.0f };
+    for (const auto& pt : points) {
+        if (x <= pt[0]) {
+            float span = pt[0] - prev[0];
+            return span > 0 ? prev[1] + (pt[1] - prev[1]) * (x - prev[0]) / span : pt[1];
+        }
+        prev = pt;
+    }
+    float span = 1.0f - prev[0];
+    return span > 0 ? prev[1] + (1.0f - prev[1]) * (x - prev[0]) / span : 1.0f;
+}
+
+static float EvalCurve(const UserProfile::StickCurve& curve, float in) {
+    if (in <= curve.deadzone)
+        return 0.0f;
+
+    float range = curve.saturation - curve.deadzone;
+    float t = range > 0 ? std::min((in - curve.deadzone) / range, 1.0f) : 1.0f;
+
+    float shaped;
+    switch (curve.shape) {
+        using enum UserProfile::StickCurve::Shape;
+    case Power: shaped = std::pow(t, curve.exponent); break;
+    case Piecewise: shaped = EvalPiecewise(curve.points, t); break;
+    case Bezier: shaped = EvalBezier(curve.bezier, t); break;
+    default: shaped = t; break;
+    }
+    shaped = std::clamp(shaped, 0.0f, 1.0f);
+
+    return curve.antiDeadzone + (1.0f - curve.antiDeadzone) * shaped;
+}
+
+void StickCurveLut::Compile(const UserProfile::StickCurve& curve) {
+    for (int i = 0; i <= kSize; ++i)
+        table[i] = EvalCurve(curve, static_cast<float>(i) / kSize);
+    axialDeadzone = curve.axialDeadzone;
+
+    // Quantized once here, so that the per-tick fixed point path never touches a float
+    // NOTE: std::pow() may round differently between C libraries, which shows here only in the rare entry that lands on a rounding boundary
+    for (int i = 0; i <= kSize; ++i)
+        tableQ16[i] = static_cast<int32_t>(std::lrint(table[i] * 65536.0f));
+    axialDeadzoneQ16 = static_cast<int32_t>(std::lrint(std::clamp(curve.axialDeadzone, 0.0f, 1.0f) * 65536.0f));
+    squareGate = curve.gate == UserProfile::StickCurve::Gate::Square;
+}
+
+void StickCurveLut::Shape(float dirX, float dirY, float magnitude, short& outX, short& outY) const noexcept {
+    float len = std::sqrt(dirX * dirX + dirY * dirY);
+    if (len <= 0.0f || magnitude <= 0.0f) {
+        outX = 0;
+        outY = 0;
+        return;
+    }
+
+    // Deflection before shaping
+    float cx = dirX / len * magnitude;
+    float cy = dirY / len * magnitude;
+    if (std::abs(cx) <= axialDeadzone) cx = 0.0f;
+    if (std::abs(cy) <= axialDeadzone) cy = 0.0f;
+
+    float m = std::sqrt(cx * cx + cy * cy);
+    if (m <= 0.0f) {
+        outX = 0;
+        outY = 0;
+        return;
+    }
+
+    // Square gate: stretch the direction so that its longer axis reaches the shaped magnitude
+    float denom = squareGate ? std::max(std::abs(cx), std::abs(cy)) : m;
+    float scale = Lookup(m) / denom;
+    outX = static_cast<short>(std::lrint(cx * scale * kStickMaxVal));
+    outY = static_cast<short>(std::lrint(cy * scale * kStickMaxVal));
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include "config.h"
+
+// A UserProfile::StickCurve compiled into a fixed-size table, so shaping a stick costs one interpolated lookup no matter how the curve is defined
+struct StickCurveLut {
+    static constexpr int kSize = 256;
+
+    // table[i] is the curve at input i/kSize; one extra entry so that interpolating at input 1.0 needs no special case
+    float table[kSize + 1];
+    float axialDeadzone = 0.0f;
+    bool squareGate = true;
+    // The same in 16.16 fixed point, for ComputeMouseSticksFixed()
+    int32_t tableQ16[kSize + 1];
+    int32_t axialDeadzoneQ16 = 0;
+
+    StickCurveLut() {
+        Compile({});
+    }
+
+    void Compile(const UserProfile::StickCurve& curve);
+
+    // `magnitude` ∈ [0,1]
+    float Lookup(float magnitude) const noexcept {
+        float x = std::clamp(magnitude, 0.0f, 1.0f) * kSize;
+        int i = std::min(static_cast<int>(x), kSize - 1);
+        float f = x - static_cast<float>(i);
+        return table[i] + (table[i + 1] - table[i]) * f;
+    }
+
+    // `magnitude` ∈ [0,65536], i.e. 16.16 fixed point; only integer math, so the result is the same on any compiler and CPU
+    int32_t LookupQ16(int32_t magnitude) const noexcept {
+        int64_t x = static_cast<int64_t>(std::clamp(magnitude, 0, 0x10000)) * kSize;
+        int i = std::min(static_cast<int>(x >> 16), kSize - 1);
+        int64_t f = x - (static_cast<int64_t>(i) << 16);
+        // Rounded; table entries only ever differ by less than 2^16, so nothing here can overflow
+        int64_t d = (tableQ16[i + 1] - tableQ16[i]) * f;
+        return tableQ16[i] + static_cast<int32_t>(d >= 0 ? (d + 0x8000) >> 16 : -((-d + 0x8000) >> 16));
+    }
+
+    // Deflect towards (dirX,dirY), which needn't be normalized, by `magnitude` ∈ [0,1], and write the shaped stick position
+    void Shape(float dirX, float dirY, float magnitude, short& outX, short& outY) const noexcept;
+};
@@ -0,0 +1,596 @@
+#include "pch.h"
+
+#include "stresstest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "clock.h"
+#include "configschema.h"
+#include "inputbackend.h"
+#include "translation.h"
+#include "userdevice.h"
+
+using namespace std::literals;
+
+namespace {
+// Producers wake the translation loop early, like WM_INPUT wakes the input thread; resets once a wait returns
+struct StressWake {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool signaled = false;
+
+    void Signal() {
+        {
+            std::lock_guard lock(mutex);
+            signaled = true;
+        }
+        cv.notify_one();
+    }
+
+    void Wait(std::chrono::nanoseconds timeout) {
+        std::unique_lock lock(mutex);
+        cv.wait_for(lock, timeout, [this]() { return signaled; });
+        signaled = false;
+    }
+};
+
+// One fake device, generating on its own thread into its own sink
+struct StressDevice {
+    bool mouse;
+    int index;
+    InputEventSink sink;
+    std::thread thread;
+    // Written by the device's thread, read once it's joined
+    uint64_t generated = 0;
+    uint64_t hotplugs = 0;
+    double cpuSeconds = 0.0;
+};
+
+// Every (device, plug-in) gets a distinct handle, at least until the generation wraps around after 65536 plug-ins
+// 32 bits, so that it fits a HANDLE in 32-bit builds too; the top nibble keeps it apart from the synthetic and replay backends' handles
+HANDLE StressDeviceHandle(int index, uint64_t generation) noexcept {
+    return reinterpret_cast<HANDLE>(static_cast<uintptr_t>(0x30000000u | (static_cast<uint32_t>(generation & 0xFFFF) << 12) | static_cast<uint32_t>((index + 1) & 0xFFF)));
+}
+
+void ProducerMain(StressDevice& dev, const StressConfig& cfg, const std::atomic<bool>& stop) {
+    constexpr BYTE kKeys[] = {
+        'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
+        VK_SPACE, VK_LSHIFT, VK_LCONTROL, VK_TAB, VK_ESCAPE, VK_RETURN,
+        VK_UP, VK_DOWN, VK_LEFT, VK_RIGHT,
+    };
+    constexpr BYTE kMouseButtons[] = { VK_LBUTTON, VK_RBUTTON, VK_MBUTTON, VK_XBUTTON1, VK_XBUTTON2 };
+    // Mice mostly move; this many of their events are button presses or releases
+    constexpr double kMouseButtonShare = 0.05;
+    constexpr int kMaxMouseDelta = 8;
+
+    std::mt19937 rng(cfg.seed ^ (static_cast<uint32_t>(dev.index) * 0x9E3779B9u));
+    std::uniform_int_distribution<int> pickDelta(-kMaxMouseDelta, kMaxMouseDelta);
+    std::bernoulli_distribution pickMouseButton(kMouseButtonShare);
+    const BYTE* keys = dev.mouse ? kMouseButtons : kKeys;
+    int keyCount = dev.mouse ? static_cast<int>(std::size(kMouseButtons)) : static_cast<int>(std::size(kKeys));
+    std::uniform_int_distribution<int> pickKey(0, keyCount - 1);
+    int rollover = std::clamp(cfg.rollover, 1, keyCount);
+    int rate = std::max(dev.mouse ? cfg.mouseRate : cfg.keyRate, 1);
+
+    bool held[0x100] = {};
+    int heldCount = 0;
+    uint64_t generation = 0;
+    HANDLE handle = StressDeviceHandle(dev.index, generation);
+
+    auto push = [&](const InputEvent& e) {
+        dev.sink.Push(e);
+        ++dev.generated;
+    };
+    auto key = [&](BYTE vkey, bool pressed, int64_t time) {
+        held[vkey] = pressed;
+        heldCount += pressed ? 1 : -1;
+        push(InputEvent{ .type = InputEvent::Type::Key, .pressed = pressed, .vkey = vkey, .device = handle, .time = time });
+    };
+    auto releaseAll = [&](int64_t time) {
+        for (int i = 0; i < keyCount; ++i) {
+            if (held[keys[i]])
+                key(keys[i], false, time);
+        }
+    };
+
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    double nextHotplugMs = cfg.hotplugMs > 0.0f ? cfg.hotplugMs : INFINITY;
+    uint64_t emitted = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+        double elapsedMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        int64_t now = gClock->Now();
+
+        // Unplugged cleanly: whatever was held is released first
+        if (elapsedMs >= nextHotplugMs) {
+            releaseAll(now);
+            handle = StressDeviceHandle(dev.index, ++generation);
+            ++dev.hotplugs;
+            nextHotplugMs += cfg.hotplugMs;
+        }
+
+        // How long the device has been sending, not counting pauses
+        double activeMs = elapsedMs;
+        if (cfg.idleMs > 0.0f && cfg.burstMs > 0.0f) {
+            double cycle = cfg.burstMs + cfg.idleMs;
+            activeMs = std::floor(elapsedMs / cycle) * cfg.burstMs + std::min(std::fmod(elapsedMs, cycle), static_cast<double>(cfg.burstMs));
+        }
+        auto target = static_cast<uint64_t>(activeMs * rate / 1000.0);
+        // Don't try to catch up on a backlog, e.g. after the thread didn't get scheduled for a while
+        target = std::min<uint64_t>(target, emitted + std::max(rate / 10, 1));
+
+        for (; emitted < target; ++emitted) {
+            if (dev.mouse && !pickMouseButton(rng)) {
+                push(InputEvent{ .type = InputEvent::Type::MouseMove, .device = handle, .dx = pickDelta(rng), .dy = pickDelta(rng), .time = now });
+                continue;
+            }
+            BYTE vkey = keys[pickKey(rng)];
+            if (held[vkey])
+                key(vkey, false, now);
+            else if (heldCount < rollover)
+                key(vkey, true, now);
+            else {
+                // Full rollover: let go of something else instead
+                for (int i = 0; i < keyCount; ++i) {
+                    if (held[keys[i]]) {
+                        key(keys[i], false, now);
+                        break;
+                    }
+                }
+            }
+        }
+        dev.sink.Flush();
+
+        std::this_thread::sleep_for(1ms);
+    }
+
+    releaseAll(gClock->Now());
+    dev.sink.Flush();
+    dev.cpuSeconds = PlatformThreadCpuSeconds();
+}
+
+// A few KB each, keep them off the stack
+struct StressState {
+    InputTranslationStruct its;
+    XiGamepad gamepads[XUSER_MAX_COUNT] = {};
+    XiGamepadBinding bindings[XUSER_MAX_COUNT] = {};
+    XiGamepadPublished published[XUSER_MAX_COUNT];
+    // Per gamepad, the time of the oldest event behind the latest publish, for readers to measure latency against
+    std::atomic<int64_t> publishedEventTime[XUSER_MAX_COUNT] = {};
+    bool enabled[XUSER_MAX_COUNT] = {};
+};
+
+double Percentile(const std::vector<int64_t>& sorted, double p) noexcept {
+    if (sorted.empty()) return 0.0;
+    auto i = static_cast<size_t>(std::ceil(p * static_cast<double>(sorted.size())));
+    return static_cast<double>(sorted[std::clamp<size_t>(i, 1, sorted.size()) - 1]);
+}
+
+// Every field derives from the same counter, so a state mixed from two publishes doesn't check out
+XINPUT_GAMEPAD ContentionGamepad(uint32_t n) noexcept {
+    XINPUT_GAMEPAD gamepad = {};
+    gamepad.wButtons = static_cast<WORD>(n);
+    gamepad.bLeftTrigger = static_cast<BYTE>(n);
+    gamepad.bRightTrigger = static_cast<BYTE>(~n);
+    gamepad.sThumbLX = static_cast<SHORT>(n);
+    gamepad.sThumbLY = static_cast<SHORT>(~n);
+    gamepad.sThumbRX = static_cast<SHORT>(n >> 16);
+    gamepad.sThumbRY = static_cast<SHORT>(~(n >> 16));
+    return gamepad;
+}
+
+bool ContentionGamepadTorn(const XINPUT_GAMEPAD& gamepad) noexcept {
+    auto n = static_cast<uint32_t>(gamepad.wButtons) | (static_cast<uint32_t>(static_cast<uint16_t>(gamepad.sThumbRX)) << 16);
+    auto expected = ContentionGamepad(n);
+    return std::memcmp(&gamepad, &expected, sizeof(gamepad)) != 0;
+}
+
+// Readers poll gamepads 1-3 for a while with no writer, then again while a writer publishes gamepad 0 as fast as it can and one more reader checks every state of it
+// Both on the real layout, and on a baseline where the same cells are packed back to back
+void RunPublishContention(const StressConfig& stress, StressResult& res) {
+    if (stress.contentionSeconds <= 0.0f) return;
+
+    // Gamepad 0's first state must already check out
+    auto published = std::make_unique<XiGamepadPublished[]>(XUSER_MAX_COUNT);
+    XiGamepadBinding binding;
+    published[0].Publish(ContentionGamepad(0), binding, gClock->Now());
+
+    // The baseline: a plain array of the cells, with no alignment or padding, so that gamepad 0's cell shares a cache line with gamepad 1's
+    // What the slot array looked like before each gamepad got cache lines of its own
+    auto packed = std::make_unique<Seqlock<XiPublishedState>[]>(XUSER_MAX_COUNT);
+    static_assert(sizeof(Seqlock<XiPublishedState>) % kCacheLineSize != 0, "The baseline cells would be line aligned anyways");
+    XiPublishedState packedState = {};
+    packedState.state.Gamepad = ContentionGamepad(0);
+    packed[0].Store(packedState);
+
+    // Same work per read as XiGamepadPublished::Read()
+    auto read = [&](bool packedLayout, int userIndex) {
+        if (!packedLayout)
+            return published[userIndex].Read();
+        XiPublishedState state = packed[userIndex].Load();
+        return state.Evaluate(state.rampTicks != 0 ? gClock->Now() : 0);
+    };
+
+    auto phaseTime = std::chrono::duration<float>(stress.contentionSeconds * 0.25f);
+    auto runReaders = [&](bool packedLayout, bool withWriter) {
+        std::atomic<bool> stop = false;
+        std::vector<uint64_t> reads(std::max(stress.readers, 1));
+        std::vector<std::thread> threads;
+        for (auto& count : reads) {
+            threads.emplace_back([&read, &stop, &count, packedLayout]() {
+                uint64_t n = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    for (int userIndex = 1; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+                        read(packedLayout, userIndex);
+                        ++n;
+                    }
+                }
+                count = n;
+            });
+        }
+        uint64_t publishes = 0;
+        std::thread writer, checker;
+        if (withWriter) {
+            writer = std::thread([&]() {
+                auto now = gClock->Now();
+                uint32_t n = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    ++n;
+                    if (packedLayout) {
+                        // What Publish() does for a binding with no attack or release, i.e. with nothing ramping
+                        packedState.state.dwPacketNumber = packedState.Evaluate(now).dwPacketNumber + 1;
+                        packedState.state.Gamepad = ContentionGamepad(n);
+                        packedState.rampStart = now;
+                        packed[0].Store(packedState);
+                    }
+                    else {
+                        published[0].Publish(ContentionGamepad(n), binding, now);
+                    }
+                }
+                publishes = n;
+            });
+            checker = std::thread([&]() {
+                uint64_t n = 0, torn = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    auto state = read(packedLayout, 0);
+                    ++n;
+                    if (ContentionGamepadTorn(state.Gamepad)) ++torn;
+                }
+                res.writtenSlotReads += n;
+                res.tornReads += torn;
+            });
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(phaseTime);
+        stop = true;
+        for (auto& thread : threads) thread.join();
+        if (withWriter) {
+            writer.join();
+            checker.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        uint64_t total = 0;
+        for (auto count : reads) total += count;
+        if (withWriter) (packedLayout ? res.packedPublishesPerSec : res.contentionPublishesPerSec) = static_cast<double>(publishes) / seconds;
+        return static_cast<double>(total) / seconds;
+    };
+    res.idleReadsPerSec = runReaders(false, false);
+    res.contendedReadsPerSec = runReaders(false, true);
+    res.packedIdleReadsPerSec = runReaders(true, false);
+    res.packedContendedReadsPerSec = runReaders(true, true);
+}
+}
+
+StressResult RunStressTest(const StressConfig& stress, const Config& config) {
+    StressResult res;
+
+    auto ss = std::make_unique<StressState>();
+    ss->its.gamepads = ss->gamepads;
+    ss->its.bindings = ss->bindings;
+    ss->its.fixedPointMouseSticks = config.fixedPointMouseSticks;
+    ss->its.actions.SetClock(gClock->TicksPerSecond(), gClock->Now());
+
+    // Mirrors ReloadConfig() and the onGamepadBindingChanged handler, like a replay
+    bool anyBound = false;
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        auto profileId = config.profiles->Find(config.xiGamepadBindings[userIndex]);
+        if (config.xiGamepadBindings[userIndex].empty() || profileId == kInvalidProfileId) continue;
+
+        const auto& profile = config.profiles->profiles[profileId];
+        ss->bindings[userIndex].Bind(config.profiles, profileId);
+        ss->bindings[userIndex].enabled = true;
+        ss->its.PopulateBtnLut(userIndex, profile);
+        ss->its.PopulateSticks(userIndex, profile);
+        ss->its.PopulateActions(userIndex, profile);
+        ss->its.PopulateKernel(userIndex);
+        ss->enabled[userIndex] = true;
+        anyBound = true;
+    }
+    if (!anyBound) {
+        res.error = "No gamepad is bound to a profile";
+        return res;
+    }
+
+    StressWake wake;
+    std::atomic<bool> stopProducers = false;
+    std::atomic<bool> stopReaders = false;
+
+    std::vector<std::unique_ptr<StressDevice>> devices;
+    for (int i = 0; i < std::max(stress.mice, 0) + std::max(stress.keyboards, 0); ++i) {
+        auto& dev = *devices.emplace_back(std::make_unique<StressDevice>());
+        dev.mouse = i < stress.mice;
+        dev.index = i;
+        dev.sink.notify = [&wake]() { wake.Signal(); };
+    }
+
+    struct Reader {
+        std::thread thread;
+        std::vector<int64_t> latencies;
+        uint64_t polls = 0;
+        double cpuSeconds = 0.0;
+    };
+    std::vector<Reader> readers(std::max(stress.readers, 0));
+    for (auto& reader : readers) {
+        reader.thread = std::thread([&ss, &reader, &stopReaders]() {
+            DWORD lastPacket[XUSER_MAX_COUNT] = {};
+            while (!stopReaders.load(std::memory_order_relaxed)) {
+                for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+                    if (!ss->enabled[userIndex]) continue;
+                    auto state = ss->published[userIndex].Read();
+                    ++reader.polls;
+                    if (state.dwPacketNumber != lastPacket[userIndex]) {
+                        lastPacket[userIndex] = state.dwPacketNumber;
+                        reader.latencies.push_back(gClock->Now() - ss->publishedEventTime[userIndex].load(std::memory_order_relaxed));
+                    }
+                }
+            }
+            reader.cpuSeconds = PlatformThreadCpuSeconds();
+        });
+    }
+
+    for (auto& dev : devices)
+        dev->thread = std::thread(ProducerMain, std::ref(*dev), std::cref(stress), std::cref(stopProducers));
+
+    auto publish = [&](int64_t eventTime, int64_t now) {
+        for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+            if (!ss->enabled[userIndex]) continue;
+            auto& pub = ss->published[userIndex];
+            auto gamepad = ss->gamepads[userIndex].ComputeXInputGamepad();
+            if (std::memcmp(&gamepad, &pub.lastPublished, sizeof(gamepad)) == 0) continue;
+            ss->publishedEventTime[userIndex].store(eventTime, std::memory_order_relaxed);
+            pub.Publish(gamepad, ss->bindings[userIndex], now);
+            ++res.statesPublished;
+        }
+    };
+
+    // Same loop as the input thread, minus the UI
+    double cpuStart = PlatformThreadCpuSeconds();
+    int64_t mouseTickPeriod = gClock->FromMilliseconds(std::max(config.mouseCheckFrequency, 1));
+    int64_t start = gClock->Now();
+    int64_t end = start + static_cast<int64_t>(static_cast<double>(stress.seconds) * static_cast<double>(gClock->TicksPerSecond()));
+    int64_t lastMouseTick = start;
+    int64_t nextMouseTick = start + mouseTickPeriod;
+    int64_t latest = start;
+    InputEventBatch batch;
+    MouseMotionCoalescer motion;
+    auto handOverMotion = [&](HANDLE device, LONG dx, LONG dy, int64_t) {
+        if (dx != 0 || dy != 0)
+            HandleMouseMovement(device, dx, dy, ss->its);
+    };
+    while (true) {
+        int64_t now = std::max(gClock->Now(), latest);
+        if (now >= end) break;
+        int64_t wait = std::min(nextMouseTick, end) - now;
+        wake.Wait(std::chrono::nanoseconds(std::max<int64_t>(wait, 0) * 1'000'000'000 / gClock->TicksPerSecond()));
+
+        now = std::max(gClock->Now(), latest);
+        latest = now;
+        if (AdvanceActions(now, ss->its))
+            publish(now, now);
+
+        for (auto& dev : devices) {
+            while (dev->sink.queue.TryPop(batch)) {
+                // Same as the input thread: motion stays pending across batches, and is only handed over before a button edge or the mouse tick
+                bool anyKey = false;
+                for (uint32_t i = 0; i < batch.count; ++i) {
+                    const auto& e = batch.events[i];
+                    if (e.type == InputEvent::Type::Key) {
+                        motion.Flush(handOverMotion);
+                        HandleKeyPress(e.device, e.vkey, e.pressed, now, ss->its);
+                        anyKey = true;
+                    }
+                    else {
+                        motion.Add(e.device, e.dx, e.dy, now, handOverMotion);
+                    }
+                }
+                res.eventsProcessed += batch.count;
+                if (anyKey)
+                    publish(batch.events[0].time, now);
+            }
+        }
+
+        if (now >= nextMouseTick) {
+            motion.Flush(handOverMotion);
+            DoMouse2Joystick(now - lastMouseTick, mouseTickPeriod, ss->its);
+            lastMouseTick = now;
+            nextMouseTick = std::max(nextMouseTick + mouseTickPeriod, now + 1);
+            publish(now, now);
+        }
+    }
+    res.translationCpuSeconds = PlatformThreadCpuSeconds() - cpuStart;
+    res.eventsCoalesced = motion.merged;
+    res.seconds = gClock->ToSeconds(gClock->Now() - start);
+
+    stopProducers = true;
+    for (auto& dev : devices) {
+        dev->thread.join();
+        res.eventsGenerated += dev->generated;
+        res.eventsDropped += dev->sink.eventsDropped.load(std::memory_order_relaxed);
+        res.hotplugs += dev->hotplugs;
+        res.producerCpuSeconds += dev->cpuSeconds;
+    }
+    stopReaders = true;
+    std::vector<int64_t> latencies;
+    for (auto& reader : readers) {
+        reader.thread.join();
+        res.readerPolls += reader.polls;
+        res.readerCpuSeconds += reader.cpuSeconds;
+        latencies.insert(latencies.end(), reader.latencies.begin(), reader.latencies.end());
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    double usPerTick = 1e6 / static_cast<double>(gClock->TicksPerSecond());
+    res.latencySamples = latencies.size();
+    res.latencyP50Us = Percentile(latencies, 0.50) * usPerTick;
+    res.latencyP99Us = Percentile(latencies, 0.99) * usPerTick;
+    res.latencyP999Us = Percentile(latencies, 0.999) * usPerTick;
+    res.latencyMaxUs = latencies.empty() ? 0.0 : static_cast<double>(latencies.back()) * usPerTick;
+
+    RunPublishContention(stress, res);
+    return res;
+}
+
+int RunStressTestConsole(const StressConfig& stress, const std::filesystem::path& configPath) {
+    Config config;
+    try {
+        config = LoadConfig(toml::parse_file(configPath));
+    }
+    catch (const toml::parse_error& e) {
+        std::printf("Cannot load %s: %s\n", configPath.string().c_str(), std::string(e.description()).c_str());
+        return 1;
+    }
+
+    auto res = RunStressTest(stress, config);
+    if (!res.Success()) {
+        std::printf("Stress test failed: %s\n", res.error.c_str());
+        return 1;
+    }
+    double secs = std::max(res.seconds, 1e-9);
+    std::printf("Events: %llu generated, %llu processed (%.0f/s)\n", (unsigned long long)res.eventsGenerated, (unsigned long long)res.eventsProcessed, res.eventsProcessed / secs);
+    std::printf("Dropped: %llu, coalesced: %llu, states published: %llu\n", (unsigned long long)res.eventsDropped, (unsigned long long)res.eventsCoalesced, (unsigned long long)res.statesPublished);
+    std::printf("Hot-plugs: %llu, reader polls: %llu\n", (unsigned long long)res.hotplugs, (unsigned long long)res.readerPolls);
+    std::printf("Event to reader latency (us): p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f (%llu samples)\n", res.latencyP50Us, res.latencyP99Us, res.latencyP999Us, res.latencyMaxUs, (unsigned long long)res.latencySamples);
+    std::printf("CPU: translation %.1f%%, producers %.3f s, readers %.3f s\n", res.translationCpuSeconds * 100.0 / secs, res.producerCpuSeconds, res.readerCpuSeconds);
+    if (res.idleReadsPerSec > 0.0 && res.packedIdleReadsPerSec > 0.0) {
+        std::printf("Reads of other gamepads: %.0f/s idle, %.0f/s while one is published (%.0f%%, %.0f publishes/s)\n", res.idleReadsPerSec, res.contendedReadsPerSec, res.contendedReadsPerSec * 100.0 / res.idleReadsPerSec, res.contentionPublishesPerSec);
+        std::printf("  packed baseline: %.0f/s idle, %.0f/s while one is published (%.0f%%, %.0f publishes/s)\n", res.packedIdleReadsPerSec, res.packedContendedReadsPerSec, res.packedContendedReadsPerSec * 100.0 / res.packedIdleReadsPerSec, res.packedPublishesPerSec);
+        std::printf("Torn reads of the published gamepad: %llu of %llu\n", (unsigned long long)res.tornReads, (unsigned long long)res.writtenSlotReads);
+    }
+    return 0;
+}
+
+namespace {
+constexpr int kConfigBenchmarkRuns = 5;
+
+// Everything a profile can set, within the ranges LoadConfig() accepts so that it reads back unchanged
+UserProfile RandomProfile(std::mt19937& rng) {
+    auto chance = [&](double p) { return std::bernoulli_distribution(p)(rng); };
+    auto fraction = [&]() { return std::uniform_real_distribution<float>(0.0f, 1.0f)(rng); };
+    auto key = [&]() { return static_cast<KeyCode>(std::uniform_int_distribution<int>('A', 'Z')(rng)); };
+    auto button = [&](UserProfile::Button& btn) {
+        int n = std::uniform_int_distribution<int>(0, 2)(rng);
+        for (int i = 0; i < n; ++i)
+            btn.keyCodes.push_back(key());
+    };
+    auto gamepadButton = [&]() { return static_cast<XiButton>(std::uniform_int_distribution<int>(static_cast<int>(XiButton::A), static_cast<int>(XiButton::RStickBtn))(rng)); };
+
+    UserProfile p;
+    for (auto btn : { &p.a, &p.b, &p.x, &p.y, &p.lb, &p.rb, &p.lt, &p.rt, &p.start, &p.back, &p.dpadUp, &p.dpadDown, &p.dpadLeft, &p.dpadRight, &p.lstickBtn, &p.rstickBtn })
+        button(*btn);
+    for (auto js : { &p.lstick, &p.rstick }) {
+        js->useMouse = chance(0.5);
+        button(js->kbd.up);
+        button(js->kbd.down);
+        button(js->kbd.left);
+        button(js->kbd.right);
+        js->kbd.speed = fraction();
+        js->kbd.attackMs = fraction() * 100.0f;
+        js->kbd.socd = UserProfile::SocdPolicy::LastWins;
+        js->mouse.sensitivity = 1.0f + fraction() * 50.0f;
+        js->mouse.invertYAxis = chance(0.5);
+        js->curve.shape = UserProfile::StickCurve::Shape::Piecewise;
+        js->curve.points = { { 0.25f, fraction() }, { 0.75f, fraction() } };
+        js->curve.deadzone = fraction() * 0.1f;
+    }
+    p.triggerAttackMs = fraction() * 100.0f;
+    button(p.analogModifier);
+    p.analogModifierScale = fraction();
+    p.turbos.push_back({ { { key() } }, gamepadButton(), 5.0f + fraction() * 20.0f });
+    p.macros.push_back({ { { key() } }, { { { gamepadButton(), gamepadButton() }, 30.0f, 30.0f }, { { gamepadButton() } } } });
+    p.tapHolds.push_back({ { { key() } }, gamepadButton(), gamepadButton() });
+    return p;
+}
+
+// Fastest of kConfigBenchmarkRuns calls of `fn`, in milliseconds
+template <typename TFunc>
+double BestMs(TFunc&& fn) {
+    using Clock = std::chrono::steady_clock;
+    double best = 0.0;
+    for (int i = 0; i < kConfigBenchmarkRuns; ++i) {
+        auto start = Clock::now();
+        fn();
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (i == 0 || ms < best)
+            best = ms;
+    }
+    return best;
+}
+}
+
+ConfigBenchmarkResult RunConfigBenchmark(int profiles, uint32_t seed) {
+    ConfigBenchmarkResult res;
+    res.profiles = std::max(profiles, 0);
+
+    std::mt19937 rng(seed);
+    Config config;
+    auto store = std::make_shared<ProfileStore>();
+    store->Add("NULL"s, UserProfile{});
+    for (int i = 0; i < res.profiles; ++i)
+        store->Add(std::format("Profile{}", i), RandomProfile(rng));
+    config.profiles = std::move(store);
+    config.xiGamepadBindings[0] = res.profiles > 0 ? "Profile0"s : ""s;
+    config.mouseDpi["Benchmark mouse"s] = 1600.0f;
+
+    auto toml = StringifyConfig(config);
+    std::string text;
+    {
+        std::ostringstream ss;
+        ss << toml::toml_formatter{ toml };
+        text = ss.str();
+    }
+    res.bytes = text.size();
+
+    toml::table parsed;
+    try {
+        res.parseMs = BestMs([&]() { parsed = toml::parse(text); });
+    }
+    catch (const toml::parse_error& e) {
+        res.error = std::format("formatted config doesn't parse: {}", e.description());
+        return res;
+    }
+
+    Config loaded;
+    res.loadMs = BestMs([&]() { loaded = LoadConfig(parsed); });
+    toml::table stringified;
+    res.stringifyMs = BestMs([&]() { stringified = StringifyConfig(loaded); });
+    res.formatMs = BestMs([&]() {
+        std::ostringstream ss;
+        ss << toml::toml_formatter{ stringified };
+    });
+    res.roundTrips = TomlNodesEqual(stringified, parsed);
+    return res;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include "config.h"
+
+// Worst-case input load on a private copy of the translation logic: many high rate devices at once, while other threads poll the published gamepad states
+struct StressConfig {
+    int mice = 4;
+    // Events per second, per device
+    int mouseRate = 8000;
+    int keyboards = 4;
+    int keyRate = 500;
+    // How many keys each keyboard holds down at most
+    int rollover = 10;
+    // Each device sends at its rate for `burstMs`, then pauses for `idleMs`; idleMs = 0 sends continuously
+    float burstMs = 100.0f;
+    float idleMs = 0.0f;
+    // Each device gets a new handle this often, as if it was unplugged and plugged back in; 0 never
+    float hotplugMs = 0.0f;
+    // Threads polling the published states in a loop, like games calling XInputGetState()
+    int readers = 4;
+    float seconds = 5.0f;
+    // Afterwards, how long to run the readers against a writer on a private set of gamepads; 0 skips it
+    float contentionSeconds = 2.0f;
+    uint32_t seed = 1;
+};
+
+struct StressResult {
+    std::string error;
+    double seconds = 0.0;
+    uint64_t eventsGenerated = 0;
+    uint64_t eventsProcessed = 0;
+    // Didn't fit into their device's queue, because translation fell behind
+    uint64_t eventsDropped = 0;
+    // Mouse moves folded into the motion before them by MouseMotionCoalescer, i.e. not handed to the translation core on their own
+    uint64_t eventsCoalesced = 0;
+    uint64_t statesPublished = 0;
+    uint64_t hotplugs = 0;
+    uint64_t readerPolls = 0;
+    // From the oldest event of a batch until a reader sees the state it produced
+    uint64_t latencySamples = 0;
+    double latencyP50Us = 0.0;
+    double latencyP99Us = 0.0;
+    double latencyP999Us = 0.0;
+    double latencyMaxUs = 0.0;
+    // Reads per second of gamepads 1-3, summed over the readers, first with nothing publishing and then with gamepad 0 published nonstop
+    // Each gamepad's state sits on its own cache lines, so the two should be about the same
+    double idleReadsPerSec = 0.0;
+    double contendedReadsPerSec = 0.0;
+    double contentionPublishesPerSec = 0.0;
+    // The same on a packed array of the published cells, where gamepad 0 shares a cache line with gamepad 1: what the alignment gains
+    double packedIdleReadsPerSec = 0.0;
+    double packedContendedReadsPerSec = 0.0;
+    double packedPublishesPerSec = 0.0;
+    // Reads of gamepad 0 while it was being published, on either layout, each checked for a state mixed from two publishes
+    uint64_t writtenSlotReads = 0;
+    uint64_t tornReads = 0;
+    // Summed over the threads of each kind
+    double translationCpuSeconds = 0.0;
+    double producerCpuSeconds = 0.0;
+    double readerCpuSeconds = 0.0;
+
+    bool Success() const { return error.empty(); }
+};
+
+// Gamepads are bound as in `config`, without device filters
+// Blocks for about `stress.seconds`
+StressResult RunStressTest(const StressConfig& stress, const Config& config);
+// The same from a console, without the UI: loads the config at `configPath`, runs and prints the results to stdout
+// Returns 0 if the test ran, 1 otherwise
+int RunStressTestConsole(const StressConfig& stress, const std::filesystem::path& configPath);
+
+// Times each step of loading and saving a config with `profiles` random profiles, like one with many games' worth of them
+struct ConfigBenchmarkResult {
+    std::string error;
+    // Of the formatted config
+    size_t bytes = 0;
+    int profiles = 0;
+    // Fastest of a few runs, in milliseconds
+    // Text -> toml::table
+    double parseMs = 0.0;
+    // toml::table -> Config
+    double loadMs = 0.0;
+    // Config -> toml::table
+    double stringifyMs = 0.0;
+    // toml::table -> text
+    double formatMs = 0.0;
+    // Whether loading the config back gave the same table
+    bool roundTrips = false;
+
+    bool Success() const { return error.empty(); }
+};
+
+ConfigBenchmarkResult RunConfigBenchmark(int profiles, uint32_t seed);
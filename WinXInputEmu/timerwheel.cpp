@@ -0,0 +1,179 @@
+#include "pch.h"
+
+#include "timerwheel.h"
+
+#include <bit>
+
+TimerWheel::TimerWheel() noexcept {
+    for (uint16_t i = 0; i < kNumLists; ++i) {
+        heads[i] = kNil;
+        tails[i] = kNil;
+    }
+}
+
+TimerWheel::TimerId TimerWheel::Schedule(uint64_t deadline, uint64_t payload) {
+    uint32_t index;
+    if (freeHead != kNil) {
+        index = freeHead;
+        freeHead = nodes[index].next;
+    }
+    else {
+        index = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(Node{ .generation = 1, .list = kNotLinked });
+    }
+
+    auto& node = nodes[index];
+    node.deadline = deadline;
+    node.payload = payload;
+    Insert(index);
+    ++count;
+
+    return (static_cast<uint64_t>(node.generation) << 32) | (index + 1);
+}
+
+bool TimerWheel::Cancel(TimerId id) noexcept {
+    uint32_t index = static_cast<uint32_t>(id) - 1;
+    if (index >= nodes.size()) return false;
+    auto& node = nodes[index];
+    if (node.generation != static_cast<uint32_t>(id >> 32) || node.list == kNotLinked) return false;
+
+    Unlink(index);
+    Free(index);
+    --count;
+    return true;
+}
+
+bool TimerWheel::PopExpired(uint64_t now, uint64_t& payload) noexcept {
+    while (true) {
+        auto slot = static_cast<uint16_t>(current & kSlotMask);
+        if (occupied[0] & (1ull << slot)) {
+            if (current > now) return false;
+
+            uint32_t index = heads[slot];
+            payload = nodes[index].payload;
+            Unlink(index);
+            Free(index);
+            --count;
+            return true;
+        }
+
+        // Nothing left at the current tick, skip straight to the next one that might have something
+        uint64_t next = NextDeadline();
+        if (next > now) {
+            if (now > current)
+                SetCurrent(now);
+            return false;
+        }
+        SetCurrent(next);
+    }
+}
+
+uint64_t TimerWheel::NextDeadline() const noexcept {
+    if (count == 0) return UINT64_MAX;
+
+    // Level 0 slots before the current one are always empty, they'd have fired already
+    uint64_t bits = occupied[0] >> (current & kSlotMask);
+    if (bits)
+        return current + std::countr_zero(bits);
+
+    // Same for the slot at the current position of each higher level: it got cascaded when the wheel entered it
+    for (int level = 1; level < kLevels; ++level) {
+        int shift = kSlotBits * level;
+        auto pos = static_cast<int>((current >> shift) & kSlotMask);
+        bits = pos == kSlots - 1 ? 0 : occupied[level] >> (pos + 1);
+        if (bits) {
+            uint64_t slot = pos + 1 + std::countr_zero(bits);
+            int rotationShift = shift + kSlotBits;
+            return ((current >> rotationShift) << rotationShift) | (slot << shift);
+        }
+    }
+
+    // Only the overflow list is left, which gets looked at when the top level wraps around
+    constexpr int kTopShift = kSlotBits * kLevels;
+    return ((current >> kTopShift) + 1) << kTopShift;
+}
+
+void TimerWheel::Insert(uint32_t index) noexcept {
+    auto& node = nodes[index];
+    if (node.deadline < current)
+        node.deadline = current;
+
+    for (int level = 0; level < kLevels; ++level) {
+        int rotationShift = kSlotBits * (level + 1);
+        if ((node.deadline >> rotationShift) == (current >> rotationShift)) {
+            auto slot = static_cast<uint16_t>((node.deadline >> (kSlotBits * level)) & kSlotMask);
+            Link(index, static_cast<uint16_t>(level * kSlots + slot));
+            return;
+        }
+    }
+    Link(index, kOverflowList);
+}
+
+void TimerWheel::Link(uint32_t index, uint16_t list) noexcept {
+    auto& node = nodes[index];
+    node.list = list;
+    node.next = kNil;
+    node.prev = tails[list];
+    if (tails[list] != kNil)
+        nodes[tails[list]].next = index;
+    else
+        heads[list] = index;
+    tails[list] = index;
+
+    if (list != kOverflowList)
+        occupied[list / kSlots] |= 1ull << (list % kSlots);
+}
+
+void TimerWheel::Unlink(uint32_t index) noexcept {
+    auto& node = nodes[index];
+    uint16_t list = node.list;
+    if (node.prev != kNil)
+        nodes[node.prev].next = node.next;
+    else
+        heads[list] = node.next;
+    if (node.next != kNil)
+        nodes[node.next].prev = node.prev;
+    else
+        tails[list] = node.prev;
+    node.list = kNotLinked;
+
+    if (list != kOverflowList && heads[list] == kNil)
+        occupied[list / kSlots] &= ~(1ull << (list % kSlots));
+}
+
+void TimerWheel::Free(uint32_t index) noexcept {
+    auto& node = nodes[index];
+    // Invalidates outstanding TimerIds
+    ++node.generation;
+    node.next = freeHead;
+    freeHead = index;
+}
+
+void TimerWheel::MoveListDown(uint16_t list) noexcept {
+    // Detach the whole list first: overflow timers that are still too far away go right back onto it
+    uint32_t index = heads[list];
+    heads[list] = kNil;
+    tails[list] = kNil;
+    if (list != kOverflowList)
+        occupied[list / kSlots] &= ~(1ull << (list % kSlots));
+
+    while (index != kNil) {
+        uint32_t next = nodes[index].next;
+        Insert(index);
+        index = next;
+    }
+}
+
+void TimerWheel::SetCurrent(uint64_t tick) noexcept {
+    if (tick == current) return;
+    current = tick;
+    if (tick & kSlotMask) return;
+
+    // Entered a new level 0 rotation: bring down the timers of the higher level slots that start here
+    for (int level = 1; level < kLevels; ++level) {
+        auto slot = static_cast<uint16_t>((tick >> (kSlotBits * level)) & kSlotMask);
+        MoveListDown(static_cast<uint16_t>(level * kSlots + slot));
+        if (slot != 0) return;
+    }
+    MoveListDown(kOverflowList);
+}
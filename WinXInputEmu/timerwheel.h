@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timer wheel, keyed by an abstract tick count
+//
+// The wheel never reads a clock: deadlines and "now" are whatever the caller says they are, so the same code runs against gClock on the input thread,
+// against recorded timestamps in a replay, or against a hand-advanced counter in a test on any platform.
+//
+// Level L has kSlots slots, each covering kSlots^L ticks. A timer sits at the lowest level whose current rotation contains its deadline, and is moved down a level
+// ("cascaded") when the wheel reaches the start of its slot. Timers beyond the top level's rotation wait in an overflow list.
+// Schedule() and Cancel() are O(1); PopExpired() is O(1) per timer plus O(kLevels) per skipped stretch of empty slots, thanks to a per-level occupancy bitmask.
+struct TimerWheel {
+    static constexpr int kLevels = 4;
+    static constexpr int kSlotBits = 6;
+    static constexpr int kSlots = 1 << kSlotBits;
+
+    // 0 is never a valid id
+    using TimerId = uint64_t;
+
+    TimerWheel() noexcept;
+
+    // Deadlines at or before the wheel's current tick fire on the next PopExpired()
+    TimerId Schedule(uint64_t deadline, uint64_t payload);
+    // Returns false if the timer already fired, was already cancelled, or never existed
+    bool Cancel(TimerId id) noexcept;
+
+    // Removes the earliest timer with deadline <= now and returns its payload, or returns false if there is none
+    // Timers with the same deadline pop in the order they were scheduled. Timers scheduled in between calls (e.g. by whoever handles the popped payload) are honored.
+    bool PopExpired(uint64_t now, uint64_t& payload) noexcept;
+
+    // A tick at or before the earliest deadline, or UINT64_MAX if the wheel is empty
+    // This is exact for timers within the current level 0 rotation; otherwise it's the tick at which the earliest timer gets cascaded, i.e. calling PopExpired() then is harmless and makes the next answer more precise.
+    uint64_t NextDeadline() const noexcept;
+
+    size_t Size() const noexcept { return count; }
+
+private:
+    static constexpr uint32_t kNil = UINT32_MAX;
+    static constexpr uint16_t kOverflowList = kLevels * kSlots;
+    static constexpr uint16_t kNumLists = kOverflowList + 1;
+    static constexpr uint16_t kNotLinked = UINT16_MAX;
+    static constexpr uint64_t kSlotMask = kSlots - 1;
+
+    struct Node {
+        uint64_t deadline;
+        uint64_t payload;
+        uint32_t prev, next;
+        uint32_t generation;
+        // Which of `heads` this node is on, or kNotLinked if it's on the free list
+        uint16_t list;
+    };
+
+    std::vector<Node> nodes;
+    uint32_t freeHead = kNil;
+    uint32_t heads[kNumLists];
+    uint32_t tails[kNumLists];
+    // Bit i of occupied[L] is set iff slot i of level L is non-empty
+    uint64_t occupied[kLevels] = {};
+    // Everything before this tick has fired
+    uint64_t current = 0;
+    size_t count = 0;
+
+    void Insert(uint32_t index) noexcept;
+    void Link(uint32_t index, uint16_t list) noexcept;
+    void Unlink(uint32_t index) noexcept;
+    void Free(uint32_t index) noexcept;
+    void MoveListDown(uint16_t list) noexcept;
+    void SetCurrent(uint64_t tick) noexcept;
+};
@@ -0,0 +1,368 @@
+﻿#include "pch.h"
+
+#include "translation.h"
+
+void ButtonTable::Clear() noexcept {
+    for (auto& span : keys)
+        span = {};
+    for (auto& count : heldCount)
+        count = 0;
+    for (auto& bits : keyDown)
+        bits = 0;
+}
+
+bool ButtonTable::Compile(const UserProfile& profile) noexcept {
+    Clear();
+
+    struct Binding {
+        XiButton btn;
+        const UserProfile::Button* src;
+    };
+    Binding bindings[kXiButtonCount];
+    int numBindings = 0;
+
+    using enum XiButton;
+#define BTN(KEY_ENUM, THE_BTN) bindings[numBindings++] = { KEY_ENUM, &THE_BTN };
+    BTN(A, profile.a);
+    BTN(B, profile.b);
+    BTN(X, profile.x);
+    BTN(Y, profile.y);
+    BTN(LB, profile.lb);
+    BTN(RB, profile.rb);
+    BTN(LT, profile.lt);
+    BTN(RT, profile.rt);
+    BTN(Start, profile.start);
+    BTN(Back, profile.back);
+    BTN(DpadUp, profile.dpadUp);
+    BTN(DpadDown, profile.dpadDown);
+    BTN(DpadLeft, profile.dpadLeft);
+    BTN(DpadRight, profile.dpadRight);
+    BTN(LStickBtn, profile.lstickBtn);
+    BTN(RStickBtn, profile.rstickBtn);
+#define STICK(PREFIX, THE_STICK) \
+    if (THE_STICK.useMouse) {} \
+    else { BTN(PREFIX##StickUp, THE_STICK.kbd.up); BTN(PREFIX##StickDown, THE_STICK.kbd.down); BTN(PREFIX##StickLeft, THE_STICK.kbd.left); BTN(PREFIX##StickRight, THE_STICK.kbd.right); }
+    STICK(L, profile.lstick);
+    STICK(R, profile.rstick);
+#undef STICK
+    BTN(AnalogModifier, profile.analogModifier);
+#undef BTN
+
+    // Bucket the (key, button) pairs by key: count them, turn the counts into offsets, then fill in
+    bool complete = true;
+    auto forEachPair = [&](auto&& fn) {
+        int accepted = 0;
+        for (int i = 0; i < numBindings; ++i) {
+            for (KeyCode keyCode : bindings[i].src->keyCodes) {
+                if (accepted == kMaxTargets) {
+                    complete = false;
+                    return;
+                }
+                ++accepted;
+                fn(keyCode, bindings[i].btn);
+            }
+        }
+    };
+    forEachPair([&](KeyCode keyCode, XiButton) { ++keys[keyCode].count; });
+    int offset = 0;
+    for (auto& span : keys) {
+        span.first = static_cast<uint8_t>(offset);
+        offset += span.count;
+        span.count = 0;
+    }
+    forEachPair([&](KeyCode keyCode, XiButton btn) {
+        auto& span = keys[keyCode];
+        targets[span.first + span.count++] = btn;
+    });
+
+    return complete;
+}
+
+// What a key kernel is specialized on
+enum KernelFlags : unsigned {
+    // Either device filter is set
+    KF_Filtered = 1 << 0,
+    // The stick is in keyboard mode
+    KF_LStickKbd = 1 << 1,
+    KF_RStickKbd = 1 << 2,
+    // The profile has timed actions
+    KF_Actions = 1 << 3,
+    // Work out all of the above on each event instead, i.e. the generic kernel
+    KF_Runtime = 1 << 4,
+};
+
+static unsigned ComputeKernelFlags(const XiGamepadBinding& binding) noexcept {
+    unsigned flags = 0;
+    if (binding.srcKbd != INVALID_HANDLE_VALUE || binding.srcMouse != INVALID_HANDLE_VALUE)
+        flags |= KF_Filtered;
+    if (!binding.sticks[0].useMouse)
+        flags |= KF_LStickKbd;
+    if (!binding.sticks[1].useMouse)
+        flags |= KF_RStickKbd;
+    if (binding.hasActions)
+        flags |= KF_Actions;
+    return flags;
+}
+
+static void TranslateNothing(int, HANDLE, BYTE, bool, int64_t, InputTranslationStruct&) {}
+
+template <unsigned kFlags>
+static void TranslateKey(int userIndex, HANDLE hDevice, BYTE vkey, bool pressed, int64_t time, InputTranslationStruct& its);
+
+template <unsigned... kFlags>
+static constexpr auto MakeKeyKernelTable(std::integer_sequence<unsigned, kFlags...>) {
+    return std::array<InputTranslationStruct::KeyKernel, sizeof...(kFlags)>{ &TranslateKey<kFlags>... };
+}
+
+// Indexed by KernelFlags, except KF_Runtime
+static constexpr auto kKeyKernels = MakeKeyKernelTable(std::make_integer_sequence<unsigned, KF_Runtime>());
+
+void InputTranslationStruct::ClearAll() {
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        xiGamepadExtraInfo[userIndex] = {};
+        btns[userIndex].Clear();
+        keyKernels[userIndex] = &TranslateNothing;
+    }
+    mouseSticks.ClearAll();
+    actions.ClearAll();
+}
+
+void InputTranslationStruct::PopulateBtnLut(int userIndex, const UserProfile& profile) {
+    xiGamepadExtraInfo[userIndex] = {};
+    if (!btns[userIndex].Compile(profile))
+        LOG(Config, Warning, L"Too many key bindings on gamepad {}, only the first {} are used", userIndex, ButtonTable::kMaxTargets);
+}
+
+void InputTranslationStruct::PopulateSticks(int userIndex, const UserProfile& profile) {
+    stickCurves[userIndex][0].Compile(profile.lstick.curve);
+    stickCurves[userIndex][1].Compile(profile.rstick.curve);
+    mouseSticks.Set(userIndex, 0, profile.lstick, stickCurves[userIndex][0]);
+    mouseSticks.Set(userIndex, 1, profile.rstick, stickCurves[userIndex][1]);
+}
+
+void InputTranslationStruct::PopulateActions(int userIndex, const UserProfile& profile) {
+    actions.Bind(userIndex, profile);
+}
+
+void InputTranslationStruct::PopulateKernel(int userIndex) {
+    const auto& binding = bindings[userIndex];
+    if (!binding.enabled || binding.suspended || !binding.profileStore)
+        keyKernels[userIndex] = &TranslateNothing;
+    else if (genericKernels)
+        keyKernels[userIndex] = &TranslateKey<KF_Runtime>;
+    else
+        keyKernels[userIndex] = kKeyKernels[ComputeKernelFlags(binding)];
+}
+
+void InputTranslationStruct::SetDeviceFilter(int userIndex, bool mouse, HANDLE hDevice) {
+    auto& binding = bindings[userIndex];
+    (mouse ? binding.srcMouse : binding.srcKbd) = hDevice;
+    PopulateKernel(userIndex);
+}
+
+// How much a single late or early tick may scale the mouse movement it saw
+constexpr float kMouseTickMinScale = 0.25f;
+constexpr float kMouseTickMaxScale = 4.0f;
+
+void DoMouse2Joystick(int64_t elapsed, int64_t period, InputTranslationStruct& its) {
+    MouseStickOutput out;
+    // The sticks follow mouse speed: normalize the movement accumulated over `elapsed` to one nominal period, so that tick jitter doesn't make them twitch
+    bool rescale = elapsed > 0 && period > 0 && elapsed != period;
+    if (its.fixedPointMouseSticks) {
+        int32_t scaleQ16 = 0x10000;
+        if (rescale) {
+            constexpr int64_t kMinQ16 = static_cast<int64_t>(kMouseTickMinScale * 0x10000);
+            constexpr int64_t kMaxQ16 = static_cast<int64_t>(kMouseTickMaxScale * 0x10000);
+            // Clamped before multiplying, so that a very late tick can't overflow this
+            int64_t clampedElapsed = std::clamp(elapsed, period / 8, period * 8);
+            scaleQ16 = static_cast<int32_t>(std::clamp((period << 16) / clampedElapsed, kMinQ16, kMaxQ16));
+        }
+        ComputeMouseSticksFixed(its.mouseSticks, scaleQ16, out);
+    }
+    else {
+        if (rescale) {
+            float scale = std::clamp(static_cast<float>(period) / static_cast<float>(elapsed), kMouseTickMinScale, kMouseTickMaxScale);
+            for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+                its.mouseSticks.accuX[userIndex] *= scale;
+                its.mouseSticks.accuY[userIndex] *= scale;
+            }
+        }
+        ComputeMouseSticks(its.mouseSticks, out);
+    }
+
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        its.mouseSticks.accuX[userIndex] = 0;
+        its.mouseSticks.accuY[userIndex] = 0;
+
+        if (!its.bindings[userIndex].enabled) continue;
+        auto& dev = its.gamepads[userIndex];
+
+        auto forStick = [&](int stick, short& outX, short& outY) {
+            if (!its.mouseSticks.active[stick][userIndex]) return;
+            auto x = static_cast<short>(out.x[stick][userIndex]);
+            auto y = static_cast<short>(out.y[stick][userIndex]);
+            if (x == outX && y == outY) return;
+            outX = x;
+            outY = y;
+            ++dev.epoch;
+        };
+        forStick(0, dev.lstickX, dev.lstickY);
+        forStick(1, dev.rstickX, dev.rstickY);
+    }
+}
+
+void HandleMouseMovement(HANDLE hDevice, LONG dx, LONG dy, InputTranslationStruct& its) {
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+        if (!its.bindings[userIndex].enabled || its.bindings[userIndex].suspended) continue;
+        HANDLE src = its.bindings[userIndex].srcMouse;
+        if (src != INVALID_HANDLE_VALUE && src != hDevice) continue;
+
+        its.mouseSticks.accuX[userIndex] += dx;
+        its.mouseSticks.accuY[userIndex] += dy;
+    }
+}
+
+void SetGamepadSuspended(int userIndex, bool suspended, int64_t time, InputTranslationStruct& its) {
+    auto& binding = its.bindings[userIndex];
+    if (binding.suspended == suspended) return;
+
+    if (suspended) {
+        its.actions.Advance(time, its.gamepads);
+        // Through the gamepad's own kernel, so that SOCD, the analog modifier and timed actions see the releases as usual
+        const auto& table = its.btns[userIndex];
+        for (int vkey = 0; vkey < 0x100; ++vkey) {
+            if (!table.IsKeyDown(static_cast<BYTE>(vkey))) continue;
+            HANDLE src = IsKeyCodeMouseButton(static_cast<BYTE>(vkey)) ? binding.srcMouse : binding.srcKbd;
+            its.keyKernels[userIndex](userIndex, src, static_cast<BYTE>(vkey), false, time, its);
+        }
+        // Mouse sticks recenter at the next tick, with no motion coming in
+        its.mouseSticks.accuX[userIndex] = 0;
+        its.mouseSticks.accuY[userIndex] = 0;
+    }
+
+    binding.suspended = suspended;
+    its.PopulateKernel(userIndex);
+}
+
+bool AdvanceActions(int64_t time, InputTranslationStruct& its) {
+    return its.actions.Advance(time, its.gamepads);
+}
+
+void HandleKeyPress(HANDLE hDevice, BYTE vkey, bool pressed, int64_t time, InputTranslationStruct& its) {
+    // Whatever was due before this key event happened first, e.g. a tap/hold deciding on "hold" just before the key is released
+    its.actions.Advance(time, its.gamepads);
+
+    for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex)
+        its.keyKernels[userIndex](userIndex, hDevice, vkey, pressed, time, its);
+}
+
+template <unsigned kFlags>
+static void TranslateKey(int userIndex, HANDLE hDevice, BYTE vkey, bool pressed, int64_t time, InputTranslationStruct& its) {
+    auto& binding = its.bindings[userIndex];
+    // A constant in specialized kernels, so everything the profile doesn't need compiles away
+    const unsigned flags = (kFlags & KF_Runtime) ? ComputeKernelFlags(binding) : kFlags;
+
+    if (flags & KF_Filtered) {
+        HANDLE src = IsKeyCodeMouseButton(vkey) ? binding.srcMouse : binding.srcKbd;
+        if (src != INVALID_HANDLE_VALUE && src != hDevice) return;
+    }
+
+    auto& dev = its.gamepads[userIndex];
+    auto& extra = its.xiGamepadExtraInfo[userIndex];
+    auto& table = its.btns[userIndex];
+
+    // Key repeats, and releases of keys this gamepad never saw go down
+    if (table.IsKeyDown(vkey) == pressed) return;
+    table.SetKeyDown(vkey, pressed);
+
+    if (flags & KF_Actions)
+        its.actions.OnKey(userIndex, vkey, pressed, time, dev);
+
+    bool recompute_lstick = false;
+    bool recompute_rstick = false;
+
+    auto span = table.keys[vkey];
+    for (int i = span.first; i < span.first + span.count; ++i) {
+        auto btn = table.targets[i];
+        auto& heldCount = table.heldCount[static_cast<int>(btn)];
+        bool wasHeld = heldCount > 0;
+        heldCount = static_cast<uint8_t>(pressed ? heldCount + 1 : heldCount - 1);
+        bool held = heldCount > 0;
+        // Another of its keys is still down; a press still goes through, e.g. to count as the most recent stick direction
+        if (held == wasHeld && !pressed) continue;
+
+        switch (btn) {
+            using enum XiButton;
+        case A: dev.a = held; break;
+        case B: dev.b = held; break;
+        case X: dev.x = held; break;
+        case Y: dev.y = held; break;
+
+        case LB: dev.lb = held; break;
+        case RB: dev.rb = held; break;
+        case LT: dev.lt = held; break;
+        case RT: dev.rt = held; break;
+
+        case Start: dev.start = held; break;
+        case Back: dev.back = held; break;
+
+        case DpadUp: dev.dpadUp = held; break;
+        case DpadDown: dev.dpadDown = held; break;
+        case DpadLeft: dev.dpadLeft = held; break;
+        case DpadRight: dev.dpadRight = held; break;
+
+        case LStickBtn: dev.lstickBtn = held; break;
+        case RStickBtn: dev.rstickBtn = held; break;
+
+            // NOTE: we assume that if any key is setup for the joystick directions, it's on keyboard mode
+            //       that is, we rely on the translation struct being populated from the current user config correctly
+#define STICKBUTTON(THEENUM, STICK, DIR, AXIS, SIGN) case THEENUM: recompute_##STICK = true; extra.STICK.DIR = held; if (pressed) extra.STICK.last##AXIS = SIGN; break;
+            STICKBUTTON(LStickUp, lstick, up, Y, 1);
+            STICKBUTTON(LStickDown, lstick, down, Y, -1);
+            STICKBUTTON(LStickLeft, lstick, left, X, -1);
+            STICKBUTTON(LStickRight, lstick, right, X, 1);
+            STICKBUTTON(RStickUp, rstick, up, Y, 1);
+            STICKBUTTON(RStickDown, rstick, down, Y, -1);
+            STICKBUTTON(RStickLeft, rstick, left, X, -1);
+            STICKBUTTON(RStickRight, rstick, right, X, 1);
+#undef STICKBUTTON
+
+        case AnalogModifier: {
+            extra.analogModifier = held;
+            dev.triggerValue = held ? static_cast<BYTE>(255 * binding.analogModifierScale) : 255;
+            recompute_lstick = true;
+            recompute_rstick = true;
+        } break;
+
+        case None: break;
+        }
+    }
+
+    float modifierScale = extra.analogModifier ? binding.analogModifierScale : 1.0f;
+    auto recomputeStick = [&](const auto& keys, const XiGamepadBinding::StickParams& conf, const StickCurveLut& curve, short& outX, short& outY) {
+        // Resolve opposing keys held at the same time
+        auto resolve = [&](bool positive, bool negative, signed char last) {
+            if (positive && negative) {
+                switch (conf.socd) {
+                    using enum UserProfile::SocdPolicy;
+                case Neutral: return 0.0f;
+                case LastWins: return static_cast<float>(last);
+                case FirstWins: return static_cast<float>(-last);
+                }
+            }
+            return (positive ? 1.0f : 0.0f) - (negative ? 1.0f : 0.0f);
+        };
+        float dirX = resolve(keys.right, keys.left, keys.lastX);
+        float dirY = resolve(keys.up, keys.down, keys.lastY);
+        // Stick's actual deflection per user's speed setting, then shaped like any other input
+        curve.Shape(dirX, dirY, conf.speed * modifierScale, outX, outY);
+    };
+    // Mouse sticks have no direction keys, but the analog modifier asks for both
+    if ((flags & KF_LStickKbd) && recompute_lstick)
+        recomputeStick(extra.lstick, binding.sticks[0], its.stickCurves[userIndex][0], dev.lstickX, dev.lstickY);
+    if ((flags & KF_RStickKbd) && recompute_rstick)
+        recomputeStick(extra.rstick, binding.sticks[1], its.stickCurves[userIndex][1], dev.rstickX, dev.rstickY);
+
+    ++dev.epoch;
+}
+
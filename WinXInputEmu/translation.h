@@ -0,0 +1,151 @@
+#pragma once
+
+#include "actions.h"
+#include "config.h"
+#include "inputdevice.h"
+#include "mousestick.h"
+#include "platform.h"
+#include "shadowed.h"
+#include "stickcurve.h"
+#include "userdevice.h"
+
+// Which gamepad buttons each key drives, for one gamepad, plus what's currently held
+// A key may drive several buttons, and several keys may drive the same button: a button is held for as long as any of its keys is
+struct ButtonTable {
+    // Upper bound on (key, button) pairs in one profile, i.e. on the total length of every UserProfile::Button::keyCodes
+    static constexpr int kMaxTargets = 128;
+
+    // keys[vkey] selects targets[first, first + count)
+    struct Span {
+        uint8_t first, count;
+    };
+    Span keys[0x100];
+    XiButton targets[kMaxTargets];
+
+    // Per XiButton, how many of its keys are held
+    uint8_t heldCount[kXiButtonCount];
+    // Bit per VK_xxx: held as far as this gamepad is concerned, i.e. passed its device filter
+    // Tells key repeats apart from presses, and keeps a release that was never pressed (e.g. held since before binding) from unbalancing heldCount
+    uint64_t keyDown[0x100 / 64];
+
+    void Clear() noexcept;
+    // Returns false if `profile` has more than kMaxTargets bindings; the table then holds the first kMaxTargets
+    bool Compile(const UserProfile& profile) noexcept;
+
+    bool IsKeyDown(BYTE vkey) const noexcept { return keyDown[vkey / 64] & (1ull << (vkey % 64)); }
+    void SetKeyDown(BYTE vkey, bool down) noexcept {
+        if (down) keyDown[vkey / 64] |= 1ull << (vkey % 64);
+        else keyDown[vkey / 64] &= ~(1ull << (vkey % 64));
+    }
+};
+
+// Information and lookup tables computable from a Config object
+// used for translating input key presses/mouse movements into gamepad state
+struct InputTranslationStruct {
+    // Handles one key event for one gamepad
+    using KeyKernel = void (*)(int userIndex, HANDLE hDevice, BYTE vkey, bool pressed, int64_t time, InputTranslationStruct& its);
+
+    struct {
+        struct {
+            // Keyboard mode stuff
+            bool up, down, left, right;
+            // Direction of the most recently pressed key on each axis, for SOCD resolution
+            signed char lastX, lastY;
+
+        } lstick, rstick;
+
+        bool analogModifier;
+    } xiGamepadExtraInfo[XUSER_MAX_COUNT];
+
+    // Response curves of [userIndex][0 = lstick, 1 = rstick], for both keyboard and mouse mode
+    StickCurveLut stickCurves[XUSER_MAX_COUNT][2];
+
+    // Mouse mode stuff, for all gamepads at once
+    MouseStickLanes mouseSticks;
+
+    // Turbo, macros and tap/hold keys
+    ActionScheduler actions;
+
+    // Compiled from each gamepad's profile by PopulateBtnLut()
+    ButtonTable btns[XUSER_MAX_COUNT];
+
+    // Per gamepad, specialized for the shape of its binding (device filters, keyboard or mouse sticks, timed actions) by PopulateKernel()
+    KeyKernel keyKernels[XUSER_MAX_COUNT];
+    // If set, PopulateKernel() installs the generic kernel, which looks at all of the above for every event, e.g. to measure what specializing gains
+    bool genericKernels = false;
+    // Mouse sticks use ComputeMouseSticksFixed(), whose results don't depend on the compiler or CPU
+    bool fixedPointMouseSticks = false;
+
+    // The gamepads this struct translates input into
+    // Normally the global ones read by the XInput API, but can be pointed elsewhere, e.g. for replaying a recording without disturbing the live state
+    XiGamepad* gamepads = gXiGamepads;
+    XiGamepadBinding* bindings = gXiGamepadBindings;
+
+    InputTranslationStruct() {
+        ClearAll();
+    }
+
+    void ClearAll();
+    void PopulateBtnLut(int userIndex, const UserProfile& profile);
+    void PopulateSticks(int userIndex, const UserProfile& profile);
+    void PopulateActions(int userIndex, const UserProfile& profile);
+    // Call after the others, and whenever bindings[userIndex] changes in any other way
+    void PopulateKernel(int userIndex);
+
+    // Sets XiGamepadBinding::srcKbd or srcMouse, keeping the kernel in sync
+    void SetDeviceFilter(int userIndex, bool mouse, HANDLE hDevice);
+};
+
+// The translation core: these only touch the InputTranslationStruct and the gamepads it points to, no window or OS state
+// Threading: input thread only, if the struct points to the global gamepads
+void HandleMouseMovement(HANDLE hDevice, LONG dx, LONG dy, InputTranslationStruct& its);
+// `time` is when the event happened, in the units of its.actions.SetClock()
+void HandleKeyPress(HANDLE hDevice, BYTE vkey, bool pressed, int64_t time, InputTranslationStruct& its);
+// Stops or resumes feeding input into one gamepad; the gamepad stays bound and visible to the game
+// Suspending first releases every key the gamepad holds, as if they had been let go at `time`
+void SetGamepadSuspended(int userIndex, bool suspended, int64_t time, InputTranslationStruct& its);
+// One mouse stick tick, `elapsed` after the previous one, where ticks are nominally `period` apart (both in the same ticks as `time` above)
+void DoMouse2Joystick(int64_t elapsed, int64_t period, InputTranslationStruct& its);
+// Runs timed action steps due at or before `time`; returns true if any gamepad changed
+// Call no later than its.actions.NextDeadline()
+bool AdvanceActions(int64_t time, InputTranslationStruct& its);
+
+// Mouse motion only has an effect at the next mouse tick, where it's summed up anyways, so consecutive moves of one device are folded together
+// and handed over as one, instead of walking every gamepad's filter for each of the thousands of reports a second a gaming mouse sends
+// Whoever feeds it must call Flush() before anything that has to come after the motion: key events, and the mouse tick
+struct MouseMotionCoalescer {
+    // Keeps the sums exactly representable in the float accumulators they end up in
+    static constexpr LONG kMaxCoalesced = 1 << 20;
+
+    HANDLE device = nullptr;
+    LONG dx = 0, dy = 0;
+    // Of the latest move folded in
+    int64_t time = 0;
+    bool pending = false;
+    // Moves folded into one before them, i.e. that didn't have to be handed over on their own
+    uint64_t merged = 0;
+
+    // `flush` is called as flush(device, dx, dy, time) with the motion to hand over, typically ending in HandleMouseMovement()
+    template <typename TFlush>
+    void Add(HANDLE hDevice, LONG moveX, LONG moveY, int64_t moveTime, TFlush&& flush) {
+        if (pending && (device != hDevice || std::abs(dx) > kMaxCoalesced || std::abs(dy) > kMaxCoalesced))
+            Flush(flush);
+        if (pending)
+            ++merged;
+        device = hDevice;
+        dx += moveX;
+        dy += moveY;
+        time = moveTime;
+        pending = true;
+    }
+
+    template <typename TFlush>
+    void Flush(TFlush&& flush) {
+        if (!pending) return;
+        flush(device, dx, dy, time);
+        device = nullptr;
+        dx = dy = 0;
+        time = 0;
+        pending = false;
+    }
+};
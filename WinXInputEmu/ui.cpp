@@ -2,67 +2,222 @@
 
 #include "ui.h"
 
+#include <atomic>
+#include <cfloat>
+#include <cmath>
 #include <imgui.h>
 #include <imgui_stdlib.h>
+#include <thread>
 
+#include "clock.h"
+#include "cursorcapture.h"
+#include "devicestats.h"
+#include "inputrecord.h"
+#include "mousestick.h"
+#include "slotrouting.h"
+#include "stresstest.h"
+#include "translation.h"
 #include "userdevice.h"
 
 using namespace std::literals;
 
+// Each kernel kind replays the recording this many times, the fastest run counts
+constexpr int kKernelBenchmarkRuns = 5;
+constexpr int kMouseStickComparisonTicks = 100000;
+
 #define FORMAT_GAMEPAD_NAME(VAR, USER_INDEX ) char VAR[256]; snprintf(VAR, sizeof(VAR), "Gamepad %d", (int)USER_INDEX);
 
-struct HostWindow {
-    std::string nameUtf8;
-    HWND hwnd;
+// Snapshot of everything ShowUI() displays that may change without any UI interaction
+struct UIWatchedState {
+    int selectedUserIndex = -1;
+    bool gamepadEnabled = false;
+    int gamepadEpoch = 0;
+    HANDLE srcKbd = INVALID_HANDLE_VALUE;
+    HANDLE srcMouse = INVALID_HANDLE_VALUE;
+    int bindIdevFromNextKey = -1;
+    int bindIdevFromNextMouse = -1;
+    bool recording = false;
+    uint64_t recordEntriesWritten = 0;
+    uint64_t recordEntriesDropped = 0;
+    bool recordWriteFailed = false;
+    bool replayRunning = false;
+    bool stressRunning = false;
+    bool configBenchRunning = false;
+    // Counts so far, so that calibration progress shows live
+    int64_t calibrationX = 0;
+    int64_t calibrationY = 0;
+    // Not the recenter count: that changes every mouse tick, redrawing for it would defeat redrawing on demand
+    bool cursorCaptured = false;
+    uint64_t clipReassertsMoved = 0;
+    uint64_t clipReassertsDropped = 0;
+
+    bool operator==(const UIWatchedState&) const = default;
 };
 
 struct UIStatePrivate {
-    std::vector<HostWindow> hostWindowList;
     int selectedUserIndex = -1;
     bool showDemoWindow = false;
 
+    std::thread replayThread;
+    // Written by the replay thread, only read by the UI once replayRunning is false
+    ReplayResult replayResult;
+    std::atomic<bool> replayRunning = false;
+    bool hasReplayResult = false;
+    bool replayRealTime = false;
+    // Nanoseconds per replayed event, 0 if the replay failed; written by the replay thread like replayResult
+    double benchSpecializedNs = 0.0;
+    double benchGenericNs = 0.0;
+    bool hasBenchResult = false;
+
+    // Of the latest "Start recording" click
+    bool recordStartFailed = false;
+
+    std::thread stressThread;
+    // Written by the stress test thread, only read by the UI once stressRunning is false
+    StressResult stressResult;
+    std::atomic<bool> stressRunning = false;
+    bool hasStressResult = false;
+    StressConfig stressConfig;
+    std::thread configBenchThread;
+    // Written by the config benchmark thread, only read by the UI once configBenchRunning is false
+    ConfigBenchmarkResult configBenchResult;
+    std::atomic<bool> configBenchRunning = false;
+    bool hasConfigBenchResult = false;
+    int configBenchProfiles = 1000;
+    // Fast enough to run on the UI thread
+    MouseStickMathComparison mouseStickComparison;
+    bool hasMouseStickComparison = false;
+
+    // In the "Devices" window
+    HANDLE selectedDevice = nullptr;
+    bool hasSelectedDevice = false;
+    float calibrationDistanceCm = 10.0f;
+    // Of the latest finished calibration, 0 if the mouse didn't move
+    float calibrationResult = 0.0f;
+    HANDLE calibrationResultDevice = nullptr;
+    bool hasCalibrationResult = false;
+
+    UIWatchedState lastWatchedState;
+
     UIStatePrivate(UIState& s)
     {
     }
 
-    void EnumHostWindows() {
-        hostWindowList.clear();
+    ~UIStatePrivate() {
+        if (replayThread.joinable())
+            replayThread.join();
+        if (stressThread.joinable())
+            stressThread.join();
+        if (configBenchThread.joinable())
+            configBenchThread.join();
+    }
 
-        DWORD currProcessId = GetCurrentProcessId();
-        HANDLE handle = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
-        if (handle == INVALID_HANDLE_VALUE)
-            return;
-        DEFER{ CloseHandle(handle); };
+    void StartReplay() {
+        if (replayThread.joinable())
+            replayThread.join();
 
-        THREADENTRY32 te32;
-        te32.dwSize = sizeof(te32);
+        replayRunning = true;
+        hasReplayResult = true;
+        hasBenchResult = false;
+        // Copy the config: the replay runs concurrently with config reloads on this thread
+        replayThread = std::thread([this, config = gConfig, speed = replayRealTime ? ReplaySpeed::RealTime : ReplaySpeed::Max]() {
+            replayResult = ReplayRecording(GetDesignatedRecordingPath(), config, speed);
+            replayRunning.store(false, std::memory_order_release);
+        });
+    }
 
-        if (!Thread32First(handle, &te32))
-            return;
+    // Replays the recording with the specialized and the generic key kernels, to see what specializing per profile gains
+    void StartKernelBenchmark() {
+        if (replayThread.joinable())
+            replayThread.join();
 
-        do {
-            if (te32.th32OwnerProcessID == currProcessId) {
-                EnumThreadWindows(te32.th32ThreadID, EnumThreadWindowsCallback, reinterpret_cast<LPARAM>(this));
-            }
-        } while (Thread32Next(handle, &te32));
+        replayRunning = true;
+        hasReplayResult = false;
+        hasBenchResult = true;
+        replayThread = std::thread([this, config = gConfig]() {
+            auto run = [&](ReplayKernels kernels) {
+                double best = 0.0;
+                for (int i = 0; i < kKernelBenchmarkRuns; ++i) {
+                    auto res = ReplayRecording(GetDesignatedRecordingPath(), config, ReplaySpeed::Max, kernels);
+                    if (!res.Success() || res.eventsReplayed == 0)
+                        return 0.0;
+                    double ns = res.elapsedSeconds * 1e9 / static_cast<double>(res.eventsReplayed);
+                    if (i == 0 || ns < best)
+                        best = ns;
+                }
+                return best;
+            };
+            benchGenericNs = run(ReplayKernels::Generic);
+            benchSpecializedNs = run(ReplayKernels::Specialized);
+            replayRunning.store(false, std::memory_order_release);
+        });
     }
 
-private:
-    static BOOL CALLBACK EnumThreadWindowsCallback(HWND hwnd, LPARAM lParam) {
-        auto self = reinterpret_cast<UIStatePrivate*>(lParam);
+    void StartStressTest() {
+        if (stressThread.joinable())
+            stressThread.join();
 
-        WCHAR nameWide[256];
-        int res = GetWindowTextW(hwnd, nameWide, IM_ARRAYSIZE(nameWide));
-        std::string nameUtf8 = res == 0
-            ? "<no name>"s
-            : WideToUtf8(std::wstring_view(nameWide, res));
+        stressRunning = true;
+        hasStressResult = true;
+        stressThread = std::thread([this, stress = stressConfig, config = gConfig]() {
+            stressResult = RunStressTest(stress, config);
+            stressRunning.store(false, std::memory_order_release);
+        });
+    }
 
-        self->hostWindowList.push_back(HostWindow{ std::move(nameUtf8), hwnd });
+    void StartConfigBenchmark() {
+        if (configBenchThread.joinable())
+            configBenchThread.join();
 
-        return true;
+        configBenchRunning = true;
+        hasConfigBenchResult = true;
+        configBenchThread = std::thread([this, profiles = configBenchProfiles, seed = stressConfig.seed]() {
+            configBenchResult = RunConfigBenchmark(profiles, seed);
+            configBenchRunning.store(false, std::memory_order_release);
+        });
     }
+
 };
 
+bool UIWatchedStateChanged(UIState& s) {
+    if (s.p == nullptr)
+        return true;
+    auto& p = *static_cast<UIStatePrivate*>(s.p.get());
+
+    UIWatchedState curr;
+    curr.selectedUserIndex = p.selectedUserIndex;
+    if (p.selectedUserIndex != -1) {
+        const auto& binding = gXiGamepadBindings[p.selectedUserIndex];
+        curr.gamepadEnabled = binding.enabled;
+        curr.gamepadEpoch = gXiGamepads[p.selectedUserIndex].epoch;
+        curr.srcKbd = binding.srcKbd;
+        curr.srcMouse = binding.srcMouse;
+    }
+    curr.bindIdevFromNextKey = s.bindIdevFromNextKey;
+    curr.bindIdevFromNextMouse = s.bindIdevFromNextMouse;
+    curr.recording = gInputRecorder.recording.load(std::memory_order_relaxed);
+    curr.recordEntriesWritten = gInputRecorder.entriesWritten.load(std::memory_order_relaxed);
+    curr.recordEntriesDropped = gInputRecorder.entriesDropped.load(std::memory_order_relaxed);
+    curr.recordWriteFailed = gInputRecorder.writeFailed.load(std::memory_order_relaxed);
+    curr.replayRunning = p.replayRunning.load(std::memory_order_relaxed);
+    curr.stressRunning = p.stressRunning.load(std::memory_order_relaxed);
+    curr.configBenchRunning = p.configBenchRunning.load(std::memory_order_relaxed);
+    if (s.deviceStats) {
+        curr.calibrationX = s.deviceStats->calibration.countsX;
+        curr.calibrationY = s.deviceStats->calibration.countsY;
+    }
+    if (s.cursorCapture) {
+        curr.cursorCaptured = s.cursorCapture->Active();
+        curr.clipReassertsMoved = s.cursorCapture->reassertsMoved;
+        curr.clipReassertsDropped = s.cursorCapture->reassertsDropped;
+    }
+
+    if (curr == p.lastWatchedState)
+        return false;
+    p.lastWatchedState = curr;
+    return true;
+}
+
 void ShowUI(UIState& s) {
     if (s.p == nullptr) {
         void* p = new UIStatePrivate(s);
@@ -76,6 +231,10 @@ void ShowUI(UIState& s) {
             if (ImGui::MenuItem("Reload config file")) {
                 ReloadConfigFromDesignatedPath();
             }
+            // Only what was changed in the UI (e.g. applied DPIs) is written, the rest of the file stays as it is
+            if (ImGui::MenuItem("Save config file")) {
+                SaveConfigToDesignatedPath();
+            }
             ImGui::Separator();
             if (ImGui::MenuItem("Quit")) {
                 PostQuitMessage(0);
@@ -109,45 +268,47 @@ void ShowUI(UIState& s) {
         }
         ImGui::SameLine();
         if (ImGui::Button("Unbind##kdb")) {
-            SrwExclusiveLock lock(gXiGamepadsLock);
-            gXiGamepads[userIndex].srcKbd = INVALID_HANDLE_VALUE;
+            s.its->SetDeviceFilter(userIndex, false, INVALID_HANDLE_VALUE);
+            gInputRecorder.RecordFilter(userIndex, false, INVALID_HANDLE_VALUE);
         }
         ImGui::SameLine();
         if (s.bindIdevFromNextKey == userIndex)
             ImGui::Text("Bound keyboard: [press any key]");
         else
-            if (gXiGamepads[userIndex].srcKbd == INVALID_HANDLE_VALUE)
+            if (gXiGamepadBindings[userIndex].srcKbd == INVALID_HANDLE_VALUE)
                 ImGui::Text("Bound keyboard: [any]");
             else
-                ImGui::Text("Bound keyboard: %p", gXiGamepads[userIndex].srcKbd);
+                ImGui::Text("Bound keyboard: %p", gXiGamepadBindings[userIndex].srcKbd);
 
         if (ImGui::Button("Rebind##mouse")) {
             s.bindIdevFromNextMouse = userIndex;
         }
         ImGui::SameLine();
         if (ImGui::Button("Unbind##mouse")) {
-            SrwExclusiveLock lock(gXiGamepadsLock);
-            gXiGamepads[userIndex].srcMouse = INVALID_HANDLE_VALUE;
+            s.its->SetDeviceFilter(userIndex, true, INVALID_HANDLE_VALUE);
+            gInputRecorder.RecordFilter(userIndex, true, INVALID_HANDLE_VALUE);
         }
         ImGui::SameLine();
         if (s.bindIdevFromNextMouse == userIndex)
             ImGui::Text("Bound mouse: [press any mouse button]");
         else
-            if (gXiGamepads[userIndex].srcMouse == INVALID_HANDLE_VALUE)
+            if (gXiGamepadBindings[userIndex].srcMouse == INVALID_HANDLE_VALUE)
                 ImGui::Text("Bound mouse: [any]");
             else
-                ImGui::Text("Bound mouse: %p", gXiGamepads[userIndex].srcMouse);
+                ImGui::Text("Bound mouse: %p", gXiGamepadBindings[userIndex].srcMouse);
 
         if (ImGui::InputText("Profile name", &profileName)) {
-            auto iter = gConfig.profiles.find(profileName);
-            if (iter != gConfig.profiles.end()) {
-                auto& profile = iter->second;
+            auto profileId = gConfig.profiles->Find(profileName);
+            if (profileId != kInvalidProfileId) {
+                const auto& profile = gConfig.profiles->profiles[profileId];
 
-                LOG_DEBUG(L"UI: rebound gamepad {} to profile '{}'", userIndex, Utf8ToWide(profileName));
-                BindProfileToGamepad(userIndex, profile);
+                LOG(UI, Info, L"UI: rebound gamepad {} to profile '{}'", userIndex, Utf8ToWide(profileName));
+                BindProfileToGamepad(userIndex, gConfig.profiles, profileId);
                 gConfigEvents.onGamepadBindingChanged(userIndex, profileName, profile);
             }
         }
+
+        ImGui::Text("Game sees: %s", DescribeSlotRoute(GetSlotRoute(userIndex)).c_str());
     }
     else {
         ImGui::Text("Select a gamepad to show details");
@@ -155,18 +316,292 @@ void ShowUI(UIState& s) {
     ImGui::End();
 
     ImGui::Begin("Game");
-    if (ImGui::Button("Enumerate host windows")) {
-        p.EnumHostWindows();
+    if (s.hostWindows) {
+        // Kept up to date by the input thread, titles are looked up on the fly since they may change any time
+        for (HWND hwnd : *s.hostWindows) {
+            WCHAR nameWide[256];
+            int res = GetWindowTextW(hwnd, nameWide, IM_ARRAYSIZE(nameWide));
+            std::string nameUtf8 = res == 0
+                ? "<no name>"s
+                : WideToUtf8(std::wstring_view(nameWide, res));
+
+            char name[256];
+            snprintf(name, IM_ARRAYSIZE(name), "%p %s", hwnd, nameUtf8.c_str());
+
+            bool selected = hwnd == s.mainHostHwnd;
+            if (ImGui::Selectable(name, &selected)) {
+                s.mainHostHwnd = hwnd;
+            }
+        }
+    }
+    if (s.cursorCapture) {
+        const auto& c = *s.cursorCapture;
+        ImGui::Separator();
+        if (c.Active()) {
+            ImGui::Text("Cursor captured in %p", c.Window());
+            ImGui::Text("Clip reasserted: %llu after moves/resizes, %llu after being dropped", (unsigned long long)c.reassertsMoved, (unsigned long long)c.reassertsDropped);
+            if (gConfig.recenterCursor)
+                ImGui::Text("Recentered: %llu times", (unsigned long long)c.recenters);
+        }
+        else {
+            ImGui::Text("Cursor not captured");
+        }
+    }
+    ImGui::End();
+
+    ImGui::Begin("Recording");
+    if (gInputRecorder.recording) {
+        if (ImGui::Button("Stop recording")) {
+            gInputRecorder.Stop();
+        }
     }
-    for (const auto& hostWindow : p.hostWindowList) {
-        char name[256];
-        snprintf(name, IM_ARRAYSIZE(name), "%p %s", hostWindow.hwnd, hostWindow.nameUtf8.c_str());
+    else {
+        if (ImGui::Button("Start recording")) {
+            p.recordStartFailed = !gInputRecorder.Start(GetDesignatedRecordingPath());
+        }
+        if (p.recordStartFailed)
+            ImGui::Text("Cannot create the recording file, see the log");
+    }
+    ImGui::Text("Entries written: %llu", (unsigned long long)gInputRecorder.entriesWritten.load(std::memory_order_relaxed));
+    ImGui::Text("Entries dropped: %llu", (unsigned long long)gInputRecorder.entriesDropped.load(std::memory_order_relaxed));
+    ImGui::Text("Bytes written: %llu", (unsigned long long)gInputRecorder.bytesWritten.load(std::memory_order_relaxed));
+    if (gInputRecorder.writeFailed.load(std::memory_order_relaxed))
+        ImGui::Text("Writing the recording file failed, the rest of the recording was lost");
+    ImGui::Separator();
+    bool replayRunning = p.replayRunning.load(std::memory_order_acquire);
+    ImGui::BeginDisabled(replayRunning || gInputRecorder.recording);
+    ImGui::Checkbox("Real-time", &p.replayRealTime);
+    ImGui::SameLine();
+    if (ImGui::Button("Replay recording")) {
+        p.StartReplay();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Benchmark kernels")) {
+        p.StartKernelBenchmark();
+    }
+    ImGui::EndDisabled();
+    if (replayRunning) {
+        ImGui::Text("Replaying...");
+    }
+    else if (p.hasBenchResult) {
+        if (p.benchSpecializedNs == 0.0 || p.benchGenericNs == 0.0)
+            ImGui::Text("Benchmark failed, replay the recording for details");
+        else
+            ImGui::Text("Per event: specialized kernels %.1f ns, generic kernel %.1f ns", p.benchSpecializedNs, p.benchGenericNs);
+    }
+    else if (p.hasReplayResult) {
+        const auto& res = p.replayResult;
+        if (!res.Success())
+            ImGui::Text("Replay failed: %s", res.error.c_str());
+        ImGui::Text("Events replayed: %llu", (unsigned long long)res.eventsReplayed);
+        ImGui::Text("States compared: %llu, mismatched: %llu", (unsigned long long)res.statesCompared, (unsigned long long)res.stateMismatches);
+        ImGui::Text("Recorded %.3f s, replayed in %.3f s", res.recordedSeconds, res.elapsedSeconds);
+        if (res.stateMismatches > 0) {
+            const auto& e = res.firstMismatchExpected;
+            const auto& a = res.firstMismatchActual;
+            ImGui::Text("First mismatch: gamepad %d, record #%llu", res.firstMismatchUserIndex, (unsigned long long)res.firstMismatchRecordIndex);
+            ImGui::Text("  expected: btns=%04X lt=%u rt=%u l=(%d,%d) r=(%d,%d)", e.wButtons, e.bLeftTrigger, e.bRightTrigger, e.sThumbLX, e.sThumbLY, e.sThumbRX, e.sThumbRY);
+            ImGui::Text("  actual:   btns=%04X lt=%u rt=%u l=(%d,%d) r=(%d,%d)", a.wButtons, a.bLeftTrigger, a.bRightTrigger, a.sThumbLX, a.sThumbLY, a.sThumbRX, a.sThumbRY);
+        }
+    }
+    ImGui::End();
 
-        bool selected = hostWindow.hwnd == s.mainHostHwnd;
-        if (ImGui::Selectable(name, &selected)) {
-            s.mainHostHwnd = hostWindow.hwnd;
+    ImGui::Begin("Stress test");
+    bool stressRunning = p.stressRunning.load(std::memory_order_acquire);
+    ImGui::BeginDisabled(stressRunning);
+    auto& sc = p.stressConfig;
+    ImGui::InputInt("Mice", &sc.mice);
+    ImGui::InputInt("Mouse events/s", &sc.mouseRate);
+    ImGui::InputInt("Keyboards", &sc.keyboards);
+    ImGui::InputInt("Key events/s", &sc.keyRate);
+    ImGui::InputInt("Rollover", &sc.rollover);
+    ImGui::InputFloat("Burst (ms)", &sc.burstMs);
+    ImGui::InputFloat("Idle (ms)", &sc.idleMs);
+    ImGui::InputFloat("Hot-plug every (ms)", &sc.hotplugMs);
+    ImGui::InputInt("Reader threads", &sc.readers);
+    ImGui::InputFloat("Duration (s)", &sc.seconds);
+    ImGui::InputFloat("Contention run (s)", &sc.contentionSeconds);
+    if (ImGui::Button("Run stress test")) {
+        p.StartStressTest();
+    }
+    ImGui::EndDisabled();
+    if (stressRunning) {
+        ImGui::Text("Running...");
+    }
+    else if (p.hasStressResult) {
+        const auto& res = p.stressResult;
+        if (!res.Success()) {
+            ImGui::Text("Stress test failed: %s", res.error.c_str());
+        }
+        else {
+            double secs = std::max(res.seconds, 1e-9);
+            ImGui::Text("Events: %llu generated, %llu processed (%.0f/s)", (unsigned long long)res.eventsGenerated, (unsigned long long)res.eventsProcessed, res.eventsProcessed / secs);
+            ImGui::Text("Dropped: %llu, coalesced: %llu, states published: %llu", (unsigned long long)res.eventsDropped, (unsigned long long)res.eventsCoalesced, (unsigned long long)res.statesPublished);
+            ImGui::Text("Hot-plugs: %llu, reader polls: %llu", (unsigned long long)res.hotplugs, (unsigned long long)res.readerPolls);
+            ImGui::Text("Event to reader latency (us): p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f (%llu samples)", res.latencyP50Us, res.latencyP99Us, res.latencyP999Us, res.latencyMaxUs, (unsigned long long)res.latencySamples);
+            ImGui::Text("CPU: translation %.1f%%, producers %.3f s, readers %.3f s", res.translationCpuSeconds * 100.0 / secs, res.producerCpuSeconds, res.readerCpuSeconds);
+            if (res.idleReadsPerSec > 0.0 && res.packedIdleReadsPerSec > 0.0) {
+                ImGui::Text("Reads of other gamepads: %.0f/s idle, %.0f/s while one is published (%.0f%%, %.0f publishes/s)", res.idleReadsPerSec, res.contendedReadsPerSec, res.contendedReadsPerSec * 100.0 / res.idleReadsPerSec, res.contentionPublishesPerSec);
+                ImGui::Text("  packed baseline: %.0f/s idle, %.0f/s while one is published (%.0f%%, %.0f publishes/s)", res.packedIdleReadsPerSec, res.packedContendedReadsPerSec, res.packedContendedReadsPerSec * 100.0 / res.packedIdleReadsPerSec, res.packedPublishesPerSec);
+                ImGui::Text("Torn reads of the published gamepad: %llu of %llu", (unsigned long long)res.tornReads, (unsigned long long)res.writtenSlotReads);
+            }
         }
     }
+    ImGui::Separator();
+    // With the live gamepads' stick settings; s.its belongs to this thread
+    ImGui::BeginDisabled(s.its == nullptr);
+    if (ImGui::Button("Compare mouse stick math")) {
+        p.mouseStickComparison = CompareMouseStickMath(s.its->mouseSticks, kMouseStickComparisonTicks, sc.seed);
+        p.hasMouseStickComparison = true;
+    }
+    ImGui::EndDisabled();
+    if (p.hasMouseStickComparison) {
+        const auto& cmp = p.mouseStickComparison;
+        ImGui::Text("Fixed point vs float: max error %d, %llu of %llu axes off by more than %d", cmp.maxError, (unsigned long long)cmp.axesOverBound, (unsigned long long)cmp.axesCompared, kMouseStickFixedMaxError);
+        ImGui::Text("Vector vs scalar reference: max error %d, %llu of %llu axes off by more than %d", cmp.simdMaxError, (unsigned long long)cmp.simdAxesOverBound, (unsigned long long)cmp.axesCompared, kMouseStickSimdMaxError);
+        ImGui::Text("Per tick of all sticks: vector %.1f ns, scalar reference %.1f ns, fixed point %.1f ns", cmp.floatNs, cmp.referenceNs, cmp.fixedNs);
+    }
+    ImGui::Separator();
+    bool configBenchRunning = p.configBenchRunning.load(std::memory_order_acquire);
+    ImGui::BeginDisabled(configBenchRunning);
+    ImGui::InputInt("Profiles", &p.configBenchProfiles);
+    if (ImGui::Button("Benchmark config")) {
+        p.StartConfigBenchmark();
+    }
+    ImGui::EndDisabled();
+    if (configBenchRunning) {
+        ImGui::Text("Running...");
+    }
+    else if (p.hasConfigBenchResult) {
+        const auto& res = p.configBenchResult;
+        if (!res.Success()) {
+            ImGui::Text("Config benchmark failed: %s", res.error.c_str());
+        }
+        else {
+            ImGui::Text("%d profiles, %llu bytes", res.profiles, (unsigned long long)res.bytes);
+            ImGui::Text("Parse %.2f ms, load %.2f ms, stringify %.2f ms, format %.2f ms", res.parseMs, res.loadMs, res.stringifyMs, res.formatMs);
+            ImGui::Text("Round trip: %s", res.roundTrips ? "identical" : "DIFFERS");
+        }
+    }
+    ImGui::End();
+
+    ImGui::Begin("Devices");
+    if (s.deviceStats) {
+        auto& stats = *s.deviceStats;
+        int64_t now = gClock->Now();
+        auto findDevice = [&](HANDLE hDevice) -> const IdevDevice* {
+            for (const auto& idev : *s.devices)
+                if (idev.hDevice == hDevice)
+                    return &idev;
+            return nullptr;
+        };
+
+        if (ImGui::BeginTable("##devices", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable)) {
+            ImGui::TableSetupColumn("Device");
+            ImGui::TableSetupColumn("Type");
+            ImGui::TableSetupColumn("Reports/s");
+            ImGui::TableSetupColumn("Keys");
+            ImGui::TableSetupColumn("Moves");
+            ImGui::TableSetupColumn("DPI");
+            ImGui::TableHeadersRow();
+            for (const auto& [hDevice, st] : stats.devices) {
+                const auto* idev = findDevice(hDevice);
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                char label[512];
+                snprintf(label, sizeof(label), "%p %s", hDevice, idev ? idev->nameUtf8.c_str() : "");
+                bool selected = p.hasSelectedDevice && p.selectedDevice == hDevice;
+                if (ImGui::Selectable(label, selected, ImGuiSelectableFlags_SpanAllColumns)) {
+                    p.selectedDevice = hDevice;
+                    p.hasSelectedDevice = true;
+                }
+                ImGui::TableNextColumn();
+                ImGui::Text("%s", idev ? WideToUtf8(RawInputTypeToString(idev->info.dwType)).c_str() : "?");
+                ImGui::TableNextColumn();
+                // The rate only updates on events, don't show a stale one for a device that went quiet
+                bool idle = now - st.lastEventTime > stats.ticksPerSecond;
+                ImGui::Text("%.0f (peak %.0f)", idle ? 0.0f : st.reportRate, st.peakReportRate);
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", (unsigned long long)st.keyEvents);
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", (unsigned long long)st.moveEvents);
+                ImGui::TableNextColumn();
+                if (st.dpi > 0.0f)
+                    ImGui::Text("%.0f", st.dpi);
+                else
+                    ImGui::Text("-");
+            }
+            ImGui::EndTable();
+        }
+
+        auto iter = p.hasSelectedDevice ? stats.devices.find(p.selectedDevice) : stats.devices.end();
+        if (iter != stats.devices.end()) {
+            HANDLE hDevice = iter->first;
+            const auto& st = iter->second;
+            const auto* idev = findDevice(hDevice);
+
+            ImGui::Separator();
+            float deltas[DeviceStats::kDeltaBuckets];
+            for (int i = 0; i < DeviceStats::kDeltaBuckets; ++i)
+                deltas[i] = static_cast<float>(st.deltaHistogram[i]);
+            ImGui::PlotHistogram("|dx|+|dy| per report (0, 1, 2-3, ..., 64+)", deltas, DeviceStats::kDeltaBuckets, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+            float gaps[DeviceStats::kGapBuckets];
+            for (int i = 0; i < DeviceStats::kGapBuckets; ++i)
+                gaps[i] = static_cast<float>(st.gapHistogram[i]);
+            ImGui::PlotHistogram("Time between reports (<1, 1-2, 2-4, ..., 64+ ms)", gaps, DeviceStats::kGapBuckets, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+            ImGui::Text("Longest gap: %.1f ms", gClock->ToSeconds(st.longestGap) * 1000.0);
+
+            // Only mice that raw input told us about have a name to save the DPI under
+            if (idev && idev->info.dwType == RIM_TYPEMOUSE) {
+                ImGui::Separator();
+                if (stats.calibration.device == hDevice) {
+                    ImGui::Text("Move the mouse %.1f cm in a straight line, then click Finish", p.calibrationDistanceCm);
+                    ImGui::Text("Counts: %lld, %lld", (long long)stats.calibration.countsX, (long long)stats.calibration.countsY);
+                    if (ImGui::Button("Finish")) {
+                        p.calibrationResult = stats.FinishCalibration(p.calibrationDistanceCm / 2.54f);
+                        p.calibrationResultDevice = hDevice;
+                        p.hasCalibrationResult = true;
+                    }
+                    ImGui::SameLine();
+                    if (ImGui::Button("Cancel")) {
+                        stats.CancelCalibration();
+                    }
+                }
+                else {
+                    ImGui::InputFloat("Distance (cm)", &p.calibrationDistanceCm);
+                    if (ImGui::Button("Calibrate DPI")) {
+                        stats.StartCalibration(hDevice);
+                        p.hasCalibrationResult = false;
+                    }
+                }
+
+                if (p.hasCalibrationResult && p.calibrationResultDevice == hDevice) {
+                    if (p.calibrationResult <= 0.0f) {
+                        ImGui::Text("The mouse didn't move, try again");
+                    }
+                    else {
+                        ImGui::Text("Measured %.0f DPI", p.calibrationResult);
+                        ImGui::SameLine();
+                        if (ImGui::Button("Apply")) {
+                            stats.SetDpi(hDevice, p.calibrationResult);
+                            gConfig.mouseDpi[idev->nameUtf8] = std::round(p.calibrationResult);
+                        }
+                        ImGui::SameLine();
+                        if (ImGui::Button("Copy config line")) {
+                            auto line = std::format("'{}' = {:.0f}", idev->nameUtf8, p.calibrationResult);
+                            ImGui::SetClipboardText(line.c_str());
+                        }
+                        ImGui::TextWrapped("Applied DPI only lasts until the config is reloaded, use WinXInputEmu > Save config file to keep it.");
+                    }
+                }
+            }
+        }
+    }
+    ImGui::End();
+
+    ImGui::Begin("Stats");
+    ImGui::Text("UI frames rendered: %.1f/s", s.uiFramesRenderedPerSec);
+    ImGui::Text("UI frames skipped: %.1f/s", s.uiFramesSkippedPerSec);
     ImGui::End();
 
     if (p.showDemoWindow) {
@@ -2,15 +2,35 @@
 
 #include "config.h"
 
+class CursorCapture;
+struct DeviceStatsTable;
+struct InputTranslationStruct;
+
 struct UIState {
     std::unique_ptr<void, void(*)(void*)> p{ nullptr, nullptr };
 
+    // Follows the foreground, see ForegroundTracker; can be overridden until the next time a host window comes to the foreground
     /* [Out] */ HWND mainHostHwnd = NULL;
     // If set to a valid gamepad user index, the next key recieved by the input source will be used to set its keyboard filter
     /* [Out] */ int bindIdevFromNextKey = -1;
     // If set to a valid gamepad user index, the next mouse click recieved by the input source will be used to set its mouse filter
     // Note that it has to be a mouse button click, movements do not count (to prevent misinput).
     /* [Out] */ int bindIdevFromNextMouse = -1;
+
+    // Of the live gamepads, for changes that must keep it in sync, e.g. device filters
+    /* [In] */ InputTranslationStruct* its = nullptr;
+    /* [In] */ const std::vector<IdevDevice>* devices = nullptr;
+    // Top-level windows of the host process
+    /* [In] */ const std::vector<HWND>* hostWindows = nullptr;
+    /* [In] */ const CursorCapture* cursorCapture = nullptr;
+    // Also where calibration is started and its result applied
+    /* [In] */ DeviceStatsTable* deviceStats = nullptr;
+    /* [In] */ float uiFramesRenderedPerSec = 0.0f;
+    // Frames that were due but held back by the unfocused/state change frame rate caps
+    /* [In] */ float uiFramesSkippedPerSec = 0.0f;
 };
 
 void ShowUI(UIState& s);
+// Returns true if any non-UI state that is currently displayed (e.g. the selected gamepad) changed since the last call
+// Used to redraw the UI on demand, instead of continuously
+bool UIWatchedStateChanged(UIState& s);
@@ -2,6 +2,13 @@
 
 #include "userdevice.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "clock.h"
+#include "slotrouting.h"
+
 XINPUT_GAMEPAD XiGamepad::ComputeXInputGamepad() const noexcept {
     XINPUT_GAMEPAD res = {};
 
@@ -13,8 +20,8 @@ XINPUT_GAMEPAD XiGamepad::ComputeXInputGamepad() const noexcept {
     if (lb) res.wButtons |= XINPUT_GAMEPAD_LEFT_SHOULDER;
     if (rb) res.wButtons |= XINPUT_GAMEPAD_RIGHT_SHOULDER;
 
-    res.bLeftTrigger = lt ? 255 : 0;
-    res.bRightTrigger = rt ? 255 : 0;
+    res.bLeftTrigger = lt ? triggerValue : 0;
+    res.bRightTrigger = rt ? triggerValue : 0;
 
     if (start) res.wButtons |= XINPUT_GAMEPAD_START;
     if (back) res.wButtons |= XINPUT_GAMEPAD_BACK;
@@ -35,7 +42,163 @@ XINPUT_GAMEPAD XiGamepad::ComputeXInputGamepad() const noexcept {
     return res;
 }
 
+bool* XiGamepad::GetButton(XiButton btn) noexcept {
+    switch (btn) {
+        using enum XiButton;
+    case A: return &a;
+    case B: return &b;
+    case X: return &x;
+    case Y: return &y;
+    case LB: return &lb;
+    case RB: return &rb;
+    case LT: return &lt;
+    case RT: return &rt;
+    case Start: return &start;
+    case Back: return &back;
+    case DpadUp: return &dpadUp;
+    case DpadDown: return &dpadDown;
+    case DpadLeft: return &dpadLeft;
+    case DpadRight: return &dpadRight;
+    case LStickBtn: return &lstickBtn;
+    case RStickBtn: return &rstickBtn;
+    default: return nullptr;
+    }
+}
+
+// While ramping, dwPacketNumber advances once per millisecond, so games that skip unchanged packets still see the motion
+static int64_t TicksPerPacket() noexcept {
+    return std::max<int64_t>(gClock->TicksPerSecond() / 1000, 1);
+}
+
+static int16_t GetAxis(const XINPUT_GAMEPAD& gamepad, int axis) noexcept {
+    switch (static_cast<XiAxis>(axis)) {
+        using enum XiAxis;
+    case LStickX: return gamepad.sThumbLX;
+    case LStickY: return gamepad.sThumbLY;
+    case RStickX: return gamepad.sThumbRX;
+    case RStickY: return gamepad.sThumbRY;
+    case LT: return gamepad.bLeftTrigger;
+    case RT: return gamepad.bRightTrigger;
+    default: return 0;
+    }
+}
+
+static void SetAxis(XINPUT_GAMEPAD& gamepad, int axis, int16_t value) noexcept {
+    switch (static_cast<XiAxis>(axis)) {
+        using enum XiAxis;
+    case LStickX: gamepad.sThumbLX = value; break;
+    case LStickY: gamepad.sThumbLY = value; break;
+    case RStickX: gamepad.sThumbRX = value; break;
+    case RStickY: gamepad.sThumbRY = value; break;
+    case LT: gamepad.bLeftTrigger = static_cast<BYTE>(value); break;
+    case RT: gamepad.bRightTrigger = static_cast<BYTE>(value); break;
+    default: break;
+    }
+}
+
+void XiGamepadBinding::Bind(std::shared_ptr<const ProfileStore> store, ProfileId id) noexcept {
+    *this = {};
+    profileStore = std::move(store);
+    profileId = id;
+
+    const auto& profile = Profile();
+    hasActions = !profile.turbos.empty() || !profile.macros.empty() || !profile.tapHolds.empty();
+    auto copyStick = [](const UserProfile::Joystick& js, StickParams& out) {
+        out.speed = js.kbd.speed;
+        out.socd = js.kbd.socd;
+        out.useMouse = js.useMouse;
+    };
+    copyStick(profile.lstick, sticks[0]);
+    copyStick(profile.rstick, sticks[1]);
+    analogModifierScale = profile.analogModifierScale;
+    SetRamps(profile);
+}
 
-SRWLOCK gXiGamepadsLock = SRWLOCK_INIT;
-bool gXiGamepadsEnabled[XUSER_MAX_COUNT] = {};
+void XiGamepadBinding::SetRamps(const UserProfile& profile) noexcept {
+    // Full scale per millisecond -> per tick
+    auto rate = [](float fullScale, float ms) {
+        return ms > 0.0f ? fullScale / (ms * static_cast<float>(gClock->TicksPerSecond()) / 1000.0f) : 0.0f;
+    };
+    auto forStick = [&](const UserProfile::Joystick& js, XiAxis x, XiAxis y) {
+        // Mouse sticks are already as smooth as the mouse
+        float attack = js.useMouse ? 0.0f : rate(32767.0f, js.kbd.attackMs);
+        float release = js.useMouse ? 0.0f : rate(32767.0f, js.kbd.releaseMs);
+        attackRate[(int)x] = attackRate[(int)y] = attack;
+        releaseRate[(int)x] = releaseRate[(int)y] = release;
+    };
+    forStick(profile.lstick, XiAxis::LStickX, XiAxis::LStickY);
+    forStick(profile.rstick, XiAxis::RStickX, XiAxis::RStickY);
+    attackRate[(int)XiAxis::LT] = attackRate[(int)XiAxis::RT] = rate(255.0f, profile.triggerAttackMs);
+    releaseRate[(int)XiAxis::LT] = releaseRate[(int)XiAxis::RT] = rate(255.0f, profile.triggerReleaseMs);
+}
+
+XINPUT_STATE XiPublishedState::Evaluate(int64_t now) const noexcept {
+    if (rampTicks == 0)
+        return state;
+
+    int64_t elapsed = std::clamp<int64_t>(now - rampStart, 0, rampTicks);
+    XINPUT_STATE res = state;
+    res.dwPacketNumber += static_cast<DWORD>(elapsed / TicksPerPacket());
+    for (int axis = 0; axis < kXiAxisCount; ++axis) {
+        if (rampRate[axis] == 0.0f) continue;
+        int target = GetAxis(state.Gamepad, axis);
+        int from = rampFrom[axis];
+        float travelled = rampRate[axis] * static_cast<float>(elapsed);
+        int distance = std::abs(target - from);
+        int step = travelled >= static_cast<float>(distance) ? distance : static_cast<int>(travelled);
+        SetAxis(res.Gamepad, axis, static_cast<int16_t>(target > from ? from + step : from - step));
+    }
+    return res;
+}
+
+void XiGamepadPublished::Publish(const XINPUT_GAMEPAD& gamepad, const XiGamepadBinding& binding, int64_t now) noexcept {
+    // Where every axis is right now, which is where the new ramps start from
+    XINPUT_STATE curr = lastState.Evaluate(now);
+
+    XiPublishedState next = {};
+    // Strictly greater than any packet number a reader could have computed from the previous state
+    next.state.dwPacketNumber = curr.dwPacketNumber + 1;
+    next.state.Gamepad = gamepad;
+    next.rampStart = now;
+    for (int axis = 0; axis < kXiAxisCount; ++axis) {
+        int from = GetAxis(curr.Gamepad, axis);
+        int target = GetAxis(gamepad, axis);
+        float rate = std::abs(target) >= std::abs(from) ? binding.attackRate[axis] : binding.releaseRate[axis];
+        if (from == target || rate == 0.0f) continue;
+
+        next.rampFrom[axis] = static_cast<int16_t>(from);
+        next.rampRate[axis] = rate;
+        next.rampTicks = std::max(next.rampTicks, static_cast<int64_t>(std::ceil(std::abs(target - from) / rate)));
+    }
+
+    lastPublished = gamepad;
+    lastState = next;
+    cell.Store(next);
+}
+
+XINPUT_STATE XiGamepadPublished::Read() const noexcept {
+    XiPublishedState state = cell.Load();
+    // Only ask the clock when something is actually moving
+    return state.Evaluate(state.rampTicks != 0 ? gClock->Now() : 0);
+}
+
+XiGamepadBinding gXiGamepadBindings[XUSER_MAX_COUNT] = {};
 XiGamepad gXiGamepads[XUSER_MAX_COUNT] = {};
+XiGamepadPublished gXiGamepadsPublished[XUSER_MAX_COUNT];
+
+static bool GamepadEquals(const XINPUT_GAMEPAD& a, const XINPUT_GAMEPAD& b) noexcept {
+    return std::memcmp(&a, &b, sizeof(XINPUT_GAMEPAD)) == 0;
+}
+
+void PublishGamepad(int userIndex, int64_t now) noexcept {
+    auto& pub = gXiGamepadsPublished[userIndex];
+    auto gamepad = gXiGamepads[userIndex].ComputeXInputGamepad();
+    // Reading back our own bookkeeping doesn't disturb readers: the line is only written if something changed
+    if (!GamepadEquals(gamepad, pub.lastPublished))
+        pub.Publish(gamepad, gXiGamepadBindings[userIndex], now);
+}
+
+void SetGamepadEnabled(int userIndex, bool enabled) noexcept {
+    gXiGamepadBindings[userIndex].enabled = enabled;
+    UpdateSlotRoutes(gConfig);
+}
@@ -1,23 +1,81 @@
 #pragma once
 
-#define NOMINMAX
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string_view>
 
 #include "config.h"
 #include "inputdevice.h"
+#include "platform.h"
+#include "seqlock.h"
 #include "shadowed.h"
+#include "spscring.h"
 
 // The prefix Xi stands for XInput
 // We try to avoid using "XInput" or "XINPUT" in any names that is unrelated from the actual XInput API, to avoid confusion
-struct XiGamepad {
-    const UserProfile* profile = nullptr;
+//
+// Per-gamepad state is split by who touches it, and each part of each gamepad sits on its own cache line(s):
+// - XiGamepadPublished (hot): the snapshot read by game threads through XInputGet*(), written by the input thread once per change
+// - XiGamepad (warm): translation scratch state, input thread only
+// - XiGamepadBinding (cold): profile and device filters, input thread only, changes only when the user rebinds something
+//   Its first cache line holds everything key translation reads per event, copied out of the profile when bound
+// So input processing for gamepad 0 never invalidates a line that game threads read for gamepad 1, and game threads polling never contend with each other.
+
+// The analog axes of a gamepad, in the order of XiGamepadRamp's arrays
+enum class XiAxis {
+    LStickX, LStickY,
+    RStickX, RStickY,
+    LT, RT,
+    COUNT,
+};
+constexpr int kXiAxisCount = static_cast<int>(XiAxis::COUNT);
+
+// Cold
+struct alignas(kCacheLineSize) XiGamepadBinding {
+    // Copy of what key translation needs of a UserProfile::Joystick
+    struct StickParams {
+        float speed = 1.0f;
+        UserProfile::SocdPolicy socd = UserProfile::SocdPolicy::Neutral;
+        bool useMouse = false;
+    };
+
+    // If false, no profile is bound and the slot shows a physical controller, if any (see slotrouting.h)
+    bool enabled = false;
+    // Input is ignored while set, e.g. while the game isn't in the foreground; see SetGamepadSuspended()
+    bool suspended = false;
+    // The profile has timed actions
+    bool hasActions = false;
+    ProfileId profileId = kInvalidProfileId;
 
     // If == INVALID_HANDLE_VALUE, accept any input source
     // Otherwise accept only the specified input source
     HANDLE srcKbd = INVALID_HANDLE_VALUE;
     HANDLE srcMouse = INVALID_HANDLE_VALUE;
 
+    // [0 = lstick, 1 = rstick]
+    StickParams sticks[2];
+    float analogModifierScale = 1.0f;
+
+    // How fast each axis may move, in full scale (32767 or 255) per gClock tick; 0 means it jumps instantly
+    // Attack applies when moving away from center, release when moving towards it
+    float attackRate[kXiAxisCount] = {};
+    float releaseRate[kXiAxisCount] = {};
+
+    // Where `profileId` points into; keeps the profile alive for as long as it's bound
+    std::shared_ptr<const ProfileStore> profileStore;
+
+    // Only valid if profileStore is set
+    const UserProfile& Profile() const noexcept { return profileStore->profiles[profileId]; }
+    std::string_view ProfileName() const noexcept { return profileStore ? std::string_view(profileStore->names[profileId]) : std::string_view(); }
+
+    // Resets everything, including device filters, and binds the given profile
+    void Bind(std::shared_ptr<const ProfileStore> store, ProfileId id) noexcept;
+    void SetRamps(const UserProfile& profile) noexcept;
+};
+
+// Warm
+struct alignas(kCacheLineSize) XiGamepad {
     // This shall be incremented every time any field is updated due to input state changes
     int epoch = 0;
 
@@ -26,13 +84,56 @@ struct XiGamepad {
     bool a, b, x, y;
     bool lb, rb;
     bool lt, rt;
+    // What a pulled trigger reports
+    BYTE triggerValue = 255;
     bool start, back;
     bool dpadUp, dpadDown, dpadLeft, dpadRight;
     bool lstickBtn, rstickBtn;
 
     XINPUT_GAMEPAD ComputeXInputGamepad() const noexcept;
+    // The field of a digital button (A through RStickBtn), or nullptr for anything else
+    bool* GetButton(XiButton btn) noexcept;
 };
 
-extern SRWLOCK gXiGamepadsLock;
-extern bool gXiGamepadsEnabled[XUSER_MAX_COUNT];
+// What game threads read: the state the gamepad is heading to, and how it gets there
+// Ramps are evaluated by the reader at the time it polls, so a ramp progresses smoothly without the input thread waking up to publish every step
+struct XiPublishedState {
+    // dwPacketNumber as of `rampStart`, Gamepad holds the targets
+    XINPUT_STATE state;
+    // gClock ticks
+    int64_t rampStart;
+    // Time until the slowest axis reaches its target, 0 if nothing is ramping
+    int64_t rampTicks;
+    // Each axis moves from rampFrom towards the target at rampRate units per tick, or is at the target already if rampRate == 0
+    int16_t rampFrom[kXiAxisCount];
+    float rampRate[kXiAxisCount];
+
+    // The effective state at `now`
+    XINPUT_STATE Evaluate(int64_t now) const noexcept;
+};
+
+// Hot
+struct alignas(kCacheLineSize) XiGamepadPublished {
+    Seqlock<XiPublishedState> cell;
+
+    // Writer side bookkeeping, input thread only
+    XINPUT_GAMEPAD lastPublished = {};
+    XiPublishedState lastState = {};
+
+    // Input thread only
+    void Publish(const XINPUT_GAMEPAD& gamepad, const XiGamepadBinding& binding, int64_t now) noexcept;
+    // Any thread
+    XINPUT_STATE Read() const noexcept;
+};
+
+extern XiGamepadBinding gXiGamepadBindings[XUSER_MAX_COUNT];
 extern XiGamepad gXiGamepads[XUSER_MAX_COUNT];
+extern XiGamepadPublished gXiGamepadsPublished[XUSER_MAX_COUNT];
+
+// Publishes the current state of gXiGamepads[userIndex] for game threads to read, if it changed
+// `now` is the gClock time the change happened, where ramps start from
+// Input thread only
+void PublishGamepad(int userIndex, int64_t now) noexcept;
+// Input thread only
+// Also updates the slot routes (see slotrouting.h)
+void SetGamepadEnabled(int userIndex, bool enabled) noexcept;
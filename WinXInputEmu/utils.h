@@ -8,12 +8,11 @@
 #include <utility>
 #include <vector>
 
-#define NOMINMAX
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
-
 #include <toml++/toml.h>
 
+#include "log.h"
+#include "platform.h"
+
 #define CONCAT_IMPL(a, b) a##b
 #define CONCAT(a, b) CONCAT_IMPL(a, b)
 #define CONCAT_3(a, b, c) CONCAT(a, CONCAT(b, c))
@@ -22,34 +21,7 @@
 #define UNIQUE_NAME(prefix) CONCAT(prefix, __COUNTER__)
 #define DISCARD UNIQUE_NAME(_discard)
 
-struct SrwExclusiveLock {
-    SRWLOCK* theLock;
-
-    SrwExclusiveLock(SRWLOCK& lock) noexcept
-        : theLock{ &lock }
-    {
-        AcquireSRWLockExclusive(theLock);
-    }
-
-    ~SrwExclusiveLock() {
-        ReleaseSRWLockExclusive(theLock);
-    }
-};
-
-struct SrwSharedLock {
-    SRWLOCK* theLock;
-
-    SrwSharedLock(SRWLOCK& lock) noexcept
-        : theLock{ &lock }
-    {
-        AcquireSRWLockShared(theLock);
-    }
-
-    ~SrwSharedLock() {
-        ReleaseSRWLockShared(theLock);
-    }
-};
-
+// Defined by the platform layer, see platform.h
 std::wstring Utf8ToWide(std::string_view utf8);
 std::string WideToUtf8(std::wstring_view wide);
 
@@ -60,8 +32,6 @@ namespace toml {
     toml::table parse_file(const std::filesystem::path& path);
 }
 
-#define LOG_DEBUG(msg, ...) OutputDebugStringW(std::format(L"[WinXInputEmu] " msg, __VA_ARGS__).c_str())
-
 template <typename TFunc>
 struct ScopeGuard {
     TFunc func;
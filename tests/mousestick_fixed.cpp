@@ -0,0 +1,130 @@
+// ComputeMouseSticksFixed() on fixed lanes and movement, against outputs recorded once: being integer only, it has to give these very same numbers with any compiler, flags and CPU
+// If a change to the fixed point math is intended, regenerate the expected outputs and say why in the commit
+
+#include "pch.h"
+
+#include "check.h"
+
+#include "mousestick.h"
+#include "stickcurve.h"
+
+#include <memory>
+
+namespace {
+struct Setup {
+    StickCurveLut curves[MouseStickLanes::kNumSticks][XUSER_MAX_COUNT];
+    MouseStickLanes lanes;
+
+    // Every stick of every gamepad set up differently, with sensitivities whose thresholds are exact in 24.8 fixed point
+    Setup() {
+        const float sensitivities[MouseStickLanes::kNumSticks][XUSER_MAX_COUNT] = { { 0.0f, 0.25f, 0.5f, 0.125f }, { 0.25f, 0.0f, 1.5f, 0.75f } };
+        for (int stick = 0; stick < MouseStickLanes::kNumSticks; ++stick) {
+            for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+                auto& curve = curves[stick][userIndex];
+                int kind = (stick * XUSER_MAX_COUNT + userIndex) % 4;
+                // Filled in with integer math rather than compiled from a StickCurve, so that the expected outputs don't depend on the C library's std::pow()
+                for (int i = 0; i <= StickCurveLut::kSize; ++i) {
+                    int32_t t = i * (0x10000 / StickCurveLut::kSize);
+                    switch (kind) {
+                    case 0: curve.tableQ16[i] = t; break;
+                    case 1: curve.tableQ16[i] = static_cast<int32_t>((int64_t{ t } * t) >> 16); break;
+                    // Anti-deadzone of 0.25
+                    case 2: curve.tableQ16[i] = 0x4000 + static_cast<int32_t>((int64_t{ t } * 0xC000) >> 16); break;
+                    // Radial deadzone of 0.125, saturated from 0.75 on
+                    default: curve.tableQ16[i] = std::clamp((t - 0x2000) * 8 / 5, 0, 0x10000); break;
+                    }
+                }
+                curve.axialDeadzoneQ16 = kind == 1 || kind == 3 ? 0x1000 : 0;
+                curve.squareGate = userIndex % 2 == 0;
+
+                UserProfile::Joystick conf;
+                conf.useMouse = true;
+                conf.mouse.sensitivity = sensitivities[stick][userIndex];
+                conf.mouse.invertXAxis = userIndex == 1;
+                conf.mouse.invertYAxis = stick == 1;
+                lanes.Set(userIndex, stick, conf, curve);
+            }
+        }
+    }
+};
+
+struct Golden {
+    float accuX[XUSER_MAX_COUNT];
+    float accuY[XUSER_MAX_COUNT];
+    int32_t tickScaleQ16;
+    // [stick][userIndex], like MouseStickOutput
+    int32_t x[MouseStickLanes::kNumSticks][XUSER_MAX_COUNT];
+    int32_t y[MouseStickLanes::kNumSticks][XUSER_MAX_COUNT];
+};
+
+const Golden kGolden[] = {
+    { { 0, 0, 0, 0 }, { 0, 0, 0, 0 }, 0x10000,
+        { { 0, 0, 0, 0 }, { 0, 0, 0, 0 } },
+        { { 0, 0, 0, 0 }, { 0, 0, 0, 0 } } },
+    // Single counts, within the axial deadzones of some sticks
+    { { 1, -1, 3, -3 }, { 0, 1, -4, 2 }, 0x10000,
+        { { 3277, 0, 0, -6290 }, { 0, 464, 0, 0 } },
+        { { 0, 0, 0, -4193 }, { 0, 464, 0, 0 } } },
+    // Exactly on the outer radius
+    { { 6, -8, 5, 0 }, { -8, 6, 5, -10 }, 0x10000,
+        { { 24575, 26214, 18368, 0 }, { 24575, 26214, 0, 0 } },
+        { { 32767, -19660, -18368, 32767 }, { -32767, 19660, 0, -32767 } } },
+    { { 10, 0, -7, 9 }, { 0, -10, 7, 4 }, 0x10000,
+        { { 32767, 0, -32271, 29943 }, { 32767, 0, 0, 29943 } },
+        { { 0, 32767, -32271, -13308 }, { 0, -32767, 0, 13308 } } },
+    { { 4, 2, -2, 1 }, { 3, -7, 9, -1 }, 0x10000,
+        { { 16383, -3655, -6428, 0 }, { 10922, -4771, 0, 0 } },
+        { { -12288, 12793, -28929, 0 }, { 8192, -16698, 0, 0 } } },
+    // Past the outer radius
+    { { 20, -15, 200, -1 }, { -15, 20, 1, 200 }, 0x10000,
+        { { 32767, 19660, 32767, 0 }, { 32767, 19660, 0, 0 } },
+        { { 24575, -26214, -164, -32767 }, { -24575, 26214, 0, 32767 } } },
+    // The same movement in an early and a late tick
+    { { 3, -5, 7, 2 }, { -4, 5, -1, 8 }, 0x8000,
+        { { 6143, 442, 0, 2585 }, { 0, 2896, 0, 0 } },
+        { { 8191, -442, 0, -10339 }, { 0, 2896, 0, 0 } } },
+    { { 3, -5, 7, 2 }, { -4, 5, -1, 8 }, 0x18000,
+        { { 18431, 23170, 32767, 7947 }, { 16384, 23170, 0, 7947 } },
+        { { 24575, -23170, 4681, -31789 }, { -21845, 23170, 0, 31789 } } },
+    // The ends of DoMouse2Joystick()'s clamp on the tick scale, and a scale that isn't a round number
+    { { 5, -3, 1, 6 }, { 2, -6, 8, -3 }, 0x4000,
+        { { 4411, 0, 0, 0 }, { 0, 412, 0, 0 } },
+        { { -1765, 0, 0, 0 }, { 0, -824, 0, 0 } } },
+    { { 2, 1, -1, 3 }, { -1, -2, 3, 2 }, 0x40000,
+        { { 29307, -10816, -10922, 27264 }, { 28151, -11723, 0, 27264 } },
+        { { 14654, 21632, -32767, -18176 }, { -14076, -23445, 0, 18176 } } },
+    { { 7, 0, 1, -8 }, { 1, 8, 0, 1 }, 0x12345,
+        { { 26362, 0, 0, -32515 }, { 24224, 0, 0, -28288 } },
+        { { -3763, -25387, 0, -4061 }, { 3457, 27144, 0, 3533 } } },
+    // Around the clamp on counts per tick
+    { { 1048577, -2000000, 0, 50 }, { 0, 1, -1048576, -50 }, 0x10000,
+        { { 32767, 32767, 0, 23170 }, { 32767, 32767, 0, 23170 } },
+        { { 0, 0, 32767, 23170 }, { 0, 0, 0, -23170 } } },
+};
+}
+
+int main() {
+    auto setup = std::make_unique<Setup>();
+    auto& lanes = setup->lanes;
+
+    bool ok = true;
+    for (const auto& golden : kGolden) {
+        std::copy(std::begin(golden.accuX), std::end(golden.accuX), lanes.accuX);
+        std::copy(std::begin(golden.accuY), std::end(golden.accuY), lanes.accuY);
+        MouseStickOutput out;
+        ComputeMouseSticksFixed(lanes, golden.tickScaleQ16, out);
+
+        for (int stick = 0; stick < MouseStickLanes::kNumSticks; ++stick) {
+            for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+                if (out.x[stick][userIndex] == golden.x[stick][userIndex] && out.y[stick][userIndex] == golden.y[stick][userIndex])
+                    continue;
+                std::fprintf(stderr, "gamepad %d stick %d, movement (%.9g, %.9g) scaled by 0x%X: got (%d, %d), expected (%d, %d)\n", userIndex, stick,
+                    golden.accuX[userIndex], golden.accuY[userIndex], static_cast<unsigned>(golden.tickScaleQ16),
+                    out.x[stick][userIndex], out.y[stick][userIndex], golden.x[stick][userIndex], golden.y[stick][userIndex]);
+                ok = false;
+            }
+        }
+    }
+    CHECK(ok);
+    return 0;
+}
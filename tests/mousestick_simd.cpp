@@ -0,0 +1,207 @@
+// ComputeMouseSticks() against ComputeMouseSticksReference() on random lanes and movement, to within kMouseStickSimdMaxError
+// Besides uniform samples, movement is aimed at where the output changes abruptly or stops changing:
+// - the saturation point of the curve, where the stick snaps to full deflection (what used to be the fixed 0.995 snap-to-full)
+// - the outer radius, where the movement gets clamped
+// - the edge of the axial deadzone, where an axis is dropped; there the vector code may land on either side, so either outcome is accepted
+
+#include "pch.h"
+
+#include "check.h"
+
+#include "mousestick.h"
+#include "stickcurve.h"
+
+#include <cmath>
+#include <memory>
+#include <random>
+
+namespace {
+std::mt19937 gRng(31);
+
+float Uniform(float lo, float hi) {
+    return std::uniform_real_distribution<float>(lo, hi)(gRng);
+}
+
+bool Chance(double p) {
+    return std::bernoulli_distribution(p)(gRng);
+}
+
+UserProfile::StickCurve RandomCurve() {
+    using Shape = UserProfile::StickCurve::Shape;
+    using Gate = UserProfile::StickCurve::Gate;
+    UserProfile::StickCurve curve;
+    switch (gRng() % 3) {
+    case 0:
+        curve.shape = Shape::Power;
+        curve.exponent = Uniform(0.3f, 3.0f);
+        break;
+    case 1:
+        curve.shape = Shape::Piecewise;
+        curve.points = { { Uniform(0.1f, 0.5f), Uniform(0.0f, 0.5f) }, { Uniform(0.5f, 0.9f), Uniform(0.5f, 1.0f) } };
+        break;
+    default:
+        curve.shape = Shape::Bezier;
+        curve.bezier = { Uniform(0.0f, 1.0f), Uniform(0.0f, 1.0f), Uniform(0.0f, 1.0f), Uniform(0.0f, 1.0f) };
+        break;
+    }
+    curve.deadzone = Chance(0.5) ? Uniform(0.0f, 0.2f) : 0.0f;
+    curve.axialDeadzone = Chance(0.5) ? Uniform(0.0f, 0.3f) : 0.0f;
+    curve.saturation = Chance(0.5) ? Uniform(0.5f, 1.0f) : 1.0f;
+    curve.antiDeadzone = Chance(0.3) ? Uniform(0.0f, 0.3f) : 0.0f;
+    curve.gate = Chance(0.5) ? Gate::Square : Gate::Circle;
+    return curve;
+}
+
+struct Setup {
+    StickCurveLut curves[MouseStickLanes::kNumSticks][XUSER_MAX_COUNT];
+    UserProfile::StickCurve params[MouseStickLanes::kNumSticks][XUSER_MAX_COUNT];
+    MouseStickLanes lanes;
+
+    void Randomize() {
+        for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+            for (int stick = 0; stick < MouseStickLanes::kNumSticks; ++stick) {
+                UserProfile::Joystick conf;
+                conf.useMouse = Chance(0.8);
+                // Now and then past 1, where the stick can never leave the center
+                conf.mouse.sensitivity = Chance(0.05) ? Uniform(1.0f, 2.0f) : Uniform(0.0f, 0.9f);
+                conf.mouse.invertXAxis = Chance(0.5);
+                conf.mouse.invertYAxis = Chance(0.5);
+                params[stick][userIndex] = RandomCurve();
+                curves[stick][userIndex].Compile(params[stick][userIndex]);
+                lanes.Set(userIndex, stick, conf, curves[stick][userIndex]);
+            }
+        }
+    }
+};
+
+// Movement of length `r` in a random direction
+void Aim(MouseStickLanes& lanes, int userIndex, float r) {
+    float phi = Uniform(0.0f, 6.2831853f);
+    lanes.accuX[userIndex] = r * std::cos(phi);
+    lanes.accuY[userIndex] = r * std::sin(phi);
+}
+
+// How far the mouse has to move for `stick` to reach `magnitude`, before the curve
+float RadiusFor(const MouseStickLanes& lanes, int userIndex, int stick, float magnitude) {
+    float invRange = lanes.invRange[stick][userIndex];
+    return invRange > 0.0f ? lanes.threshold[stick][userIndex] + magnitude / invRange : kMouseStickOuterRadius;
+}
+
+int32_t AxisError(const MouseStickOutput& a, const MouseStickOutput& b, int stick, int userIndex) {
+    return std::max(std::abs(a.x[stick][userIndex] - b.x[stick][userIndex]), std::abs(a.y[stick][userIndex] - b.y[stick][userIndex]));
+}
+
+// Whether `simd` is within the bound of the reference with the stick's axial deadzone nudged just below or above its value, i.e. on either side of the edge
+bool MatchesAcrossAxialDeadzone(const MouseStickLanes& lanes, const MouseStickOutput& simd, int stick, int userIndex) {
+    float dz = lanes.axialDeadzone[stick][userIndex];
+    if (dz <= 0.0f) return false;
+    // The reference takes the axial deadzone from the curve
+    auto curve = std::make_unique<StickCurveLut>(*lanes.curve[stick][userIndex]);
+    auto nudged = std::make_unique<MouseStickLanes>(lanes);
+    nudged->curve[stick][userIndex] = curve.get();
+    for (float factor : { 1.0f - 1e-4f, 1.0f + 1e-4f }) {
+        curve->axialDeadzone = dz * factor;
+        MouseStickOutput ref;
+        ComputeMouseSticksReference(*nudged, ref);
+        if (AxisError(simd, ref, stick, userIndex) <= kMouseStickSimdMaxError)
+            return true;
+    }
+    return false;
+}
+}
+
+int main() {
+    constexpr int kSetups = 400;
+    constexpr int kSamplesPerSetup = 500;
+
+    auto setup = std::make_unique<Setup>();
+    uint64_t axesCompared = 0;
+    uint64_t saturationSamples = 0;
+    uint64_t axialDeadzoneSamples = 0;
+    uint64_t axialDeadzoneExceptions = 0;
+    int32_t maxError = 0;
+
+    for (int s = 0; s < kSetups; ++s) {
+        setup->Randomize();
+        auto& lanes = setup->lanes;
+
+        for (int i = 0; i < kSamplesPerSetup; ++i) {
+            // Which stick of each gamepad the aimed samples are aimed for
+            int aimedStick = static_cast<int>(gRng() % MouseStickLanes::kNumSticks);
+            for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+                const auto& params = setup->params[aimedStick][userIndex];
+                switch (gRng() % 8) {
+                case 0: {
+                    // Right around the saturation point: just below, on, and just above where the curve reaches full deflection
+                    float magnitude = params.saturation * (1.0f + Uniform(-1e-3f, 1e-3f));
+                    Aim(lanes, userIndex, RadiusFor(lanes, userIndex, aimedStick, std::min(magnitude, 1.0f)));
+                    ++saturationSamples;
+                } break;
+                case 1:
+                    // Right around the outer radius, including exactly on it
+                    Aim(lanes, userIndex, kMouseStickOuterRadius * (Chance(0.5) ? 1.0f : 1.0f + Uniform(-1e-5f, 1e-5f)));
+                    if (Chance(0.25)) {
+                        lanes.accuX[userIndex] = Chance(0.5) ? 6.0f : -8.0f;
+                        lanes.accuY[userIndex] = Chance(0.5) ? -8.0f : 6.0f;
+                    }
+                    break;
+                case 2: {
+                    // One axis right on the edge of the axial deadzone
+                    float magnitude = Uniform(0.2f, 1.0f);
+                    float r = RadiusFor(lanes, userIndex, aimedStick, magnitude);
+                    float along = std::min(params.axialDeadzone / magnitude, 1.0f) * (1.0f + Uniform(-1e-6f, 1e-6f));
+                    float across = std::sqrt(std::max(1.0f - along * along, 0.0f));
+                    bool onX = Chance(0.5);
+                    lanes.accuX[userIndex] = r * (onX ? along : across) * (Chance(0.5) ? 1.0f : -1.0f);
+                    lanes.accuY[userIndex] = r * (onX ? across : along) * (Chance(0.5) ? 1.0f : -1.0f);
+                    ++axialDeadzoneSamples;
+                } break;
+                case 3:
+                    lanes.accuX[userIndex] = 0.0f;
+                    lanes.accuY[userIndex] = 0.0f;
+                    break;
+                case 4:
+                    // Scaled by a late or early tick, no longer whole counts
+                    lanes.accuX[userIndex] = Uniform(-30.0f, 30.0f);
+                    lanes.accuY[userIndex] = Uniform(-30.0f, 30.0f);
+                    break;
+                default: {
+                    // Whole counts, mostly within the outer radius, now and then a fast flick
+                    int spread = Chance(0.125) ? 200 : 24;
+                    lanes.accuX[userIndex] = static_cast<float>(static_cast<int>(gRng() % (2 * spread + 1)) - spread);
+                    lanes.accuY[userIndex] = static_cast<float>(static_cast<int>(gRng() % (2 * spread + 1)) - spread);
+                } break;
+                }
+            }
+
+            MouseStickOutput simd, ref;
+            ComputeMouseSticks(lanes, simd);
+            ComputeMouseSticksReference(lanes, ref);
+
+            // Sticks not driven by the mouse are compared too, as if they were
+            for (int userIndex = 0; userIndex < XUSER_MAX_COUNT; ++userIndex) {
+                for (int stick = 0; stick < MouseStickLanes::kNumSticks; ++stick) {
+                    axesCompared += 2;
+                    int32_t error = AxisError(simd, ref, stick, userIndex);
+                    if (error > kMouseStickSimdMaxError && MatchesAcrossAxialDeadzone(lanes, simd, stick, userIndex)) {
+                        ++axialDeadzoneExceptions;
+                        continue;
+                    }
+                    if (error > kMouseStickSimdMaxError) {
+                        std::fprintf(stderr, "gamepad %d stick %d, movement (%.9g, %.9g): vector (%d, %d), reference (%d, %d)\n", userIndex, stick,
+                            lanes.accuX[userIndex], lanes.accuY[userIndex], simd.x[stick][userIndex], simd.y[stick][userIndex], ref.x[stick][userIndex], ref.y[stick][userIndex]);
+                    }
+                    CHECK(error <= kMouseStickSimdMaxError);
+                    maxError = std::max(maxError, error);
+                }
+            }
+        }
+    }
+
+    std::printf("%llu axes compared, max error %d, %llu samples at the saturation point, %llu of %llu at the edge of an axial deadzone landed on the other side\n",
+        (unsigned long long)axesCompared, maxError, (unsigned long long)saturationSamples, (unsigned long long)axialDeadzoneExceptions, (unsigned long long)axialDeadzoneSamples);
+    CHECK(saturationSamples > 0);
+    // Even when aimed right at the edge, landing on the other side must stay the exception
+    CHECK(axialDeadzoneExceptions * 10 < axialDeadzoneSamples);
+    return 0;
+}
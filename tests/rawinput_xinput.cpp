@@ -0,0 +1,117 @@
+// Raw input packets in, XInputGetState() out: the path a key press takes on the input thread, with the packets built by hand instead of coming from WM_INPUT
+
+#include "pch.h"
+
+#include "check.h"
+
+#include "clock.h"
+#include "config.h"
+#include "inputbackend.h"
+#include "inputdevice.h"
+#include "platform.h"
+#include "shadowed.h"
+#include "translation.h"
+#include "userdevice.h"
+
+static const HANDLE kKeyboard = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(0x1001));
+
+static RAWINPUT KeyboardPacket(USHORT vkey, bool pressed) {
+    RAWINPUT packet = {};
+    packet.header.dwType = RIM_TYPEKEYBOARD;
+    packet.header.dwSize = sizeof(RAWINPUT);
+    packet.header.hDevice = kKeyboard;
+    packet.data.keyboard.VKey = vkey;
+    packet.data.keyboard.Flags = pressed ? RI_KEY_MAKE : RI_KEY_BREAK;
+    return packet;
+}
+
+int main() {
+    auto configPath = std::filesystem::temp_directory_path() / "wxi_rawinput_xinput.toml";
+    {
+        std::ofstream f(configPath);
+        f << "[Binding]\n"
+             "Gamepad0 = \"test\"\n"
+             "[UserProfiles.\"test\"]\n"
+             "A = \"A\"\n"
+             "B = \"Space\"\n";
+    }
+
+    // What the input thread does when a gamepad gets bound, minus the window side of it
+    InputTranslationStruct its;
+    its.actions.SetClock(gClock->TicksPerSecond(), gClock->Now());
+    gConfigEvents.onGamepadBindingChanged += [&](int userIndex, const std::string&, const UserProfile& profile) {
+        its.PopulateBtnLut(userIndex, profile);
+        its.PopulateSticks(userIndex, profile);
+        its.PopulateActions(userIndex, profile);
+        its.PopulateKernel(userIndex);
+    };
+    ReloadConfig(configPath);
+    std::filesystem::remove(configPath);
+
+    RID_DEVICE_INFO info = {};
+    info.cbSize = sizeof(info);
+    info.dwType = RIM_TYPEKEYBOARD;
+    FakeRawInputSetDevices({ { kKeyboard, info, L"\\\\?\\HID#VID_046D&PID_C31C&MI_00#7&1a2b3c4d&0&0000#{884b96c3-56ef-11d1-bc8c-00a0c91405dd}" } });
+    std::vector<IdevDevice> devices;
+    PollInputDevices(devices);
+    CHECK(devices.size() == 1);
+    CHECK(devices[0].hDevice == kKeyboard);
+
+    InputEventSink sink;
+    RawInputBackend backend(nullptr);
+    CHECK(backend.Start(sink));
+
+    auto deliver = [&](const RAWINPUT& packet) {
+        int64_t now = gClock->Now();
+        backend.OnWmInput(FakeRawInputHandle(packet), now);
+        InputEventBatch batch;
+        while (sink.queue.TryPop(batch)) {
+            for (uint32_t i = 0; i < batch.count; ++i) {
+                const auto& e = batch.events[i];
+                CHECK(e.type == InputEvent::Type::Key);
+                HandleKeyPress(e.device, e.vkey, e.pressed, e.time, its);
+            }
+        }
+        PublishGamepad(0, now);
+    };
+
+    XINPUT_STATE state = {};
+    CHECK(XInputGetState(0, &state) == ERROR_SUCCESS);
+    CHECK(state.Gamepad.wButtons == 0);
+    // Nothing is bound to the other slots, and there is no system XInput behind them
+    XINPUT_STATE other = {};
+    CHECK(XInputGetState(1, &other) == ERROR_DEVICE_NOT_CONNECTED);
+
+    DWORD packetNumber = state.dwPacketNumber;
+    deliver(KeyboardPacket('A', true));
+    CHECK(XInputGetState(0, &state) == ERROR_SUCCESS);
+    CHECK(state.Gamepad.wButtons == XINPUT_GAMEPAD_A);
+    CHECK(state.dwPacketNumber != packetNumber);
+
+    packetNumber = state.dwPacketNumber;
+    deliver(KeyboardPacket(VK_SPACE, true));
+    CHECK(XInputGetState(0, &state) == ERROR_SUCCESS);
+    CHECK(state.Gamepad.wButtons == (XINPUT_GAMEPAD_A | XINPUT_GAMEPAD_B));
+    CHECK(state.dwPacketNumber != packetNumber);
+
+    // An unbound key doesn't change the state, nor its packet number
+    packetNumber = state.dwPacketNumber;
+    deliver(KeyboardPacket('Q', true));
+    CHECK(XInputGetState(0, &state) == ERROR_SUCCESS);
+    CHECK(state.Gamepad.wButtons == (XINPUT_GAMEPAD_A | XINPUT_GAMEPAD_B));
+    CHECK(state.dwPacketNumber == packetNumber);
+
+    deliver(KeyboardPacket('A', false));
+    deliver(KeyboardPacket(VK_SPACE, false));
+    CHECK(XInputGetState(0, &state) == ERROR_SUCCESS);
+    CHECK(state.Gamepad.wButtons == 0);
+    CHECK(state.dwPacketNumber != packetNumber);
+
+    // Once stopped, the backend drops whatever still arrives
+    backend.Stop();
+    backend.OnWmInput(FakeRawInputHandle(KeyboardPacket('A', true)), gClock->Now());
+    InputEventBatch batch;
+    CHECK(!sink.queue.TryPop(batch));
+
+    return 0;
+}
@@ -0,0 +1,219 @@
+// TimerWheel against a std::multimap doing the same by brute force: random schedules, cancels and pops, driven by a ManualClock
+// Deadlines and clock steps cluster around where timers move between levels: 64 ticks (level 0 to 1), 4096 (1 to 2), 2^18 (2 to 3) and 2^24 (3 to the overflow list)
+
+#include "pch.h"
+
+#include "check.h"
+
+#include "clock.h"
+#include "timerwheel.h"
+
+#include <map>
+#include <random>
+#include <unordered_map>
+
+namespace {
+constexpr uint64_t kBoundaries[] = { 1ull << 6, 1ull << 12, 1ull << 18, 1ull << 24 };
+
+struct Model {
+    struct Timer {
+        uint64_t payload;
+        TimerWheel::TimerId id;
+    };
+    // Equal keys keep their insertion order, like timers with the same deadline must
+    std::multimap<uint64_t, Timer> timers;
+    std::unordered_map<TimerWheel::TimerId, std::multimap<uint64_t, Timer>::iterator> byId;
+    // Everything before this has fired; a deadline in the past fires as if it was due right now
+    uint64_t current = 0;
+};
+
+struct Run {
+    std::mt19937_64 rng;
+    ManualClock clock;
+    TimerWheel wheel;
+    Model model;
+    // Fired or cancelled, so Cancel() must refuse them
+    std::vector<TimerWheel::TimerId> dead;
+    uint64_t nextPayload = 1;
+    uint64_t pops = 0;
+    uint64_t cancels = 0;
+
+    Run(uint64_t seed, uint64_t start)
+        : rng(seed)
+        , clock(1000, static_cast<int64_t>(start)) {}
+
+    uint64_t Now() const { return static_cast<uint64_t>(clock.Now()); }
+    uint64_t Below(uint64_t n) { return std::uniform_int_distribution<uint64_t>(0, n - 1)(rng); }
+
+    // Somewhere the timer's level or the tick it cascades at is about to change
+    uint64_t Offset() {
+        switch (Below(8)) {
+        case 0: return Below(4);
+        case 1: return Below(kBoundaries[0] + 8);
+        case 2: return Below(kBoundaries[3] * 3);
+        default: {
+            uint64_t b = kBoundaries[Below(std::size(kBoundaries))];
+            return b - 3 + Below(7);
+        }
+        }
+    }
+
+    void Schedule() {
+        uint64_t now = Now();
+        // Now and then a deadline already in the past
+        uint64_t deadline = Below(16) == 0 ? now - std::min<uint64_t>(now, Below(100)) : now + Offset();
+        // Or one right on a boundary of the absolute tick count, where slots wrap around
+        if (Below(8) == 0) {
+            uint64_t b = kBoundaries[Below(std::size(kBoundaries))];
+            deadline = (now / b + 1 + Below(2)) * b - 1 + Below(3);
+        }
+
+        uint64_t payload = nextPayload++;
+        auto id = wheel.Schedule(deadline, payload);
+        CHECK(id != 0);
+        CHECK(!model.byId.contains(id));
+        auto iter = model.timers.emplace(std::max(deadline, model.current), Model::Timer{ payload, id });
+        model.byId.emplace(id, iter);
+        CHECK(wheel.Size() == model.timers.size());
+    }
+
+    void Cancel() {
+        if (!dead.empty() && Below(4) == 0) {
+            CHECK(!wheel.Cancel(dead[Below(dead.size())]));
+            return;
+        }
+        if (model.timers.empty()) return;
+        // Not uniform, but reaches every part of the map over time
+        auto iter = model.timers.begin();
+        std::advance(iter, Below(std::min<size_t>(model.timers.size(), 64)));
+        if (Below(2) == 0) {
+            iter = model.timers.end();
+            std::advance(iter, -static_cast<ptrdiff_t>(1 + Below(std::min<size_t>(model.timers.size(), 64))));
+        }
+
+        auto id = iter->second.id;
+        CHECK(wheel.Cancel(id));
+        CHECK(!wheel.Cancel(id));
+        model.byId.erase(id);
+        model.timers.erase(iter);
+        dead.push_back(id);
+        ++cancels;
+        CHECK(wheel.Size() == model.timers.size());
+    }
+
+    // Pops everything due by now, sometimes scheduling more from in between pops like a handler of the popped payload would
+    void Drain(bool reschedule = true) {
+        uint64_t now = Now();
+        while (true) {
+            uint64_t next = wheel.NextDeadline();
+            if (model.timers.empty()) {
+                CHECK(next == UINT64_MAX);
+            }
+            else {
+                uint64_t earliest = model.timers.begin()->first;
+                CHECK(next <= earliest);
+                // Exact within the current level 0 rotation
+                if ((earliest >> 6) == (model.current >> 6))
+                    CHECK(next == earliest);
+            }
+
+            uint64_t payload = 0;
+            bool popped = wheel.PopExpired(now, payload);
+            bool due = !model.timers.empty() && model.timers.begin()->first <= now;
+            CHECK(popped == due);
+            if (!popped) break;
+
+            auto iter = model.timers.begin();
+            CHECK(payload == iter->second.payload);
+            model.current = iter->first;
+            dead.push_back(iter->second.id);
+            model.byId.erase(iter->second.id);
+            model.timers.erase(iter);
+            ++pops;
+            CHECK(wheel.Size() == model.timers.size());
+
+            if (reschedule && Below(8) == 0)
+                Schedule();
+        }
+        model.current = std::max(model.current, now);
+    }
+
+    void Advance() {
+        uint64_t now = Now();
+        uint64_t step;
+        switch (Below(6)) {
+        case 0: step = 0; break;
+        case 1: step = 1; break;
+        case 2: step = Below(kBoundaries[0] * 2); break;
+        case 3: step = Offset(); break;
+        default: {
+            // Onto, or right around, the next boundary of the absolute tick count
+            uint64_t b = kBoundaries[Below(std::size(kBoundaries))];
+            step = (now / b + 1) * b - 1 + Below(3) - now;
+        } break;
+        }
+        clock.now += static_cast<int64_t>(step);
+    }
+};
+
+void RunSeed(uint64_t seed, uint64_t start, int steps) {
+    Run run(seed, start);
+    for (int i = 0; i < steps; ++i) {
+        switch (run.Below(10)) {
+        case 0: case 1: case 2: case 3: run.Schedule(); break;
+        case 4: case 5: run.Cancel(); break;
+        case 6: case 7: run.Advance(); break;
+        default: run.Drain(); break;
+        }
+    }
+
+    // Whatever is left fires in order too
+    run.clock.now += static_cast<int64_t>(kBoundaries[3] * 4);
+    run.Drain(false);
+    CHECK(run.wheel.Size() == 0);
+    CHECK(run.model.timers.empty());
+    CHECK(run.pops > 0);
+    CHECK(run.cancels > 0);
+}
+}
+
+int main() {
+    // A wheel at tick 0, and wheels starting just before each boundary, so that the first few cascades happen right away
+    RunSeed(1, 0, 200'000);
+    uint64_t seed = 2;
+    for (uint64_t b : kBoundaries)
+        RunSeed(seed++, b * 5 - 2, 50'000);
+    // Far out, where the top level has wrapped around many times
+    RunSeed(seed++, (1ull << 40) + 12345, 50'000);
+
+    // Fixed cases on the boundaries themselves
+    {
+        TimerWheel wheel;
+        uint64_t payload = 0;
+        auto a = wheel.Schedule(1ull << 24, 1);
+        auto b = wheel.Schedule((1ull << 24) - 1, 2);
+        wheel.Schedule(4096, 3);
+        wheel.Schedule(64, 4);
+        wheel.Schedule(63, 5);
+        wheel.Schedule(64, 6);
+        CHECK(wheel.NextDeadline() == 63);
+        CHECK(!wheel.PopExpired(62, payload));
+        CHECK(wheel.PopExpired(64, payload) && payload == 5);
+        CHECK(wheel.PopExpired(64, payload) && payload == 4);
+        CHECK(wheel.PopExpired(64, payload) && payload == 6);
+        CHECK(!wheel.PopExpired(4095, payload));
+        CHECK(wheel.PopExpired(4096, payload) && payload == 3);
+        CHECK(wheel.Cancel(b));
+        CHECK(!wheel.Cancel(b));
+        CHECK(!wheel.PopExpired((1ull << 24) - 1, payload));
+        CHECK(wheel.PopExpired(1ull << 24, payload) && payload == 1);
+        CHECK(!wheel.Cancel(a));
+        CHECK(wheel.Size() == 0);
+        CHECK(wheel.NextDeadline() == UINT64_MAX);
+        // In the past by now: due right away
+        wheel.Schedule(5, 7);
+        CHECK(wheel.PopExpired(1ull << 24, payload) && payload == 7);
+    }
+
+    return 0;
+}
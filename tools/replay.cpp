@@ -0,0 +1,32 @@
+// Replays a recording against a config and diffs every recorded gamepad state, like the "Replay" button of the Recording window
+// Exits with a non-zero status if any state differs, so that a recording works as a regression test
+
+#include "pch.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "inputrecord.h"
+
+int main(int argc, char** argv) {
+    auto speed = ReplaySpeed::Max;
+    auto kernels = ReplayKernels::Specialized;
+    const char* paths[2] = {};
+    int pathCount = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--realtime") == 0)
+            speed = ReplaySpeed::RealTime;
+        else if (std::strcmp(argv[i], "--generic") == 0)
+            kernels = ReplayKernels::Generic;
+        else if (pathCount < 2)
+            paths[pathCount++] = argv[i];
+        else
+            pathCount = 3;
+    }
+    if (pathCount != 2) {
+        std::printf("Usage: %s [--realtime] [--generic] <recording.wxirec> <config.toml>\n", argv[0]);
+        return 2;
+    }
+
+    return RunReplayConsole(paths[0], paths[1], speed, kernels);
+}
@@ -0,0 +1,71 @@
+// Runs the stress test of the "Stress test" tool window from a console, against the profiles of a config file
+
+#include "pch.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "stresstest.h"
+
+int main(int argc, char** argv) {
+    StressConfig stress;
+    struct IntOption { const char* name; int* value; };
+    struct FloatOption { const char* name; float* value; };
+    const IntOption intOptions[] = {
+        { "--mice", &stress.mice },
+        { "--mouse-rate", &stress.mouseRate },
+        { "--keyboards", &stress.keyboards },
+        { "--key-rate", &stress.keyRate },
+        { "--rollover", &stress.rollover },
+        { "--readers", &stress.readers },
+    };
+    const FloatOption floatOptions[] = {
+        { "--seconds", &stress.seconds },
+        { "--contention-seconds", &stress.contentionSeconds },
+        { "--burst-ms", &stress.burstMs },
+        { "--idle-ms", &stress.idleMs },
+        { "--hotplug-ms", &stress.hotplugMs },
+    };
+
+    const char* configPath = nullptr;
+    bool usage = false;
+    for (int i = 1; i < argc && !usage; ++i) {
+        bool matched = false;
+        if (i + 1 < argc) {
+            for (const auto& opt : intOptions) {
+                if (std::strcmp(argv[i], opt.name) == 0) {
+                    *opt.value = std::atoi(argv[++i]);
+                    matched = true;
+                    break;
+                }
+            }
+            for (const auto& opt : floatOptions) {
+                if (!matched && std::strcmp(argv[i], opt.name) == 0) {
+                    *opt.value = static_cast<float>(std::atof(argv[++i]));
+                    matched = true;
+                    break;
+                }
+            }
+            if (!matched && std::strcmp(argv[i], "--seed") == 0) {
+                stress.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+                matched = true;
+            }
+        }
+        if (!matched) {
+            if (argv[i][0] == '-' || configPath)
+                usage = true;
+            else
+                configPath = argv[i];
+        }
+    }
+    if (usage || !configPath) {
+        std::printf("Usage: %s [options] <config.toml>\n", argv[0]);
+        for (const auto& opt : intOptions) std::printf("  %s N\n", opt.name);
+        for (const auto& opt : floatOptions) std::printf("  %s X\n", opt.name);
+        std::printf("  --seed N\n");
+        return 2;
+    }
+
+    return RunStressTestConsole(stress, configPath);
+}